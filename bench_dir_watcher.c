@@ -0,0 +1,592 @@
+//-----------------------------------------------------------------------------
+// bench_dir_watcher.c
+//
+// benchmark the data structures the watcher spends its time in
+//
+// arguments: the numbers of directories to benchmark, default 10000 100000
+//
+// For each size there is a synthetic directory tree, shaped roughly like a
+// home directory: a fanout of 8, with names which repeat in different
+// directories. The benchmarks are
+//
+//    hash_cache       add, iterate and clear, with paths from the tree picked
+//                     so a few directories get most of the events. Once at
+//                     the size the watcher uses, and once with a table big
+//                     enough for the whole tree (up to LARGE_CACHE_LIMIT)
+//    wd_directory     add, find_wd_directory, find_directory_wd, prune
+//    list_sub_dirs    a wide tree (every directory in one) and a deep tree
+//                     (fanout 4) created under $TMPDIR
+//
+// Each size of each group runs in its own process, so the memory numbers do
+// not include the groups before it. Each result is a line of
+//
+//    name directories ns/op allocs/op peak_rss_kb rss_growth_kb
+//
+// peak_rss_kb is the process high water mark after the benchmark, and
+// rss_growth_kb how much of that came from the benchmark rather than the
+// fixture (the paths, or the tree on disk). allocs/op counts calls to
+// malloc, calloc and realloc, from anywhere in the process.
+//-----------------------------------------------------------------------------
+#define _XOPEN_SOURCE 700
+#include <errno.h>
+#include <ftw.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "error_text.h"
+#include "hash_cache.h"
+#include "list_sub_dirs.h"
+#include "metrics.h"
+#include "wd_directory.h"
+
+// the hash cache as dir_watcher.c creates it
+#define HASH_TABLE_SIZE 100
+#define HASH_TABLE_MEMORY_SIZE 15000
+
+#define LARGE_CACHE_LIMIT 20000
+#define TREE_FANOUT 8
+#define DEEP_FANOUT 4
+#define LOOKUPS 100000
+
+// wd_directory.c and list_sub_dirs.c report fatal errors here, main.c
+// defines these for the real program
+char error_path[] = "/tmp/bench_dir_watcher_error.txt";
+FILE * error_file = NULL;
+
+static const char * names[] = {
+   "src", "lib", "Documents", "build", ".git", "objects", "Photos", "2016",
+   "include", "test", "node_modules", "Music", "tmp", "docs", "assets", "old"
+};
+
+//-----------------------------------------------------------------------------
+// counting allocations
+//
+// These replace the libc functions for the whole process, and pass the
+// calls on to glibc's own allocator.
+//-----------------------------------------------------------------------------
+extern void * __libc_malloc(size_t size);
+extern void * __libc_calloc(size_t count, size_t size);
+extern void * __libc_realloc(void * p, size_t size);
+extern void __libc_free(void * p);
+
+static uint64_t allocations = 0;
+
+void * malloc(size_t size) {
+   allocations++;
+   return __libc_malloc(size);
+}
+
+void * calloc(size_t count, size_t size) {
+   allocations++;
+   return __libc_calloc(count, size);
+}
+
+void * realloc(void * p, size_t size) {
+   allocations++;
+   return __libc_realloc(p, size);
+}
+
+void free(void * p) {
+   __libc_free(p);
+}
+
+//-----------------------------------------------------------------------------
+// the tree: directory i has parent (i-1)/fanout, so the directories are in
+// breadth first order and a parent always comes before its children
+//-----------------------------------------------------------------------------
+struct TREE {
+   int      count;
+   char *   text_p;     // all the paths, '\0' separated
+   size_t * offsets_p;  // offsets_p[i] is the path of directory i
+};
+
+static uint64_t random_state = 0x9e3779b97f4a7c15ULL;
+
+//-----------------------------------------------------------------------------
+static uint64_t next_random(void) {
+//-----------------------------------------------------------------------------
+   // xorshift64*: the same sequence every run
+   random_state ^= random_state >> 12;
+   random_state ^= random_state << 25;
+   random_state ^= random_state >> 27;
+   return random_state * 2685821657736338717ULL;
+
+} // next_random
+
+//-----------------------------------------------------------------------------
+// a directory picked so that a few get most of the picks, as with events
+static int hot_directory(int count) {
+//-----------------------------------------------------------------------------
+   double u;
+   uint64_t rank;
+
+   u = (next_random() >> 11) / 9007199254740992.0;
+   rank = (uint64_t) (count * u * u * u);
+
+   // spread the hot directories over the tree
+   return (int) ((rank * 2654435761ULL) % count);
+
+} // hot_directory
+
+//-----------------------------------------------------------------------------
+static void build_tree(struct TREE * tree_p, int count, int fanout) {
+//-----------------------------------------------------------------------------
+   size_t size;
+   size_t used;
+   size_t len;
+   int i;
+   char name[64];
+
+   size = (size_t) count * 64;
+   tree_p->count = count;
+   tree_p->text_p = malloc(size);
+   tree_p->offsets_p = malloc(count * sizeof(size_t));
+   if ((NULL == tree_p->text_p) || (NULL == tree_p->offsets_p)) {
+      fprintf(stderr, "unable to allocate a tree of %d\n", count);
+      exit(1);
+   }
+
+   strcpy(tree_p->text_p, "/home/user");
+   tree_p->offsets_p[0] = 0;
+   used = strlen(tree_p->text_p) + 1;
+
+   for (i=1; i < count; i++) {
+      snprintf(
+         name, sizeof name, "/%s-%d", names[(i * 7) % 16], i % 1000
+      );
+      len = strlen(tree_p->text_p + tree_p->offsets_p[(i-1)/fanout]);
+      if (used + len + strlen(name) + 1 > size) {
+         size *= 2;
+         tree_p->text_p = realloc(tree_p->text_p, size);
+         if (NULL == tree_p->text_p) {
+            fprintf(stderr, "unable to allocate a tree of %d\n", count);
+            exit(1);
+         }
+      }
+      tree_p->offsets_p[i] = used;
+      memcpy(
+         tree_p->text_p + used,
+         tree_p->text_p + tree_p->offsets_p[(i-1)/fanout],
+         len
+      );
+      strcpy(tree_p->text_p + used + len, name);
+      used += len + strlen(name) + 1;
+   }
+
+} // build_tree
+
+#define TREE_PATH(tree_p, i) ((tree_p)->text_p + (tree_p)->offsets_p[i])
+
+//-----------------------------------------------------------------------------
+static void release_tree(struct TREE * tree_p) {
+//-----------------------------------------------------------------------------
+   free(tree_p->text_p);
+   free(tree_p->offsets_p);
+
+} // release_tree
+
+//-----------------------------------------------------------------------------
+// measuring
+//-----------------------------------------------------------------------------
+struct MEASURE {
+   uint64_t start_ns;
+   uint64_t start_allocations;
+   long     start_rss_kb;
+};
+
+//-----------------------------------------------------------------------------
+static long peak_rss_kb(void) {
+//-----------------------------------------------------------------------------
+   struct rusage usage;
+
+   getrusage(RUSAGE_SELF, &usage);
+   return usage.ru_maxrss;
+
+} // peak_rss_kb
+
+//-----------------------------------------------------------------------------
+static void start_measure(struct MEASURE * measure_p) {
+//-----------------------------------------------------------------------------
+   measure_p->start_rss_kb = peak_rss_kb();
+   measure_p->start_allocations = allocations;
+   measure_p->start_ns = metric_now_ns();
+
+} // start_measure
+
+//-----------------------------------------------------------------------------
+static void report(
+   struct MEASURE * measure_p,
+   const char * name_p,
+   int directories,
+   uint64_t ops
+) {
+//-----------------------------------------------------------------------------
+   uint64_t elapsed_ns;
+   uint64_t op_allocations;
+   long rss_kb;
+
+   elapsed_ns = metric_now_ns() - measure_p->start_ns;
+   op_allocations = allocations - measure_p->start_allocations;
+   rss_kb = peak_rss_kb();
+
+   if (0 == ops) {
+      ops = 1;
+   }
+   printf(
+      "%-32s %9d %12.1f %10.2f %12ld %14ld\n",
+      name_p,
+      directories,
+      (double) elapsed_ns / ops,
+      (double) op_allocations / ops,
+      rss_kb,
+      rss_kb - measure_p->start_rss_kb
+   );
+   fflush(stdout);
+
+} // report
+
+//-----------------------------------------------------------------------------
+// hash_cache
+//-----------------------------------------------------------------------------
+static void bench_hash_cache_size(
+   struct TREE * tree_p,
+   const char * prefix_p,
+   unsigned int hash_size,
+   unsigned int mem_size
+) {
+//-----------------------------------------------------------------------------
+   struct MEASURE measure;
+   hash_cache * hc;
+   int * picks_p;
+   int pick_count;
+   int i;
+   uint64_t adds;
+   uint64_t iterated;
+   unsigned int pos;
+   unsigned int count;
+   unsigned int datalen;
+   char * str;
+   char name[64];
+
+   // the same picks for each operation
+   pick_count = tree_p->count < LOOKUPS ? LOOKUPS : tree_p->count;
+   picks_p = malloc(pick_count * sizeof(int));
+   if (NULL == picks_p) {
+      fprintf(stderr, "unable to allocate picks\n");
+      exit(1);
+   }
+   for (i=0; i < pick_count; i++) {
+      picks_p[i] = hot_directory(tree_p->count);
+   }
+
+   hc = new_hash_cache(hash_size, mem_size);
+   if (NULL == hc) {
+      fprintf(stderr, "unable to create hash cache %u\n", hash_size);
+      exit(1);
+   }
+
+   // add, and clear when it is full, as the watcher flushes
+   adds = 0;
+   start_measure(&measure);
+   for (i=0; i < pick_count; i++) {
+      str = TREE_PATH(tree_p, picks_p[i]);
+      while (0 == hash_cache_add(hc, str, strlen(str)+1)) {
+         hash_cache_clear(hc);
+      }
+      adds++;
+   }
+   snprintf(name, sizeof name, "%s_add", prefix_p);
+   report(&measure, name, tree_p->count, adds);
+
+   // iterate over a full cache and clear it, again and again
+   iterated = 0;
+   i = 0;
+   start_measure(&measure);
+   while (iterated < (uint64_t) pick_count) {
+      hash_cache_clear(hc);
+      for ( ; i < pick_count; i++) {
+         str = TREE_PATH(tree_p, picks_p[i]);
+         if (0 == hash_cache_add(hc, str, strlen(str)+1)) {
+            break;
+         }
+      }
+      if (i == pick_count) {
+         i = 0;
+      }
+      for(pos = 0; (pos = hash_cache_iter(hc, pos, &count, (void**)&str, &datalen))!=0;) {
+         iterated++;
+      }
+   }
+   snprintf(name, sizeof name, "%s_fill_iter_clear", prefix_p);
+   report(&measure, name, tree_p->count, iterated);
+
+   free_hash_cache(hc);
+   free(picks_p);
+
+} // bench_hash_cache_size
+
+//-----------------------------------------------------------------------------
+static void bench_hash_cache(int directories) {
+//-----------------------------------------------------------------------------
+   struct TREE tree;
+   unsigned int large_size;
+
+   build_tree(&tree, directories, TREE_FANOUT);
+
+   bench_hash_cache_size(
+      &tree, "hash_cache", HASH_TABLE_SIZE, HASH_TABLE_MEMORY_SIZE
+   );
+
+   large_size = directories < LARGE_CACHE_LIMIT ? directories : LARGE_CACHE_LIMIT;
+   bench_hash_cache_size(
+      &tree, "hash_cache_large", large_size * 2 + 2, large_size * 256
+   );
+
+   release_tree(&tree);
+
+} // bench_hash_cache
+
+//-----------------------------------------------------------------------------
+// wd_directory: directory i is watched by wd i+1
+//-----------------------------------------------------------------------------
+static void bench_wd_directory(int directories) {
+//-----------------------------------------------------------------------------
+   struct TREE tree;
+   struct MEASURE measure;
+   WD_LIST_NODE_P list_p;
+   WD_LIST_NODE_P node_p;
+   int i;
+   int parent_wd;
+   uint64_t pruned;
+   char path[4096];
+
+   build_tree(&tree, directories, TREE_FANOUT);
+
+   if (wd_directory_initialize() != 0) {
+      fprintf(stderr, "wd_directory_initialize failed\n");
+      exit(1);
+   }
+
+   start_measure(&measure);
+   for (i=0; i < tree.count; i++) {
+      parent_wd = (0 == i) ? NULL_WD : (i-1) / TREE_FANOUT + 1;
+      if (add_wd_directory(i+1, parent_wd, TREE_PATH(&tree, i), 0) != 0) {
+         fprintf(stderr, "add_wd_directory %d failed\n", i+1);
+         exit(1);
+      }
+   }
+   report(&measure, "wd_directory_add", directories, tree.count);
+
+   start_measure(&measure);
+   for (i=0; i < LOOKUPS; i++) {
+      if (NULL == find_wd_directory(hot_directory(tree.count)+1, path, sizeof path)) {
+         fprintf(stderr, "find_wd_directory failed\n");
+         exit(1);
+      }
+   }
+   report(&measure, "wd_directory_find_path", directories, LOOKUPS);
+
+   start_measure(&measure);
+   for (i=0; i < LOOKUPS; i++) {
+      if (NULL_WD == find_directory_wd(TREE_PATH(&tree, hot_directory(tree.count)))) {
+         fprintf(stderr, "find_directory_wd failed\n");
+         exit(1);
+      }
+   }
+   report(&measure, "wd_directory_find_wd", directories, LOOKUPS);
+
+   // prune the subtrees under the top directory, one at a time
+   pruned = 0;
+   start_measure(&measure);
+   for (i=1; (i <= TREE_FANOUT) && (i < tree.count); i++) {
+      list_p = prune_wd_directory(i+1);
+      for (node_p=list_p; node_p != NULL; node_p=node_p->next_p) {
+         pruned++;
+      }
+      release_wd_list(list_p);
+   }
+   report(&measure, "wd_directory_prune", directories, pruned);
+
+   wd_directory_close();
+   release_tree(&tree);
+
+} // bench_wd_directory
+
+//-----------------------------------------------------------------------------
+// list_sub_dirs
+//-----------------------------------------------------------------------------
+static int remove_entry(
+   const char * path_p,
+   const struct stat * stat_p,
+   int type,
+   struct FTW * ftw_p
+) {
+//-----------------------------------------------------------------------------
+   return remove(path_p);
+
+} // remove_entry
+
+//-----------------------------------------------------------------------------
+static void make_directory(const char * path_p) {
+//-----------------------------------------------------------------------------
+   if (mkdir(path_p, 0700) != 0) {
+      fprintf(stderr, "mkdir %s: %s\n", path_p, strerror(errno));
+      exit(1);
+   }
+
+} // make_directory
+
+//-----------------------------------------------------------------------------
+// list every directory below path_p, as the watcher's crawl does
+static uint64_t crawl(const char * path_p) {
+//-----------------------------------------------------------------------------
+   SUB_DIR_NODE_P head_p;
+   SUB_DIR_NODE_P node_p;
+   uint64_t listed;
+   char sub_path[4096];
+
+   listed = 1;
+   head_p = list_sub_dirs(path_p);
+   for (node_p=head_p; node_p != NULL; node_p=node_p->next_p) {
+      snprintf(sub_path, sizeof sub_path, "%s/%s", path_p, node_p->d_name);
+      listed += crawl(sub_path);
+   }
+   release_sub_dir_list(head_p);
+
+   return listed;
+
+} // crawl
+
+//-----------------------------------------------------------------------------
+static void bench_list_sub_dirs(int directories) {
+//-----------------------------------------------------------------------------
+   struct MEASURE measure;
+   struct TREE tree;
+   const char * tmp_p;
+   SUB_DIR_NODE_P head_p;
+   SUB_DIR_NODE_P node_p;
+   uint64_t listed;
+   int i;
+   char base[1024];
+   char path[4096];
+
+   tmp_p = getenv("TMPDIR");
+   snprintf(base, sizeof base, "%s/bench_dir_watcher.XXXXXX", tmp_p ? tmp_p : "/tmp");
+   if (NULL == mkdtemp(base)) {
+      fprintf(stderr, "mkdtemp %s: %s\n", base, strerror(errno));
+      exit(1);
+   }
+
+   // wide: every directory in one
+   snprintf(path, sizeof path, "%s/wide", base);
+   make_directory(path);
+   for (i=1; i < directories; i++) {
+      snprintf(path, sizeof path, "%s/wide/%s-%d", base, names[i % 16], i);
+      make_directory(path);
+   }
+   snprintf(path, sizeof path, "%s/wide", base);
+
+   listed = 0;
+   start_measure(&measure);
+   head_p = list_sub_dirs(path);
+   for (node_p=head_p; node_p != NULL; node_p=node_p->next_p) {
+      listed++;
+   }
+   release_sub_dir_list(head_p);
+   report(&measure, "list_sub_dirs_wide", directories, listed);
+
+   // deep: the synthetic tree, with a smaller fanout
+   build_tree(&tree, directories, DEEP_FANOUT);
+   snprintf(path, sizeof path, "%s/deep", base);
+   make_directory(path);
+   for (i=1; i < tree.count; i++) {
+      snprintf(
+         path,
+         sizeof path,
+         "%s/deep%s",
+         base,
+         TREE_PATH(&tree, i) + strlen(TREE_PATH(&tree, 0))
+      );
+      make_directory(path);
+   }
+   release_tree(&tree);
+   snprintf(path, sizeof path, "%s/deep", base);
+
+   start_measure(&measure);
+   listed = crawl(path);
+   report(&measure, "list_sub_dirs_deep", directories, listed);
+
+   if (nftw(base, remove_entry, 64, FTW_DEPTH | FTW_PHYS) != 0) {
+      fprintf(stderr, "unable to remove %s: %s\n", base, strerror(errno));
+   }
+
+} // bench_list_sub_dirs
+
+//-----------------------------------------------------------------------------
+// run a benchmark in its own process, so it starts with a small heap
+static void run(void (* bench_p)(int), int directories) {
+//-----------------------------------------------------------------------------
+   pid_t pid;
+   int status;
+
+   pid = fork();
+   if (-1 == pid) {
+      fprintf(stderr, "fork: %s\n", strerror(errno));
+      exit(1);
+   }
+   if (0 == pid) {
+      bench_p(directories);
+      exit(0);
+   }
+
+   if ((waitpid(pid, &status, 0) != pid) || ! WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+      fprintf(stderr, "benchmark of %d directories failed\n", directories);
+      exit(1);
+   }
+
+} // run
+
+//-----------------------------------------------------------------------------
+int main(int argc, char **argv) {
+//-----------------------------------------------------------------------------
+   static const int default_sizes[] = {10000, 100000};
+   int sizes[64];
+   int size_count;
+   int i;
+
+   size_count = 0;
+   for (i=1; (i < argc) && (size_count < 64); i++) {
+      sizes[size_count] = atoi(argv[i]);
+      if (sizes[size_count] < 2) {
+         fprintf(stderr, "usage: %s [directories ...]\n", argv[0]);
+         return 1;
+      }
+      size_count++;
+   }
+   if (0 == size_count) {
+      size_count = sizeof default_sizes / sizeof default_sizes[0];
+      memcpy(sizes, default_sizes, sizeof default_sizes);
+   }
+
+   printf(
+      "%-32s %9s %12s %10s %12s %14s\n",
+      "benchmark", "dirs", "ns/op", "allocs/op", "peak_rss_kb", "rss_growth_kb"
+   );
+   fflush(stdout);
+
+   for (i=0; i < size_count; i++) {
+      run(bench_hash_cache, sizes[i]);
+      run(bench_wd_directory, sizes[i]);
+      run(bench_list_sub_dirs, sizes[i]);
+   }
+
+   return 0;
+
+} // main
@@ -0,0 +1,399 @@
+"""
+benchmark_crawl.py
+
+Measure how long the watcher takes to crawl a large tree, and what it costs.
+
+Builds a synthetic tree of directories (and optionally files), launches the
+watcher the way launch_watcher.py does, and waits for stats.txt, which the
+watcher writes as soon as the first crawl is done. The results are printed
+as JSON, so they can be kept and compared across builds:
+
+    python benchmark_crawl.py --width 10 --depth 5 ./spideroak_inotify_dir_watcher
+
+A tree is width + width**2 + ... + width**depth directories. Trees are
+kept under --root-dir between runs, so the same tree can be benchmarked
+with several builds; use a tmpfs such as /dev/shm to take the disk out of
+the numbers. With --strace the watcher runs under 'strace -c -f' and the
+results include its system call counts (the crawl is much slower then).
+
+Settings for the watcher are taken from the environment, as
+launch_watcher.py does.
+"""
+from __future__ import print_function
+
+import json
+import os
+import os.path
+import shutil
+import signal
+import subprocess
+import sys
+import tempfile
+import time
+
+# the watcher's optional settings all share this prefix
+_environment_prefix = "SPIDEROAK_DIR_WATCHER_"
+_tree_marker_name = "benchmark_tree.json"
+_poll_interval = 0.01
+
+class BenchmarkError(Exception):
+    pass
+
+def _parse_command_line():
+    from optparse import OptionParser
+
+    parser = OptionParser(
+        usage="%prog [options] <executable path>"
+    )
+    parser.add_option(
+        "--width", dest="width", type="int",
+        help="directories in each directory"
+    )
+    parser.set_defaults(width=10)
+    parser.add_option(
+        "--depth", dest="depth", type="int",
+        help="levels of directories below the top"
+    )
+    parser.set_defaults(depth=4)
+    parser.add_option(
+        "--files", dest="files", type="int",
+        help="files in each directory"
+    )
+    parser.set_defaults(files=0)
+    parser.add_option(
+        "--root-dir", dest="root_dir", type="string",
+        help="where to build the tree, default a new temporary directory"
+    )
+    parser.add_option(
+        "--repeat", dest="repeat", type="int",
+        help="number of times to launch the watcher"
+    )
+    parser.set_defaults(repeat=1)
+    parser.add_option(
+        "--timeout", dest="timeout", type="float",
+        help="seconds to wait for the crawl"
+    )
+    parser.set_defaults(timeout=3600.0)
+    parser.add_option(
+        "--strace", dest="strace", action="store_true",
+        help="count system calls with strace -c"
+    )
+    parser.set_defaults(strace=False)
+    parser.add_option(
+        "--output", dest="output", type="string",
+        help="write the JSON here instead of stdout"
+    )
+    parser.add_option(
+        "--remove", dest="remove", action="store_true",
+        help="remove the tree when done"
+    )
+    parser.set_defaults(remove=False)
+
+    options, args = parser.parse_args()
+    if len(args) != 1:
+        parser.error("you must specify the watcher executable")
+    options.executable_path = os.path.abspath(args[0])
+
+    return options
+
+def _tree_parameters(options):
+    return {
+        "width": options.width,
+        "depth": options.depth,
+        "files": options.files,
+    }
+
+def _create_tree(data_path, width, depth, files):
+    """
+    build the tree breadth first, returning the number of directories
+    and files created
+    """
+    directory_count = 0
+    file_count = 0
+    level = [data_path, ]
+    for _ in range(depth):
+        next_level = list()
+        for parent_path in level:
+            for x in range(width):
+                path = os.path.join(parent_path, "dir%04d" % (x, ))
+                os.mkdir(path)
+                next_level.append(path)
+                directory_count += 1
+                for y in range(files):
+                    file_path = os.path.join(path, "file%04d.txt" % (y, ))
+                    open(file_path, "w").close()
+                    file_count += 1
+        level = next_level
+
+    return directory_count, file_count
+
+def _prepare_tree(root_path, parameters):
+    """
+    build the tree under root_path, unless the one there has the same
+    parameters, returning (directories, files, seconds to build)
+    """
+    data_path = os.path.join(root_path, "data")
+    marker_path = os.path.join(root_path, _tree_marker_name)
+
+    if os.path.exists(marker_path):
+        with open(marker_path) as marker_file:
+            marker = json.load(marker_file)
+        if marker["parameters"] == parameters:
+            return marker["directories"], marker["files"], 0.0
+        os.unlink(marker_path)
+
+    if os.path.exists(data_path):
+        shutil.rmtree(data_path)
+    os.mkdir(data_path)
+
+    start_time = time.time()
+    directory_count, file_count = _create_tree(
+        data_path,
+        parameters["width"],
+        parameters["depth"],
+        parameters["files"]
+    )
+    build_seconds = time.time() - start_time
+
+    with open(marker_path, "w") as marker_file:
+        json.dump(
+            {
+                "parameters": parameters,
+                "directories": directory_count,
+                "files": file_count,
+            },
+            marker_file
+        )
+
+    return directory_count, file_count, build_seconds
+
+def watcher_environment():
+    """the watcher's settings from our environment"""
+    environment = dict()
+    for key, value in os.environ.items():
+        if key.startswith(_environment_prefix):
+            environment[key] = value
+    return environment
+
+def read_stats(stats_path):
+    """the watcher's stats file as a dict of name: int"""
+    stats = dict()
+    with open(stats_path) as stats_file:
+        for line in stats_file:
+            fields = line.split()
+            if len(fields) != 2:
+                continue
+            try:
+                stats[fields[0]] = int(fields[1])
+            except ValueError:
+                stats[fields[0]] = fields[1]
+    return stats
+
+def read_rss(pid):
+    """VmHWM and VmRSS of a process, in bytes"""
+    peak = None
+    current = None
+    with open("/proc/%d/status" % (pid, )) as status_file:
+        for line in status_file:
+            if line.startswith("VmHWM:"):
+                peak = int(line.split()[1]) * 1024
+            elif line.startswith("VmRSS:"):
+                current = int(line.split()[1]) * 1024
+    return peak, current
+
+def _find_watcher_pid(process, strace):
+    """under strace, the watcher is strace's child"""
+    if not strace:
+        return process.pid
+
+    children_path = "/proc/%d/task/%d/children" % (process.pid, process.pid, )
+    while process.poll() is None:
+        with open(children_path) as children_file:
+            children = children_file.read().split()
+        if children:
+            return int(children[0])
+        time.sleep(_poll_interval)
+
+    raise BenchmarkError("strace exited %s" % (process.returncode, ))
+
+def _parse_strace_summary(summary_path):
+    """the calls and errors columns of strace -c, by system call"""
+    syscalls = dict()
+    with open(summary_path) as summary_file:
+        for line in summary_file:
+            fields = line.split()
+            if len(fields) not in (5, 6, ) or fields[-1] == "total":
+                continue
+            try:
+                calls = int(fields[3])
+                errors = int(fields[4]) if len(fields) == 6 else 0
+            except ValueError:
+                continue
+            syscalls[fields[-1]] = {"calls": calls, "errors": errors, }
+    return syscalls
+
+def _run_watcher(options, work_path, data_path):
+    """launch the watcher, wait for the crawl, and measure it"""
+    notify_path = os.path.join(work_path, "notify")
+    config_path = os.path.join(work_path, "config.txt")
+    exclude_path = os.path.join(work_path, "exclude.txt")
+    stats_path = os.path.join(notify_path, "stats.txt")
+    strace_path = os.path.join(work_path, "strace.txt")
+
+    if os.path.exists(notify_path):
+        shutil.rmtree(notify_path)
+    os.mkdir(notify_path)
+    with open(config_path, "w") as config_file:
+        config_file.write("%s\n" % (data_path, ))
+    open(exclude_path, "w").close()
+
+    environment = watcher_environment()
+    # only the stats file written after the crawl
+    environment["SPIDEROAK_DIR_WATCHER_STATS_INTERVAL"] = "0"
+
+    if options.strace:
+        # the shell becomes strace, which becomes the watcher's parent
+        args = [
+            "/bin/sh",
+            "-c",
+            'exec strace -c -f -o "$0" "$1" $$ "$2" "$3" "$4"',
+            strace_path,
+            options.executable_path,
+            config_path,
+            exclude_path,
+            notify_path,
+        ]
+    else:
+        args = [
+            options.executable_path,
+            str(os.getpid()),
+            config_path,
+            exclude_path,
+            notify_path,
+        ]
+
+    start_time = time.time()
+    process = subprocess.Popen(args, env=environment)
+    try:
+        watcher_pid = _find_watcher_pid(process, options.strace)
+        while not os.path.exists(stats_path):
+            if process.poll() is not None:
+                raise BenchmarkError(
+                    "watcher exited %s during the crawl" % (process.returncode, )
+                )
+            if time.time() - start_time > options.timeout:
+                raise BenchmarkError("timed out waiting for the crawl")
+            time.sleep(_poll_interval)
+        ready_seconds = time.time() - start_time
+
+        peak_rss, rss = read_rss(watcher_pid)
+        stats = read_stats(stats_path)
+    finally:
+        if process.poll() is None:
+            if options.strace:
+                os.kill(_find_watcher_pid(process, options.strace), signal.SIGTERM)
+            else:
+                os.kill(process.pid, signal.SIGTERM)
+        process.wait()
+
+    result = {
+        "time_to_ready_seconds": round(ready_seconds, 6),
+        "crawl_seconds": stats.get("crawl_nanoseconds", 0) / 1e9,
+        "crawl_directories": stats.get("crawl_directories"),
+        "watches": stats.get("watches_current"),
+        "peak_rss_bytes": peak_rss,
+        "rss_bytes": rss,
+        "exit_code": process.returncode,
+    }
+    if options.strace:
+        result["syscalls"] = _parse_strace_summary(strace_path)
+
+    return result
+
+def read_max_user_watches():
+    try:
+        with open("/proc/sys/fs/inotify/max_user_watches") as limit_file:
+            return int(limit_file.read())
+    except (IOError, OSError, ValueError):
+        return None
+
+def _median(values):
+    values = sorted(values)
+    middle = len(values) // 2
+    if len(values) % 2 == 1:
+        return values[middle]
+    return (values[middle-1] + values[middle]) / 2.0
+
+def main():
+    options = _parse_command_line()
+
+    if options.root_dir is None:
+        root_path = tempfile.mkdtemp(prefix="benchmark_crawl.")
+    else:
+        root_path = os.path.abspath(options.root_dir)
+        if not os.path.isdir(root_path):
+            os.makedirs(root_path)
+    work_path = os.path.join(root_path, "work")
+    data_path = os.path.join(root_path, "data")
+    if not os.path.isdir(work_path):
+        os.mkdir(work_path)
+
+    parameters = _tree_parameters(options)
+    directory_count, file_count, build_seconds = _prepare_tree(
+        root_path, parameters
+    )
+
+    max_user_watches = read_max_user_watches()
+    if max_user_watches is not None and directory_count + 1 > max_user_watches:
+        print(
+            "warning: %d directories, but max_user_watches is %d" % (
+                directory_count + 1, max_user_watches,
+            ),
+            file=sys.stderr
+        )
+
+    runs = list()
+    try:
+        for _ in range(options.repeat):
+            runs.append(_run_watcher(options, work_path, data_path))
+    finally:
+        if options.remove:
+            shutil.rmtree(root_path)
+
+    report = {
+        "executable": options.executable_path,
+        "time": int(time.time()),
+        "tree": {
+            "path": data_path,
+            "parameters": parameters,
+            "directories": directory_count,
+            "files": file_count,
+            "build_seconds": round(build_seconds, 3),
+        },
+        "max_user_watches": max_user_watches,
+        "strace": options.strace,
+        "runs": runs,
+        "median_time_to_ready_seconds": _median(
+            [run["time_to_ready_seconds"] for run in runs]
+        ),
+        "max_peak_rss_bytes": max([run["peak_rss_bytes"] for run in runs]),
+    }
+
+    text = json.dumps(
+        report, indent=4, sort_keys=True, separators=(",", ": ")
+    )
+    if options.output is None:
+        print(text)
+    else:
+        with open(options.output, "w") as output_file:
+            output_file.write(text)
+            output_file.write("\n")
+
+    return 0
+
+if __name__ == "__main__":
+    try:
+        sys.exit(main())
+    except BenchmarkError as instance:
+        print("benchmark failed: %s" % (instance, ), file=sys.stderr)
+        sys.exit(1)
@@ -1,2 +1,6 @@
-gcc -Wall -ggdb -D DEBUG -l sqlite3 -o spideroak_inotify_dir_watcher \
-        main.c wd_directory.c list_sub_dirs.c iterate_inotify_events.c
+gcc -Wall -ggdb -D DEBUG -o spideroak_inotify_dir_watcher \
+        main.c libdirwatcher.c dir_watcher.c event_source.c \
+        wd_directory.c list_sub_dirs.c region.c iterate_inotify_events.c hash_cache.c \
+        notification_writer.c name_patterns.c exclude_matcher.c watch_profile.c \
+        fingerprint_cache.c metrics.c trace_ring.c \
+        log_limit.c -lpthread
@@ -1,2 +1,2 @@
-gcc -Wall -O0 -ggdb -D DEBUG -l sqlite3 -o test_wd_directory \
-        test_wd_directory.c wd_directory.c
+gcc -Wall -O0 -ggdb -D DEBUG -o test_wd_directory \
+        test_wd_directory.c wd_directory.c region.c
@@ -0,0 +1,3249 @@
+//-----------------------------------------------------------------------------
+// dir_watcher.c
+//
+// turn inotify events into notification files
+//-----------------------------------------------------------------------------
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <sys/stat.h>
+#include "hash_cache.h"
+
+#include "dir_watcher.h"
+#include "error_text.h"
+#include "event_source.h"
+#include "exclude_matcher.h"
+#include "fingerprint_cache.h"
+#include "iterate_inotify_events.h"
+#include "list_sub_dirs.h"
+#include "log_limit.h"
+#include "metrics.h"
+#include "name_patterns.h"
+#include "notification_writer.h"
+#include "region.h"
+#include "trace_ring.h"
+#include "watch_profile.h"
+#include "wd_directory.h"
+
+#define MAX_PATH_LEN 4096
+
+#define HASH_TABLE_SIZE 100
+#define HASH_TABLE_MEMORY_SIZE 15000
+
+#define DEFAULT_STATS_INTERVAL 60 // seconds
+#define DEFAULT_LAG_SECONDS 10
+
+// the iterator reads at most 64KB at a time, and an event without a
+// name takes 16 bytes of it
+#define MAX_BATCH_EVENTS 4096
+#define BATCH_WD_SLOTS 8192 // a power of 2
+#define BATCH_PATH_CHUNK 64 * 1024
+
+// barriers: the consumer writes BARRIER_PREFIX<token> next to the config
+// file, and we answer with <notify dir>/BARRIER_PREFIX<token>.ack
+#define BARRIER_PREFIX "barrier."
+#define BARRIER_TOKEN_MAX 64
+#define DRAIN_READ_MIN (32 * 1024)
+#define MAX_BARRIERS 32 // in one read of the control instance
+
+// a config line may give its top level directory's stream, ahead of the
+// watch profile: "stream:1 modify:60 /var/lib/vms"
+#define STREAM_PREFIX "stream:"
+
+// pruned watches removed from the kernel after each batch of events
+#define RETIRE_BATCH 1024
+
+#define MAX_SHARDS DIR_WATCHER_MAX_SHARDS
+
+// 48 bytes each, so about 200MB at most
+#define MAX_FINGERPRINT_ENTRIES (4 * 1024 * 1024)
+
+// the error file, for whoever runs the watcher to read when it exits
+char error_path[MAX_PATH_LEN+1];
+FILE * error_file = NULL;
+
+static int error; // holder for errno
+static int control_fd = -1;
+
+// A rewrite of the config or exclude file is reloaded once neither has
+// changed for a whole tick, so when the spider rewrites both we don't
+// crawl a new root before its excludes arrive.
+static int reload_pending = 0;
+static int config_rewritten = 0; // since the last tick
+static char temp_path_buffer[MAX_PATH_LEN];
+static char ack_temp_path_buffer[MAX_PATH_LEN];
+static const char * notify_dir_path = NULL;
+static const char * config_file_path = NULL;
+static const char * exclude_file_path = NULL;
+static uint32_t create_dir_mask = IN_CREATE | IN_ISDIR;
+
+struct EVENT_NAME_LOOKUP_ENTRY {
+   uint32_t       event_id;
+   const char  *  event_name; 
+};
+
+static struct EVENT_NAME_LOOKUP_ENTRY event_name_lookup[] = {
+   {IN_CLOSE_WRITE,  "IN_CLOSE_WRITE"},
+   {IN_CREATE,       "IN_CREATE"},
+   {IN_DELETE,       "IN_DELETE "},
+   {IN_MOVED_FROM,   "IN_MOVED_FROM"},
+   {IN_MOVED_TO,     "IN_MOVED_TO"},
+   {IN_DELETE_SELF,  "IN_DELETE_SELF"},
+   {IN_MOVE_SELF,    "IN_MOVE_SELF"},
+   {IN_MODIFY,       "IN_MODIFY"},
+   {0,               "*unknown*"}
+}; // event_name_lookup
+
+// a growable list of strings read from the config or exclude file
+struct PATH_LIST {
+   char ** paths;
+   int     count;
+   int     slots;
+};
+
+// a growable list of wds
+struct WD_ARRAY {
+   int * wds;
+   int   count;
+   int   slots;
+};
+
+static EXCLUDE_MATCHER_P excludes = NULL;
+static struct PATH_LIST exclude_rules;
+static struct PATH_LIST top_level_paths;
+
+// The top level directories are spread across shard_count inotify
+// instances, so each has a kernel queue of its own, and an overflow only
+// costs us the roots of the shard it happened in. Every directory is in
+// its root's shard. A kernel wd only means something with its instance,
+// so the wds we keep are kernel_wd * shard_count + shard: with one shard,
+// they are the kernel's.
+struct SHARD {
+   int      inotify_fd;
+   uint32_t prev_cookie;
+   int      last_queue_bytes;
+   uint64_t events;
+   uint64_t batches;
+   uint64_t overflows;
+};
+static struct SHARD shards[MAX_SHARDS];
+static int shard_count = 1;
+
+// The notifications may be split into stream_count streams, one for each
+// consumer. A directory goes to the stream picked by a hash of its top
+// level path, so each root stays in the same stream across reloads and
+// restarts. With more than one stream, the directories we mark are keyed
+// by the stream (see notification_writer.h).
+static int stream_count = 1;
+static char dirty_key_buffer[MAX_PATH_LEN+1];
+
+// with a callback, a flush hands it the dirty directories instead of the
+// notification writer. They are gathered in flush_paths for the call.
+static DIR_WATCHER_CALLBACK flush_callback = NULL;
+static void * flush_callback_context_p = NULL;
+static const char ** flush_paths = NULL;
+static unsigned int flush_path_slots = 0;
+
+// wds have left the wd directory since the rate limited IN_MODIFY events
+// were last gone through for them (see forget_removed_modify_events)
+static int modify_wds_removed = 0;
+
+// while dir_watcher_configure runs, an inotify_add_watch error which would
+// end the process, such as ENOSPC, is kept for its caller instead, and
+// ends the crawl
+static int configuring = 0;
+static int add_watch_error = 0;
+
+// a watched directory seen leaving by IN_MOVED_FROM, held until we know
+// whether the next event is the IN_MOVED_TO saying where it went
+static int pending_move_wd = NULL_WD;
+static uint32_t pending_move_cookie = 0;
+static char parent_path_buffer[MAX_PATH_LEN+1];
+
+// wds pruned from the wd directory whose kernel watches are still to be
+// removed. Each inotify_rm_watch queues an IN_IGNORED, so removing the
+// watches of a big subtree all at once would stall us and could overflow
+// our own queue: we remove RETIRE_BATCH of them after each batch of
+// events, and the IN_IGNOREDs wake us up for the next lot.
+static struct WD_ARRAY retired_wds;
+static int retired_next = 0;
+
+// the wds of directories deleted in the batch of events being processed,
+// sorted. rm -rf deletes a directory's contents and then the directory,
+// and we only report the directory it started from, when its parent's
+// IN_DELETE arrives.
+static struct WD_ARRAY deleted_wds;
+
+// a batch of events, decoded in one pass over the iterator's buffer.
+// Their order is kept, so IN_MOVED_FROM is still just before its
+// IN_MOVED_TO. name_offset is from the first event, 0 for no name.
+struct BATCH_EVENT {
+   int      wd;
+   uint32_t mask;
+   uint32_t cookie;
+   uint32_t name_offset;
+};
+static struct BATCH_EVENT batch_events[MAX_BATCH_EVENTS];
+static int batch_event_count = 0;
+
+// the paths of the wds seen since the wd directory last changed, so
+// that a batch looks each wd up once however its events are interleaved.
+// A slot is in use if its generation is the current one, so forgetting
+// them all is a counter increment. The paths are copied into a region,
+// released at the next lookup after they are forgotten: the path of the
+// event being processed stays good until the next event.
+struct BATCH_WD {
+   int          wd;
+   uint32_t     generation;
+   const char * path_p;     // NULL if we don't know the wd
+   int          marked;     // reported since we looked it up
+};
+static struct BATCH_WD batch_wds[BATCH_WD_SLOTS];
+static uint32_t batch_generation = 1;
+static int batch_wd_count = 0;
+static REGION_P batch_path_region = NULL;
+static const char * batch_paths_p = NULL; // the first path in the region
+static int batch_paths_stale = 0;
+
+static const char dir_watcher_ignore[] = "__dir_watcher_ignore";
+static const char * fingerprint_cache_size = 
+   "SPIDEROAK_DIR_WATCHER_FINGERPRINT_CACHE";
+static const char * temp_patterns_file = 
+   "SPIDEROAK_DIR_WATCHER_TEMP_PATTERNS";
+static const char * stats_interval_seconds = 
+   "SPIDEROAK_DIR_WATCHER_STATS_INTERVAL";
+static const char * capture_file = 
+   "SPIDEROAK_DIR_WATCHER_CAPTURE";
+static const char * shard_count_setting = 
+   "SPIDEROAK_DIR_WATCHER_SHARDS";
+static const char * consumer_lag_seconds = 
+   "SPIDEROAK_DIR_WATCHER_LAG_SECONDS";
+static const char * stream_count_setting = 
+   "SPIDEROAK_DIR_WATCHER_STREAMS";
+
+// metrics are written to stats.txt in the notification directory every
+// stats_interval seconds (0 for never), and on SIGUSR1
+static int stats_interval = DEFAULT_STATS_INTERVAL;
+static uint64_t next_stats_ns = 0;
+static char stats_path_buffer[MAX_PATH_LEN];
+static char stats_temp_path_buffer[MAX_PATH_LEN];
+
+// the trace ring is dumped to trace.txt on SIGUSR2 and on an error exit
+static char trace_path_buffer[MAX_PATH_LEN];
+static char trace_temp_path_buffer[MAX_PATH_LEN];
+
+// monotonic timestamps for the batch of events being processed
+struct BATCH_STAMPS {
+   uint64_t wake_ns;          // poll said the inotify fd was readable
+   uint64_t read_start_ns;
+   uint64_t read_end_ns;      // the events are in our buffer
+   uint64_t lookup_ns;        // total time finding parent paths
+};
+static struct BATCH_STAMPS batch_stamps;
+
+// when the oldest directory waiting in the hash cache was read, and when
+// it was marked, 0 if the hash cache is empty
+static uint64_t pending_read_ns = 0;
+static uint64_t pending_mark_ns = 0;
+
+// file names whose events never make a directory dirty, unless
+// temp_patterns_file names a file of patterns to use instead
+static const char * default_temp_patterns[] = {
+   ".*.sw?",         // vim swap files
+   "4913",           // vim checks it can write a directory with this
+   "*~",             // editor backups
+   ".#*",            // emacs lock files
+   "*.part",         // firefox partial downloads
+   "*.crdownload",   // chrome partial downloads
+   "*.tmp",
+   NULL
+};
+static NAME_PATTERNS_P temp_patterns = NULL;
+
+// The watcher's own output must never wake it up, so the notification
+// directory is excluded
+static char notify_dir_real_path[PATH_MAX+1];
+
+// directories marked since the last flush. The notification writer
+// has another, which it hands back when it has written it out.
+static hash_cache * hc;
+
+//-----------------------------------------------------------------------------
+static const char * event_name(uint32_t event_mask) {
+//-----------------------------------------------------------------------------
+   int i;
+
+   for (i=0; 1; i++) {
+      if (0 == event_name_lookup[i].event_id) {
+         return event_name_lookup[i].event_name;
+      }
+      if (event_name_lookup[i].event_id & event_mask) {
+         return event_name_lookup[i].event_name;
+      } 
+   } // for
+
+} // event_name
+
+//-----------------------------------------------------------------------------
+static void initialize_error_path(const char * notify_dir_p) {
+//-----------------------------------------------------------------------------
+   int bytes_written;
+
+   bytes_written = snprintf(
+      error_path, 
+      (MAX_PATH_LEN+1),
+      "%s/error.txt",
+      notify_dir_p
+   );
+   if ((MAX_PATH_LEN+1) == bytes_written) {
+      syslog(LOG_ERR, "error path overflow %s", notify_dir_p);
+      exit(1);
+   }
+
+} // initialize_temp_path
+
+//-----------------------------------------------------------------------------
+static void initialize_temp_path(const char * notify_dir_p) {
+//-----------------------------------------------------------------------------
+   int bytes_written;
+
+   bytes_written = snprintf(
+      temp_path_buffer, 
+      sizeof temp_path_buffer,
+      "%s/temp",
+      notify_dir_p
+   );
+   if (sizeof temp_path_buffer == bytes_written) {
+      syslog(LOG_ERR, "temp path overflow %s", notify_dir_p);
+      error_file = fopen(error_path, "w");
+      fprintf(error_file, "temp path overflow %s\n", notify_dir_p);
+      fclose(error_file);
+      exit(1);
+   }
+
+   // not BARRIER_PREFIX, in case the config and notify dirs are the same
+   snprintf(
+      ack_temp_path_buffer, 
+      sizeof ack_temp_path_buffer,
+      "%s/ack.temp",
+      notify_dir_p
+   );
+
+} // initialize_temp_path
+
+//-----------------------------------------------------------------------------
+static void initialize_stats_path(const char * notify_dir_p) {
+//-----------------------------------------------------------------------------
+   int bytes_written;
+
+   bytes_written = snprintf(
+      stats_temp_path_buffer, 
+      sizeof stats_temp_path_buffer,
+      "%s/stats.temp",
+      notify_dir_p
+   );
+   if (sizeof stats_temp_path_buffer == bytes_written) {
+      syslog(LOG_ERR, "stats path overflow %s", notify_dir_p);
+      error_file = fopen(error_path, "w");
+      fprintf(error_file, "stats path overflow %s\n", notify_dir_p);
+      fclose(error_file);
+      exit(1);
+   }
+   snprintf(
+      stats_path_buffer, 
+      sizeof stats_path_buffer,
+      "%s/stats.txt",
+      notify_dir_p
+   );
+   snprintf(
+      trace_path_buffer, 
+      sizeof trace_path_buffer,
+      "%s/trace.txt",
+      notify_dir_p
+   );
+   snprintf(
+      trace_temp_path_buffer, 
+      sizeof trace_temp_path_buffer,
+      "%s/trace.temp",
+      notify_dir_p
+   );
+
+} // initialize_stats_path
+
+//-----------------------------------------------------------------------------
+// on_exit handler: leave the recent history next to error.txt
+// registered once, however many times the watcher is initialized
+static void dump_trace_on_error(int status, void * arg_p) {
+//-----------------------------------------------------------------------------
+   if (status != 0) {
+      dump_trace_ring(trace_path_buffer, trace_temp_path_buffer);
+   }
+} // dump_trace_on_error
+
+//-----------------------------------------------------------------------------
+// our wd for a wd the shard's inotify instance gave us
+static int shard_wd(int shard, int wd) {
+//-----------------------------------------------------------------------------
+   // IN_Q_OVERFLOW has no wd
+   if (wd < 0) {
+      return wd;
+   }
+
+   // the kernel hands out wds in sequence, so with many shards a very
+   // long run could get past what we can number
+   if (wd > (INT_MAX - shard) / shard_count) {
+      syslog(LOG_ERR, "wd %d too big for %d shards", wd, shard_count);
+      error_file = fopen(error_path, "w");
+      fprintf(error_file, "wd %d too big for %d shards\n", wd, shard_count);
+      fclose(error_file);
+      exit(36);
+   }
+
+   return wd * shard_count + shard;
+
+} // shard_wd
+
+//-----------------------------------------------------------------------------
+static int wd_shard(int wd) {
+//-----------------------------------------------------------------------------
+   return wd % shard_count;
+} // wd_shard
+
+//-----------------------------------------------------------------------------
+static int kernel_wd(int wd) {
+//-----------------------------------------------------------------------------
+   return wd / shard_count;
+} // kernel_wd
+
+//-----------------------------------------------------------------------------
+// arg_p points to an int for each shard
+static void count_shard_wd(int wd, const char * path_p, void * arg_p) {
+//-----------------------------------------------------------------------------
+   ((int *) arg_p)[wd_shard(wd)]++;
+} // count_shard_wd
+
+//-----------------------------------------------------------------------------
+// the shard for a new top level directory: the one watching the fewest
+// directories
+static int least_loaded_shard(void) {
+//-----------------------------------------------------------------------------
+   int watches[MAX_SHARDS];
+   int shard;
+   int i;
+
+   if (1 == shard_count) {
+      return 0;
+   }
+
+   memset(watches, 0, sizeof watches);
+   for_each_wd_directory(count_shard_wd, watches);
+
+   shard = 0;
+   for (i=1; i < shard_count; i++) {
+      if (watches[i] < watches[shard]) {
+         shard = i;
+      }
+   }
+
+   return shard;
+
+} // least_loaded_shard
+
+//-----------------------------------------------------------------------------
+// the allocations for the crawl's and the prunes' lists
+static void write_region_stats(
+   FILE * file_p, 
+   const char * prefix_p, 
+   const struct REGION_STATS * stats_p
+) {
+//-----------------------------------------------------------------------------
+   fprintf(
+      file_p, 
+      "%s_allocations %llu\n", 
+      prefix_p, 
+      (unsigned long long) stats_p->allocations
+   );
+   fprintf(
+      file_p, 
+      "%s_releases %llu\n", 
+      prefix_p, 
+      (unsigned long long) stats_p->releases
+   );
+   fprintf(
+      file_p, 
+      "%s_chunk_allocations %llu\n", 
+      prefix_p, 
+      (unsigned long long) stats_p->chunk_allocations
+   );
+   fprintf(
+      file_p, 
+      "%s_bytes_peak %llu\n", 
+      prefix_p, 
+      (unsigned long long) stats_p->bytes_peak
+   );
+   fprintf(
+      file_p, 
+      "%s_chunk_bytes %llu\n", 
+      prefix_p, 
+      (unsigned long long) stats_p->chunk_bytes
+   );
+
+} // write_region_stats
+
+//-----------------------------------------------------------------------------
+// what each inotify instance is doing
+static void write_shard_stats(FILE * file_p) {
+//-----------------------------------------------------------------------------
+   int watches[MAX_SHARDS];
+   int i;
+
+   memset(watches, 0, sizeof watches);
+   for_each_wd_directory(count_shard_wd, watches);
+
+   fprintf(file_p, "shards %d\n", shard_count);
+   for (i=0; i < shard_count; i++) {
+      fprintf(file_p, "shard%d_watches_current %d\n", i, watches[i]);
+      fprintf(
+         file_p, 
+         "shard%d_events %llu\n", 
+         i, 
+         (unsigned long long) shards[i].events
+      );
+      fprintf(
+         file_p, 
+         "shard%d_event_batches %llu\n", 
+         i, 
+         (unsigned long long) shards[i].batches
+      );
+      fprintf(
+         file_p, 
+         "shard%d_overflows %llu\n", 
+         i, 
+         (unsigned long long) shards[i].overflows
+      );
+      fprintf(
+         file_p, 
+         "shard%d_queue_bytes_current %d\n", 
+         i, 
+         shards[i].last_queue_bytes
+      );
+   }
+
+} // write_shard_stats
+
+//-----------------------------------------------------------------------------
+// the metrics which are a current value rather than a running total
+static void write_gauges(FILE * file_p) {
+//-----------------------------------------------------------------------------
+   FILE * statm_file_p;
+   unsigned long size_pages;
+   unsigned long resident_pages;
+   uint64_t crawl_ns;
+   int watches_current;
+   int queue_bytes;
+   int i;
+
+   watches_current = wd_directory_count();
+   fprintf(file_p, "watches_current %d\n", watches_current);
+   fprintf(
+      file_p, 
+      "watches_removed %llu\n", 
+      (unsigned long long) (metric_counters[METRIC_WATCHES_ADDED] - watches_current)
+   );
+   fprintf(
+      file_p, 
+      "wd_directory_bytes %llu\n", 
+      (unsigned long long) wd_directory_memory()
+   );
+   fprintf(
+      file_p, "watches_retiring %d\n", retired_wds.count - retired_next
+   );
+   fprintf(
+      file_p, "notification_backlog %d\n", notification_writer_backlog()
+   );
+   write_region_stats(file_p, "sub_dir_lists", sub_dir_list_stats());
+   write_region_stats(file_p, "wd_lists", wd_list_stats());
+
+   crawl_ns = metric_counters[METRIC_CRAWL_NANOSECONDS];
+   fprintf(
+      file_p, 
+      "crawl_directories_per_second %llu\n", 
+      (unsigned long long) (0 == crawl_ns ? 0 :
+         metric_counters[METRIC_CRAWL_DIRECTORIES] * 1000000000ULL / crawl_ns)
+   );
+
+   queue_bytes = 0;
+   for (i=0; i < shard_count; i++) {
+      queue_bytes += shards[i].last_queue_bytes;
+   }
+   fprintf(file_p, "queue_bytes_current %d\n", queue_bytes);
+   if (shard_count > 1) {
+      write_shard_stats(file_p);
+   }
+
+   statm_file_p = fopen("/proc/self/statm", "r");
+   if (statm_file_p != NULL) {
+      if (2 == fscanf(statm_file_p, "%lu %lu", &size_pages, &resident_pages)) {
+         fprintf(
+            file_p, 
+            "rss_bytes %llu\n", 
+            (unsigned long long) resident_pages * sysconf(_SC_PAGESIZE)
+         );
+      }
+      fclose(statm_file_p);
+   }
+
+} // write_gauges
+
+//-----------------------------------------------------------------------------
+static void write_stats(void) {
+//-----------------------------------------------------------------------------
+   write_metrics_file(stats_path_buffer, stats_temp_path_buffer, write_gauges);
+   if (stats_interval > 0) {
+      next_stats_ns = metric_now_ns() + stats_interval * 1000000000ULL;
+   }
+} // write_stats
+
+//-----------------------------------------------------------------------------
+static void append_path(struct PATH_LIST * list_p, const char * path_p) {
+//-----------------------------------------------------------------------------
+   char ** new_paths;
+
+   if (list_p->count == list_p->slots) {
+      new_paths = realloc(
+         list_p->paths, 
+         (list_p->slots + 64) * sizeof(char *)
+      );
+      if (NULL == new_paths) {
+         syslog(LOG_ERR, "realloc failed");
+         error_file = fopen(error_path, "w");
+         fprintf(error_file, "realloc failed\n");
+         fclose(error_file);
+         exit(27);
+      }
+      list_p->paths = new_paths;
+      list_p->slots += 64;
+   }
+
+   list_p->paths[list_p->count] = strdup(path_p);
+   if (NULL == list_p->paths[list_p->count]) {
+      syslog(LOG_ERR, "strdup failed");
+      error_file = fopen(error_path, "w");
+      fprintf(error_file, "strdup failed\n");
+      fclose(error_file);
+      exit(27);
+   }
+   list_p->count++;
+
+} // append_path
+
+//-----------------------------------------------------------------------------
+static int path_list_contains(
+   const struct PATH_LIST * list_p, 
+   const char * path_p
+) {
+//-----------------------------------------------------------------------------
+   int i;
+
+   for (i=0; i < list_p->count; i++) {
+      if (0 == strcmp(list_p->paths[i], path_p)) {
+         return 1;
+      }
+   }
+
+   return 0;
+
+} // path_list_contains
+
+//-----------------------------------------------------------------------------
+static void release_path_list(struct PATH_LIST * list_p) {
+//-----------------------------------------------------------------------------
+   int i;
+
+   for (i=0; i < list_p->count; i++) {
+      free(list_p->paths[i]);
+   }
+   free(list_p->paths);
+   memset(list_p, 0, sizeof(struct PATH_LIST));
+
+} // release_path_list
+
+//-----------------------------------------------------------------------------
+static void append_wd(struct WD_ARRAY * array_p, int wd) {
+//-----------------------------------------------------------------------------
+   int * new_wds;
+   int new_slots;
+
+   if (array_p->count == array_p->slots) {
+      new_slots = (0 == array_p->slots) ? 1024 : array_p->slots * 2;
+      new_wds = realloc(array_p->wds, new_slots * sizeof(int));
+      if (NULL == new_wds) {
+         syslog(LOG_ERR, "realloc failed for %d wds", new_slots);
+         error_file = fopen(error_path, "w");
+         fprintf(error_file, "realloc failed for %d wds\n", new_slots);
+         fclose(error_file);
+         exit(35);
+      }
+      array_p->wds = new_wds;
+      array_p->slots = new_slots;
+   }
+   array_p->wds[array_p->count++] = wd;
+
+} // append_wd
+
+//-----------------------------------------------------------------------------
+static int compare_wds(const void * left_p, const void * right_p) {
+//-----------------------------------------------------------------------------
+   int left = *(const int *) left_p;
+   int right = *(const int *) right_p;
+
+   return (left > right) - (left < right);
+
+} // compare_wds
+
+//-----------------------------------------------------------------------------
+static void release_wd_array(struct WD_ARRAY * array_p) {
+//-----------------------------------------------------------------------------
+   free(array_p->wds);
+   memset(array_p, 0, sizeof(struct WD_ARRAY));
+} // release_wd_array
+
+//-----------------------------------------------------------------------------
+// called whenever the wd directory changes
+static void forget_batch_paths(void) {
+//-----------------------------------------------------------------------------
+   batch_generation++;
+   if (0 == batch_generation) {
+      memset(batch_wds, 0, sizeof batch_wds);
+      batch_generation = 1;
+   }
+   batch_wd_count = 0;
+   batch_paths_stale = 1;
+
+} // forget_batch_paths
+
+//-----------------------------------------------------------------------------
+static unsigned int batch_wd_index(int wd) {
+//-----------------------------------------------------------------------------
+   return ((uint32_t) wd * 2654435761U) & (BATCH_WD_SLOTS - 1);
+} // batch_wd_index
+
+//-----------------------------------------------------------------------------
+// the slot of wd, looking up its path if we don't have it yet
+static struct BATCH_WD * find_batch_wd(int wd) {
+//-----------------------------------------------------------------------------
+   struct BATCH_WD * slot_p;
+   unsigned int index;
+   const char * path_p;
+   char * copy_p;
+   size_t path_size;
+   uint64_t lookup_start_ns;
+   uint64_t lookup_ns;
+
+   for (index=batch_wd_index(wd); ; index=(index+1) & (BATCH_WD_SLOTS-1)) {
+      slot_p = &batch_wds[index];
+      if (slot_p->generation != batch_generation) {
+         break;
+      }
+      if (slot_p->wd == wd) {
+         return slot_p;
+      }
+   }
+
+   // keep the probes short
+   if (batch_wd_count >= BATCH_WD_SLOTS / 2) {
+      forget_batch_paths();
+      slot_p = &batch_wds[batch_wd_index(wd)];
+   }
+
+   if (batch_paths_stale) {
+      region_release(batch_path_region, batch_paths_p);
+      batch_paths_p = NULL;
+      batch_paths_stale = 0;
+   }
+
+   lookup_start_ns = metric_now_ns();
+   memset(parent_path_buffer, '\0', sizeof parent_path_buffer);
+   path_p = find_wd_directory(wd, parent_path_buffer, MAX_PATH_LEN);
+   lookup_ns = metric_now_ns() - lookup_start_ns;
+   batch_stamps.lookup_ns += lookup_ns;
+   metric_record(METRIC_WD_LOOKUP_NS, lookup_ns);
+
+   copy_p = NULL;
+   if (path_p != NULL) {
+      path_size = strlen(path_p) + 1;
+      copy_p = region_alloc(batch_path_region, path_size);
+      if (NULL == copy_p) {
+         syslog(LOG_ERR, "region_alloc failed for %zu bytes", path_size);
+         error_file = fopen(error_path, "w");
+         fprintf(error_file, "region_alloc failed for %zu bytes\n", path_size);
+         fclose(error_file);
+         exit(37);
+      }
+      memcpy(copy_p, path_p, path_size);
+      if (NULL == batch_paths_p) {
+         batch_paths_p = copy_p;
+      }
+   }
+
+   slot_p->wd = wd;
+   slot_p->generation = batch_generation;
+   slot_p->path_p = copy_p;
+   slot_p->marked = 0;
+   batch_wd_count++;
+
+   return slot_p;
+
+} // find_batch_wd
+
+//-----------------------------------------------------------------------------
+// hand the pruned wds to remove_retired_watches
+static void remove_pruned_wds(WD_LIST_NODE_P wd_list_p) {
+//-----------------------------------------------------------------------------
+   WD_LIST_NODE_P node_p;
+
+   for (node_p=wd_list_p; node_p != NULL; node_p=node_p->next_p) {
+      append_wd(&retired_wds, node_p->wd);
+   }
+
+} // remove_pruned_wds
+
+//-----------------------------------------------------------------------------
+// remove the kernel watches of up to RETIRE_BATCH pruned wds
+static void remove_retired_watches(void) {
+//-----------------------------------------------------------------------------
+   int wd;
+   int fd;
+   int removed;
+
+   for (
+      removed=0; 
+      (retired_next < retired_wds.count) && (removed < RETIRE_BATCH);
+   ) {
+      wd = retired_wds.wds[retired_next++];
+
+      // watched again since: a directory moved back, or a watch which
+      // inotify_add_watch handed back to us
+      if (wd_directory_exists(wd)) {
+         continue;
+      }
+
+      removed++;
+      fd = shards[wd_shard(wd)].inotify_fd;
+      if (-1 == source_rm_watch(fd, kernel_wd(wd))) {
+         error = errno;
+         if (EINVAL == error) {
+            // this one is already gone
+            continue;
+         }
+         syslog(
+            LOG_ERR, 
+            "inotify_rm_watch failed %d (%d) %s",
+            wd, 
+            error, 
+            strerror(error)
+         );
+         error_file = fopen(error_path, "w");
+         fprintf(
+            error_file, 
+            "inotify_rm_watch failed %d (%d) %s\n",
+            wd, 
+            error, 
+            strerror(error)
+         );
+         fclose(error_file);
+         exit(15);
+      } 
+   }
+
+   if (retired_next == retired_wds.count) {
+      retired_next = 0;
+      retired_wds.count = 0;
+   }
+
+} // remove_retired_watches
+
+//-----------------------------------------------------------------------------
+static void prune_wd_and_clean_up(int wd) {
+//-----------------------------------------------------------------------------
+   WD_LIST_NODE_P wd_list_p;
+
+   // We prune the whole tree (if any) below this directory, because
+   // the paths are no longer right. We assume that we will build new 
+   // entries when we get IN_MOVED_TO
+   trace(TRACE_PRUNED, wd, 0, 0);
+   wd_list_p = prune_wd_directory(wd);
+   forget_batch_paths();
+   modify_wds_removed = 1;
+   remove_pruned_wds(wd_list_p);
+   release_wd_list(wd_list_p);
+
+} // prune_wd_and_clean_up
+
+//-----------------------------------------------------------------------------
+// directories named dir_watcher_ignore are never watched
+static int is_ignored_path(const char * path) {
+//-----------------------------------------------------------------------------
+   size_t pathlen;
+
+   pathlen = strlen(path);
+   if (pathlen < sizeof(dir_watcher_ignore) - 1) {
+      return 0;
+   }
+
+   return 0 == strcmp(
+      path + pathlen - sizeof(dir_watcher_ignore) + 1, dir_watcher_ignore
+   );
+
+} // is_ignored_path
+
+//-----------------------------------------------------------------------------
+static int watch_tree(
+   int shard, 
+   int parent_wd, 
+   const char * path, 
+   int profile
+) {
+//-----------------------------------------------------------------------------
+   int watch_descriptor;
+   const char * exclude_rule_p;
+   SUB_DIR_NODE_P head_p;
+   SUB_DIR_NODE_P node_p;
+   char path_buffer[MAX_PATH_LEN];
+   int chars_stored;
+
+   // check the excludes before we list or watch anything, so we never
+   // descend into an excluded subtree
+   exclude_rule_p = match_exclude(excludes, path);
+   if (exclude_rule_p != NULL) {
+      trace(TRACE_WATCH_EXCLUDED, parent_wd, 0, 0);
+      METRIC_INCREMENT(METRIC_DIRECTORIES_EXCLUDED);
+      return -1; 
+   }
+
+   if (is_ignored_path(path)) {
+      syslog_limited(
+         LOG_CLASS_IGNORED_PATH, LOG_NOTICE, "ignoring path %s", path
+      );
+      return -1;
+   }
+
+   if (add_watch_error != 0) {
+      return -1;
+   }
+
+   watch_descriptor = find_directory_wd(path);
+   if (watch_descriptor != NULL_WD) {
+      syslog_limited(
+         LOG_CLASS_ALREADY_WATCHING,
+         LOG_NOTICE, 
+         "Already watching %s wd=%d", 
+         path, 
+         watch_descriptor
+      );
+      return -1;
+   }
+
+   watch_descriptor = source_add_watch(
+      shards[shard].inotify_fd, 
+      path, 
+      watch_profile_mask(profile)
+   );
+   if (-1 == watch_descriptor) {
+      error = errno;
+
+      // latency: the directory may no longer be there by the time we get
+      // around to adding this watch. So we ignore errno 2, and hope
+      // we pick him up in another event, like move
+      if (ENOENT == error) {
+         syslog_limited(
+            LOG_CLASS_MISSING_DIRECTORY,
+            LOG_NOTICE, 
+            "inotify_add_watch ignoring missing directory %s", 
+            path 
+         );
+         return -1;
+      }
+
+      if (EACCES == error) {
+         syslog_limited(
+            LOG_CLASS_ACCESS_DENIED,
+            LOG_NOTICE, 
+            "inotify_add_watch ignoring directory (access denied) %s", 
+            path 
+         );
+         return -1;
+      }
+
+      syslog(
+         LOG_ERR, 
+         "inotify_add_watch %s %d %s", 
+         path, 
+         error, 
+         strerror(error)
+      );
+      if (configuring) {
+         add_watch_error = error;
+         return -1;
+      }
+      error_file = fopen(error_path, "w");
+      fprintf(
+         error_file, 
+         "inotify_add_watch %s %d %s\n", 
+         path, 
+         error, 
+         strerror(error)
+      );
+      fclose(error_file);
+      exit(2);
+   }
+   watch_descriptor = shard_wd(shard, watch_descriptor);
+
+   // 2020-07-06 dougfort -- In some cases, such as a top level directory 
+   // being moved, we may already have a watch on the old directory.
+   // In this case, inotify_add_watch returns the existing wd, which we
+   // want to get rid of.
+   if (wd_directory_exists(watch_descriptor)) {
+      syslog_limited(
+         LOG_CLASS_WD_EXISTS,
+         LOG_WARNING, 
+         "wd exists for new watch, pruning it %d, %s", 
+         watch_descriptor,
+         path
+      );
+      prune_wd_and_clean_up(watch_descriptor);
+   }
+
+   if (0 != add_wd_directory(watch_descriptor, parent_wd, path, profile)) {
+      syslog(
+         LOG_ERR, 
+         "Unable to add wd_directory %d %s",
+         watch_descriptor,
+         path
+      );
+      error_file = fopen(error_path, "w");
+      fprintf(
+         error_file, 
+         "Unable to add wd_directory %d %s\n",
+         watch_descriptor,
+         path
+      );
+      fclose(error_file);
+      exit(3);
+   }
+   forget_batch_paths();
+   trace(TRACE_WATCH_ADDED, watch_descriptor, 0, parent_wd);
+   METRIC_INCREMENT(METRIC_WATCHES_ADDED);
+
+   // now recursively add a watch for every directory below this path
+   // we're counting on the filesystem to limit the depth
+   head_p = source_list_sub_dirs(path);
+   METRIC_INCREMENT(METRIC_CRAWL_DIRECTORIES);
+   for (node_p = head_p; node_p != NULL; node_p = node_p->next_p) {
+      chars_stored = snprintf(
+         path_buffer, 
+         sizeof path_buffer,
+         "%s/%s",
+         path,
+         node_p->d_name
+      );
+      if (chars_stored >= sizeof path_buffer) {
+         syslog(LOG_ERR, "path buffer overlow %s", path_buffer);
+         error_file = fopen(error_path, "w");
+         fprintf(error_file, "path buffer overlow %s\n", path_buffer);
+         fclose(error_file);
+         exit(4);
+      }
+      watch_tree(shard, watch_descriptor, path_buffer, profile);
+   } // for
+
+   release_sub_dir_list(head_p);
+
+   return 0; //success
+
+} // watch_tree
+
+//-----------------------------------------------------------------------------
+// watch path and every directory below it, timing the crawl
+// A directory goes in its parent's shard.
+static int add_watch(int shard, int parent_wd, const char * path, int profile) {
+//-----------------------------------------------------------------------------
+   uint64_t start_ns;
+   int result;
+
+   start_ns = metric_now_ns();
+   result = watch_tree(shard, parent_wd, path, profile);
+   METRIC_ADD(METRIC_CRAWL_NANOSECONDS, metric_now_ns() - start_ns);
+
+   return result;
+
+} // add_watch
+
+//-----------------------------------------------------------------------------
+// find where the watcher's output really is, in case the path we were
+// given goes through a symlink
+static void initialize_own_output(const char * notify_dir_p) {
+//-----------------------------------------------------------------------------
+   if (NULL == realpath(notify_dir_p, notify_dir_real_path)) {
+      notify_dir_real_path[0] = '\0';
+   }
+} // initialize_own_output
+
+//-----------------------------------------------------------------------------
+// add the notification directory to the excludes, in case it is inside
+// a watched directory. Otherwise every notification would cause another.
+static void exclude_own_output(
+   EXCLUDE_MATCHER_P matcher_p, 
+   const char * notify_dir_p
+) {
+//-----------------------------------------------------------------------------
+   int result = 0;
+
+   if ('/' == notify_dir_p[0]) {
+      result |= add_exclude_rule(matcher_p, notify_dir_p);
+   }
+   if (notify_dir_real_path[0] != '\0') {
+      result |= add_exclude_rule(matcher_p, notify_dir_real_path);
+   }
+
+   if (result != 0) {
+      syslog(LOG_ERR, "add_exclude_rule failed");
+      error_file = fopen(error_path, "w");
+      fprintf(error_file, "add_exclude_rule failed\n");
+      fclose(error_file);
+      exit(8);
+   }
+
+} // exclude_own_output
+
+//-----------------------------------------------------------------------------
+static void add_temp_pattern(const char * pattern) {
+//-----------------------------------------------------------------------------
+   if (add_name_pattern(temp_patterns, pattern) != 0) {
+      syslog(LOG_ERR, "add_name_pattern failed");
+      error_file = fopen(error_path, "w");
+      fprintf(error_file, "add_name_pattern failed\n");
+      fclose(error_file);
+      exit(30);
+   }
+} // add_temp_pattern
+
+//-----------------------------------------------------------------------------
+// compile the temporary file name patterns, from patterns_path if it
+// is not NULL, otherwise the defaults
+static void load_temp_patterns(const char * patterns_path) {
+//-----------------------------------------------------------------------------
+   FILE * patterns_file_p;
+   char read_buffer[MAX_PATH_LEN];
+   char * char_p;
+   int i;
+
+   temp_patterns = new_name_patterns();
+   if (NULL == temp_patterns) {
+      syslog(LOG_ERR, "new_name_patterns failed");
+      error_file = fopen(error_path, "w");
+      fprintf(error_file, "new_name_patterns failed\n");
+      fclose(error_file);
+      exit(30);
+   }
+
+   if (NULL == patterns_path) {
+      for (i=0; default_temp_patterns[i] != NULL; i++) {
+         add_temp_pattern(default_temp_patterns[i]);
+      }
+      return;
+   }
+
+   patterns_file_p = fopen(patterns_path, "r");
+   if (NULL == patterns_file_p) {
+      error = errno;
+      syslog(LOG_ERR, "fopen %s %d %s", patterns_path, error, strerror(error));
+      error_file = fopen(error_path, "w");
+      fprintf(
+         error_file, "fopen %s %d %s\n", patterns_path, error, strerror(error)
+      );
+      fclose(error_file);
+      exit(30);
+   }
+
+   while (fgets(read_buffer, MAX_PATH_LEN, patterns_file_p) != NULL) {
+      char_p = strchr(read_buffer, '\n');
+      if (char_p != NULL) {
+         *char_p = '\0';
+      }
+      if (read_buffer[0] != '\0') {
+         syslog(LOG_INFO, "temp file pattern: '%s'", read_buffer);
+         add_temp_pattern(read_buffer);
+      }
+   }
+
+   fclose(patterns_file_p);   
+
+} // load_temp_patterns
+
+//-----------------------------------------------------------------------------
+// compile the exclude rules
+static EXCLUDE_MATCHER_P new_excludes(const struct PATH_LIST * rules_p) {
+//-----------------------------------------------------------------------------
+   EXCLUDE_MATCHER_P matcher_p;
+   int i;
+
+   matcher_p = new_exclude_matcher();
+   if (NULL == matcher_p) {
+      syslog(LOG_ERR, "new_exclude_matcher failed");
+      error_file = fopen(error_path, "w");
+      fprintf(error_file, "new_exclude_matcher failed\n");
+      fclose(error_file);
+      exit(8);
+   }
+
+   for (i=0; i < rules_p->count; i++) {
+      syslog(LOG_INFO, "exclude path: '%s'", rules_p->paths[i]);
+
+      if (add_exclude_rule(matcher_p, rules_p->paths[i]) != 0) {
+         syslog(LOG_ERR, "add_exclude_rule failed");
+         error_file = fopen(error_path, "w");
+         fprintf(error_file, "add_exclude_rule failed\n");
+         fclose(error_file);
+         exit(8);
+      }
+   }
+
+   syslog(LOG_INFO, "%d exclude rules", exclude_rule_count(matcher_p));
+
+   return matcher_p;
+
+} // new_excludes
+
+//-----------------------------------------------------------------------------
+// read the exclude file into rules_p
+// returns 0 on success, -1 with errno set if the file can't be opened
+static int load_exclude_rules(
+   const char *exclude_path,
+   struct PATH_LIST * rules_p
+) {
+//-----------------------------------------------------------------------------
+   FILE * exclude_file_p;
+   char read_buffer[MAX_PATH_LEN];
+   char * char_p;
+
+   exclude_file_p = fopen(exclude_path, "r");
+   if (NULL == exclude_file_p) {
+      error = errno;
+      syslog(LOG_WARNING, "fopen %s %d %s", exclude_path, error, strerror(error));
+      errno = error;
+      return -1;
+   }
+
+   while (1) {
+      fgets(read_buffer, MAX_PATH_LEN, exclude_file_p);
+
+      if (ferror(exclude_file_p)) {
+         error = errno;
+         syslog(
+            LOG_ERR, "fgets %s %d %s", exclude_path, error, strerror(error)
+         );
+         error_file = fopen(error_path, "w");
+         fprintf(
+            error_file, "fgets %s %d %s\n", exclude_path, error, strerror(error)
+         );
+         fclose(error_file);
+         exit(6);
+      }
+
+      if (feof(exclude_file_p)) {
+         break;
+      }
+
+      char_p = strchr(read_buffer, '\n');
+      if (char_p != NULL) {
+         *char_p = '\0';
+      }
+
+      append_path(rules_p, read_buffer);
+
+   } // while
+   
+   fclose(exclude_file_p);   
+
+   return 0;
+
+} // load_exclude_rules
+
+//-----------------------------------------------------------------------------
+// read the config file into paths_p
+// returns 0 on success, -1 with errno set if the file can't be opened
+static int load_top_level_paths(
+   const char *config_path, 
+   struct PATH_LIST * paths_p
+) {
+//-----------------------------------------------------------------------------
+   FILE * config_file_p;
+   char read_buffer[MAX_PATH_LEN];
+   char * char_p;
+
+   config_file_p = fopen(config_path, "r");
+   if (NULL == config_file_p) {
+      error = errno;
+      syslog(LOG_WARNING, "fopen %s %d %s", config_path, error, strerror(error));
+      errno = error;
+      return -1;
+   }
+
+   while (1) {
+      fgets(read_buffer, MAX_PATH_LEN, config_file_p);
+
+      if (ferror(config_file_p)) {
+         error = errno;
+         syslog(LOG_ERR, "fgets %s %d %s", config_path, error, strerror(error));
+         error_file = fopen(error_path, "w");
+         fprintf(
+            error_file, "fgets %s %d %s\n", config_path, error, strerror(error)
+         );
+         fclose(error_file);
+         exit(10);
+      }
+
+      if (feof(config_file_p)) {
+         break;
+      }
+
+      char_p = strchr(read_buffer, '\n');
+      if (char_p != NULL) {
+         *char_p = '\0';
+      }
+
+      syslog(LOG_INFO, "top level path: '%s'", read_buffer);
+      append_path(paths_p, read_buffer);
+
+   } // while
+   
+   fclose(config_file_p);   
+
+   return 0;
+
+} // load_top_level_paths
+
+//-----------------------------------------------------------------------------
+// the stream a config file line asks for, -1 if it doesn't
+// returns the rest of the line
+static const char * line_stream(const char * line, int * stream_p) {
+//-----------------------------------------------------------------------------
+   const char * number_p;
+   char * end_p;
+   long stream;
+
+   *stream_p = -1;
+   if (strncmp(line, STREAM_PREFIX, strlen(STREAM_PREFIX)) != 0) {
+      return line;
+   }
+
+   number_p = line + strlen(STREAM_PREFIX);
+   stream = strtol(number_p, &end_p, 10);
+   if (
+      (end_p == number_p) || 
+      (*end_p != ' ') || 
+      (stream < 0) || 
+      (stream >= NOTIFICATION_MAX_STREAMS)
+   ) {
+      // left for the profile parser to find wanting
+      return line;
+   }
+   while (' ' == *end_p) {
+      end_p++;
+   }
+
+   *stream_p = (int) stream;
+   return end_p;
+
+} // line_stream
+
+//-----------------------------------------------------------------------------
+// split a config file line into its path and watch profile
+static const char * top_level_path(const char * line, int * profile_p) {
+//-----------------------------------------------------------------------------
+   const char * path;
+   int stream;
+
+   line = line_stream(line, &stream);
+   path = parse_watch_profile(line, profile_p);
+   if (NULL == path) {
+      syslog(LOG_WARNING, "invalid watch profile, using default: %s", line);
+      *profile_p = DEFAULT_WATCH_PROFILE;
+      path = strchr(line, '/');
+   }
+
+   return NULL == path ? line : path;
+
+} // top_level_path
+
+//-----------------------------------------------------------------------------
+// returns 0 on success, or if the root is excluded, -1 with error set
+// if it can't be watched
+static int watch_top_level_path(const char * line) {
+//-----------------------------------------------------------------------------
+   const char * path;
+   int profile;
+   int stream;
+
+   line_stream(line, &stream);
+   if ((stream >= stream_count) && (stream_count > 1)) {
+      syslog(
+         LOG_WARNING, 
+         "only %d streams, %s goes where its path hashes to", 
+         stream_count, 
+         line
+      );
+   }
+
+   // watch_tree sets error only when inotify_add_watch fails
+   path = top_level_path(line, &profile);
+   error = 0;
+   if (add_watch(least_loaded_shard(), NULL_WD, path, profile) != 0) {
+      syslog(LOG_WARNING, "Can't watch toplevel path %s", path);
+      return (0 == error) ? 0 : -1;
+   }
+
+   return 0;
+
+} // watch_top_level_path
+
+//-----------------------------------------------------------------------------
+static void prune_directory(const char * path) {
+//-----------------------------------------------------------------------------
+   char path_buffer[MAX_PATH_LEN];
+   char * end_p;
+   int wd;
+
+   if (strlen(path) >= sizeof path_buffer) {
+      return;
+   }
+   strcpy(path_buffer, path);
+
+   // exclude rules may have trailing slashes
+   end_p = path_buffer + strlen(path_buffer) - 1;
+   while ((end_p > path_buffer) && ('/' == *end_p)) {
+      *end_p-- = '\0';
+   }
+
+   wd = find_directory_wd(path_buffer);
+   if (wd != NULL_WD) {
+      syslog(LOG_INFO, "no longer watching %s", path_buffer);
+      prune_wd_and_clean_up(wd);
+   }
+
+} // prune_directory
+
+//-----------------------------------------------------------------------------
+// if we are watching the parent of path, (re)build the watches for path
+static void watch_if_parent_watched(const char * path) {
+//-----------------------------------------------------------------------------
+   char parent_buffer[MAX_PATH_LEN];
+   char * slash_p;
+   int parent_wd;
+
+   if (strlen(path) >= sizeof parent_buffer) {
+      return;
+   }
+   strcpy(parent_buffer, path);
+
+   // ignore trailing slashes
+   slash_p = parent_buffer + strlen(parent_buffer) - 1;
+   while ((slash_p > parent_buffer) && ('/' == *slash_p)) {
+      *slash_p-- = '\0';
+   }
+
+   slash_p = strrchr(parent_buffer, '/');
+   if ((NULL == slash_p) || (slash_p == parent_buffer)) {
+      return;
+   }
+   *slash_p = '\0';
+
+   parent_wd = find_directory_wd(parent_buffer);
+   if (parent_wd != NULL_WD) {
+      *slash_p = '/';
+      if (NULL_WD == find_directory_wd(parent_buffer)) {
+         add_watch(
+            wd_shard(parent_wd), 
+            parent_wd, 
+            parent_buffer, 
+            find_wd_profile(parent_wd)
+         );
+      }
+   }
+
+} // watch_if_parent_watched
+
+//-----------------------------------------------------------------------------
+// arg_p points to where the next node goes, starting with the head
+// The list is built front to back: the head must be allocated first.
+static void collect_wd(int wd, const char * path_p, void * arg_p) {
+//-----------------------------------------------------------------------------
+   WD_LIST_NODE_P ** next_ppp = (WD_LIST_NODE_P **) arg_p;
+   WD_LIST_NODE_P node_p;
+
+   node_p = new_wd_list_node(wd);
+   **next_ppp = node_p;
+   *next_ppp = &node_p->next_p;
+
+} // collect_wd
+
+//-----------------------------------------------------------------------------
+static void collect_excluded_wd(int wd, const char * path_p, void * arg_p) {
+//-----------------------------------------------------------------------------
+   if (match_exclude(excludes, path_p) != NULL) {
+      collect_wd(wd, path_p, arg_p);
+   }
+} // collect_excluded_wd
+
+//-----------------------------------------------------------------------------
+// look for directories which are no longer excluded below every
+// watched directory. This lists every watched directory, but only adds
+// watches for the new ones.
+static void watch_unexcluded_sub_dirs(void) {
+//-----------------------------------------------------------------------------
+   WD_LIST_NODE_P wd_list_p = NULL;
+   WD_LIST_NODE_P * next_pp = &wd_list_p;
+   WD_LIST_NODE_P wd_node_p;
+   SUB_DIR_NODE_P head_p;
+   SUB_DIR_NODE_P node_p;
+   char dir_buffer[MAX_PATH_LEN+1];
+   char path_buffer[MAX_PATH_LEN];
+   int chars_stored;
+   int profile;
+
+   for_each_wd_directory(collect_wd, &next_pp);
+
+   for (wd_node_p=wd_list_p; wd_node_p != NULL; wd_node_p=wd_node_p->next_p) {
+      memset(dir_buffer, '\0', sizeof dir_buffer);
+      if (NULL == find_wd_directory(wd_node_p->wd, dir_buffer, MAX_PATH_LEN)) {
+         continue;
+      }
+
+      profile = find_wd_profile(wd_node_p->wd);
+      head_p = source_list_sub_dirs(dir_buffer);
+      for (node_p = head_p; node_p != NULL; node_p = node_p->next_p) {
+         chars_stored = snprintf(
+            path_buffer, 
+            sizeof path_buffer,
+            "%s/%s",
+            dir_buffer,
+            node_p->d_name
+         );
+         if (chars_stored >= sizeof path_buffer) {
+            continue;
+         }
+         if (NULL_WD == find_directory_wd(path_buffer)) {
+            add_watch(
+               wd_shard(wd_node_p->wd), wd_node_p->wd, path_buffer, profile
+            );
+         }
+      }
+      release_sub_dir_list(head_p);
+   }
+
+   release_wd_list(wd_list_p);
+
+} // watch_unexcluded_sub_dirs
+
+//-----------------------------------------------------------------------------
+// make new_paths_p and new_rules_p the top level paths and exclude rules,
+// and bring the watches in line with them. Only the differences cost
+// anything: unchanged roots are not touched, new roots and un-excluded
+// subtrees are crawled, removed roots and newly excluded subtrees are
+// pruned. The lists become ours.
+// returns 0 on success, -1 with errno set if a root which is new to the
+// config can't be watched, or a watch can't be added while configuring
+static int apply_config(
+   struct PATH_LIST * new_paths_p, 
+   struct PATH_LIST * new_rules_p
+) {
+//-----------------------------------------------------------------------------
+   EXCLUDE_MATCHER_P old_excludes;
+   struct PATH_LIST old_paths;
+   WD_LIST_NODE_P wd_list_p;
+   WD_LIST_NODE_P * next_pp;
+   WD_LIST_NODE_P node_p;
+   const char * path;
+   int profile;
+   int name_rule_added = 0;
+   int name_rule_removed = 0;
+   int root_error = 0;
+   int i;
+
+   METRIC_INCREMENT(METRIC_RELOADS);
+   trace(TRACE_RELOAD, NULL_WD, 0, 0);
+
+   old_excludes = excludes;
+   excludes = new_excludes(new_rules_p);
+   exclude_own_output(excludes, notify_dir_path);
+
+   // prune the roots which have gone away, or are now excluded.
+   // A root whose profile has changed is pruned here and watched again below
+   for (i=0; i < top_level_paths.count; i++) {
+      path = top_level_path(top_level_paths.paths[i], &profile);
+      if (
+         (! path_list_contains(new_paths_p, top_level_paths.paths[i])) ||
+         (match_exclude(excludes, path) != NULL)
+      ) {
+         prune_directory(path);
+         // a root may also lie inside another root
+         watch_if_parent_watched(path);
+      }
+   }
+
+   // prune newly excluded subtrees
+   for (i=0; i < new_rules_p->count; i++) {
+      if (path_list_contains(&exclude_rules, new_rules_p->paths[i])) {
+         continue;
+      }
+      if ('/' == new_rules_p->paths[i][0]) {
+         prune_directory(new_rules_p->paths[i]);
+      } else if (new_rules_p->paths[i][0] != '\0') {
+         name_rule_added = 1;
+      }
+   }
+
+   // a new name pattern can match anywhere, so we have to check
+   // everything we are watching
+   if (name_rule_added) {
+      wd_list_p = NULL;
+      next_pp = &wd_list_p;
+      for_each_wd_directory(collect_excluded_wd, &next_pp);
+      for (node_p=wd_list_p; node_p != NULL; node_p=node_p->next_p) {
+         if (wd_directory_exists(node_p->wd)) {
+            prune_wd_and_clean_up(node_p->wd);
+         }
+      }
+      release_wd_list(wd_list_p);
+   }
+
+   // what is watched from here on is marked dirty in the new roots' streams
+   old_paths = top_level_paths;
+   top_level_paths = *new_paths_p;
+
+   // watch subtrees which are no longer excluded
+   for (i=0; i < exclude_rules.count; i++) {
+      if (path_list_contains(new_rules_p, exclude_rules.paths[i])) {
+         continue;
+      }
+      if ('/' == exclude_rules.paths[i][0]) {
+         watch_if_parent_watched(exclude_rules.paths[i]);
+      } else if (exclude_rules.paths[i][0] != '\0') {
+         name_rule_removed = 1;
+      }
+   }
+
+   if (name_rule_removed) {
+      watch_unexcluded_sub_dirs();
+   }
+
+   // watch the new roots, and any which are no longer excluded
+   for (i=0; i < top_level_paths.count; i++) {
+      path = top_level_path(top_level_paths.paths[i], &profile);
+      if (
+         (NULL_WD == find_directory_wd(path)) &&
+         (watch_top_level_path(top_level_paths.paths[i]) != 0) &&
+         (! path_list_contains(&old_paths, top_level_paths.paths[i])) &&
+         (0 == root_error)
+      ) {
+         root_error = error;
+      }
+   }
+
+   release_exclude_matcher(old_excludes);
+   release_path_list(&exclude_rules);
+   release_path_list(&old_paths);
+   exclude_rules = *new_rules_p;
+
+   if (add_watch_error != 0) {
+      errno = add_watch_error;
+      return -1;
+   }
+   if (root_error != 0) {
+      errno = root_error;
+      return -1;
+   }
+
+   return 0;
+
+} // apply_config
+
+//-----------------------------------------------------------------------------
+// re-read the config and exclude files
+static void reload_config(const char * config_path, const char * exclude_path) {
+//-----------------------------------------------------------------------------
+   struct PATH_LIST new_paths;
+   struct PATH_LIST new_rules;
+
+   syslog(LOG_NOTICE, "reloading config");
+
+   // the spider may be part way through replacing a file: wait for the
+   // notification that it is back
+   memset(&new_paths, 0, sizeof new_paths);
+   memset(&new_rules, 0, sizeof new_rules);
+   if (
+      (load_top_level_paths(config_path, &new_paths) != 0) ||
+      (load_exclude_rules(exclude_path, &new_rules) != 0)
+   ) {
+      syslog(LOG_WARNING, "config files unreadable, reload postponed");
+      release_path_list(&new_paths);
+      release_path_list(&new_rules);
+      return;
+   }
+   apply_config(&new_paths, &new_rules);
+
+   syslog(LOG_NOTICE, "config reloaded");
+
+} // reload_config
+
+//-----------------------------------------------------------------------------
+// watch the directories holding the config and exclude files, on their own
+// inotify instance, so we notice when the spider rewrites them
+static void watch_config_files(const char * config_path, const char * exclude_path) {
+//-----------------------------------------------------------------------------
+   const char * paths[2];
+   char dir_buffer[MAX_PATH_LEN];
+   char * slash_p;
+   int i;
+
+   control_fd = inotify_init();
+   if (-1 == control_fd) {
+      error = errno;
+      syslog(LOG_WARNING, "inotify_init (control) %d %s", error, strerror(error));
+      return;
+   }
+
+   paths[0] = config_path;
+   paths[1] = exclude_path;
+   for (i=0; i < 2; i++) {
+      if (strlen(paths[i]) >= sizeof dir_buffer) {
+         continue;
+      }
+      strcpy(dir_buffer, paths[i]);
+      slash_p = strrchr(dir_buffer, '/');
+      if (NULL == slash_p) {
+         strcpy(dir_buffer, ".");
+      } else if (slash_p == dir_buffer) {
+         slash_p[1] = '\0';
+      } else {
+         *slash_p = '\0';
+      }
+
+      if (-1 == inotify_add_watch(control_fd, dir_buffer, IN_CLOSE_WRITE | IN_MOVED_TO)) {
+         error = errno;
+         syslog(
+            LOG_WARNING, 
+            "unable to watch config directory %s %d %s; use SIGHUP to reload",
+            dir_buffer,
+            error,
+            strerror(error)
+         );
+      }
+   }
+
+} // watch_config_files
+
+//-----------------------------------------------------------------------------
+static int watch_new_directory(
+   int parent_wd, 
+   const char * parent, 
+   const char * name
+) {
+//-----------------------------------------------------------------------------
+   char new_dir_path_buffer[MAX_PATH_LEN];
+   int bytes_written;
+
+   bytes_written = snprintf(
+      new_dir_path_buffer, 
+      sizeof new_dir_path_buffer,
+      "%s/%s",
+      parent,
+      name
+   );
+
+   if (sizeof new_dir_path_buffer == bytes_written) {
+      syslog(
+         LOG_ERR, 
+         "new dir path overflow %s", 
+         new_dir_path_buffer
+      );
+      error_file = fopen(error_path, "w");
+      fprintf(
+         error_file, 
+         "new dir path overflow %s\n", 
+         new_dir_path_buffer
+      );
+      fclose(error_file);
+      exit(14);
+   }
+
+   return add_watch(
+      wd_shard(parent_wd), 
+      parent_wd, 
+      new_dir_path_buffer, 
+      find_wd_profile(parent_wd)
+   );
+
+} // watch_new_directory
+
+//-----------------------------------------------------------------------------
+// the wd watching parent_dir_p/dir_name_p, such as a directory which has
+// just been moved away or deleted, NULL_WD if we weren't watching it
+static int sub_dir_wd(
+   const char * parent_dir_p, 
+   const char * dir_name_p
+) {
+//-----------------------------------------------------------------------------
+   char path_buffer[MAX_PATH_LEN];
+   int chars_stored;
+
+   if (NULL == parent_dir_p) {
+      return NULL_WD;
+   }
+
+   chars_stored = snprintf(
+      path_buffer, 
+      sizeof path_buffer,
+      "%s/%s",
+      parent_dir_p,
+      dir_name_p
+   );
+   if (chars_stored >= sizeof path_buffer) {
+      syslog(LOG_ERR, "path buffer overlow %s", path_buffer);
+      error_file = fopen(error_path, "w");
+      fprintf(error_file, "path buffer overlow %s\n", path_buffer);
+      fclose(error_file);
+      exit(4);
+   }
+
+   // 2010-09-14 dougfort -- don't treat not finding the wd as an error
+   // We assume that the directory was created and then renamed before
+   // we had a chance to create watch descriptors.
+   return find_directory_wd(path_buffer);
+
+} // sub_dir_wd
+
+//-----------------------------------------------------------------------------
+// decode the batch of events which start_iter_inotify has just read into
+// batch_events, noting which directories are deleted in it
+static void decode_batch(int shard, const struct inotify_event * event_p) {
+//-----------------------------------------------------------------------------
+   const char * first_p;
+   struct BATCH_EVENT * batch_event_p;
+
+   batch_event_count = 0;
+   deleted_wds.count = 0;
+
+   for (
+      first_p = (const char *) event_p; 
+      event_p != NULL; 
+      event_p=next_iter_inotify(shards[shard].inotify_fd)
+   ) {
+      if (MAX_BATCH_EVENTS == batch_event_count) {
+         syslog(LOG_ERR, "more than %d events in a batch", MAX_BATCH_EVENTS);
+         error_file = fopen(error_path, "w");
+         fprintf(
+            error_file, "more than %d events in a batch\n", MAX_BATCH_EVENTS
+         );
+         fclose(error_file);
+         exit(39);
+      }
+      batch_event_p = &batch_events[batch_event_count++];
+      batch_event_p->wd = shard_wd(shard, event_p->wd);
+      batch_event_p->mask = event_p->mask;
+      batch_event_p->cookie = event_p->cookie;
+      batch_event_p->name_offset = 
+         (event_p->len > 0) ? event_p->name - first_p : 0;
+
+      // a top level directory has no parent to report it, so we go on
+      // reporting what happens in it
+      if (
+         (event_p->mask & IN_DELETE_SELF) && 
+         (find_wd_parent(batch_event_p->wd) != NULL_WD)
+      ) {
+         append_wd(&deleted_wds, batch_event_p->wd);
+      }
+   }
+
+   if (deleted_wds.count > 1) {
+      qsort(deleted_wds.wds, deleted_wds.count, sizeof(int), compare_wds);
+   }
+
+} // decode_batch
+
+//-----------------------------------------------------------------------------
+static int is_deleted_wd(int wd) {
+//-----------------------------------------------------------------------------
+   if (0 == deleted_wds.count) {
+      return 0;
+   }
+
+   return bsearch(
+      &wd, deleted_wds.wds, deleted_wds.count, sizeof(int), compare_wds
+   ) != NULL;
+
+} // is_deleted_wd
+
+//-----------------------------------------------------------------------------
+// a directory under one which survives has been deleted. The IN_IGNOREDs
+// have normally taken its tree out of the wd directory already, but not
+// while a deleted directory is held open, and we must not go on thinking
+// we watch its path.
+static void prune_deleted_directory(
+   const char * parent_dir_p, 
+   const char * dir_name_p
+) {
+//-----------------------------------------------------------------------------
+   int wd;
+
+   wd = sub_dir_wd(parent_dir_p, dir_name_p);
+   if (wd != NULL_WD) {
+      prune_wd_and_clean_up(wd);
+   }
+
+} // prune_deleted_directory
+
+//-----------------------------------------------------------------------------
+// a moved directory's IN_MOVED_TO didn't follow, so we don't know where
+// it went, if anywhere we watch
+static void prune_pending_move(void) {
+//-----------------------------------------------------------------------------
+   if (NULL_WD == pending_move_wd) {
+      return;
+   }
+
+   prune_wd_and_clean_up(pending_move_wd);
+   pending_move_wd = NULL_WD;
+
+} // prune_pending_move
+
+//-----------------------------------------------------------------------------
+// the pending moved directory has arrived as parent_dir_p/dir_name_p.
+// The kernel's watches follow the directories, so if nothing we decide
+// from the path changes, we only need to move the path.
+// returns 0 if it was moved, nonzero if it must be watched afresh
+static int move_pending_directory(
+   int parent_wd,
+   const char * parent_dir_p, 
+   const char * dir_name_p
+) {
+//-----------------------------------------------------------------------------
+   char path_buffer[MAX_PATH_LEN];
+   char old_path_buffer[MAX_PATH_LEN+1];
+   int chars_stored;
+
+   if (NULL == parent_dir_p) {
+      return -1;
+   }
+
+   chars_stored = snprintf(
+      path_buffer, 
+      sizeof path_buffer,
+      "%s/%s",
+      parent_dir_p,
+      dir_name_p
+   );
+   if (chars_stored >= sizeof path_buffer) {
+      return -1;
+   }
+
+   memset(old_path_buffer, '\0', sizeof old_path_buffer);
+   if (
+      (NULL == find_wd_directory(
+         pending_move_wd, old_path_buffer, MAX_PATH_LEN
+      )) ||
+      (find_wd_profile(pending_move_wd) != find_wd_profile(parent_wd)) ||
+      (match_exclude(excludes, path_buffer) != NULL) ||
+      is_ignored_path(path_buffer) ||
+      exclude_rules_below(excludes, old_path_buffer) ||
+      exclude_rules_below(excludes, path_buffer)
+   ) {
+      return -1;
+   }
+
+   if (move_wd_directory(pending_move_wd, parent_wd, dir_name_p) != 0) {
+      return -1;
+   }
+   forget_batch_paths();
+
+   trace(TRACE_MOVED, pending_move_wd, 0, parent_wd);
+   METRIC_INCREMENT(METRIC_DIRECTORIES_MOVED);
+   pending_move_wd = NULL_WD;
+
+   return 0;
+
+} // move_pending_directory
+
+//-----------------------------------------------------------------------------
+// the stream for the top level path dir_p is under: the one its config line
+// gives, or else one picked by a hash of the path
+static int path_stream(const char * dir_p) {
+//-----------------------------------------------------------------------------
+   const char * root_p = NULL;
+   const char * path;
+   size_t root_len = 0;
+   size_t len;
+   int profile;
+   int stream = -1;
+   int i;
+   // FNV-1a
+   uint32_t hash = 2166136261u;
+
+   // nested roots are allowed: the longest one is the one watching dir_p
+   for (i=0; i < top_level_paths.count; i++) {
+      path = top_level_path(top_level_paths.paths[i], &profile);
+      len = strlen(path);
+      if (
+         (len > root_len) &&
+         (0 == strncmp(dir_p, path, len)) &&
+         (('/' == dir_p[len]) || ('\0' == dir_p[len]))
+      ) {
+         root_p = path;
+         root_len = len;
+         line_stream(top_level_paths.paths[i], &stream);
+      }
+   }
+   if (NULL == root_p) {
+      return 0;
+   }
+   if ((stream >= 0) && (stream < stream_count)) {
+      return stream;
+   }
+
+   for (; *root_p != '\0'; root_p++) {
+      hash ^= (unsigned char) *root_p;
+      hash *= 16777619u;
+   }
+
+   return hash % stream_count;
+
+} // path_stream
+
+//-----------------------------------------------------------------------------
+// the key we mark dir_p by, in a buffer reused by the next call
+static const char * dirty_key(const char * dir_p) {
+//-----------------------------------------------------------------------------
+   if ((1 == stream_count) || (flush_callback != NULL)) {
+      return dir_p;
+   }
+
+   dirty_key_buffer[0] = (char) (path_stream(dir_p) + 1);
+   strncpy(dirty_key_buffer + 1, dir_p, MAX_PATH_LEN);
+   dirty_key_buffer[MAX_PATH_LEN] = '\0';
+
+   return dirty_key_buffer;
+
+} // dirty_key
+
+//-----------------------------------------------------------------------------
+// the notification writer couldn't write a notification: fail as we would
+// have failed writing it ourselves
+static void exit_if_writer_failed(int status) {
+//-----------------------------------------------------------------------------
+   if (0 == status) {
+      return;
+   }
+
+   syslog(LOG_ERR, "%s", notification_writer_error());
+   error_file = fopen(error_path, "w");
+   fprintf(error_file, "%s\n", notification_writer_error());
+   fclose(error_file);
+   exit(status);
+
+} // exit_if_writer_failed
+
+//-----------------------------------------------------------------------------
+// hand the directories marked so far, parent_dir_p first if it is not
+// NULL, to the callback instead of the notification writer
+static void call_flush_callback(const char * parent_dir_p, unsigned int entries) {
+//-----------------------------------------------------------------------------
+   const char ** new_paths;
+   unsigned int count = 0;
+   unsigned int pos;
+   unsigned int hits;
+   unsigned int datalen;
+   char * str;
+
+   if (entries + 1 > flush_path_slots) {
+      new_paths = realloc(flush_paths, (entries + 1) * sizeof(char *));
+      if (NULL == new_paths) {
+         syslog(LOG_ERR, "realloc failed");
+         error_file = fopen(error_path, "w");
+         fprintf(error_file, "realloc failed\n");
+         fclose(error_file);
+         exit(27);
+      }
+      flush_paths = new_paths;
+      flush_path_slots = entries + 1;
+   }
+
+   if (parent_dir_p != NULL) {
+      flush_paths[count++] = parent_dir_p;
+   }
+   for(pos = 0; (pos = hash_cache_iter(hc, pos, &hits, (void**)&str, &datalen))!=0;) {
+      flush_paths[count++] = str;
+   }
+
+   flush_callback(flush_paths, count, flush_callback_context_p);
+   hash_cache_clear(hc);
+
+} // call_flush_callback
+
+//-----------------------------------------------------------------------------
+// hand the directories marked so far, with parent_dir_p above them if it
+// is not NULL, to the notification writer
+static void flush_hash_cache(const char * parent_dir_p) {
+//-----------------------------------------------------------------------------
+   unsigned int entries;
+   uint64_t start_ns;
+
+   entries = hash_cache_entries(hc);
+   if ((0 == entries) && (NULL == parent_dir_p)) {
+      // nothing marked, or all of it unmarked again
+      pending_read_ns = 0;
+      pending_mark_ns = 0;
+      return;
+   }
+
+   start_ns = metric_now_ns();
+   if (NULL == flush_callback) {
+      exit_if_writer_failed(
+         notification_writer_swap(&hc, parent_dir_p, pending_read_ns)
+      );
+   } else {
+      call_flush_callback(parent_dir_p, entries);
+   }
+
+   METRIC_INCREMENT(METRIC_FLUSHES);
+   trace(TRACE_FLUSHED, NULL_WD, 0, entries + (parent_dir_p != NULL));
+   METRIC_ADD(
+      METRIC_DIRECTORIES_NOTIFIED, entries + (parent_dir_p != NULL)
+   );
+   metric_record(METRIC_HASH_CACHE_FILL, entries);
+
+   if (pending_read_ns != 0) {
+      metric_record(METRIC_DEBOUNCE_NS, start_ns - pending_mark_ns);
+      pending_read_ns = 0;
+      pending_mark_ns = 0;
+   }
+
+} // flush_hash_cache
+
+//-----------------------------------------------------------------------------
+// add a directory to the next notification
+// read_ns is when we read the event which made it dirty
+static void mark_dirty(
+   const char * dir_p, 
+   uint64_t read_ns
+) {
+//-----------------------------------------------------------------------------
+   METRIC_INCREMENT(METRIC_DIRECTORIES_MARKED);
+   if (0 == pending_read_ns) {
+      pending_read_ns = read_ns;
+      pending_mark_ns = metric_now_ns();
+   }
+
+   dir_p = dirty_key(dir_p);
+   if(0 == hash_cache_add(hc, (void*)dir_p, strlen(dir_p)+1)) {
+      flush_hash_cache(dir_p);
+   }
+
+} // mark_dirty
+
+//-----------------------------------------------------------------------------
+// a directory waiting for the next notification has been deleted, and its
+// parent will be reported instead
+static void unmark_dirty(const char * dir_p) {
+//-----------------------------------------------------------------------------
+   dir_p = dirty_key(dir_p);
+   if (hash_cache_remove(hc, (void*)dir_p, strlen(dir_p)+1) > 0) {
+      METRIC_INCREMENT(METRIC_DIRECTORIES_UNMARKED);
+   }
+} // unmark_dirty
+
+
+//-----------------------------------------------------------------------------
+static int file_unchanged(const char * parent_dir_p, const char * name) {
+//-----------------------------------------------------------------------------
+   char path_buffer[MAX_PATH_LEN];
+   int chars_stored;
+
+   chars_stored = snprintf(
+      path_buffer, 
+      sizeof path_buffer,
+      "%s/%s",
+      parent_dir_p,
+      name
+   );
+   if (chars_stored >= sizeof path_buffer) {
+      return 0;
+   }
+
+   return fingerprint_unchanged(path_buffer);
+
+} // file_unchanged
+
+//-----------------------------------------------------------------------------
+// forget the rate limited IN_MODIFY events of the wds which have gone.
+// That means going through the whole table, so it waits for the end of a
+// batch (or the next tick), however many wds the batch removed.
+static void forget_removed_modify_events(void) {
+//-----------------------------------------------------------------------------
+   if (modify_wds_removed) {
+      forget_modify_events(wd_directory_exists);
+      modify_wds_removed = 0;
+   }
+} // forget_removed_modify_events
+
+//-----------------------------------------------------------------------------
+// report a directory whose IN_MODIFY was held back by the rate limit
+static void report_modified_wd(int wd) {
+//-----------------------------------------------------------------------------
+   char path_buffer[MAX_PATH_LEN+1];
+   const char * path_p;
+
+   memset(path_buffer, '\0', sizeof path_buffer);
+   path_p = find_wd_directory(wd, path_buffer, MAX_PATH_LEN);
+   if (NULL == path_p) {
+      return;
+   }
+
+   mark_dirty(path_p, metric_now_ns());
+
+} // report_modified_wd
+
+//-----------------------------------------------------------------------------
+// arg_p points to the shard
+static void mark_shard_dir(int wd, const char * path_p, void * arg_p) {
+//-----------------------------------------------------------------------------
+   if (wd_shard(wd) == *(int *) arg_p) {
+      mark_dirty(path_p, metric_now_ns());
+   }
+} // mark_shard_dir
+
+//-----------------------------------------------------------------------------
+// The shard's queue overflowed, so we have lost events for its roots.
+// Instead of exiting, which makes the spider go over everything, we watch
+// the shard's roots again with a new inotify instance, and report every
+// directory in them. With one shard, the new instance takes over the event
+// source's descriptor.
+static void resync_shard(int shard) {
+//-----------------------------------------------------------------------------
+   struct PATH_LIST roots;
+   WD_LIST_NODE_P wd_list_p;
+   const char * path;
+   int profile;
+   int new_fd;
+   int wd;
+   int i;
+   int j;
+
+   syslog(LOG_WARNING, "Inotify queue overflow in shard %d, resyncing", shard);
+   shards[shard].overflows++;
+   trace(TRACE_RESYNC, NULL_WD, 0, shard);
+
+   prune_pending_move();
+
+   // the instance goes, and its watches with it
+   memset(&roots, 0, sizeof roots);
+   for (i=0; i < top_level_paths.count; i++) {
+      path = top_level_path(top_level_paths.paths[i], &profile);
+      wd = find_directory_wd(path);
+      if (
+         (wd != NULL_WD) && 
+         (wd_shard(wd) == shard) && 
+         (NULL_WD == find_wd_parent(wd))
+      ) {
+         append_path(&roots, top_level_paths.paths[i]);
+         wd_list_p = prune_wd_directory(wd);
+         release_wd_list(wd_list_p);
+         forget_batch_paths();
+      }
+   }
+
+   // the new instance gives out the same wds again, at once
+   forget_modify_events(wd_directory_exists);
+   modify_wds_removed = 0;
+
+   for (i=j=retired_next; i < retired_wds.count; i++) {
+      if (wd_shard(retired_wds.wds[i]) != shard) {
+         retired_wds.wds[j++] = retired_wds.wds[i];
+      }
+   }
+   retired_wds.count = j;
+
+   // the new instance keeps the old one's descriptor number, so poll()
+   // needn't know. An epoll set drops the old instance as it closes, so
+   // dir_watcher_shard_resyncs tells its owner to add the new one.
+   new_fd = inotify_init();
+   if ((-1 == new_fd) || (-1 == dup2(new_fd, shards[shard].inotify_fd))) {
+      error = errno;
+      syslog(LOG_ERR, "inotify_init (shard) %d %s", error, strerror(error));
+      error_file = fopen(error_path, "w");
+      fprintf(error_file, "inotify_init (shard) %d %s\n", error, strerror(error));
+      fclose(error_file);
+      exit(23);
+   }
+   close(new_fd);
+   shards[shard].prev_cookie = 0;
+
+   for (i=0; i < roots.count; i++) {
+      path = top_level_path(roots.paths[i], &profile);
+      if (add_watch(shard, NULL_WD, path, profile) != 0) {
+         syslog(LOG_WARNING, "Can't watch toplevel path %s", path);
+      }
+   }
+   for_each_wd_directory(mark_shard_dir, &shard);
+
+   release_path_list(&roots);
+
+} // resync_shard
+
+//-----------------------------------------------------------------------------
+static void process_inotify_events(int shard) {
+//-----------------------------------------------------------------------------
+   const struct inotify_event * first_event_p;
+   const struct BATCH_EVENT * event_p;
+   struct BATCH_WD * batch_wd_p;
+   const char * parent_dir_p;
+   const char * name_p;
+   int fd;
+   int wd;
+   int i;
+   int interval_wd;
+   int modify_interval;
+   int queue_bytes;
+   uint64_t event_count;
+
+   fd = shards[shard].inotify_fd;
+
+   // what is waiting in the kernel queue tells us how close we are
+   // to an overflow
+   if (0 == source_queue_bytes(fd, &queue_bytes)) {
+      shards[shard].last_queue_bytes = queue_bytes;
+      metric_record(METRIC_QUEUE_BYTES, queue_bytes);
+   }
+
+   interval_wd = NULL_WD;
+   modify_interval = 0;
+   event_count = 0;
+
+   batch_stamps.read_start_ns = metric_now_ns();
+   first_event_p = start_iter_inotify(fd);
+   batch_stamps.read_end_ns = metric_now_ns();
+   decode_batch(shard, first_event_p);
+   forget_batch_paths();
+   batch_stamps.lookup_ns = 0;
+   metric_record(
+      METRIC_QUEUE_WAIT_NS, 
+      batch_stamps.read_start_ns - batch_stamps.wake_ns
+   );
+   metric_record(
+      METRIC_READ_NS, 
+      batch_stamps.read_end_ns - batch_stamps.read_start_ns
+   );
+
+   for (i=0; i < batch_event_count; i++) {
+      
+      event_p = &batch_events[i];
+      wd = event_p->wd;
+      name_p = (event_p->name_offset > 0) ? 
+         (const char *) first_event_p + event_p->name_offset : NULL;
+      event_count++;
+      metric_count_event(event_p->mask);
+      trace(TRACE_EVENT, wd, event_p->mask, event_p->cookie);
+
+      if (
+         (pending_move_wd != NULL_WD) && 
+         (! ((event_p->mask & IN_MOVED_TO) && 
+            (event_p->cookie == pending_move_cookie)))
+      ) {
+         prune_pending_move();
+      }
+
+      // each wd is looked up once until the wd directory changes
+      batch_wd_p = find_batch_wd(wd);
+      parent_dir_p = batch_wd_p->path_p;
+
+      if (
+         (event_p->mask & IN_Q_OVERFLOW) && 
+         ((shard_count > 1) || (flush_callback != NULL))
+      ) {
+
+         // the other shards have lost nothing, and a library's caller
+         // would rather not lose its process
+         resync_shard(shard);
+         break;
+
+      } else if (event_p->mask & IN_Q_OVERFLOW) {
+         syslog(LOG_ERR, "Inotify queue overflow");
+         error_file = fopen(error_path, "w");
+         fprintf(error_file, "Inotify queue overflow\n");
+         fclose(error_file);
+
+         // we abort because this means we have lost some events,
+         // we need to force Monitor to make a ful pass
+         exit(16);
+
+      } else if (create_dir_mask == (event_p->mask & create_dir_mask)) {
+
+         // due to latency, we may not be able to watch this directory; 
+         // for example it may have moved by the time we get this event
+         if (
+            watch_new_directory(wd, parent_dir_p, name_p) != 0
+         ) {
+            continue;
+         } 
+
+      } else if (event_p->mask & IN_DELETE_SELF) {
+
+         // This should be picked up by its parent. 
+         // If they delete the whole top level directory,
+         // we will miss it.
+         if ((parent_dir_p != NULL) && (find_wd_parent(wd) != NULL_WD)) {
+            unmark_dirty(parent_dir_p);
+            batch_wd_p->marked = 0;
+         }
+         continue;
+
+      } else if (event_p->mask & IN_MOVE_SELF) {
+
+         // this event should already be reported after IN_MOVE_FROM
+         // and IN_MOVE_TO
+         continue;
+
+      } else if (event_p->mask & IN_MOVED_FROM) {
+         
+         // we assume that IN_MOVED_FROM always hits before IN_MOVED_TO
+         // this may not be valid so we check the cookie
+         if (event_p->cookie == shards[shard].prev_cookie) {
+            syslog(
+               LOG_ERR, 
+               "cookie %d from IN_MOVED_TO present", 
+               shards[shard].prev_cookie
+            );
+            error_file = fopen(error_path, "w");
+            fprintf(
+               error_file, 
+               "cookie %d from IN_MOVED_TO present\n", 
+               shards[shard].prev_cookie
+            );
+            fclose(error_file);
+            exit(17);
+         }
+         shards[shard].prev_cookie = event_p->cookie;
+
+         // We used to prune the whole tree below this directory here,
+         // because its paths are no longer right. If IN_MOVED_TO comes
+         // next, we can keep the tree and only change its path.
+         if (event_p->mask & IN_ISDIR) {
+            pending_move_wd = sub_dir_wd(parent_dir_p, name_p);
+            pending_move_cookie = event_p->cookie;
+         }
+
+      } else if (event_p->mask & IN_MOVED_TO) {
+         
+         // we assume that IN_MOVED_FROM always hits before IN_MOVED_TO
+         // this may not be valid so we check the cookie
+         // 2009-03-25 dougfort -- we accept the missing cookie, because
+         // we may be moving in from somewhere we're not watching
+         if (event_p->cookie != shards[shard].prev_cookie) {
+            trace(
+               TRACE_COOKIE_ABSENT, wd, event_p->mask, event_p->cookie
+            );
+         }
+         shards[shard].prev_cookie = event_p->cookie;
+
+         if (
+            (event_p->mask & IN_ISDIR) &&
+            (pending_move_wd != NULL_WD) &&
+            (0 == move_pending_directory(wd, parent_dir_p, name_p))
+         ) {
+            // move_pending_directory has forgotten the paths below it
+         } else if (event_p->mask & IN_ISDIR) {
+            // We treat this as an add, create a whole new watch structure.
+            // We clear out the old one first, if we were watching it
+            prune_pending_move();
+            watch_new_directory(wd, parent_dir_p, name_p);
+         }
+
+      } else if (event_p->mask & IN_IGNORED) {
+
+         // we get this event after kernel has removed a watch descriptor
+         // we need to make sure we do not keep carrying it around
+         trace(TRACE_WATCH_REMOVED, wd, event_p->mask, 0);
+         remove_wd_directory(wd);
+         forget_batch_paths();
+         modify_wds_removed = 1;
+
+         continue;
+      } else if (
+         ((IN_DELETE | IN_ISDIR) == (event_p->mask & (IN_DELETE | IN_ISDIR))) &&
+         (! is_deleted_wd(wd))
+      ) {
+
+         // the top of a deleted tree: we report the parent below
+         prune_deleted_directory(parent_dir_p, name_p);
+
+      } else if (event_p->mask & IN_CREATE) {
+         // We can ignore the creation of files, because we'll see when
+         // they are closed later. This prevents us from backing up a
+         // non-finished download and then later (when the file is closed)
+         // the rest of the file.
+         continue;
+      } else if (event_p->mask & IN_MODIFY) {
+         // only profiles with a modify interval ask for IN_MODIFY.
+         // Files which are appended to and never closed fire this 
+         // constantly, so we report each file at most once an interval
+         if (wd != interval_wd) {
+            modify_interval = watch_profile_modify_interval(
+               find_wd_profile(wd)
+            );
+            interval_wd = wd;
+         }
+         if (! allow_modify_event(wd, name_p, modify_interval)) {
+            METRIC_INCREMENT(METRIC_EVENTS_RATE_LIMITED);
+            trace(TRACE_DROP_RATE_LIMITED, wd, event_p->mask, 0);
+            continue;
+         }
+      }
+
+      // rm -rf empties a directory before deleting it. We report the
+      // directory above everything it deleted instead.
+      if (is_deleted_wd(wd)) {
+         METRIC_INCREMENT(METRIC_EVENTS_DELETED);
+         trace(TRACE_DROP_DELETED, wd, event_p->mask, 0);
+         continue;
+      }
+
+      // the rest only decides whether to report the directory
+      if (batch_wd_p->marked) {
+         METRIC_INCREMENT(METRIC_EVENTS_ALREADY_MARKED);
+         continue;
+      }
+
+      // editor swap files, partial downloads and the like come and go
+      // without being worth a report
+      if (
+         (name_p != NULL) && 
+         (! (event_p->mask & IN_ISDIR)) &&
+         (match_name_patterns(temp_patterns, name_p) != NULL)
+      ) {
+         METRIC_INCREMENT(METRIC_EVENTS_TEMP_FILE);
+         trace(TRACE_DROP_TEMP_FILE, wd, event_p->mask, 0);
+         continue;
+      }
+
+      if (NULL == parent_dir_p) {
+         syslog_limited(
+            LOG_CLASS_NO_PARENT,
+            LOG_ERR, 
+            "unable to find parent %05d event 0x%08X %s %d at %s",
+            wd, 
+            event_p->mask,
+            event_name(event_p->mask),
+            event_p->cookie,
+            (name_p != NULL) ? name_p : "*noname*" 
+         );
+         // Let's ignore this. This might have happend:
+         // Latency: 
+         // mkdir temp ; mv old_dir temp/new_dir 
+         // rmdir temp/new_dir ; rmdir temp
+         // -> now we start working:
+         //    * we observe the creation of "temp", but there is no "temp",
+         //      so we don't create a watcher
+         //    * Then we observe the move of "new_dir" but the parent in not
+         //      in our database
+         // This happens when firefox clears its caches.
+         METRIC_INCREMENT(METRIC_EVENTS_NO_PARENT);
+         trace(TRACE_DROP_NO_PARENT, wd, event_p->mask, 0);
+         continue;
+      }
+
+      // many programs open files for writing and close them without
+      // changing anything
+      if (
+         (event_p->mask & IN_CLOSE_WRITE) && 
+         fingerprint_cache_enabled() &&
+         file_unchanged(parent_dir_p, name_p)
+      ) {
+         METRIC_INCREMENT(METRIC_EVENTS_UNCHANGED);
+         trace(TRACE_DROP_UNCHANGED, wd, event_p->mask, 0);
+         continue;
+      }
+
+      trace(TRACE_MARKED, wd, event_p->mask, 0);
+      mark_dirty(parent_dir_p, batch_stamps.read_end_ns);
+      batch_wd_p->marked = 1;
+
+   } // for
+
+   // the batch ended between IN_MOVED_FROM and IN_MOVED_TO
+   prune_pending_move();
+   forget_removed_modify_events();
+   remove_retired_watches();
+
+   METRIC_INCREMENT(METRIC_EVENT_BATCHES);
+   metric_record(METRIC_EVENTS_PER_BATCH, event_count);
+   shards[shard].batches++;
+   shards[shard].events += event_count;
+   metric_record(METRIC_BATCH_LOOKUP_NS, batch_stamps.lookup_ns);
+   metric_record(
+      METRIC_BATCH_NS, metric_now_ns() - batch_stamps.read_end_ns
+   );
+
+} // process_inotify_events
+
+//-----------------------------------------------------------------------------
+// a token is what follows BARRIER_PREFIX in the barrier file name; it is
+// used in the acknowledgement's name, so keep it to safe characters
+static int valid_barrier_token(const char * token_p) {
+//-----------------------------------------------------------------------------
+   size_t len;
+   size_t i;
+
+   len = strlen(token_p);
+   if ((0 == len) || (len > BARRIER_TOKEN_MAX)) {
+      return 0;
+   }
+   if ((len >= 4) && (0 == strcmp(token_p + len - 4, ".ack"))) {
+      return 0;
+   }
+   for (i=0; i < len; i++) {
+      if (
+         ! isalnum((unsigned char) token_p[i]) &&
+         (token_p[i] != '-') && (token_p[i] != '_') && (token_p[i] != '.')
+      ) {
+         return 0;
+      }
+   }
+
+   return 1;
+
+} // valid_barrier_token
+
+//-----------------------------------------------------------------------------
+// process the events which were already queued when the barrier was seen
+// Anything the consumer did before creating the barrier file was queued
+// by then. We stop once that much has been read, so a busy tree can't
+// hold the barrier up for ever.
+static void drain_inotify_queue(void) {
+//-----------------------------------------------------------------------------
+   int queue_bytes;
+   int remaining;
+   int fd;
+   int shard;
+
+   for (shard=0; shard < shard_count; shard++) {
+      fd = shards[shard].inotify_fd;
+
+      // not source_queue_bytes: barriers are not replayed from the kernel
+      // calls, only their flush is
+      if (-1 == ioctl(fd, FIONREAD, &remaining)) {
+         continue;
+      }
+
+      while (remaining > 0) {
+         if ((-1 == ioctl(fd, FIONREAD, &queue_bytes)) || (0 == queue_bytes)) {
+            break;
+         }
+         batch_stamps.wake_ns = metric_now_ns();
+         process_inotify_events(shard);
+
+         // a read takes everything waiting, or at least DRAIN_READ_MIN
+         remaining -= 
+            (queue_bytes < DRAIN_READ_MIN) ? queue_bytes : DRAIN_READ_MIN;
+      }
+   }
+
+} // drain_inotify_queue
+
+//-----------------------------------------------------------------------------
+// the number of the last notification file, or with more than one stream
+// a line for each: the stream and its last number
+static int write_last_numbers(FILE * ack_file_p) {
+//-----------------------------------------------------------------------------
+   int stream;
+
+   if (1 == stream_count) {
+      return fprintf(ack_file_p, "%08d\n", notification_writer_last_number(0));
+   }
+
+   for (stream=0; stream < stream_count; stream++) {
+      if (
+         fprintf(
+            ack_file_p, 
+            "%02d %08d\n", 
+            stream, 
+            notification_writer_last_number(stream)
+         ) < 0
+      ) {
+         return -1;
+      }
+   }
+
+   return 0;
+
+} // write_last_numbers
+
+//-----------------------------------------------------------------------------
+// write the last notification numbers to <notify dir>/barrier.<token>.ack
+static void acknowledge_barrier(const char * token_p) {
+//-----------------------------------------------------------------------------
+   char ack_path_buffer[MAX_PATH_LEN];
+   FILE * ack_file_p;
+   int bytes_written;
+
+   bytes_written = snprintf(
+      ack_path_buffer, 
+      sizeof ack_path_buffer,
+      "%s/%s%s.ack",
+      notify_dir_path,
+      BARRIER_PREFIX,
+      token_p
+   );
+   if (sizeof ack_path_buffer <= bytes_written) {
+      syslog(LOG_ERR, "barrier path overflow %s", token_p);
+      error_file = fopen(error_path, "w");
+      fprintf(error_file, "barrier path overflow %s\n", token_p);
+      fclose(error_file);
+      exit(34);
+   }
+
+   ack_file_p = fopen(ack_temp_path_buffer, "w");
+   if (
+      (NULL == ack_file_p) ||
+      (write_last_numbers(ack_file_p) < 0) ||
+      (fclose(ack_file_p) != 0) ||
+      (-1 == rename(ack_temp_path_buffer, ack_path_buffer))
+   ) {
+      error = errno;
+      syslog(
+         LOG_ERR, 
+         "barrier ack %s %d %s", 
+         ack_path_buffer, 
+         error, 
+         strerror(error)
+      );
+      error_file = fopen(error_path, "w");
+      fprintf(
+         error_file, 
+         "barrier ack %s %d %s\n", 
+         ack_path_buffer, 
+         error, 
+         strerror(error)
+      );
+      fclose(error_file);
+      exit(34);
+   }
+
+} // acknowledge_barrier
+
+//-----------------------------------------------------------------------------
+// the consumer wrote <config dir>/barrier.<token>: once everything queued
+// before it is in a notification file, acknowledge it
+// One drain and flush does for all the barriers seen in a read.
+static void handle_barriers(
+   const char * config_path, 
+   char names[][NAME_MAX+1],
+   int count
+) {
+//-----------------------------------------------------------------------------
+   char barrier_path_buffer[MAX_PATH_LEN];
+   const char * slash_p;
+   int dir_len;
+   int i;
+
+   drain_inotify_queue();
+   source_barrier();
+   flush_hash_cache(NULL);
+   exit_if_writer_failed(notification_writer_wait());
+
+   slash_p = strrchr(config_path, '/');
+   dir_len = (NULL == slash_p) ? 0 : (int) (slash_p - config_path);
+   for (i=0; i < count; i++) {
+      acknowledge_barrier(names[i] + strlen(BARRIER_PREFIX));
+      METRIC_INCREMENT(METRIC_BARRIERS);
+      trace(TRACE_BARRIER, NULL_WD, 0, notification_writer_last_number(0));
+
+      // the barrier file has done its job
+      if (
+         snprintf(
+            barrier_path_buffer,
+            sizeof barrier_path_buffer,
+            "%.*s%s%s",
+            dir_len,
+            config_path,
+            (NULL == slash_p) ? "" : "/",
+            names[i]
+         ) < sizeof barrier_path_buffer
+      ) {
+         unlink(barrier_path_buffer);
+      }
+   }
+
+} // handle_barriers
+
+//-----------------------------------------------------------------------------
+static int is_config_file_name(const char * config_path, const char * name) {
+//-----------------------------------------------------------------------------
+   const char * slash_p;
+
+   slash_p = strrchr(config_path, '/');
+   return 0 == strcmp(NULL == slash_p ? config_path : slash_p + 1, name);
+
+} // is_config_file_name
+
+//-----------------------------------------------------------------------------
+// a rewritten config or exclude file is left for dir_watcher_tick to reload
+// barrier files are handled once they have all been read
+static void process_control_events(
+   const char * config_path, 
+   const char * exclude_path
+) {
+//-----------------------------------------------------------------------------
+   const struct inotify_event * event_p;
+   static char barrier_names[MAX_BARRIERS][NAME_MAX+1];
+   int barrier_count = 0;
+
+   for (
+      event_p=start_iter_inotify(control_fd); 
+      event_p != NULL; 
+      event_p=next_iter_inotify(control_fd)
+   ) {
+      if (0 == event_p->len) {
+         continue;
+      }
+      if (
+         is_config_file_name(config_path, event_p->name) ||
+         is_config_file_name(exclude_path, event_p->name)
+      ) {
+         reload_pending = 1;
+         config_rewritten = 1;
+      } else if (
+         0 == strncmp(event_p->name, BARRIER_PREFIX, strlen(BARRIER_PREFIX))
+      ) {
+         if (! valid_barrier_token(event_p->name + strlen(BARRIER_PREFIX))) {
+            syslog(LOG_NOTICE, "ignoring barrier file %s", event_p->name);
+         } else if (barrier_count == MAX_BARRIERS) {
+            syslog(LOG_WARNING, "too many barriers, ignoring %s", event_p->name);
+         } else {
+            strncpy(barrier_names[barrier_count], event_p->name, NAME_MAX);
+            barrier_names[barrier_count][NAME_MAX] = '\0';
+            barrier_count++;
+         }
+      }
+   } // for
+
+   // not in the loop: draining the queue reuses the event iterator
+   if (barrier_count > 0) {
+      handle_barriers(config_path, barrier_names, barrier_count);
+   }
+
+} // process_control_events
+
+
+
+//-----------------------------------------------------------------------------
+void dir_watcher_initialize(const char * notify_dir_p) {
+//-----------------------------------------------------------------------------
+   static int trace_dump_registered = 0;
+   const char * env_p;
+   char * end_p;
+   long fingerprint_entries;
+
+   notify_dir_path = notify_dir_p;
+
+   initialize_error_path(notify_dir_p);
+   initialize_stats_path(notify_dir_p);
+   if (! trace_dump_registered) {
+      on_exit(dump_trace_on_error, NULL);
+      trace_dump_registered = 1;
+   }
+
+   hc = new_hash_cache(HASH_TABLE_SIZE,HASH_TABLE_MEMORY_SIZE);
+   if(hc == NULL) {
+      syslog(LOG_ERR, "hash_cache init error");
+      error_file = fopen(error_path, "w");
+      fprintf(error_file, "hash_cache init error");
+      fclose(error_file);
+      exit(26);
+   }
+
+   batch_path_region = new_region(BATCH_PATH_CHUNK);
+   if (NULL == batch_path_region) {
+      syslog(LOG_ERR, "batch path region init error");
+      error_file = fopen(error_path, "w");
+      fprintf(error_file, "batch path region init error\n");
+      fclose(error_file);
+      exit(38);
+   }
+
+   env_p = getenv(fingerprint_cache_size);
+   if (env_p != NULL) {
+      fingerprint_entries = strtol(env_p, &end_p, 10);
+      if (
+         (end_p == env_p) || 
+         (*end_p != '\0') ||
+         (fingerprint_entries < 0) || 
+         (fingerprint_entries > MAX_FINGERPRINT_ENTRIES)
+      ) {
+         syslog(
+            LOG_WARNING, 
+            "%s must be from 0 to %d, using 0", 
+            fingerprint_cache_size,
+            MAX_FINGERPRINT_ENTRIES
+         );
+         fingerprint_entries = 0;
+      }
+      if (fingerprint_cache_initialize(fingerprint_entries) != 0) {
+         error_file = fopen(error_path, "w");
+         fprintf(error_file, "fingerprint cache init error\n");
+         fclose(error_file);
+         exit(29);
+      }
+   }
+
+   env_p = getenv(stats_interval_seconds);
+   if (env_p != NULL) {
+      stats_interval = atoi(env_p);
+   }
+
+   env_p = getenv(shard_count_setting);
+   if (env_p != NULL) {
+      shard_count = atoi(env_p);
+      if ((shard_count < 1) || (shard_count > MAX_SHARDS)) {
+         syslog(
+            LOG_WARNING, 
+            "%s must be from 1 to %d, using 1", 
+            shard_count_setting,
+            MAX_SHARDS
+         );
+         shard_count = 1;
+      }
+   }
+
+   env_p = getenv(stream_count_setting);
+   if (env_p != NULL) {
+      stream_count = atoi(env_p);
+      if ((stream_count < 1) || (stream_count > NOTIFICATION_MAX_STREAMS)) {
+         syslog(
+            LOG_WARNING, 
+            "%s must be from 1 to %d, using 1", 
+            stream_count_setting,
+            NOTIFICATION_MAX_STREAMS
+         );
+         stream_count = 1;
+      }
+   }
+
+   env_p = getenv(capture_file);
+   if ((env_p != NULL) && (source_capture_open(env_p) != 0)) {
+      error_file = fopen(error_path, "w");
+      fprintf(error_file, "unable to capture events to %s\n", env_p);
+      fclose(error_file);
+      exit(33);
+   }
+
+   wd_directory_initialize();
+
+   initialize_temp_path(notify_dir_p);
+   metrics_initialize();
+
+} // dir_watcher_initialize
+
+//-----------------------------------------------------------------------------
+// with a callback there are no notification files, so no writer, and no
+// stream directories
+static void start_notification_writer(void) {
+//-----------------------------------------------------------------------------
+   const char * env_p;
+   int lag_seconds = DEFAULT_LAG_SECONDS;
+
+   if (flush_callback != NULL) {
+      return;
+   }
+
+   env_p = getenv(consumer_lag_seconds);
+   if (env_p != NULL) {
+      lag_seconds = atoi(env_p);
+   }
+   if (
+      notification_writer_start(
+         notify_dir_path, 
+         temp_path_buffer, 
+         HASH_TABLE_SIZE, 
+         HASH_TABLE_MEMORY_SIZE,
+         lag_seconds,
+         stream_count
+      ) != 0
+   ) {
+      syslog(LOG_ERR, "notification writer init error");
+      error_file = fopen(error_path, "w");
+      fprintf(error_file, "notification writer init error\n");
+      fclose(error_file);
+      exit(40);
+   }
+
+} // start_notification_writer
+
+//-----------------------------------------------------------------------------
+int dir_watcher_start(const char * config_path, const char * exclude_path) {
+//-----------------------------------------------------------------------------
+   int i;
+   int j;
+
+   config_file_path = config_path;
+   exclude_file_path = exclude_path;
+
+   if (config_path != NULL) {
+      source_config(SOURCE_START, config_path, exclude_path);
+   }
+
+   // a recording is of one inotify instance
+   if ((shard_count > 1) && (source_replaying() || getenv(capture_file))) {
+      syslog(LOG_NOTICE, "capture and replay use one shard");
+      shard_count = 1;
+   }
+
+   for (i=0; i < shard_count; i++) {
+      memset(&shards[i], 0, sizeof(struct SHARD));
+      shards[i].inotify_fd = 
+         (1 == shard_count) ? source_inotify_init() : inotify_init();
+      if (-1 == shards[i].inotify_fd) {
+         error = errno;
+         syslog(LOG_ERR, "inotify_init %d %s", error, strerror(error));
+         for (j=0; j < shard_count; j++) {
+            if (j < i) {
+               close(shards[j].inotify_fd);
+            }
+            shards[j].inotify_fd = -1;
+         }
+         errno = error;
+         return -1;
+      }
+   }
+
+   start_notification_writer();
+   load_temp_patterns(getenv(temp_patterns_file));
+   initialize_own_output(notify_dir_path);
+   if (config_path != NULL) {
+      if (load_exclude_rules(exclude_path, &exclude_rules) != 0) {
+         error = errno;
+         error_file = fopen(error_path, "w");
+         fprintf(
+            error_file, "fopen %s %d %s\n", exclude_path, error, strerror(error)
+         );
+         fclose(error_file);
+         exit(5);
+      }
+      if (load_top_level_paths(config_path, &top_level_paths) != 0) {
+         error = errno;
+         error_file = fopen(error_path, "w");
+         fprintf(
+            error_file, "fopen %s %d %s\n", config_path, error, strerror(error)
+         );
+         fclose(error_file);
+         exit(9);
+      }
+   }
+   excludes = new_excludes(&exclude_rules);
+   exclude_own_output(excludes, notify_dir_path);
+   for (i=0; i < top_level_paths.count; i++) {
+      watch_top_level_path(top_level_paths.paths[i]);
+   }
+
+   // a replay is told about reloads by the recording
+   if ((config_path != NULL) && (! source_replaying())) {
+      watch_config_files(config_path, exclude_path);
+   }
+
+   // the first stats file also says the initial crawl is done
+   write_stats();
+
+   return 0;
+
+} // dir_watcher_start
+
+//-----------------------------------------------------------------------------
+int dir_watcher_shard_count(void) {
+//-----------------------------------------------------------------------------
+   return shard_count;
+} // dir_watcher_shard_count
+
+//-----------------------------------------------------------------------------
+int dir_watcher_inotify_fd(int shard) {
+//-----------------------------------------------------------------------------
+   return shards[shard].inotify_fd;
+} // dir_watcher_inotify_fd
+
+//-----------------------------------------------------------------------------
+uint64_t dir_watcher_shard_resyncs(int shard) {
+//-----------------------------------------------------------------------------
+   return shards[shard].overflows;
+} // dir_watcher_shard_resyncs
+
+//-----------------------------------------------------------------------------
+int dir_watcher_control_fd(void) {
+//-----------------------------------------------------------------------------
+   return control_fd;
+} // dir_watcher_control_fd
+
+//-----------------------------------------------------------------------------
+void dir_watcher_process_events(int shard, uint64_t wake_ns) {
+//-----------------------------------------------------------------------------
+   batch_stamps.wake_ns = wake_ns;
+   process_inotify_events(shard);
+} // dir_watcher_process_events
+
+//-----------------------------------------------------------------------------
+void dir_watcher_process_control_events(void) {
+//-----------------------------------------------------------------------------
+   process_control_events(config_file_path, exclude_file_path);
+} // dir_watcher_process_control_events
+
+//-----------------------------------------------------------------------------
+void dir_watcher_tick(void) {
+//-----------------------------------------------------------------------------
+   source_tick();
+   if (config_rewritten) {
+      config_rewritten = 0;
+   } else if (reload_pending) {
+      dir_watcher_reload();
+   }
+   remove_retired_watches();
+   forget_removed_modify_events();
+   expire_modify_events(report_modified_wd);
+   report_suppressed_logs();
+   flush_hash_cache(NULL);
+   exit_if_writer_failed(notification_writer_status());
+   if ((stats_interval > 0) && (metric_now_ns() >= next_stats_ns)) {
+      write_stats();
+   }
+} // dir_watcher_tick
+
+//-----------------------------------------------------------------------------
+void dir_watcher_flush(void) {
+//-----------------------------------------------------------------------------
+   flush_hash_cache(NULL);
+   exit_if_writer_failed(notification_writer_wait());
+} // dir_watcher_flush
+
+//-----------------------------------------------------------------------------
+void dir_watcher_reload(void) {
+//-----------------------------------------------------------------------------
+   reload_pending = 0;
+   config_rewritten = 0;
+   if (NULL == config_file_path) {
+      return;
+   }
+   source_config(SOURCE_RELOAD, config_file_path, exclude_file_path);
+   reload_config(config_file_path, exclude_file_path);
+   remove_retired_watches();
+} // dir_watcher_reload
+
+//-----------------------------------------------------------------------------
+int dir_watcher_configure(
+   const char * const * roots, 
+   int root_count,
+   const char * const * rules,
+   int rule_count
+) {
+//-----------------------------------------------------------------------------
+   struct PATH_LIST new_paths;
+   struct PATH_LIST new_rules;
+   int result;
+   int i;
+
+   memset(&new_paths, 0, sizeof new_paths);
+   memset(&new_rules, 0, sizeof new_rules);
+   for (i=0; i < root_count; i++) {
+      append_path(&new_paths, roots[i]);
+   }
+   for (i=0; i < rule_count; i++) {
+      append_path(&new_rules, rules[i]);
+   }
+   configuring = 1;
+   add_watch_error = 0;
+   result = apply_config(&new_paths, &new_rules);
+   error = errno;
+   configuring = 0;
+   add_watch_error = 0;
+   remove_retired_watches();
+
+   errno = error;
+   return result;
+
+} // dir_watcher_configure
+
+//-----------------------------------------------------------------------------
+void dir_watcher_set_callback(
+   DIR_WATCHER_CALLBACK callback, 
+   void * context_p
+) {
+//-----------------------------------------------------------------------------
+   flush_callback = callback;
+   flush_callback_context_p = context_p;
+} // dir_watcher_set_callback
+
+//-----------------------------------------------------------------------------
+void dir_watcher_write_stats(void) {
+//-----------------------------------------------------------------------------
+   write_stats();
+} // dir_watcher_write_stats
+
+//-----------------------------------------------------------------------------
+void dir_watcher_dump_trace(void) {
+//-----------------------------------------------------------------------------
+   dump_trace_ring(trace_path_buffer, trace_temp_path_buffer);
+} // dir_watcher_dump_trace
+
+//-----------------------------------------------------------------------------
+void dir_watcher_close(void) {
+//-----------------------------------------------------------------------------
+   int i;
+
+   // with one shard, the event source owns its inotify instance
+   for (i=0; i < shard_count; i++) {
+      if ((shard_count > 1) && (shards[i].inotify_fd != -1)) {
+         close(shards[i].inotify_fd);
+      }
+      shards[i].inotify_fd = -1;
+   }
+   exit_if_writer_failed(notification_writer_stop());
+   free_hash_cache(hc);
+   hc = NULL;
+   source_close();
+   if (control_fd != -1) {
+      close(control_fd);
+      control_fd = -1;
+   }
+   fingerprint_cache_close();
+   release_exclude_matcher(excludes);
+   excludes = NULL;
+   release_path_list(&exclude_rules);
+   release_path_list(&top_level_paths);
+   release_name_patterns(temp_patterns);
+   wd_directory_close();
+   release_wd_array(&retired_wds);
+   retired_next = 0;
+   release_wd_array(&deleted_wds);
+   release_region(batch_path_region);
+   batch_path_region = NULL;
+   batch_paths_p = NULL;
+   batch_paths_stale = 0;
+   forget_batch_paths();
+   free(flush_paths);
+   flush_paths = NULL;
+   flush_path_slots = 0;
+   flush_callback = NULL;
+   flush_callback_context_p = NULL;
+} // dir_watcher_close
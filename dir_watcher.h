@@ -0,0 +1,103 @@
+//-----------------------------------------------------------------------------
+// dir_watcher.h
+//
+// turn inotify events into notification files
+//
+// This is everything the watcher does apart from waiting for something to
+// do, which is up to the caller: libdirwatcher.c polls the inotify
+// descriptors for main.c and whoever else links it, and the replay driver
+// reads a recording.
+//-----------------------------------------------------------------------------
+#if !defined(__DIR_WATCHER_H)
+#define __DIR_WATCHER_H
+
+#include <stdint.h>
+
+#define DIR_WATCHER_MAX_SHARDS 16
+
+// given the directories which have changed since the last call, paths_p
+// and the paths in it are only valid during the call
+typedef void (*DIR_WATCHER_CALLBACK)(
+   const char * const * paths_p, 
+   int count, 
+   void * context_p
+);
+
+// set up everything which does not depend on the config: the error and
+// stats files in the notification directory, the hash cache, the settings
+// from the environment and the wd database
+void dir_watcher_initialize(const char * notify_dir_p);
+
+// read the config and exclude files and watch the top level directories,
+// and start the notification writer unless there is a callback
+// the paths must stay valid until dir_watcher_close. With NULL for both,
+// there are no files: the paths and rules come from dir_watcher_configure
+// returns 0 on success, -1 with errno set if there is no inotify instance
+// to be had. dir_watcher_close releases what was set up.
+int dir_watcher_start(const char * config_path, const char * exclude_path);
+
+// make these the top level paths (config file lines) and exclude rules,
+// as if the config and exclude files had been rewritten with them
+// returns 0 on success, -1 with errno set if a root which is new to the
+// config can't be watched (ENOENT, EACCES), or inotify_add_watch fails in
+// a way which would end the process anywhere else, as with ENOSPC when the
+// user's watch limit is reached. What could be watched is watched.
+int dir_watcher_configure(
+   const char * const * roots, 
+   int root_count,
+   const char * const * rules,
+   int rule_count
+);
+
+// hand the directories which have changed to callback at each flush,
+// instead of writing notification files (NULL to write them again)
+// call before dir_watcher_start
+void dir_watcher_set_callback(
+   DIR_WATCHER_CALLBACK callback, 
+   void * context_p
+);
+
+// the number of inotify instances the watched directories are spread
+// across, at most DIR_WATCHER_MAX_SHARDS
+int dir_watcher_shard_count(void);
+
+// the inotify instance for a shard of the watched directories
+int dir_watcher_inotify_fd(int shard);
+
+// how many times the shard has been resynced after its queue overflowed.
+// Each time, the shard's descriptor has been given a new inotify instance,
+// which an epoll set watching the old one must be given again.
+uint64_t dir_watcher_shard_resyncs(int shard);
+
+// the inotify instance for the config and exclude files, -1 if there is none
+int dir_watcher_control_fd(void);
+
+// read and handle a batch of events from a shard's inotify instance
+// wake_ns (metric_now_ns) is when we learned the events were waiting
+void dir_watcher_process_events(int shard, uint64_t wake_ns);
+
+// read the events for the config and exclude files, and barrier files
+// rewritten config files are reloaded by dir_watcher_tick
+void dir_watcher_process_control_events(void);
+
+// call about every 3 seconds: reload the config and exclude files once
+// they have been rewritten and left alone for a tick, write a notification
+// for the directories which have changed, and the stats file when it is due
+void dir_watcher_tick(void);
+
+// write a notification for the directories which have changed, now
+void dir_watcher_flush(void);
+
+// re-read the config and exclude files
+void dir_watcher_reload(void);
+
+// write the stats file now
+void dir_watcher_write_stats(void);
+
+// write the trace ring to a file now
+void dir_watcher_dump_trace(void);
+
+// release everything at shutdown
+void dir_watcher_close(void);
+
+#endif // !defined(__DIR_WATCHER_H)
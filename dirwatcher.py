@@ -0,0 +1,253 @@
+"""
+dirwatcher.py
+
+Run the watcher in this process, through libdirwatcher.so, and be called
+with the directories which have changed instead of reading notification
+files.
+
+    def changed(paths):
+        ...
+
+    watcher = DirWatcher(state_dir, changed)
+    watcher.add_root("/home/me")
+    watcher.set_excludes(["/home/me/tmp", ])
+    while running:
+        select.select([watcher, ], [], [], DirWatcher.flush_seconds)
+        watcher.dispatch()
+    watcher.close()
+
+changed is called from dispatch with a list of directory paths. The state
+directory holds error.txt, stats.txt and trace.txt as the notification
+directory does for the executable. There is one watcher in a process.
+Errors the caller can do something about raise DirWatcherError, with the
+errno; the rest end the process, as they would end the executable (see
+libdirwatcher.h). An exception from changed is raised from the dispatch
+or flush it was called from, and the paths it was given are given to it
+again at the next dispatch or flush, with the ones which have changed
+since.
+
+The library is found in the directory holding this file, or where the
+SPIDEROAK_DIRWATCHER_LIBRARY environment variable says.
+
+or from the shell, printing the directories as they change:
+
+    python dirwatcher.py <state dir> <directory> [<directory> ...]
+"""
+from __future__ import print_function
+
+import ctypes
+import os
+import os.path
+import select
+import sys
+
+_library_setting = "SPIDEROAK_DIRWATCHER_LIBRARY"
+_library_name = "libdirwatcher.so"
+
+_callback_type = ctypes.CFUNCTYPE(
+    None, ctypes.POINTER(ctypes.c_char_p), ctypes.c_int, ctypes.c_void_p
+)
+
+_library = None
+
+def _load_library():
+    global _library
+    if _library is not None:
+        return _library
+
+    library_path = os.environ.get(
+        _library_setting,
+        os.path.join(os.path.dirname(os.path.abspath(__file__)), _library_name)
+    )
+    library = ctypes.CDLL(library_path, use_errno=True)
+
+    library.dirwatcher_create.argtypes = [
+        ctypes.c_char_p, _callback_type, ctypes.c_void_p,
+    ]
+    library.dirwatcher_create.restype = ctypes.c_int
+    library.dirwatcher_add_root.argtypes = [ctypes.c_char_p, ]
+    library.dirwatcher_add_root.restype = ctypes.c_int
+    library.dirwatcher_remove_root.argtypes = [ctypes.c_char_p, ]
+    library.dirwatcher_remove_root.restype = ctypes.c_int
+    library.dirwatcher_set_excludes.argtypes = [
+        ctypes.POINTER(ctypes.c_char_p), ctypes.c_int,
+    ]
+    library.dirwatcher_set_excludes.restype = ctypes.c_int
+    library.dirwatcher_poll_fd.argtypes = []
+    library.dirwatcher_poll_fd.restype = ctypes.c_int
+    library.dirwatcher_dispatch.argtypes = []
+    library.dirwatcher_dispatch.restype = ctypes.c_int
+    library.dirwatcher_flush.argtypes = []
+    library.dirwatcher_flush.restype = ctypes.c_int
+    library.dirwatcher_destroy.argtypes = []
+    library.dirwatcher_destroy.restype = None
+
+    _library = library
+    return _library
+
+# a name which isn't in the filesystem encoding comes back with surrogate
+# escapes, and goes to the library again as the bytes it was
+try:
+    _encode = os.fsencode
+    _decode = os.fsdecode
+except AttributeError:
+    # Python 2: paths are byte strings, as the library's are
+    def _encode(path):
+        if isinstance(path, bytes):
+            return path
+        return path.encode(sys.getfilesystemencoding())
+
+    def _decode(path):
+        return path
+
+class DirWatcherError(OSError):
+    pass
+
+def _check(result, what):
+    if result != 0:
+        error = ctypes.get_errno()
+        raise DirWatcherError(error, "%s: %s" % (what, os.strerror(error)))
+
+class DirWatcher(object):
+    """
+    the watcher, calling changed with a list of the directories which have
+    changed, from dispatch and flush
+    """
+    # call dispatch at least this often
+    flush_seconds = 3
+
+    def __init__(self, state_dir, changed):
+        self._library = _load_library()
+        self._changed = changed
+        self._error = None
+        # the library forgets what it calls back with, so what changed
+        # raised on is kept here
+        self._undelivered = []
+        # the library keeps these, so we must too
+        self._state_dir = _encode(state_dir)
+        self._callback = _callback_type(self._call_changed)
+
+        _check(
+            self._library.dirwatcher_create(
+                self._state_dir, self._callback, None
+            ),
+            "create"
+        )
+        self._open = True
+
+    def _call_changed(self, paths_p, count, _context_p):
+        self._deliver([_decode(paths_p[i]) for i in range(count)])
+
+    def _deliver(self, paths):
+        # an exception can't go back through the library: hold it for
+        # dispatch to raise
+        if self._undelivered:
+            undelivered = set(self._undelivered)
+            paths = self._undelivered + [
+                path for path in paths if path not in undelivered
+            ]
+        self._undelivered = []
+        try:
+            self._changed(paths)
+        except Exception:
+            self._undelivered = paths
+            if self._error is None:
+                self._error = sys.exc_info()[1]
+
+    def _deliver_undelivered(self):
+        # when nothing has changed since, the library doesn't call back
+        if self._undelivered and self._error is None:
+            self._deliver([])
+
+    def _raise_held_error(self):
+        if self._error is not None:
+            error, self._error = self._error, None
+            raise error
+
+    def add_root(self, root):
+        """
+        watch a top level directory, given as a config file line
+        """
+        _check(self._library.dirwatcher_add_root(_encode(root)), root)
+        self._raise_held_error()
+
+    def remove_root(self, root):
+        """
+        stop watching a top level directory, given as it was added
+        """
+        _check(self._library.dirwatcher_remove_root(_encode(root)), root)
+        self._raise_held_error()
+
+    def set_excludes(self, rules):
+        """
+        replace the exclude rules, given as exclude file lines
+        """
+        encoded_rules = [_encode(rule) for rule in rules]
+        rule_array = (ctypes.c_char_p * len(encoded_rules))(*encoded_rules)
+        _check(
+            self._library.dirwatcher_set_excludes(
+                rule_array, len(encoded_rules)
+            ),
+            "set_excludes"
+        )
+        self._raise_held_error()
+
+    def fileno(self):
+        """
+        readable when there are events for dispatch
+        """
+        return self._library.dirwatcher_poll_fd()
+
+    def dispatch(self):
+        """
+        handle the events waiting, calling changed every flush_seconds
+        """
+        result = self._library.dirwatcher_dispatch()
+        self._deliver_undelivered()
+        self._raise_held_error()
+        _check(result, "dispatch")
+
+    def flush(self):
+        """
+        handle the events waiting, and call changed now
+        """
+        result = self._library.dirwatcher_flush()
+        self._deliver_undelivered()
+        self._raise_held_error()
+        _check(result, "flush")
+
+    def close(self):
+        if self._open:
+            self._open = False
+            self._library.dirwatcher_destroy()
+
+def main():
+    args = sys.argv[1:]
+    if len(args) < 2:
+        print(
+            "Usage: ... <state dir> <directory> [<directory> ...]",
+            file=sys.stderr
+        )
+        return -1
+
+    def changed(paths):
+        for path in paths:
+            print(path)
+        sys.stdout.flush()
+
+    watcher = DirWatcher(args[0], changed)
+    try:
+        for root in args[1:]:
+            watcher.add_root(os.path.abspath(root))
+        while True:
+            select.select([watcher, ], [], [], DirWatcher.flush_seconds)
+            watcher.dispatch()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        watcher.close()
+
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
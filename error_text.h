@@ -1,7 +1,7 @@
 //-----------------------------------------------------------------------------
 // error_text.h
 //
-// a file for reporting errors, the sources are in main.c
+// a file for reporting errors, the sources are in dir_watcher.c
 //
 //-----------------------------------------------------------------------------
 #if !defined(__ERROR_TEXT_H__)
@@ -0,0 +1,593 @@
+//-----------------------------------------------------------------------------
+// event_source.c
+//
+// the kernel calls the watcher makes for its main inotify instance,
+// which can be recorded to a file, and replayed from one
+//-----------------------------------------------------------------------------
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "error_text.h"
+#include "event_source.h"
+
+static const char file_magic[8] = "SODWREC1";
+
+// every record starts with this, followed by length bytes of data
+struct SOURCE_RECORD {
+   uint32_t type;
+   uint32_t length;
+   uint64_t time_ns;    // since the recording started
+   int32_t  result;     // the return value of the call
+   int32_t  error;      // errno, when the call failed
+};
+
+static int error; // holder for errno
+static int source_fd = -1; // the inotify instance we record or replay
+static uint64_t start_ns = 0;
+
+static FILE * capture_file_p = NULL;
+
+static FILE * replay_file_p = NULL;
+static struct SOURCE_RECORD replay_record;
+static char * replay_data_p = NULL;
+static uint32_t replay_data_slots = 0;
+static int replay_record_loaded = 0;
+
+static const char * type_names[SOURCE_RECORD_TYPE_COUNT] = {
+   "end",
+   "start",
+   "reload",
+   "init",
+   "add_watch",
+   "rm_watch",
+   "list_sub_dirs",
+   "queue_bytes",
+   "read",
+   "tick",
+   "barrier"
+};
+
+//-----------------------------------------------------------------------------
+static uint64_t now_ns(void) {
+//-----------------------------------------------------------------------------
+   struct timespec now;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+
+} // now_ns
+
+//-----------------------------------------------------------------------------
+static void write_record(
+   enum SOURCE_RECORD_TYPE type,
+   int result,
+   int result_error,
+   const void * data_p,
+   uint32_t length
+) {
+//-----------------------------------------------------------------------------
+   struct SOURCE_RECORD record;
+
+   if (NULL == capture_file_p) {
+      return;
+   }
+
+   memset(&record, 0, sizeof record);
+   record.type = type;
+   record.length = length;
+   record.time_ns = now_ns() - start_ns;
+   record.result = result;
+   record.error = result_error;
+
+   if (
+      (fwrite(&record, sizeof record, 1, capture_file_p) != 1) ||
+      ((length > 0) && (fwrite(data_p, length, 1, capture_file_p) != 1))
+   ) {
+      error = errno;
+      syslog(
+         LOG_WARNING, "capture write failed, stopping capture %d %s",
+         error,
+         strerror(error)
+      );
+      fclose(capture_file_p);
+      capture_file_p = NULL;
+   }
+
+} // write_record
+
+//-----------------------------------------------------------------------------
+int source_capture_open(const char * path_p) {
+//-----------------------------------------------------------------------------
+   capture_file_p = fopen(path_p, "w");
+   if (NULL == capture_file_p) {
+      error = errno;
+      syslog(LOG_ERR, "fopen %s %d %s", path_p, error, strerror(error));
+      return -1;
+   }
+   if (fwrite(file_magic, sizeof file_magic, 1, capture_file_p) != 1) {
+      error = errno;
+      syslog(LOG_ERR, "fwrite %s %d %s", path_p, error, strerror(error));
+      fclose(capture_file_p);
+      capture_file_p = NULL;
+      return -1;
+   }
+
+   start_ns = now_ns();
+   syslog(LOG_NOTICE, "capturing events to %s", path_p);
+
+   return 0;
+
+} // source_capture_open
+
+//-----------------------------------------------------------------------------
+int source_replay_open(const char * path_p) {
+//-----------------------------------------------------------------------------
+   char magic[sizeof file_magic];
+
+   replay_file_p = fopen(path_p, "r");
+   if (NULL == replay_file_p) {
+      error = errno;
+      syslog(LOG_ERR, "fopen %s %d %s", path_p, error, strerror(error));
+      return -1;
+   }
+
+   if (
+      (fread(magic, sizeof magic, 1, replay_file_p) != 1) ||
+      (memcmp(magic, file_magic, sizeof magic) != 0)
+   ) {
+      syslog(LOG_ERR, "%s is not an event recording", path_p);
+      fclose(replay_file_p);
+      replay_file_p = NULL;
+      return -1;
+   }
+
+   replay_record_loaded = 0;
+   return 0;
+
+} // source_replay_open
+
+//-----------------------------------------------------------------------------
+int source_replaying(void) {
+//-----------------------------------------------------------------------------
+   return replay_file_p != NULL;
+} // source_replaying
+
+//-----------------------------------------------------------------------------
+void source_close(void) {
+//-----------------------------------------------------------------------------
+   if (capture_file_p != NULL) {
+      write_record(SOURCE_END, 0, 0, NULL, 0);
+      if (capture_file_p != NULL) {
+         fclose(capture_file_p);
+         capture_file_p = NULL;
+      }
+   }
+
+   if (replay_file_p != NULL) {
+      fclose(replay_file_p);
+      replay_file_p = NULL;
+   }
+   free(replay_data_p);
+   replay_data_p = NULL;
+   replay_data_slots = 0;
+
+   if (source_fd != -1) {
+      close(source_fd);
+      source_fd = -1;
+   }
+
+} // source_close
+
+//-----------------------------------------------------------------------------
+// read the next record into replay_record and replay_data_p, if we have
+// not already. A short or unreadable file ends the replay.
+static void load_replay_record(void) {
+//-----------------------------------------------------------------------------
+   char * new_data_p;
+
+   if (replay_record_loaded) {
+      return;
+   }
+   replay_record_loaded = 1;
+
+   if (fread(&replay_record, sizeof replay_record, 1, replay_file_p) != 1) {
+      memset(&replay_record, 0, sizeof replay_record);
+      return;
+   }
+
+   if (replay_record.length + 1 > replay_data_slots) {
+      new_data_p = realloc(replay_data_p, replay_record.length + 1);
+      if (NULL == new_data_p) {
+         syslog(LOG_ERR, "realloc failed");
+         error_file = fopen(error_path, "w");
+         fprintf(error_file, "realloc failed\n");
+         fclose(error_file);
+         exit(27);
+      }
+      replay_data_p = new_data_p;
+      replay_data_slots = replay_record.length + 1;
+   }
+
+   if (
+      (replay_record.length > 0) &&
+      (fread(replay_data_p, replay_record.length, 1, replay_file_p) != 1)
+   ) {
+      memset(&replay_record, 0, sizeof replay_record);
+      return;
+   }
+   // so a path in the data is always terminated
+   replay_data_p[replay_record.length] = '\0';
+
+} // load_replay_record
+
+//-----------------------------------------------------------------------------
+enum SOURCE_RECORD_TYPE source_replay_peek(void) {
+//-----------------------------------------------------------------------------
+   load_replay_record();
+   if (replay_record.type >= SOURCE_RECORD_TYPE_COUNT) {
+      return SOURCE_END;
+   }
+   return replay_record.type;
+} // source_replay_peek
+
+//-----------------------------------------------------------------------------
+uint64_t source_replay_time(void) {
+//-----------------------------------------------------------------------------
+   load_replay_record();
+   return replay_record.time_ns;
+} // source_replay_time
+
+//-----------------------------------------------------------------------------
+uint64_t source_replay_take(const char ** data_pp, uint32_t * len_p) {
+//-----------------------------------------------------------------------------
+   load_replay_record();
+   replay_record_loaded = 0;
+
+   if (data_pp != NULL) {
+      *data_pp = replay_data_p;
+      *len_p = replay_record.length;
+   }
+
+   return replay_record.time_ns;
+
+} // source_replay_take
+
+//-----------------------------------------------------------------------------
+// take the next record, which must be of this type, and for this path if
+// path_p is not NULL
+static const struct SOURCE_RECORD * expect_record(
+   enum SOURCE_RECORD_TYPE type,
+   const char * path_p
+) {
+//-----------------------------------------------------------------------------
+   enum SOURCE_RECORD_TYPE next_type;
+
+   next_type = source_replay_peek();
+   if (
+      (next_type != type) ||
+      ((path_p != NULL) && (strcmp(path_p, replay_data_p) != 0))
+   ) {
+      syslog(
+         LOG_ERR,
+         "replay diverged: expected %s %s, recording has %s",
+         type_names[type],
+         NULL == path_p ? "" : path_p,
+         type_names[next_type]
+      );
+      error_file = fopen(error_path, "w");
+      fprintf(
+         error_file,
+         "replay diverged: expected %s %s, recording has %s\n",
+         type_names[type],
+         NULL == path_p ? "" : path_p,
+         type_names[next_type]
+      );
+      fclose(error_file);
+      exit(32);
+   }
+
+   source_replay_take(NULL, NULL);
+   return &replay_record;
+
+} // expect_record
+
+//-----------------------------------------------------------------------------
+int source_inotify_init(void) {
+//-----------------------------------------------------------------------------
+   const struct SOURCE_RECORD * record_p;
+
+   if (replay_file_p != NULL) {
+      record_p = expect_record(SOURCE_INIT, NULL);
+      if (-1 == record_p->result) {
+         errno = record_p->error;
+         return -1;
+      }
+      // hold a descriptor number, so no other fd can be mistaken for ours
+      source_fd = open("/dev/null", O_RDONLY);
+      return source_fd;
+   }
+
+   source_fd = inotify_init();
+   write_record(SOURCE_INIT, source_fd, -1 == source_fd ? errno : 0, NULL, 0);
+
+   return source_fd;
+
+} // source_inotify_init
+
+//-----------------------------------------------------------------------------
+int source_add_watch(int fd, const char * path_p, uint32_t mask) {
+//-----------------------------------------------------------------------------
+   const struct SOURCE_RECORD * record_p;
+   int wd;
+
+   if (fd != source_fd) {
+      return inotify_add_watch(fd, path_p, mask);
+   }
+
+   if (replay_file_p != NULL) {
+      record_p = expect_record(SOURCE_ADD_WATCH, path_p);
+      errno = record_p->error;
+      return record_p->result;
+   }
+
+   wd = inotify_add_watch(fd, path_p, mask);
+   write_record(
+      SOURCE_ADD_WATCH, wd, -1 == wd ? errno : 0, path_p, strlen(path_p) + 1
+   );
+
+   return wd;
+
+} // source_add_watch
+
+//-----------------------------------------------------------------------------
+int source_rm_watch(int fd, int wd) {
+//-----------------------------------------------------------------------------
+   const struct SOURCE_RECORD * record_p;
+   int32_t recorded_wd;
+   int result;
+
+   if (fd != source_fd) {
+      return inotify_rm_watch(fd, wd);
+   }
+
+   if (replay_file_p != NULL) {
+      record_p = expect_record(SOURCE_RM_WATCH, NULL);
+      errno = record_p->error;
+      return record_p->result;
+   }
+
+   result = inotify_rm_watch(fd, wd);
+   recorded_wd = wd;
+   write_record(
+      SOURCE_RM_WATCH,
+      result,
+      -1 == result ? errno : 0,
+      &recorded_wd,
+      sizeof recorded_wd
+   );
+
+   return result;
+
+} // source_rm_watch
+
+//-----------------------------------------------------------------------------
+int source_queue_bytes(int fd, int * bytes_p) {
+//-----------------------------------------------------------------------------
+   const struct SOURCE_RECORD * record_p;
+   int result;
+
+   if (fd != source_fd) {
+      return ioctl(fd, FIONREAD, bytes_p);
+   }
+
+   if (replay_file_p != NULL) {
+      record_p = expect_record(SOURCE_QUEUE_BYTES, NULL);
+      if (-1 == record_p->result) {
+         errno = record_p->error;
+         return -1;
+      }
+      *bytes_p = record_p->result;
+      return 0;
+   }
+
+   result = ioctl(fd, FIONREAD, bytes_p);
+   write_record(
+      SOURCE_QUEUE_BYTES,
+      -1 == result ? -1 : *bytes_p,
+      -1 == result ? errno : 0,
+      NULL,
+      0
+   );
+
+   return result;
+
+} // source_queue_bytes
+
+//-----------------------------------------------------------------------------
+ssize_t source_read(int fd, void * buffer_p, size_t len) {
+//-----------------------------------------------------------------------------
+   const struct SOURCE_RECORD * record_p;
+   ssize_t bytes_read;
+
+   if (fd != source_fd) {
+      return read(fd, buffer_p, len);
+   }
+
+   if (replay_file_p != NULL) {
+      record_p = expect_record(SOURCE_READ, NULL);
+      if (-1 == record_p->result) {
+         errno = record_p->error;
+         return -1;
+      }
+      if (record_p->length > len) {
+         errno = EINVAL;
+         return -1;
+      }
+      memcpy(buffer_p, replay_data_p, record_p->length);
+      return record_p->length;
+   }
+
+   bytes_read = read(fd, buffer_p, len);
+   write_record(
+      SOURCE_READ,
+      -1 == bytes_read ? -1 : 0,
+      -1 == bytes_read ? errno : 0,
+      buffer_p,
+      -1 == bytes_read ? 0 : bytes_read
+   );
+
+   return bytes_read;
+
+} // source_read
+
+//-----------------------------------------------------------------------------
+SUB_DIR_NODE_P source_list_sub_dirs(const char * path_p) {
+//-----------------------------------------------------------------------------
+   SUB_DIR_NODE_P head_p;
+   SUB_DIR_NODE_P node_p;
+   SUB_DIR_NODE_P * next_pp;
+   const struct SOURCE_RECORD * record_p;
+   const char * name_p;
+   const char * end_p;
+   char * data_p;
+   size_t length;
+   int count;
+
+   if (replay_file_p != NULL) {
+      record_p = expect_record(SOURCE_LIST_SUB_DIRS, path_p);
+      head_p = NULL;
+      next_pp = &head_p;
+      end_p = replay_data_p + record_p->length;
+      for (
+         name_p = replay_data_p + strlen(replay_data_p) + 1;
+         name_p < end_p;
+         name_p += strlen(name_p) + 1
+      ) {
+         node_p = new_sub_dir_node(name_p);
+         *next_pp = node_p;
+         next_pp = &node_p->next_p;
+      }
+      return head_p;
+   }
+
+   head_p = list_sub_dirs(path_p);
+   if (NULL == capture_file_p) {
+      return head_p;
+   }
+
+   length = strlen(path_p) + 1;
+   count = 0;
+   for (node_p = head_p; node_p != NULL; node_p = node_p->next_p) {
+      length += strlen(node_p->d_name) + 1;
+      count++;
+   }
+
+   data_p = malloc(length);
+   if (NULL == data_p) {
+      syslog(LOG_WARNING, "malloc failed, stopping capture");
+      fclose(capture_file_p);
+      capture_file_p = NULL;
+      return head_p;
+   }
+
+   strcpy(data_p, path_p);
+   length = strlen(path_p) + 1;
+   for (node_p = head_p; node_p != NULL; node_p = node_p->next_p) {
+      strcpy(data_p + length, node_p->d_name);
+      length += strlen(node_p->d_name) + 1;
+   }
+
+   write_record(SOURCE_LIST_SUB_DIRS, count, 0, data_p, length);
+   free(data_p);
+
+   return head_p;
+
+} // source_list_sub_dirs
+
+//-----------------------------------------------------------------------------
+void source_tick(void) {
+//-----------------------------------------------------------------------------
+   write_record(SOURCE_TICK, 0, 0, NULL, 0);
+} // source_tick
+
+//-----------------------------------------------------------------------------
+void source_barrier(void) {
+//-----------------------------------------------------------------------------
+   write_record(SOURCE_BARRIER, 0, 0, NULL, 0);
+} // source_barrier
+
+//-----------------------------------------------------------------------------
+// append the contents of a file to a malloc'ed buffer
+// returns the new length, or -1 on failure
+static long append_file(const char * path_p, char ** buffer_pp, long length) {
+//-----------------------------------------------------------------------------
+   FILE * file_p;
+   char read_buffer[4096];
+   size_t bytes_read;
+   char * new_buffer_p;
+
+   file_p = fopen(path_p, "r");
+   if (NULL == file_p) {
+      return -1;
+   }
+
+   while ((bytes_read = fread(read_buffer, 1, sizeof read_buffer, file_p)) > 0) {
+      new_buffer_p = realloc(*buffer_pp, length + bytes_read + 1);
+      if (NULL == new_buffer_p) {
+         fclose(file_p);
+         return -1;
+      }
+      *buffer_pp = new_buffer_p;
+      memcpy(*buffer_pp + length, read_buffer, bytes_read);
+      length += bytes_read;
+   }
+   fclose(file_p);
+
+   return length;
+
+} // append_file
+
+//-----------------------------------------------------------------------------
+void source_config(
+   enum SOURCE_RECORD_TYPE type,
+   const char * config_path_p,
+   const char * exclude_path_p
+) {
+//-----------------------------------------------------------------------------
+   char * data_p;
+   long length;
+
+   if (NULL == capture_file_p) {
+      return;
+   }
+
+   data_p = malloc(1);
+   if (NULL == data_p) {
+      return;
+   }
+
+   length = append_file(config_path_p, &data_p, 0);
+   if (length >= 0) {
+      data_p[length++] = '\0';
+      length = append_file(exclude_path_p, &data_p, length);
+   }
+
+   if (length < 0) {
+      syslog(LOG_WARNING, "unable to record config files, stopping capture");
+      fclose(capture_file_p);
+      capture_file_p = NULL;
+   } else {
+      write_record(type, 0, 0, data_p, length);
+   }
+
+   free(data_p);
+
+} // source_config
@@ -0,0 +1,89 @@
+//-----------------------------------------------------------------------------
+// event_source.h
+//
+// the kernel calls the watcher makes for its main inotify instance,
+// which can be recorded to a file, and replayed from one
+//
+// Normally these are the plain system calls. With capture on, every call
+// and its result is also appended to a recording: the inotify reads with
+// their timestamps, the results of inotify_add_watch and inotify_rm_watch,
+// and the directory listings of the crawl, from which the wd to path
+// table is built. The flush ticks and the config and exclude files are
+// recorded too.
+//
+// With replay on, nothing reaches the kernel. Each call takes the next
+// record instead, so the same processing and flushing code sees exactly
+// what it saw when the recording was made. If a call does not match the
+// next record, the replay has diverged and we exit.
+//-----------------------------------------------------------------------------
+#if !defined(__EVENT_SOURCE_H)
+#define __EVENT_SOURCE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "list_sub_dirs.h"
+
+enum SOURCE_RECORD_TYPE {
+   SOURCE_END,             // end of the recording
+   SOURCE_START,           // data is the config file, '\0', the exclude file
+   SOURCE_RELOAD,          // as SOURCE_START
+   SOURCE_INIT,            // inotify_init
+   SOURCE_ADD_WATCH,       // data is the path
+   SOURCE_RM_WATCH,        // data is the wd
+   SOURCE_LIST_SUB_DIRS,   // data is the path, then the names, '\0' separated
+   SOURCE_QUEUE_BYTES,     // FIONREAD
+   SOURCE_READ,            // data is the bytes read
+   SOURCE_TICK,            // the flush timer
+   SOURCE_BARRIER,         // a barrier's flush, after draining the queue
+   SOURCE_RECORD_TYPE_COUNT
+};
+
+// append everything to a recording at path_p
+// returns 0 for success
+int source_capture_open(const char * path_p);
+
+// take everything from the recording at path_p
+// returns 0 for success
+int source_replay_open(const char * path_p);
+
+// nonzero if we are replaying
+int source_replaying(void);
+
+// finish the recording, or close the replay
+void source_close(void);
+
+// the system calls
+int source_inotify_init(void);
+int source_add_watch(int fd, const char * path_p, uint32_t mask);
+int source_rm_watch(int fd, int wd);
+int source_queue_bytes(int fd, int * bytes_p);
+ssize_t source_read(int fd, void * buffer_p, size_t len);
+SUB_DIR_NODE_P source_list_sub_dirs(const char * path_p);
+
+// record a flush tick
+void source_tick(void);
+
+// record the flush for a barrier
+void source_barrier(void);
+
+// record the contents of the config and exclude files, for SOURCE_START
+// or SOURCE_RELOAD
+void source_config(
+   enum SOURCE_RECORD_TYPE type,
+   const char * config_path_p,
+   const char * exclude_path_p
+);
+
+// replay: the type of the next record, without taking it
+enum SOURCE_RECORD_TYPE source_replay_peek(void);
+
+// replay: take the next record, returning its time in nanoseconds after the
+// recording started. If data_pp is not NULL, it is set to the record's data
+// and *len_p to its length; the data is valid until the next record is taken.
+uint64_t source_replay_take(const char ** data_pp, uint32_t * len_p);
+
+// replay: the time of the next record
+uint64_t source_replay_time(void);
+
+#endif // !defined(__EVENT_SOURCE_H)
@@ -0,0 +1,460 @@
+//-----------------------------------------------------------------------------
+// exclude_matcher.c
+//
+// decide whether a directory is excluded from watching
+//-----------------------------------------------------------------------------
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "exclude_matcher.h"
+#include "name_patterns.h"
+
+#define ROOT_NODE 0
+#define NO_RULE (-1)
+#define NO_NODE (-1)
+#define INITIAL_NODES 64
+#define INITIAL_POOL_SIZE 4096
+
+// one path component in the prefix trie
+struct TRIE_NODE {
+   int      parent;
+   uint32_t hash;         // hash of (parent, name)
+   int      name_offset;  // in the string pool
+   int      name_len;
+   int      rule_offset;  // the rule ending here, or NO_RULE
+   int      rules_below;  // rules ending here or under here
+};
+
+struct EXCLUDE_MATCHER {
+   struct TRIE_NODE * nodes;
+   int                node_count;
+   int                node_slots;
+
+   // open addressing hash of node indexes keyed by (parent, name),
+   // size is a power of 2, NO_NODE marks a free slot
+   int              * children;
+   unsigned int       child_slots;
+
+   // component names and rule text
+   char             * pool;
+   int                pool_used;
+   int                pool_size;
+
+   NAME_PATTERNS_P    name_patterns;
+   int                prefix_rule_count;
+};
+
+//-----------------------------------------------------------------------------
+static uint32_t component_hash(int parent, const char * name_p, int name_len) {
+//-----------------------------------------------------------------------------
+   // FNV-1a over the parent index and the name
+   uint32_t hash = 2166136261u;
+   int i;
+
+   hash = (hash ^ (uint32_t) parent) * 16777619u;
+   for (i=0; i < name_len; i++) {
+      hash ^= (unsigned char) name_p[i];
+      hash *= 16777619u;
+   }
+
+   return hash;
+
+} // component_hash
+
+//-----------------------------------------------------------------------------
+static int pool_store(
+   EXCLUDE_MATCHER_P matcher_p,
+   const char * text_p,
+   int text_len
+) {
+//-----------------------------------------------------------------------------
+   char * new_pool;
+   int new_size;
+   int offset;
+
+   if (matcher_p->pool_used + text_len + 1 > matcher_p->pool_size) {
+      new_size = matcher_p->pool_size * 2;
+      while (matcher_p->pool_used + text_len + 1 > new_size) {
+         new_size *= 2;
+      }
+      new_pool = realloc(matcher_p->pool, new_size);
+      if (NULL == new_pool) {
+         return -1;
+      }
+      matcher_p->pool = new_pool;
+      matcher_p->pool_size = new_size;
+   }
+
+   offset = matcher_p->pool_used;
+   memcpy(&matcher_p->pool[offset], text_p, text_len);
+   matcher_p->pool[offset+text_len] = '\0';
+   matcher_p->pool_used += text_len + 1;
+
+   return offset;
+
+} // pool_store
+
+//-----------------------------------------------------------------------------
+// return the slot in the children table holding the child, or the free
+// slot where it would go
+static unsigned int find_child_slot(
+   EXCLUDE_MATCHER_P matcher_p,
+   int parent,
+   uint32_t hash,
+   const char * name_p,
+   int name_len
+) {
+//-----------------------------------------------------------------------------
+   unsigned int mask = matcher_p->child_slots - 1;
+   unsigned int i;
+   struct TRIE_NODE * node_p;
+
+   for (i = hash & mask; matcher_p->children[i] != NO_NODE; i = (i+1) & mask) {
+      node_p = &matcher_p->nodes[matcher_p->children[i]];
+      if (
+         (node_p->hash == hash) &&
+         (node_p->parent == parent) &&
+         (node_p->name_len == name_len) &&
+         (0 == memcmp(&matcher_p->pool[node_p->name_offset], name_p, name_len))
+      ) {
+         break;
+      }
+   }
+
+   return i;
+
+} // find_child_slot
+
+//-----------------------------------------------------------------------------
+static int grow_children(EXCLUDE_MATCHER_P matcher_p) {
+//-----------------------------------------------------------------------------
+   int * new_children;
+   unsigned int new_slots;
+   unsigned int mask;
+   unsigned int i;
+   int node;
+
+   new_slots = matcher_p->child_slots * 2;
+   new_children = malloc(new_slots * sizeof(int));
+   if (NULL == new_children) {
+      return -1;
+   }
+   for (i=0; i < new_slots; i++) {
+      new_children[i] = NO_NODE;
+   }
+
+   mask = new_slots - 1;
+   for (node=ROOT_NODE+1; node < matcher_p->node_count; node++) {
+      for (
+         i = matcher_p->nodes[node].hash & mask;
+         new_children[i] != NO_NODE;
+         i = (i+1) & mask
+      ) {
+      }
+      new_children[i] = node;
+   }
+
+   free(matcher_p->children);
+   matcher_p->children = new_children;
+   matcher_p->child_slots = new_slots;
+
+   return 0;
+
+} // grow_children
+
+//-----------------------------------------------------------------------------
+// find the child of parent with this name, creating it if need be
+static int intern_child(
+   EXCLUDE_MATCHER_P matcher_p,
+   int parent,
+   const char * name_p,
+   int name_len
+) {
+//-----------------------------------------------------------------------------
+   struct TRIE_NODE * new_nodes;
+   struct TRIE_NODE * node_p;
+   uint32_t hash;
+   unsigned int slot;
+   int name_offset;
+
+   hash = component_hash(parent, name_p, name_len);
+   slot = find_child_slot(matcher_p, parent, hash, name_p, name_len);
+   if (matcher_p->children[slot] != NO_NODE) {
+      return matcher_p->children[slot];
+   }
+
+   if (matcher_p->node_count == matcher_p->node_slots) {
+      new_nodes = realloc(
+         matcher_p->nodes,
+         matcher_p->node_slots * 2 * sizeof(struct TRIE_NODE)
+      );
+      if (NULL == new_nodes) {
+         return NO_NODE;
+      }
+      matcher_p->nodes = new_nodes;
+      matcher_p->node_slots *= 2;
+   }
+
+   name_offset = pool_store(matcher_p, name_p, name_len);
+   if (name_offset < 0) {
+      return NO_NODE;
+   }
+
+   node_p = &matcher_p->nodes[matcher_p->node_count];
+   node_p->parent = parent;
+   node_p->hash = hash;
+   node_p->name_offset = name_offset;
+   node_p->name_len = name_len;
+   node_p->rule_offset = NO_RULE;
+   node_p->rules_below = 0;
+   matcher_p->children[slot] = matcher_p->node_count;
+   matcher_p->node_count++;
+
+   // keep the children table at most half full
+   if (matcher_p->node_count * 2 > matcher_p->child_slots) {
+      if (grow_children(matcher_p) != 0) {
+         return NO_NODE;
+      }
+   }
+
+   return matcher_p->node_count - 1;
+
+} // intern_child
+
+//-----------------------------------------------------------------------------
+static int add_prefix_rule(EXCLUDE_MATCHER_P matcher_p, const char * rule_p) {
+//-----------------------------------------------------------------------------
+   const char * start_p;
+   const char * end_p;
+   int node;
+   int rule_offset;
+
+   node = ROOT_NODE;
+   for (start_p = rule_p; *start_p != '\0'; start_p = end_p) {
+      while ('/' == *start_p) {
+         start_p++;
+      }
+      if ('\0' == *start_p) {
+         break;
+      }
+      for (end_p = start_p; (*end_p != '\0') && (*end_p != '/'); end_p++) {
+      }
+      node = intern_child(matcher_p, node, start_p, end_p - start_p);
+      if (NO_NODE == node) {
+         return -1;
+      }
+   }
+
+   if (matcher_p->nodes[node].rule_offset != NO_RULE) {
+      // duplicate
+      return 0;
+   }
+
+   rule_offset = pool_store(matcher_p, rule_p, strlen(rule_p));
+   if (rule_offset < 0) {
+      return -1;
+   }
+   matcher_p->nodes[node].rule_offset = rule_offset;
+   matcher_p->prefix_rule_count++;
+
+   for (; node != NO_NODE; node = matcher_p->nodes[node].parent) {
+      matcher_p->nodes[node].rules_below++;
+   }
+
+   return 0;
+
+} // add_prefix_rule
+
+//-----------------------------------------------------------------------------
+EXCLUDE_MATCHER_P new_exclude_matcher(void) {
+//-----------------------------------------------------------------------------
+   EXCLUDE_MATCHER_P matcher_p;
+   unsigned int i;
+
+   matcher_p = calloc(1, sizeof(struct EXCLUDE_MATCHER));
+   if (NULL == matcher_p) {
+      return NULL;
+   }
+
+   matcher_p->node_slots = INITIAL_NODES;
+   matcher_p->nodes = malloc(INITIAL_NODES * sizeof(struct TRIE_NODE));
+   matcher_p->child_slots = INITIAL_NODES * 2;
+   matcher_p->children = malloc(matcher_p->child_slots * sizeof(int));
+   matcher_p->pool_size = INITIAL_POOL_SIZE;
+   matcher_p->pool = malloc(INITIAL_POOL_SIZE);
+   matcher_p->name_patterns = new_name_patterns();
+
+   if (
+      (NULL == matcher_p->nodes) ||
+      (NULL == matcher_p->children) ||
+      (NULL == matcher_p->pool) ||
+      (NULL == matcher_p->name_patterns)
+   ) {
+      release_exclude_matcher(matcher_p);
+      return NULL;
+   }
+
+   for (i=0; i < matcher_p->child_slots; i++) {
+      matcher_p->children[i] = NO_NODE;
+   }
+
+   // the root node stands for "/"
+   matcher_p->nodes[ROOT_NODE].parent = NO_NODE;
+   matcher_p->nodes[ROOT_NODE].hash = 0;
+   matcher_p->nodes[ROOT_NODE].name_offset = 0;
+   matcher_p->nodes[ROOT_NODE].name_len = 0;
+   matcher_p->nodes[ROOT_NODE].rule_offset = NO_RULE;
+   matcher_p->nodes[ROOT_NODE].rules_below = 0;
+   matcher_p->node_count = 1;
+
+   return matcher_p;
+
+} // new_exclude_matcher
+
+//-----------------------------------------------------------------------------
+int add_exclude_rule(EXCLUDE_MATCHER_P matcher_p, const char * rule_p) {
+//-----------------------------------------------------------------------------
+   if ('\0' == *rule_p) {
+      return 0;
+   }
+
+   if ('/' == *rule_p) {
+      return add_prefix_rule(matcher_p, rule_p);
+   }
+
+   return add_name_pattern(matcher_p->name_patterns, rule_p);
+
+} // add_exclude_rule
+
+//-----------------------------------------------------------------------------
+int exclude_rule_count(EXCLUDE_MATCHER_P matcher_p) {
+//-----------------------------------------------------------------------------
+   return
+      matcher_p->prefix_rule_count +
+      name_pattern_count(matcher_p->name_patterns);
+} // exclude_rule_count
+
+//-----------------------------------------------------------------------------
+const char * match_exclude(EXCLUDE_MATCHER_P matcher_p, const char * path_p) {
+//-----------------------------------------------------------------------------
+   const char * start_p;
+   const char * end_p;
+   const char * name_p;
+   int name_len;
+   char name_buffer[NAME_MAX+1];
+   unsigned int slot;
+   int node;
+
+   name_p = path_p;
+   name_len = 0;
+   node = ROOT_NODE;
+   for (start_p = path_p; *start_p != '\0'; start_p = end_p) {
+
+      // a rule of "/" is for "/" only, not for everything below it
+      if (
+         (node != NO_NODE) && 
+         (node != ROOT_NODE) &&
+         (matcher_p->nodes[node].rule_offset != NO_RULE)
+      ) {
+         return &matcher_p->pool[matcher_p->nodes[node].rule_offset];
+      }
+
+      while ('/' == *start_p) {
+         start_p++;
+      }
+      if ('\0' == *start_p) {
+         break;
+      }
+      for (end_p = start_p; (*end_p != '\0') && (*end_p != '/'); end_p++) {
+      }
+      name_p = start_p;
+      name_len = end_p - start_p;
+
+      // once we have left the trie, we only need the last component
+      if (node != NO_NODE) {
+         slot = find_child_slot(
+            matcher_p,
+            node,
+            component_hash(node, start_p, name_len),
+            start_p,
+            name_len
+         );
+         node = matcher_p->children[slot];
+      }
+   }
+
+   if ((node != NO_NODE) && (matcher_p->nodes[node].rule_offset != NO_RULE)) {
+      return &matcher_p->pool[matcher_p->nodes[node].rule_offset];
+   }
+
+   if (0 == name_pattern_count(matcher_p->name_patterns)) {
+      return NULL;
+   }
+
+   // no directory has a name that long
+   if (name_len > NAME_MAX) {
+      return NULL;
+   }
+
+   // a trailing '/' leaves the last component unterminated
+   if (name_p[name_len] != '\0') {
+      memcpy(name_buffer, name_p, name_len);
+      name_buffer[name_len] = '\0';
+      name_p = name_buffer;
+   }
+
+   return match_name_patterns(matcher_p->name_patterns, name_p);
+
+} // match_exclude
+
+//-----------------------------------------------------------------------------
+int exclude_rules_below(EXCLUDE_MATCHER_P matcher_p, const char * path_p) {
+//-----------------------------------------------------------------------------
+   const char * start_p;
+   const char * end_p;
+   unsigned int slot;
+   int node;
+
+   node = ROOT_NODE;
+   for (start_p = path_p; *start_p != '\0'; start_p = end_p) {
+      while ('/' == *start_p) {
+         start_p++;
+      }
+      if ('\0' == *start_p) {
+         break;
+      }
+      for (end_p = start_p; (*end_p != '\0') && (*end_p != '/'); end_p++) {
+      }
+      slot = find_child_slot(
+         matcher_p,
+         node,
+         component_hash(node, start_p, end_p - start_p),
+         start_p,
+         end_p - start_p
+      );
+      node = matcher_p->children[slot];
+      if (NO_NODE == node) {
+         return 0;
+      }
+   }
+
+   return matcher_p->nodes[node].rules_below > 0;
+
+} // exclude_rules_below
+
+//-----------------------------------------------------------------------------
+void release_exclude_matcher(EXCLUDE_MATCHER_P matcher_p) {
+//-----------------------------------------------------------------------------
+   if (NULL == matcher_p) {
+      return;
+   }
+
+   free(matcher_p->nodes);
+   free(matcher_p->children);
+   free(matcher_p->pool);
+   release_name_patterns(matcher_p->name_patterns);
+   free(matcher_p);
+
+} // release_exclude_matcher
@@ -0,0 +1,42 @@
+//-----------------------------------------------------------------------------
+// exclude_matcher.h
+//
+// decide whether a directory is excluded from watching
+//
+// There are two kinds of exclude rule:
+// - an absolute path ("/home/user/Downloads") excludes that directory and
+//   everything below it. These are compiled into a trie of path components,
+//   so matching a path costs O(depth) however many rules there are.
+// - anything else ("node_modules", "*.cache") is a directory name pattern,
+//   which excludes every directory with a matching name, at any depth.
+//-----------------------------------------------------------------------------
+#if !defined(__EXCLUDE_MATCHER_H)
+#define __EXCLUDE_MATCHER_H
+
+typedef struct EXCLUDE_MATCHER * EXCLUDE_MATCHER_P;
+
+// create a matcher with no rules
+// returns NULL on failure
+EXCLUDE_MATCHER_P new_exclude_matcher(void);
+
+// add a rule, as read from a line of the exclude file
+// empty rules are ignored
+// return 0 for success, nonzero for failure
+int add_exclude_rule(EXCLUDE_MATCHER_P matcher_p, const char * rule_p);
+
+// the number of rules in the matcher
+int exclude_rule_count(EXCLUDE_MATCHER_P matcher_p);
+
+// match an absolute directory path against the rules
+// returns the rule which excludes the path, or NULL if it is not excluded
+const char * match_exclude(EXCLUDE_MATCHER_P matcher_p, const char * path_p);
+
+// are there absolute path rules for the path or anything below it
+// A directory moved from or to such a path can't keep its watches as
+// they are, because what is excluded under it changes.
+int exclude_rules_below(EXCLUDE_MATCHER_P matcher_p, const char * path_p);
+
+// release a matcher, does nothing if matcher_p is NULL
+void release_exclude_matcher(EXCLUDE_MATCHER_P matcher_p);
+
+#endif // !defined(__EXCLUDE_MATCHER_H)
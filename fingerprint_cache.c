@@ -0,0 +1,126 @@
+//-----------------------------------------------------------------------------
+// fingerprint_cache.c
+//
+// remember (inode, size, mtime, ctime) for files we have seen closed after
+// writing
+//-----------------------------------------------------------------------------
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <syslog.h>
+#include <time.h>
+
+#include "fingerprint_cache.h"
+
+// Filesystems with coarse timestamps can change a file twice within one
+// tick without changing its mtime. Like git's 'racily clean' check, we
+// don't trust a fingerprint taken this close to the file's mtime.
+#define RACY_NANOSECONDS (2LL * 1000000000LL)
+
+struct FINGERPRINT {
+   dev_t    dev;
+   ino_t    ino;          // 0 for an empty slot
+   off_t    size;
+   int64_t  mtime_ns;
+   int64_t  ctime_ns;
+   int64_t  taken_ns;     // when we stat'ed the file
+};
+
+static struct FINGERPRINT * fingerprints = NULL;
+static unsigned int fingerprint_slots = 0;
+
+//-----------------------------------------------------------------------------
+static int64_t timespec_ns(const struct timespec * ts_p) {
+//-----------------------------------------------------------------------------
+   return (int64_t) ts_p->tv_sec * 1000000000LL + ts_p->tv_nsec;
+} // timespec_ns
+
+//-----------------------------------------------------------------------------
+int fingerprint_cache_initialize(unsigned int max_entries) {
+//-----------------------------------------------------------------------------
+   if (0 == max_entries) {
+      return 0;
+   }
+
+   fingerprints = calloc(max_entries, sizeof(struct FINGERPRINT));
+   if (NULL == fingerprints) {
+      syslog(LOG_ERR, "unable to calloc %u fingerprints", max_entries);
+      return -1;
+   }
+   fingerprint_slots = max_entries;
+
+   syslog(LOG_INFO, "fingerprint cache of %u entries", max_entries);
+
+   return 0;
+
+} // fingerprint_cache_initialize
+
+//-----------------------------------------------------------------------------
+int fingerprint_cache_enabled(void) {
+//-----------------------------------------------------------------------------
+   return fingerprints != NULL;
+} // fingerprint_cache_enabled
+
+//-----------------------------------------------------------------------------
+int fingerprint_unchanged(const char * path_p) {
+//-----------------------------------------------------------------------------
+   struct stat stat_buffer;
+   struct timespec now;
+   struct FINGERPRINT * fingerprint_p;
+   uint64_t key;
+   int64_t mtime_ns;
+   int64_t ctime_ns;
+   int unchanged;
+
+   if (NULL == fingerprints) {
+      return 0;
+   }
+
+   // the file may already be gone, let the event through
+   if (lstat(path_p, &stat_buffer) != 0) {
+      return 0;
+   }
+
+   if (! S_ISREG(stat_buffer.st_mode)) {
+      return 0;
+   }
+
+   mtime_ns = timespec_ns(&stat_buffer.st_mtim);
+   ctime_ns = timespec_ns(&stat_buffer.st_ctim);
+
+   key = ((uint64_t) stat_buffer.st_dev << 32) ^ (uint64_t) stat_buffer.st_ino;
+   key *= 0x9E3779B97F4A7C15ULL;
+   fingerprint_p = &fingerprints[(key >> 32) % fingerprint_slots];
+
+   unchanged = (
+      (fingerprint_p->ino == stat_buffer.st_ino) &&
+      (fingerprint_p->dev == stat_buffer.st_dev) &&
+      (fingerprint_p->size == stat_buffer.st_size) &&
+      (fingerprint_p->mtime_ns == mtime_ns) &&
+      (fingerprint_p->ctime_ns == ctime_ns) &&
+      (fingerprint_p->taken_ns - mtime_ns >= RACY_NANOSECONDS) &&
+      (fingerprint_p->taken_ns - ctime_ns >= RACY_NANOSECONDS)
+   );
+
+   if (! unchanged) {
+      clock_gettime(CLOCK_REALTIME, &now);
+      fingerprint_p->dev = stat_buffer.st_dev;
+      fingerprint_p->ino = stat_buffer.st_ino;
+      fingerprint_p->size = stat_buffer.st_size;
+      fingerprint_p->mtime_ns = mtime_ns;
+      fingerprint_p->ctime_ns = ctime_ns;
+      fingerprint_p->taken_ns = timespec_ns(&now);
+   }
+
+   return unchanged;
+
+} // fingerprint_unchanged
+
+//-----------------------------------------------------------------------------
+void fingerprint_cache_close(void) {
+//-----------------------------------------------------------------------------
+   free(fingerprints);
+   fingerprints = NULL;
+   fingerprint_slots = 0;
+} // fingerprint_cache_close
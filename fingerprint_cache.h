@@ -0,0 +1,31 @@
+//-----------------------------------------------------------------------------
+// fingerprint_cache.h
+//
+// remember (inode, size, mtime, ctime) for files we have seen closed after
+// writing, so we can drop IN_CLOSE_WRITE for files which were opened for
+// writing and closed without being changed.
+//
+// The cache is a fixed size table, filled the first time we see an event
+// for a file. When two files share a slot the newer one wins, which only
+// costs an extra report.
+//-----------------------------------------------------------------------------
+#if !defined(__FINGERPRINT_CACHE_H)
+#define __FINGERPRINT_CACHE_H
+
+// set up a cache of max_entries fingerprints
+// max_entries of 0 disables the cache
+// returns 0 on success
+int fingerprint_cache_initialize(unsigned int max_entries);
+
+// nonzero if the cache is in use
+int fingerprint_cache_enabled(void);
+
+// stat the file, and compare with its previous fingerprint
+// returns nonzero if the file is certainly unchanged, 0 if it changed,
+// is new to the cache or cannot be stat'ed
+int fingerprint_unchanged(const char * path_p);
+
+// release the cache at shutdown
+void fingerprint_cache_close(void);
+
+#endif // !defined(__FINGERPRINT_CACHE_H)
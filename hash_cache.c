@@ -1,4 +1,5 @@
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include "hash_cache.h"
@@ -26,13 +27,15 @@ struct hash_cache_s {
 
 };
 
-// A simple checksum-function
+// FNV-1a: paths which differ in a character or two, as sibling
+// directories do, still spread across the table
 unsigned int default_hash_function(void * data, unsigned int datalen) {
     unsigned int i;
-    unsigned int hash = 0;
+    uint32_t hash = 2166136261u;
 
     for(i=0; i < datalen; i++) {
-        hash +=  i ^ ((unsigned char*)data)[i];
+        hash ^= ((unsigned char*)data)[i];
+        hash *= 16777619u;
     }
 
     return hash;
@@ -137,6 +140,78 @@ int hash_cache_add(hash_cache * hc, void * data, unsigned int datalen) {
     return hc->hash[hash_pos]->count;
 }
 
+// Remove an element, if it is there
+// returns how often it had been added, 0 if it was not there
+unsigned int hash_cache_remove(hash_cache * hc, void * data, unsigned int datalen) {
+    unsigned int hash;
+    unsigned int hash_pos;
+    unsigned int next_pos;
+    unsigned int home_pos;
+    unsigned int count;
+    hash_cache_entry * entry;
+    hash_cache_entry * last;
+
+    hash = default_hash_function(data, datalen);
+    hash_pos = hash % hc->hash_size;
+
+    // Find the element
+    while(
+        (hc->hash[hash_pos] != NULL) && (
+            (hc->hash[hash_pos]->hash != hash) ||
+            (hc->hash[hash_pos]->datalen != datalen) ||
+            (memcmp(hc->hash[hash_pos]->memory_pos, data, datalen) != 0)
+        )
+    ) {
+        hash_pos = (hash_pos + 1) % hc->hash_size;
+    }
+
+    entry = hc->hash[hash_pos];
+    if(entry == NULL) {
+        return 0;  // Not there
+    }
+    count = entry->count;
+
+    // Give back its memory if it was the last data stored, as it usually
+    // is when a directory is marked and then deleted
+    if((char*)entry->memory_pos + entry->datalen == hc->memory_pos) {
+        hc->memory_pos = entry->memory_pos;
+    }
+
+    // Move the last entry into its place, so the used entries stay together
+    last = &(hc->entries[hc->hash_pos - 1]);
+    if(last != entry) {
+        *entry = *last;
+        hc->hash[entry->hash_pos] = entry;
+    }
+    last->count = 0;
+    hc->hash_pos--;
+    hc->counter -= count;
+
+    // Move back the rows which had to step over this one to find a free row
+    hc->hash[hash_pos] = NULL;
+    next_pos = (hash_pos + 1) % hc->hash_size;
+    while(hc->hash[next_pos] != NULL) {
+        home_pos = hc->hash[next_pos]->hash % hc->hash_size;
+        if(
+            ((next_pos - home_pos + hc->hash_size) % hc->hash_size) >=
+            ((next_pos - hash_pos + hc->hash_size) % hc->hash_size)
+        ) {
+            hc->hash[hash_pos] = hc->hash[next_pos];
+            hc->hash[hash_pos]->hash_pos = hash_pos;
+            hc->hash[next_pos] = NULL;
+            hash_pos = next_pos;
+        }
+        next_pos = (next_pos + 1) % hc->hash_size;
+    }
+
+    return count;
+}
+
+// The number of distinct elements
+unsigned int hash_cache_entries(hash_cache * hc) {
+    return hc->hash_pos;
+}
+
 // Clear the hash-table
 void hash_cache_clear(hash_cache * hc) {
     unsigned int i;
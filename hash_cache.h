@@ -11,6 +11,13 @@ hash_cache * new_hash_cache(unsigned int hash_size, unsigned int mem_size);
 // Add a new element
 int hash_cache_add(hash_cache * hc, void * data, unsigned int datalen);
 
+// Remove an element, if it is there
+// returns how often it had been added, 0 if it was not there
+unsigned int hash_cache_remove(hash_cache * hc, void * data, unsigned int datalen);
+
+// The number of distinct elements
+unsigned int hash_cache_entries(hash_cache * hc);
+
 // Clear the hash-table
 void hash_cache_clear(hash_cache * hc);
 
@@ -13,6 +13,7 @@
 
 #include "iterate_inotify_events.h"
 #include "error_text.h"
+#include "event_source.h"
 
 #define INOTIFY_EVENT_SIZE  (sizeof (struct inotify_event))
 #define INOTIFY_EVENT_BUFFER_LEN 64 * 1024
@@ -32,7 +33,7 @@ const struct inotify_event * start_iter_inotify(int inotify_fd) {
    start_unused_buffer = 0;
    event_start_index = 0;
 
-   bytes_read = read(
+   bytes_read = source_read(
       inotify_fd, 
       &inotify_event_buffer[start_unused_buffer], 
       INOTIFY_EVENT_BUFFER_LEN - start_unused_buffer
@@ -142,4 +143,3 @@ const struct inotify_event * next_iter_inotify(int inotify_fd) {
    return event_p;
 
 } // next_iter_inotify
-
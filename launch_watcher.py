@@ -5,7 +5,8 @@ import os
 import subprocess
 import sys
 
-_memory_database = "SPIDEROAK_DIR_WATCHER_MEMORY_DATABASE"
+# the watcher's optional settings all share this prefix
+_environment_prefix = "SPIDEROAK_DIR_WATCHER_"
 
 def main(executeable_path, config_path, exclude_path, notification_path):
     """launch a filesystem watcher"""
@@ -18,8 +19,9 @@ def main(executeable_path, config_path, exclude_path, notification_path):
 	    notification_path, 
     ]
     environment = dict()
-    if _memory_database in os.environ:
-        environment[_memory_database] = os.environ[_memory_database]
+    for key, value in os.environ.items():
+        if key.startswith(_environment_prefix):
+            environment[key] = value
 
     process = subprocess.Popen(args, env=environment)
     print "process started pid =", process.pid
@@ -0,0 +1,453 @@
+//-----------------------------------------------------------------------------
+// libdirwatcher.c
+//
+// the watcher as a library
+//-----------------------------------------------------------------------------
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "libdirwatcher.h"
+#include "dir_watcher.h"
+#include "metrics.h"
+
+// the roots or the exclude rules, as given
+struct STRING_LIST {
+   char ** strings;
+   int     count;
+   int     slots;
+};
+
+static int created = 0;
+static int from_files = 0;
+static int error; // holder for errno
+
+// the epoll data for the config files' inotify instance, after the shards'
+#define CONTROL_EVENTS DIR_WATCHER_MAX_SHARDS
+
+// the shards' inotify instances keep their descriptors for as long as the
+// watcher lasts, but a resync puts a new instance behind a shard's
+// descriptor, and it has to be added again
+static int epoll_fd = -1;
+static uint64_t shard_resyncs[DIR_WATCHER_MAX_SHARDS];
+static uint64_t next_flush_ns = 0;
+
+static struct STRING_LIST roots;
+static struct STRING_LIST rules;
+
+//-----------------------------------------------------------------------------
+// returns 0 on success, -1 with errno ENOMEM
+static int append_string(struct STRING_LIST * list_p, const char * string_p) {
+//-----------------------------------------------------------------------------
+   char ** new_strings;
+
+   if (list_p->count == list_p->slots) {
+      new_strings = realloc(
+         list_p->strings,
+         (list_p->slots + 64) * sizeof(char *)
+      );
+      if (NULL == new_strings) {
+         return -1;
+      }
+      list_p->strings = new_strings;
+      list_p->slots += 64;
+   }
+
+   list_p->strings[list_p->count] = strdup(string_p);
+   if (NULL == list_p->strings[list_p->count]) {
+      return -1;
+   }
+   list_p->count++;
+
+   return 0;
+
+} // append_string
+
+//-----------------------------------------------------------------------------
+// returns the index of string_p in the list, -1 if it isn't there
+static int find_string(const struct STRING_LIST * list_p, const char * string_p) {
+//-----------------------------------------------------------------------------
+   int i;
+
+   for (i=0; i < list_p->count; i++) {
+      if (0 == strcmp(list_p->strings[i], string_p)) {
+         return i;
+      }
+   }
+
+   return -1;
+
+} // find_string
+
+//-----------------------------------------------------------------------------
+static void release_string_list(struct STRING_LIST * list_p) {
+//-----------------------------------------------------------------------------
+   int i;
+
+   for (i=0; i < list_p->count; i++) {
+      free(list_p->strings[i]);
+   }
+   free(list_p->strings);
+   memset(list_p, 0, sizeof(struct STRING_LIST));
+
+} // release_string_list
+
+//-----------------------------------------------------------------------------
+// returns as dir_watcher_configure
+static int configure(void) {
+//-----------------------------------------------------------------------------
+   return dir_watcher_configure(
+      (const char * const *) roots.strings,
+      roots.count,
+      (const char * const *) rules.strings,
+      rules.count
+   );
+} // configure
+
+//-----------------------------------------------------------------------------
+static void remove_string(struct STRING_LIST * list_p, int i) {
+//-----------------------------------------------------------------------------
+   free(list_p->strings[i]);
+   list_p->count--;
+   memmove(
+      &list_p->strings[i],
+      &list_p->strings[i+1],
+      (list_p->count - i) * sizeof(char *)
+   );
+} // remove_string
+
+//-----------------------------------------------------------------------------
+// add an inotify instance to the epoll set, with id as its data
+// returns 0 on success, -1 with errno set
+static int poll_inotify_fd(int fd, uint32_t id) {
+//-----------------------------------------------------------------------------
+   struct epoll_event event;
+
+   memset(&event, 0, sizeof event);
+   event.events = EPOLLIN;
+   event.data.u32 = id;
+   if (-1 == epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event)) {
+      error = errno;
+      syslog(LOG_ERR, "epoll_ctl %d %s", error, strerror(error));
+      errno = error;
+      return -1;
+   }
+
+   return 0;
+
+} // poll_inotify_fd
+
+//-----------------------------------------------------------------------------
+// add the shard's inotify instance to the epoll set
+// returns 0 on success, -1 with errno set
+static int poll_shard(int shard) {
+//-----------------------------------------------------------------------------
+   if (poll_inotify_fd(dir_watcher_inotify_fd(shard), shard) != 0) {
+      return -1;
+   }
+   shard_resyncs[shard] = dir_watcher_shard_resyncs(shard);
+
+   return 0;
+
+} // poll_shard
+
+//-----------------------------------------------------------------------------
+// read a batch of events from each shard which has some waiting, and the
+// config files' events
+// returns 0 on success, -1 with errno set
+static int process_waiting_events(void) {
+//-----------------------------------------------------------------------------
+   struct epoll_event events[DIR_WATCHER_MAX_SHARDS + 1];
+   uint64_t wake_ns;
+   int ready;
+   int shard;
+   int i;
+
+   ready = epoll_wait(epoll_fd, events, DIR_WATCHER_MAX_SHARDS + 1, 0);
+   wake_ns = metric_now_ns();
+   if (-1 == ready) {
+      error = errno;
+      if (EINTR == error) {
+         return 0;
+      }
+      syslog(LOG_ERR, "epoll_wait %d %s", error, strerror(error));
+      errno = error;
+      return -1;
+   }
+
+   for (i=0; i < ready; i++) {
+      if (CONTROL_EVENTS == events[i].data.u32) {
+         dir_watcher_process_control_events();
+      } else {
+         dir_watcher_process_events(events[i].data.u32, wake_ns);
+      }
+   }
+
+   // a shard which couldn't be added again last time is tried again
+   for (shard=0; shard < dir_watcher_shard_count(); shard++) {
+      if (dir_watcher_shard_resyncs(shard) != shard_resyncs[shard]) {
+         if (poll_shard(shard) != 0) {
+            return -1;
+         }
+      }
+   }
+
+   return 0;
+
+} // process_waiting_events
+
+//-----------------------------------------------------------------------------
+// with a callback, the paths are NULL, and the roots and rules are ours
+// returns 0 on success, -1 with errno set
+static int create(
+   const char * state_dir_p,
+   const char * config_path_p,
+   const char * exclude_path_p,
+   DIRWATCHER_CALLBACK callback,
+   void * context_p
+) {
+//-----------------------------------------------------------------------------
+   int shard;
+
+   if (created) {
+      errno = EBUSY;
+      return -1;
+   }
+
+   dir_watcher_initialize(state_dir_p);
+   dir_watcher_set_callback(callback, context_p);
+   if (dir_watcher_start(config_path_p, exclude_path_p) != 0) {
+      error = errno;
+      dir_watcher_close();
+      errno = error;
+      return -1;
+   }
+
+   epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+   if (-1 == epoll_fd) {
+      error = errno;
+      syslog(LOG_ERR, "epoll_create1 %d %s", error, strerror(error));
+      dir_watcher_close();
+      errno = error;
+      return -1;
+   }
+   for (shard=0; shard < dir_watcher_shard_count(); shard++) {
+      if (poll_shard(shard) != 0) {
+         break;
+      }
+   }
+   if (
+      (shard < dir_watcher_shard_count()) ||
+      (
+         (dir_watcher_control_fd() != -1) &&
+         (poll_inotify_fd(dir_watcher_control_fd(), CONTROL_EVENTS) != 0)
+      )
+   ) {
+      error = errno;
+      close(epoll_fd);
+      epoll_fd = -1;
+      dir_watcher_close();
+      errno = error;
+      return -1;
+   }
+   created = 1;
+   from_files = (config_path_p != NULL);
+
+   next_flush_ns = metric_now_ns() + DIRWATCHER_FLUSH_SECONDS * 1000000000ULL;
+
+   return 0;
+
+} // create
+
+//-----------------------------------------------------------------------------
+int dirwatcher_create(
+   const char * state_dir_p,
+   DIRWATCHER_CALLBACK callback,
+   void * context_p
+) {
+//-----------------------------------------------------------------------------
+   if (NULL == callback) {
+      errno = EINVAL;
+      return -1;
+   }
+
+   return create(state_dir_p, NULL, NULL, callback, context_p);
+
+} // dirwatcher_create
+
+//-----------------------------------------------------------------------------
+int dirwatcher_create_from_files(
+   const char * notify_dir_p,
+   const char * config_path_p,
+   const char * exclude_path_p
+) {
+//-----------------------------------------------------------------------------
+   return create(notify_dir_p, config_path_p, exclude_path_p, NULL, NULL);
+} // dirwatcher_create_from_files
+
+//-----------------------------------------------------------------------------
+int dirwatcher_add_root(const char * root_p) {
+//-----------------------------------------------------------------------------
+   if (from_files) {
+      errno = EINVAL;
+      return -1;
+   }
+   if (find_string(&roots, root_p) != -1) {
+      errno = EEXIST;
+      return -1;
+   }
+
+   if (append_string(&roots, root_p) != 0) {
+      errno = ENOMEM;
+      return -1;
+   }
+
+   // a root we can't watch all of is not watched at all
+   if (configure() != 0) {
+      error = errno;
+      remove_string(&roots, roots.count - 1);
+      configure();
+      errno = error;
+      return -1;
+   }
+
+   return 0;
+
+} // dirwatcher_add_root
+
+//-----------------------------------------------------------------------------
+int dirwatcher_remove_root(const char * root_p) {
+//-----------------------------------------------------------------------------
+   int i;
+
+   if (from_files) {
+      errno = EINVAL;
+      return -1;
+   }
+   i = find_string(&roots, root_p);
+   if (-1 == i) {
+      errno = ENOENT;
+      return -1;
+   }
+
+   remove_string(&roots, i);
+
+   return configure();
+
+} // dirwatcher_remove_root
+
+//-----------------------------------------------------------------------------
+int dirwatcher_set_excludes(const char * const * new_rules, int count) {
+//-----------------------------------------------------------------------------
+   struct STRING_LIST copied_rules;
+   struct STRING_LIST old_rules;
+   int i;
+
+   if (from_files) {
+      errno = EINVAL;
+      return -1;
+   }
+
+   // the rules we have stay until the new ones are all copied
+   memset(&copied_rules, 0, sizeof copied_rules);
+   for (i=0; i < count; i++) {
+      if (append_string(&copied_rules, new_rules[i]) != 0) {
+         release_string_list(&copied_rules);
+         errno = ENOMEM;
+         return -1;
+      }
+   }
+   // and come back if the directories the new ones let in can't be watched
+   old_rules = rules;
+   rules = copied_rules;
+   if (configure() != 0) {
+      error = errno;
+      release_string_list(&rules);
+      rules = old_rules;
+      configure();
+      errno = error;
+      return -1;
+   }
+   release_string_list(&old_rules);
+
+   return 0;
+
+} // dirwatcher_set_excludes
+
+//-----------------------------------------------------------------------------
+int dirwatcher_poll_fd(void) {
+//-----------------------------------------------------------------------------
+   return epoll_fd;
+} // dirwatcher_poll_fd
+
+//-----------------------------------------------------------------------------
+int dirwatcher_dispatch(void) {
+//-----------------------------------------------------------------------------
+   int result;
+
+   result = process_waiting_events();
+   error = errno;
+
+   if (metric_now_ns() >= next_flush_ns) {
+      dir_watcher_tick();
+      next_flush_ns =
+         metric_now_ns() + DIRWATCHER_FLUSH_SECONDS * 1000000000ULL;
+   }
+
+   errno = error;
+   return result;
+
+} // dirwatcher_dispatch
+
+//-----------------------------------------------------------------------------
+int dirwatcher_flush(void) {
+//-----------------------------------------------------------------------------
+   int result;
+
+   result = process_waiting_events();
+   error = errno;
+   dir_watcher_tick();
+   next_flush_ns = metric_now_ns() + DIRWATCHER_FLUSH_SECONDS * 1000000000ULL;
+
+   errno = error;
+   return result;
+
+} // dirwatcher_flush
+
+//-----------------------------------------------------------------------------
+void dirwatcher_reload(void) {
+//-----------------------------------------------------------------------------
+   dir_watcher_reload();
+} // dirwatcher_reload
+
+//-----------------------------------------------------------------------------
+void dirwatcher_write_stats(void) {
+//-----------------------------------------------------------------------------
+   dir_watcher_write_stats();
+} // dirwatcher_write_stats
+
+//-----------------------------------------------------------------------------
+void dirwatcher_dump_trace(void) {
+//-----------------------------------------------------------------------------
+   dir_watcher_dump_trace();
+} // dirwatcher_dump_trace
+
+//-----------------------------------------------------------------------------
+void dirwatcher_destroy(void) {
+//-----------------------------------------------------------------------------
+   if (! created) {
+      return;
+   }
+
+   close(epoll_fd);
+   epoll_fd = -1;
+   dir_watcher_close();
+   release_string_list(&roots);
+   release_string_list(&rules);
+   created = 0;
+   from_files = 0;
+
+} // dirwatcher_destroy
@@ -0,0 +1,118 @@
+//-----------------------------------------------------------------------------
+// libdirwatcher.h
+//
+// the watcher as a library
+//
+// For a program which would rather be called with the directories which
+// have changed than run spideroak_inotify_dir_watcher and read its
+// notification files. The caller polls dirwatcher_poll_fd and calls
+// dirwatcher_dispatch, which calls back with the changed directories.
+// spideroak_inotify_dir_watcher is itself a caller, of
+// dirwatcher_create_from_files.
+//
+// There is one watcher in a process. The functions which return an int
+// return -1 with errno set for an error the caller can do something about.
+//
+// Other errors end the process, as they end the executable: the reason
+// goes to syslog and error.txt in the state directory, the recent events
+// to trace.txt, and the process exits with the executable's exit status
+// for the error. These are
+//    running out of memory inside the watcher
+//    inotify_add_watch failing other than for a missing or unreadable
+//       directory, as it does when the user's watch limit is reached, for
+//       a directory created or moved in while dispatching
+//    an inotify instance which can't be read, or has lost events and
+//       can't be replaced
+//    a path which doesn't fit in a path buffer
+// An inotify instance which has lost events is replaced, and every
+// directory it watched is called back with.
+//-----------------------------------------------------------------------------
+#if !defined(__LIBDIRWATCHER_H__)
+#define __LIBDIRWATCHER_H__
+
+// how often dirwatcher_dispatch calls back with what has changed
+#define DIRWATCHER_FLUSH_SECONDS 3
+
+// given the directories which have changed since the last call, paths_p
+// and the paths in it are only valid during the call
+typedef void (*DIRWATCHER_CALLBACK)(
+   const char * const * paths_p,
+   int count,
+   void * context_p
+);
+
+// create the watcher, watching nothing yet. state_dir_p is where the error,
+// stats and trace files go, and must stay valid until dirwatcher_destroy.
+// The SPIDEROAK_DIR_WATCHER_ settings in the environment apply, apart from
+// those for notification files: there are none, and no thread to write them.
+// returns 0 on success, -1 with errno EBUSY if there is a watcher already,
+// EINVAL if callback is NULL, or the error from inotify_init or epoll
+int dirwatcher_create(
+   const char * state_dir_p,
+   DIRWATCHER_CALLBACK callback,
+   void * context_p
+);
+
+// create the watcher as spideroak_inotify_dir_watcher runs it: the top
+// level directories and exclude rules are read from the config and exclude
+// files, and read again when they are rewritten, and the changed
+// directories are written to notification files in notify_dir_p, with the
+// error, stats and trace files. The paths must stay valid until
+// dirwatcher_destroy. Where the other functions would call back, this
+// watcher writes a notification file. dirwatcher_add_root,
+// dirwatcher_remove_root and dirwatcher_set_excludes fail with EINVAL.
+// returns as dirwatcher_create
+int dirwatcher_create_from_files(
+   const char * notify_dir_p,
+   const char * config_path_p,
+   const char * exclude_path_p
+);
+
+// watch a top level directory and everything below it. root_p is as a
+// line of the config file, so it may start with a watch profile.
+// returns 0 on success, -1 with errno EEXIST if it is a root already,
+// ENOMEM, or the error from inotify_add_watch: ENOENT or EACCES if the
+// directory is missing or unreadable, ENOSPC if the user's watch limit is
+// reached part way through. It is not a root then, and nothing of it is
+// watched.
+int dirwatcher_add_root(const char * root_p);
+
+// stop watching a top level directory, given as it was added
+// returns 0 on success, -1 with errno ENOENT if it isn't a root, or ENOSPC
+// if a root it lay inside can't watch all of its directories again. It is
+// not a root either way.
+int dirwatcher_remove_root(const char * root_p);
+
+// replace the exclude rules, which are as the lines of the exclude file
+// returns 0 on success, -1 with errno ENOMEM, or ENOSPC if what the new
+// rules no longer exclude can't all be watched, keeping the rules it had
+int dirwatcher_set_excludes(const char * const * rules, int count);
+
+// readable when there are events for dirwatcher_dispatch
+int dirwatcher_poll_fd(void);
+
+// handle the events waiting, and call back once DIRWATCHER_FLUSH_SECONDS
+// have passed since the last time. Call when the poll fd is readable, and
+// at least every DIRWATCHER_FLUSH_SECONDS.
+// returns 0 on success, -1 with errno from epoll, when the events waiting
+// may not all have been handled. The next call tries again.
+int dirwatcher_dispatch(void);
+
+// handle the events waiting, and call back now (or write the notification
+// file, for a watcher created from files)
+// returns as dirwatcher_dispatch
+int dirwatcher_flush(void);
+
+// read the config and exclude files again now, if the watcher has them
+void dirwatcher_reload(void);
+
+// write stats.txt now
+void dirwatcher_write_stats(void);
+
+// write the recent events to trace.txt now
+void dirwatcher_dump_trace(void);
+
+// stop watching and release everything
+void dirwatcher_destroy(void);
+
+#endif // !defined(__LIBDIRWATCHER_H__)
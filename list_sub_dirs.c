@@ -12,9 +12,46 @@
 
 #include "error_text.h"
 #include "list_sub_dirs.h"
+#include "log_limit.h"
+
+#define SUB_DIR_REGION_CHUNK_SIZE (64 * 1024)
 
 static int error; // holder for errno
 
+static REGION_P sub_dir_region = NULL;
+static struct REGION_STATS no_stats;
+
+//-----------------------------------------------------------------------------
+SUB_DIR_NODE_P new_sub_dir_node(const char * name_p) {
+//-----------------------------------------------------------------------------
+   SUB_DIR_NODE_P node_p = NULL;
+   size_t name_len;
+
+   if (NULL == sub_dir_region) {
+      sub_dir_region = new_region(SUB_DIR_REGION_CHUNK_SIZE);
+   }
+
+   name_len = strlen(name_p);
+   if (sub_dir_region != NULL) {
+      node_p = region_alloc(
+         sub_dir_region, sizeof(struct SUB_DIR_NODE) + name_len + 1
+      );
+   }
+   if (NULL == node_p) {
+      syslog(LOG_ERR, "node_p is NULL");
+      error_file = fopen(error_path, "w");
+      fprintf(error_file, "node_p is NULL\n");
+      fclose(error_file);
+      exit(-1);
+   }
+
+   node_p->next_p = NULL;
+   memcpy(node_p->d_name, name_p, name_len + 1);
+
+   return node_p;
+
+} // new_sub_dir_node
+
 //-----------------------------------------------------------------------------
 SUB_DIR_NODE_P list_sub_dirs(const char * path) {
 //-----------------------------------------------------------------------------
@@ -30,13 +67,23 @@ SUB_DIR_NODE_P list_sub_dirs(const char * path) {
 
       // this directory might have been moved or deleted out from under us
       if (ENOENT == error) {
-         syslog(LOG_NOTICE, "Ignoring missing directory %s", path);
+         syslog_limited(
+            LOG_CLASS_MISSING_DIRECTORY, 
+            LOG_NOTICE, 
+            "Ignoring missing directory %s", 
+            path
+         );
          return NULL;
       }
 
       // don't abort if we stumble into something that's not a directory
       if (ENOTDIR == error) {
-         syslog(LOG_NOTICE, "list_sub dirs: not a directory %s", path);
+         syslog_limited(
+            LOG_CLASS_NOT_A_DIRECTORY,
+            LOG_NOTICE, 
+            "list_sub dirs: not a directory %s", 
+            path
+         );
          return NULL;
       }
 
@@ -103,23 +150,13 @@ SUB_DIR_NODE_P list_sub_dirs(const char * path) {
          }
 
          if (NULL == head_p) {
-            head_p = calloc(1, sizeof(struct SUB_DIR_NODE));
+            head_p = new_sub_dir_node(dir_entry_p->d_name);
             node_p = head_p;
          } else {
-            node_p->next_p = calloc(1, sizeof(struct SUB_DIR_NODE));
+            node_p->next_p = new_sub_dir_node(dir_entry_p->d_name);
             node_p = node_p->next_p;
          }
 
-         if (NULL == node_p) {
-            syslog(LOG_ERR, "node_p is NULL");
-            error_file = fopen(error_path, "w");
-            fprintf(error_file, "node_p is NULL\n");
-            fclose(error_file);
-            exit(-1);
-         }
-
-         strncpy(node_p->d_name, dir_entry_p->d_name, DIR_NAME_SIZE); 
-
       }
    }
 
@@ -131,12 +168,17 @@ SUB_DIR_NODE_P list_sub_dirs(const char * path) {
 //-----------------------------------------------------------------------------
 void release_sub_dir_list(SUB_DIR_NODE_P head_p) {
 //-----------------------------------------------------------------------------
-   SUB_DIR_NODE_P node_p;
-   SUB_DIR_NODE_P next_p;
-
-   for (node_p=head_p; node_p != NULL; node_p=next_p) {
-      next_p = node_p->next_p;
-      free(node_p);
-   } // while
+   if (head_p != NULL) {
+      region_release(sub_dir_region, head_p);
+   }
 } // release_sub_dir_list
 
+//-----------------------------------------------------------------------------
+const struct REGION_STATS * sub_dir_list_stats(void) {
+//-----------------------------------------------------------------------------
+   if (NULL == sub_dir_region) {
+      return &no_stats;
+   }
+   return region_stats(sub_dir_region);
+} // sub_dir_list_stats
+
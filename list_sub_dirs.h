@@ -6,22 +6,33 @@
 #if !defined(__LIST_SUB_DIRS_H)
 #define __LIST_SUB_DIRS_H
 
-#define DIR_NAME_SIZE 256
+#include "region.h"
 
+// the nodes are only as long as their names
 struct SUB_DIR_NODE {
    struct SUB_DIR_NODE * next_p;
-   char d_name[DIR_NAME_SIZE+1];
+   char d_name[];
 };
 
 typedef struct SUB_DIR_NODE * SUB_DIR_NODE_P;
 
 // return a singly linked list of NULL terminated directory names
 // return NULL if there are no subdirectories
+// The lists come from a region (region.h), so they must be released in
+// the reverse order of their creation.
 SUB_DIR_NODE_P list_sub_dirs(const char * path);
 
+// a node for a list built elsewhere, such as a replayed listing
+// The first node allocated must be the head of the list.
+SUB_DIR_NODE_P new_sub_dir_node(const char * name_p);
+
 // release resources used by a sub dir list
 // does nothing if head_p is NULL (so you can release an empty list)
-// after return, the address pointed to by head_p is invalid
+// after return, the address pointed to by head_p is invalid, and so is
+// that of any list created after it
 void release_sub_dir_list(SUB_DIR_NODE_P head_p);
 
+// allocation counts for the lists, for the stats file
+const struct REGION_STATS * sub_dir_list_stats(void);
+
 #endif // !defined(__LIST_SUB_DIRS_H)
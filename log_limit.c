@@ -0,0 +1,126 @@
+//-----------------------------------------------------------------------------
+// log_limit.c
+//
+// rate limit syslog messages which can repeat thousands of times a second
+//-----------------------------------------------------------------------------
+#include <stdint.h>
+#include <time.h>
+
+#include "log_limit.h"
+
+#define LOG_BURST 10                // messages let through at once
+#define LOG_RATE 1                  // tokens added per second
+#define LOG_SUMMARY_PERIOD 60       // seconds
+
+struct LOG_BUCKET {
+   int      tokens;
+   time_t   last_refill;
+   time_t   period_start;
+   uint64_t suppressed;
+};
+
+static struct LOG_BUCKET buckets[LOG_CLASS_COUNT];
+static int initialized = 0;
+
+static const char * class_names[LOG_CLASS_COUNT] = {
+   "missing directory",
+   "access denied",
+   "not a directory",
+   "already watching",
+   "ignored path",
+   "wd exists for new watch",
+   "unable to find parent"
+};
+
+//-----------------------------------------------------------------------------
+static time_t monotonic_seconds(void) {
+//-----------------------------------------------------------------------------
+   struct timespec now;
+
+   // the coarse clock is all we need, and it does not leave the vDSO
+   clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+   return now.tv_sec;
+
+} // monotonic_seconds
+
+//-----------------------------------------------------------------------------
+static void initialize_buckets(time_t now) {
+//-----------------------------------------------------------------------------
+   int i;
+
+   for (i=0; i < LOG_CLASS_COUNT; i++) {
+      buckets[i].tokens = LOG_BURST;
+      buckets[i].last_refill = now;
+      buckets[i].period_start = now;
+      buckets[i].suppressed = 0;
+   }
+   initialized = 1;
+
+} // initialize_buckets
+
+//-----------------------------------------------------------------------------
+int log_allowed(enum LOG_CLASS log_class) {
+//-----------------------------------------------------------------------------
+   struct LOG_BUCKET * bucket_p;
+   time_t now;
+   time_t elapsed;
+
+   now = monotonic_seconds();
+   if (! initialized) {
+      initialize_buckets(now);
+   }
+
+   bucket_p = &buckets[log_class];
+   elapsed = now - bucket_p->last_refill;
+   if (elapsed > 0) {
+      if (elapsed > LOG_BURST) {
+         elapsed = LOG_BURST;
+      }
+      bucket_p->tokens += elapsed * LOG_RATE;
+      if (bucket_p->tokens > LOG_BURST) {
+         bucket_p->tokens = LOG_BURST;
+      }
+      bucket_p->last_refill = now;
+   }
+
+   if (bucket_p->tokens > 0) {
+      bucket_p->tokens--;
+      return 1;
+   }
+
+   bucket_p->suppressed++;
+   return 0;
+
+} // log_allowed
+
+//-----------------------------------------------------------------------------
+void report_suppressed_logs(void) {
+//-----------------------------------------------------------------------------
+   struct LOG_BUCKET * bucket_p;
+   time_t now;
+   int i;
+
+   if (! initialized) {
+      return;
+   }
+
+   now = monotonic_seconds();
+   for (i=0; i < LOG_CLASS_COUNT; i++) {
+      bucket_p = &buckets[i];
+      if (now - bucket_p->period_start < LOG_SUMMARY_PERIOD) {
+         continue;
+      }
+      if (bucket_p->suppressed > 0) {
+         syslog(
+            LOG_NOTICE,
+            "suppressed %llu '%s' messages in last %lds",
+            (unsigned long long) bucket_p->suppressed,
+            class_names[i],
+            (long) (now - bucket_p->period_start)
+         );
+         bucket_p->suppressed = 0;
+      }
+      bucket_p->period_start = now;
+   }
+
+} // report_suppressed_logs
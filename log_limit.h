@@ -0,0 +1,43 @@
+//-----------------------------------------------------------------------------
+// log_limit.h
+//
+// rate limit syslog messages which can repeat thousands of times a second
+//
+// Each class of message has a token bucket: a burst of messages gets
+// through, then about one a second. Suppressed messages are counted, and
+// report_suppressed_logs writes one summary line per class a minute.
+//-----------------------------------------------------------------------------
+#if !defined(__LOG_LIMIT_H)
+#define __LOG_LIMIT_H
+
+#include <syslog.h>
+
+enum LOG_CLASS {
+   LOG_CLASS_MISSING_DIRECTORY,
+   LOG_CLASS_ACCESS_DENIED,
+   LOG_CLASS_NOT_A_DIRECTORY,
+   LOG_CLASS_ALREADY_WATCHING,
+   LOG_CLASS_IGNORED_PATH,
+   LOG_CLASS_WD_EXISTS,
+   LOG_CLASS_NO_PARENT,
+   LOG_CLASS_COUNT
+};
+
+// take a token for a message of this class
+// returns nonzero if the message should be logged, otherwise counts it
+// as suppressed
+int log_allowed(enum LOG_CLASS log_class);
+
+// syslog, subject to the limit for log_class
+#define syslog_limited(log_class, priority, ...) \
+   do { \
+      if (log_allowed(log_class)) { \
+         syslog(priority, __VA_ARGS__); \
+      } \
+   } while (0)
+
+// log a summary for each class with suppressed messages whose reporting
+// period has ended. Call this regularly.
+void report_suppressed_logs(void);
+
+#endif // !defined(__LOG_LIMIT_H)
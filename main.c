@@ -10,17 +10,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/inotify.h>
 #include <sys/poll.h>
 #include <unistd.h>
 #include <syslog.h>
 #include <sys/stat.h>
-#include <sys/time.h>
-#include "hash_cache.h"
 
-#include "iterate_inotify_events.h"
-#include "list_sub_dirs.h"
-#include "wd_directory.h"
+#include "libdirwatcher.h"
 
 #if defined(DEBUG)
    #define LOG_MASK_PRIORITY LOG_DEBUG
@@ -29,60 +24,17 @@
 #endif
 
 #define POLL_TIMEOUT 1
-#define MAX_POLL_FDS 1
-#define MAX_EXCLUDES 64
-#define MAX_PATH_LEN 4096
 
-#define HASH_TABLE_SIZE 100
-#define HASH_TABLE_MEMORY_SIZE 15000
-
-char error_path[MAX_PATH_LEN+1];
-FILE * error_file = NULL;
+// the library reports its own errors in error.txt, but the signal
+// handlers are set up before there is a watcher to do it
+static char error_path_buffer[PATH_MAX+1];
+static FILE * error_file_p;
 
 static int alive = 1;
-static int flush_now;
+static int reload_now;
+static int stats_now;
+static int trace_now;
 static int error; // holder for errno
-static int inotify_fd = -1;
-static char temp_path_buffer[MAX_PATH_LEN];
-static int notification_count = 0;
-static uint32_t watch_mask =
-      IN_CLOSE_WRITE 
-    | IN_CREATE 
-    | IN_DELETE 
-    | IN_MOVED_FROM 
-    | IN_MOVED_TO 
-    | IN_DELETE_SELF 
-    | IN_MOVE_SELF;
-
-static uint32_t create_dir_mask = IN_CREATE | IN_ISDIR;
-
-struct EVENT_NAME_LOOKUP_ENTRY {
-   uint32_t       event_id;
-   const char  *  event_name; 
-};
-
-static struct EVENT_NAME_LOOKUP_ENTRY event_name_lookup[] = {
-   {IN_CLOSE_WRITE,  "IN_CLOSE_WRITE"},
-   {IN_CREATE,       "IN_CREATE"},
-   {IN_DELETE,       "IN_DELETE "},
-   {IN_MOVED_FROM,   "IN_MOVED_FROM"},
-   {IN_MOVED_TO,     "IN_MOVED_TO"},
-   {IN_DELETE_SELF,  "IN_DELETE_SELF"},
-   {IN_MOVE_SELF,    "IN_MOVE_SELF"},
-   {0,               "*unknown*"}
-}; // event_name_lookup
-
-struct EXCLUDE_ENTRY {
-   const char  * path_p;
-   size_t        path_len;
-}; 
-static struct EXCLUDE_ENTRY excludes[MAX_EXCLUDES];
-static int exclude_count = 0;
-static uint32_t prev_cookie = 0;
-static char parent_path_buffer[MAX_PATH_LEN+1];
-
-static const char dir_watcher_ignore[] = "__dir_watcher_ignore";
-static hash_cache * hc;
 
 //-----------------------------------------------------------------------------
 static void sigterm_handler(int signal_num) {
@@ -93,757 +45,46 @@ static void sigterm_handler(int signal_num) {
 } // sigterm_handler
 
 //-----------------------------------------------------------------------------
-static void sigalrm_handler(int signal_num) {
+static void sighup_handler(int signal_num) {
 //-----------------------------------------------------------------------------
-   if (SIGALRM == signal_num) {
-      flush_now = 1;
+   if (SIGHUP == signal_num) {
+      reload_now = 1;
    }
-} // sigalrm_handler
+} // sighup_handler
 
 //-----------------------------------------------------------------------------
-static const char * event_name(uint32_t event_mask) {
+static void sigusr1_handler(int signal_num) {
 //-----------------------------------------------------------------------------
-   int i;
-
-   for (i=0; 1; i++) {
-      if (0 == event_name_lookup[i].event_id) {
-         return event_name_lookup[i].event_name;
-      }
-      if (event_name_lookup[i].event_id & event_mask) {
-         return event_name_lookup[i].event_name;
-      } 
-   } // for
-
-} // event_name
+   if (SIGUSR1 == signal_num) {
+      stats_now = 1;
+   }
+} // sigusr1_handler
 
 //-----------------------------------------------------------------------------
-static void initialize_error_path(const char * notify_dir_p) {
+static void sigusr2_handler(int signal_num) {
 //-----------------------------------------------------------------------------
-   int bytes_written;
-
-   bytes_written = snprintf(
-      error_path, 
-      sizeof error_path,
-      "%s/error.txt",
-      notify_dir_p
-   );
-   if (sizeof error_path == bytes_written) {
-      syslog(LOG_ERR, "error path overflow %s", notify_dir_p);
-      exit(1);
+   if (SIGUSR2 == signal_num) {
+      trace_now = 1;
    }
-
-} // initialize_temp_path
+} // sigusr2_handler
 
 //-----------------------------------------------------------------------------
-static void initialize_temp_path(const char * notify_dir_p) {
+static void initialize_error_path(const char * notify_dir_p) {
 //-----------------------------------------------------------------------------
    int bytes_written;
 
    bytes_written = snprintf(
-      temp_path_buffer, 
-      sizeof temp_path_buffer,
-      "%s/temp",
+      error_path_buffer, 
+      sizeof error_path_buffer,
+      "%s/error.txt",
       notify_dir_p
    );
-   if (sizeof temp_path_buffer == bytes_written) {
-      syslog(LOG_ERR, "temp path overflow %s", notify_dir_p);
-      error_file = fopen(error_path, "w");
-      fprintf(error_file, "temp path overflow %s\n", notify_dir_p);
-      fclose(error_file);
+   if (bytes_written >= (int) sizeof error_path_buffer) {
+      syslog(LOG_ERR, "error path overflow %s", notify_dir_p);
       exit(1);
    }
 
-} // initialize_temp_path
-
-//-----------------------------------------------------------------------------
-static void remove_pruned_wds(WD_LIST_NODE_P wd_list_p) {
-//-----------------------------------------------------------------------------
-   WD_LIST_NODE_P node_p;
-
-   for (node_p=wd_list_p; node_p != NULL; node_p=node_p->next_p) {
-      if (-1 == inotify_rm_watch(inotify_fd, node_p->wd)) {
-         error = errno;
-         if (EINVAL == error) {
-            // this one is already gone
-            continue;
-         }
-         syslog(
-            LOG_ERR, 
-            "inotify_rm_watch failed %d (%d) %s",
-            node_p->wd, 
-            error, 
-            strerror(error)
-         );
-         error_file = fopen(error_path, "w");
-         fprintf(
-            error_file, 
-            "inotify_rm_watch failed %d (%d) %s\n",
-            node_p->wd, 
-            error, 
-            strerror(error)
-         );
-         fclose(error_file);
-         exit(15);
-      } 
-   }
-
-} // remove_pruned_wds
-
-//-----------------------------------------------------------------------------
-static void prune_wd_and_clean_up(int wd) {
-//-----------------------------------------------------------------------------
-   WD_LIST_NODE_P wd_list_p;
-
-   // We prune the whole tree (if any) below this directory, because
-   // the paths are no longer right. We assume that we will build new 
-   // entries when we get IN_MOVED_TO
-   wd_list_p = prune_wd_directory(wd);
-   remove_pruned_wds(wd_list_p);
-   release_wd_list(wd_list_p);
-
-} // prune_wd_and_clean_up
-
-//-----------------------------------------------------------------------------
-static int add_watch(int parent_wd, const char * path) {
-//-----------------------------------------------------------------------------
-   int i;
-   int watch_descriptor;
-   SUB_DIR_NODE_P head_p;
-   SUB_DIR_NODE_P node_p;
-   char path_buffer[MAX_PATH_LEN];
-   int chars_stored;
-   int pathlen;
-
-   for (i=0; i < exclude_count; i++) {
-      if (0 == strncmp(path, excludes[i].path_p, excludes[i].path_len)) {
-         if((path[excludes[i].path_len]=='\0') || (path[excludes[i].path_len]=='/')) {
-            syslog(
-               LOG_NOTICE, 
-               "excluding path %s (%s)",
-               path,
-               excludes[i].path_p
-            );
-            return -1; 
-         }
-      }
-   }
-
-   pathlen = strlen(path);
-   if(pathlen >= sizeof(dir_watcher_ignore) - 1) {
-      if (strcmp(path + pathlen - sizeof(dir_watcher_ignore) + 1, dir_watcher_ignore) == 0) {
-         syslog(LOG_NOTICE, "ignoring path %s", path);
-         return -1;
-      }
-   }
-
-   watch_descriptor = find_directory_wd(path);
-   if (watch_descriptor != NULL_WD) {
-      syslog(LOG_NOTICE, "Already watching %s wd=%d", path, watch_descriptor);
-      return -1;
-   }
-
-   syslog(LOG_DEBUG, "watching %s", path);
-   watch_descriptor = inotify_add_watch(inotify_fd, path, watch_mask);
-   if (-1 == watch_descriptor) {
-      error = errno;
-
-      // latency: the directory may no longer be there by the time we get
-      // around to adding this watch. So we ignore errno 2, and hope
-      // we pick him up in another event, like move
-      if (ENOENT == error) {
-         syslog(
-            LOG_NOTICE, 
-            "inotify_add_watch ignoring missing directory %s", 
-            path 
-         );
-         return -1;
-      }
-
-      if (EACCES == error) {
-         syslog(
-            LOG_NOTICE, 
-            "inotify_add_watch ignoring directory (access denied) %s", 
-            path 
-         );
-         return -1;
-      }
-
-      syslog(
-         LOG_ERR, 
-         "inotify_add_watch %s %d %s", 
-         path, 
-         error, 
-         strerror(error)
-      );
-      error_file = fopen(error_path, "w");
-      fprintf(
-         error_file, 
-         "inotify_add_watch %s %d %s\n", 
-         path, 
-         error, 
-         strerror(error)
-      );
-      fclose(error_file);
-      exit(2);
-   }
-
-   // 2020-07-06 dougfort -- In some cases, such as a top level directory 
-   // being moved, we may already have a watch on the old directory.
-   // In this case, inotify_add_watch returns the existing wd, which we
-   // want to get rid of.
-   if (wd_directory_exists(watch_descriptor)) {
-      syslog(
-         LOG_WARNING, "wd exists for new watch, pruning it %d, %s", 
-         watch_descriptor,
-         path
-      );
-      prune_wd_and_clean_up(watch_descriptor);
-   }
-
-   if (0 != add_wd_directory(watch_descriptor, parent_wd, path)) {
-      syslog(
-         LOG_ERR, 
-         "Unable to add wd_directory %d %s",
-         watch_descriptor,
-         path
-      );
-      error_file = fopen(error_path, "w");
-      fprintf(
-         error_file, 
-         "Unable to add wd_directory %d %s\n",
-         watch_descriptor,
-         path
-      );
-      fclose(error_file);
-      exit(3);
-   }
-
-   // now recursively add a watch for every directory below this path
-   // we're counting on the filesystem to limit the depth
-   head_p = list_sub_dirs(path);
-   for (node_p = head_p; node_p != NULL; node_p = node_p->next_p) {
-      chars_stored = snprintf(
-         path_buffer, 
-         sizeof path_buffer,
-         "%s/%s",
-         path,
-         node_p->d_name
-      );
-      if (chars_stored >= sizeof path_buffer) {
-         syslog(LOG_ERR, "path buffer overlow %s", path_buffer);
-         error_file = fopen(error_path, "w");
-         fprintf(error_file, "path buffer overlow %s\n", path_buffer);
-         fclose(error_file);
-         exit(4);
-      }
-      add_watch(watch_descriptor, path_buffer);
-   } // for
-
-   release_sub_dir_list(head_p);
-
-   return 0; //success
-
-} // add_watch
-
-//-----------------------------------------------------------------------------
-static void load_excludes(const char *exclude_path) {
-//-----------------------------------------------------------------------------
-   FILE * exclude_file_p;
-   char read_buffer[MAX_PATH_LEN];
-   char * char_p;
-
-   exclude_file_p = fopen(exclude_path, "r");
-   if (NULL == exclude_file_p) {
-      error = errno;
-      syslog(LOG_ERR, "fopen %s %d %s", exclude_path, error, strerror(error));
-      error_file = fopen(error_path, "w");
-      fprintf(
-         error_file, "fopen %s %d %s\n", exclude_path, error, strerror(error)
-      );
-      fclose(error_file);
-      exit(5);
-   }
-
-   while (1) {
-      fgets(read_buffer, MAX_PATH_LEN, exclude_file_p);
-
-      if (ferror(exclude_file_p)) {
-         error = errno;
-         syslog(
-            LOG_ERR, "fgets %s %d %s", exclude_path, error, strerror(error)
-         );
-         error_file = fopen(error_path, "w");
-         fprintf(
-            error_file, "fgets %s %d %s\n", exclude_path, error, strerror(error)
-         );
-         fclose(error_file);
-         exit(6);
-      }
-
-      if (feof(exclude_file_p)) {
-         break;
-      }
-
-      if (exclude_count >= MAX_EXCLUDES) {
-         syslog(LOG_ERR, "Too many excludes");
-         error_file = fopen(error_path, "w");
-         fprintf(error_file, "Too many excludes\n");
-         fclose(error_file);
-         exit(7);
-      }
-
-      char_p = strchr(read_buffer, '\n');
-      if (char_p != NULL) {
-         *char_p = '\0';
-      }
-
-      syslog(LOG_INFO, "exclude path: '%s'", read_buffer);
-
-      excludes[exclude_count].path_len = strlen(read_buffer);
-      excludes[exclude_count].path_p = calloc(
-         excludes[exclude_count].path_len+1, sizeof(char)
-      );
-
-      if (NULL == excludes[exclude_count].path_p) {
-         syslog(LOG_ERR, "calloc failed");
-         error_file = fopen(error_path, "w");
-         fprintf(error_file, "calloc failed\n");
-         fclose(error_file);
-         exit(8);
-      }
-
-      strcpy((char *) excludes[exclude_count].path_p, read_buffer);
-      exclude_count++;
-
-   } // while
-   
-   fclose(exclude_file_p);   
-
-} // load_excludes
-
-//-----------------------------------------------------------------------------
-static void load_top_level_paths(const char *config_path) {
-//-----------------------------------------------------------------------------
-   FILE * config_file_p;
-   char read_buffer[MAX_PATH_LEN];
-   char * char_p;
-
-   config_file_p = fopen(config_path, "r");
-   if (NULL == config_file_p) {
-      error = errno;
-      syslog(LOG_ERR, "fopen %s %d %s", config_path, error, strerror(error));
-      error_file = fopen(error_path, "w");
-      fprintf(
-         error_file, "fopen %s %d %s\n", config_path, error, strerror(error)
-      );
-      fclose(error_file);
-      exit(9);
-   }
-
-   while (1) {
-      fgets(read_buffer, MAX_PATH_LEN, config_file_p);
-
-      if (ferror(config_file_p)) {
-         error = errno;
-         syslog(LOG_ERR, "fgets %s %d %s", config_path, error, strerror(error));
-         error_file = fopen(error_path, "w");
-         fprintf(
-            error_file, "fgets %s %d %s\n", config_path, error, strerror(error)
-         );
-         fclose(error_file);
-         exit(10);
-      }
-
-      if (feof(config_file_p)) {
-         break;
-      }
-
-      char_p = strchr(read_buffer, '\n');
-      if (char_p != NULL) {
-         *char_p = '\0';
-      }
-
-      syslog(LOG_INFO, "top level path: '%s'", read_buffer);
-
-      if (add_watch(NULL_WD, read_buffer) != 0) {
-         syslog(LOG_WARNING, "Can't watch toplevel path %s", read_buffer);
-      }
-
-   } // while
-   
-   fclose(config_file_p);   
-
-} // load_top_level_paths
-
-//-----------------------------------------------------------------------------
-static FILE * open_temp_file(void) {
-//-----------------------------------------------------------------------------
-   FILE * temp_file_p;
-
-   temp_file_p = fopen(temp_path_buffer, "w");
-   if (NULL == temp_file_p) {
-      error = errno;
-      syslog(
-         LOG_ERR, 
-         "open(temp_file %s %d %s", 
-         temp_path_buffer, 
-         error, 
-         strerror(error)
-      );
-      error_file = fopen(error_path, "w");
-      fprintf(
-         error_file, 
-         "open(temp_file %s %d %s\n", 
-         temp_path_buffer, 
-         error, 
-         strerror(error)
-      );
-      fclose(error_file);
-      exit(11);
-   }
-
-   return temp_file_p;
-
-} // open_temp_file
-
-//-----------------------------------------------------------------------------
-static void rename_temp_file(const char * notify_dir_p) {
-//-----------------------------------------------------------------------------
-   char notification_path_buffer[MAX_PATH_LEN];
-   int bytes_written;
-
-   notification_count++;
-   bytes_written = snprintf(
-      notification_path_buffer, 
-      sizeof notification_path_buffer,
-      "%s/%08d.txt",
-      notify_dir_p,
-      notification_count
-   );
-   if (sizeof notification_path_buffer == bytes_written) {
-      syslog(
-         LOG_ERR, 
-         "notification path overflow %s", 
-         notification_path_buffer
-      );
-      error_file = fopen(error_path, "w");
-      fprintf(
-         error_file, 
-         "notification path overflow %s\n", 
-         notification_path_buffer
-      );
-      fclose(error_file);
-      exit(12);
-   }
-
-   if (-1 == rename(temp_path_buffer, notification_path_buffer)) {
-      error = errno;
-      syslog(
-         LOG_ERR, 
-         "rename(temp_file %s %s %d %s", 
-         temp_path_buffer, 
-         notification_path_buffer,
-         error, 
-         strerror(error)
-      );
-      error_file = fopen(error_path, "w");
-      fprintf(
-         error_file, 
-         "rename(temp_file %s %s %d %s\n", 
-         temp_path_buffer, 
-         notification_path_buffer,
-         error, 
-         strerror(error)
-      );
-      fclose(error_file);
-      exit(13);
-   }
-
-} // rename_temp_file
-
-//-----------------------------------------------------------------------------
-static int watch_new_directory(
-   int parent_wd, 
-   const char * parent, 
-   const char * name
-) {
-//-----------------------------------------------------------------------------
-   char new_dir_path_buffer[MAX_PATH_LEN];
-   int bytes_written;
-
-   bytes_written = snprintf(
-      new_dir_path_buffer, 
-      sizeof new_dir_path_buffer,
-      "%s/%s",
-      parent,
-      name
-   );
-
-   if (sizeof new_dir_path_buffer == bytes_written) {
-      syslog(
-         LOG_ERR, 
-         "new dir path overflow %s", 
-         new_dir_path_buffer
-      );
-      error_file = fopen(error_path, "w");
-      fprintf(
-         error_file, 
-         "new dir path overflow %s\n", 
-         new_dir_path_buffer
-      );
-      fclose(error_file);
-      exit(14);
-   }
-
-   return add_watch(parent_wd, new_dir_path_buffer);
-
-} // watch_new_directory
-
-//-----------------------------------------------------------------------------
-static void prune_moved_directory(
-   const char * parent_dir_p, 
-   const char * dir_name_p
-) {
-//-----------------------------------------------------------------------------
-   char path_buffer[MAX_PATH_LEN];
-   int chars_stored;
-   int moved_dir_wd;
-
-   chars_stored = snprintf(
-      path_buffer, 
-      sizeof path_buffer,
-      "%s/%s",
-      parent_dir_p,
-      dir_name_p
-   );
-   if (chars_stored >= sizeof path_buffer) {
-      syslog(LOG_ERR, "path buffer overlow %s", path_buffer);
-      error_file = fopen(error_path, "w");
-      fprintf(error_file, "path buffer overlow %s\n", path_buffer);
-      fclose(error_file);
-      exit(4);
-   }
-
-   moved_dir_wd = find_directory_wd(path_buffer);
-
-   // 2010-09-14 dougfort -- don't treat not finding the wd as an error
-   // We assume that the directory was created and then renamed before
-   // we had a chance to create watch descriptors.
-   if (NULL_WD != moved_dir_wd) {
-      prune_wd_and_clean_up(moved_dir_wd);
-   }
-
-} // prune_moved_directory
-
-//-----------------------------------------------------------------------------
-static void flush_hash_cache(const char * notify_dir_p, const char * parent_dir_p) {
-//-----------------------------------------------------------------------------
-   FILE * temp_file_p;
-   unsigned int pos;
-   unsigned int count;
-   unsigned int datalen;
-   char * str;
-   
-
-   temp_file_p = NULL;
-
-   if(parent_dir_p != NULL) {
-      temp_file_p = open_temp_file();
-      fprintf(temp_file_p, "%s\n", parent_dir_p);
-   }
-   for(pos = 0; (pos = hash_cache_iter(hc, pos, &count, (void**)&str, &datalen))!=0;) {
-      if(temp_file_p == NULL) {
-          temp_file_p = open_temp_file();
-      }
-      fprintf(temp_file_p, "%s\n", str);
-      if (ferror(temp_file_p)) {
-      error = errno;
-         syslog(
-            LOG_ERR, 
-            "fprintf(temp_file %s %d %s", 
-            temp_path_buffer, 
-            error, 
-            strerror(error)
-         );
-         error_file = fopen(error_path, "w");
-         fprintf(
-            error_file, 
-            "fprintf(temp_file %s %d %s\n", 
-            temp_path_buffer, 
-            error, 
-            strerror(error)
-         );
-         fclose(error_file);
-         exit(20);
-      }
-   }
-   hash_cache_clear(hc);
-   if (temp_file_p != NULL) {
-      fclose(temp_file_p);
-      rename_temp_file(notify_dir_p);
-   }
-}
-
-
-//-----------------------------------------------------------------------------
-static void process_inotify_events(const char * notify_dir_p) {
-//-----------------------------------------------------------------------------
-   const struct inotify_event * event_p;
-   const char * parent_dir_p;
-   int prev_wd;
-
-   parent_dir_p = NULL;
-   prev_wd = NULL_WD;
-   for (
-      event_p=start_iter_inotify(inotify_fd); 
-      event_p != NULL; 
-      event_p=next_iter_inotify(inotify_fd)
-   ) {
-      
-      // slightly memoize the path lookup
-      if (event_p->wd != prev_wd) {
-        memset(parent_path_buffer, '\0', sizeof parent_path_buffer);
-        parent_dir_p = find_wd_directory(
-           event_p->wd,
-           parent_path_buffer,
-           MAX_PATH_LEN
-        );
-        prev_wd = event_p->wd;
-      }
-
-      syslog(
-         LOG_DEBUG, 
-         "%05d event 0x%08X %s %d at %s parent %s",
-         event_p->wd, 
-         event_p->mask,
-         event_name(event_p->mask),
-         event_p->cookie,
-         event_p->len > 0 ? event_p->name : "*noname*", 
-         NULL == parent_dir_p ? "*none*" : parent_dir_p
-      );
-
-      if (event_p->mask & IN_Q_OVERFLOW) {
-         syslog(LOG_ERR, "Inotify queue overflow");
-         error_file = fopen(error_path, "w");
-         fprintf(error_file, "Inotify queue overflow\n");
-         fclose(error_file);
-
-         // we abort because this means we have lost some events,
-         // we need to force Monitor to make a ful pass
-         exit(16);
-
-      } else if (create_dir_mask == (event_p->mask & create_dir_mask)) {
-
-         // due to latency, we may not be able to watch this directory; 
-         // for example it may have moved by the time we get this event
-         if (
-            watch_new_directory(event_p->wd, parent_dir_p, event_p->name) != 0
-         ) {
-            continue;
-         } 
-
-      } else if (event_p->mask & IN_DELETE_SELF) {
-
-         // This should be picked up by its parent. 
-         // If they delete the whole top level directory,
-         // we will miss it.
-         continue;
-
-      } else if (event_p->mask & IN_MOVE_SELF) {
-
-         // this event should already be reported after IN_MOVE_FROM
-         // and IN_MOVE_TO
-         continue;
-
-      } else if (event_p->mask & IN_MOVED_FROM) {
-         
-         // we assume that IN_MOVED_FROM always hits before IN_MOVED_TO
-         // this may not be valid so we check the cookie
-         if (event_p->cookie == prev_cookie) {
-            syslog(LOG_ERR, "cookie %d from IN_MOVED_TO present", prev_cookie);
-            error_file = fopen(error_path, "w");
-            fprintf(
-               error_file, "cookie %d from IN_MOVED_TO present\n", prev_cookie
-            );
-            fclose(error_file);
-            exit(17);
-         }
-         prev_cookie = event_p->cookie;
-
-         if (event_p->mask & IN_ISDIR) {
-            prune_moved_directory(parent_dir_p, event_p->name);
-         }
-
-      } else if (event_p->mask & IN_MOVED_TO) {
-         
-         // we assume that IN_MOVED_FROM always hits before IN_MOVED_TO
-         // this may not be valid so we check the cookie
-         // 2009-03-25 dougfort -- we accept the missing cookie, because
-         // we may be moving in from somewhere we're not watching
-         if (event_p->cookie != prev_cookie) {
-            syslog(
-               LOG_NOTICE, 
-               "cookie %d from IN_MOVED_FROM absent %d %s %s",
-               event_p->cookie, 
-               prev_cookie,
-               parent_dir_p,
-               event_p->name
-            );
-         }
-         prev_cookie = event_p->cookie;
-
-         if (event_p->mask & IN_ISDIR) {
-            // We treat this as an add, create a whole new watch structure.
-            // We assume the old one was cleared out when we got IN_MOVED_FROM
-            watch_new_directory(event_p->wd, parent_dir_p, event_p->name);
-         }
-
-      } else if (event_p->mask & IN_IGNORED) {
-
-         // we get this event after kernel has removed a watch descriptor
-         // we need to make sure we do not keep carrying it around
-         syslog(LOG_DEBUG, "ignored event removing wd");
-         remove_wd_directory(event_p->wd);
-
-         continue;
-      } else if (event_p->mask & IN_CREATE) {
-         // We can ignore the creation of files, because we'll see when
-         // they are closed later. This prevents us from backing up a
-         // non-finished download and then later (when the file is closed)
-         // the rest of the file.
-         continue;
-      }
-
-      if (NULL == parent_dir_p) {
-         syslog(
-            LOG_ERR, 
-            "unable to find parent %05d event 0x%08X %s %d at %s",
-            event_p->wd, 
-            event_p->mask,
-            event_name(event_p->mask),
-            event_p->cookie,
-            event_p->len > 0 ? event_p->name : "*noname*" 
-         );
-         // Let's ignore this. This might have happend:
-         // Latency: 
-         // mkdir temp ; mv old_dir temp/new_dir 
-         // rmdir temp/new_dir ; rmdir temp
-         // -> now we start working:
-         //    * we observe the creation of "temp", but there is no "temp",
-         //      so we don't create a watcher
-         //    * Then we observe the move of "new_dir" but the parent in not
-         //      in our database
-         // This happens when firefox clears its caches.
-         continue;
-      }
-
-      if(0 == hash_cache_add(hc, (void*)parent_dir_p, strlen(parent_dir_p)+1)) {
-         flush_hash_cache(notify_dir_p, parent_dir_p);
-      }
-
-   } // for
-
-} // process_inotify_events
+} // initialize_error_path
 
 //-----------------------------------------------------------------------------
 // arguments:
@@ -853,14 +94,12 @@ static void process_inotify_events(const char * notify_dir_p) {
 // argv[4] - notification directory
 int main(int argc, char **argv) {
 //-----------------------------------------------------------------------------
-   struct pollfd poll_fds[MAX_POLL_FDS];
-   int poll_fd_count;
+   struct pollfd poll_fd;
    int poll_result;
    int parent_pid;
    const char * config_file_path;
    const char * exclude_file_path;
    const char * notification_path;
-   struct itimerval timer;
  
    umask(0077);
 
@@ -876,102 +115,115 @@ int main(int argc, char **argv) {
    parent_pid           = atoi(argv[1]);
    config_file_path     = argv[2];
    exclude_file_path    = argv[3];
-   notification_path     = argv[4];
+   notification_path    = argv[4];
 
    initialize_error_path(notification_path);
 
    if (signal(SIGTERM, sigterm_handler) == SIG_ERR) {
       error = errno;
       syslog(LOG_ERR, "signal(SIGTERM %d %s", error, strerror(error));
-      error_file = fopen(error_path, "w");
-      fprintf(error_file, "signal(SIGTERM %d %s\n", error, strerror(error));
-      fclose(error_file);
+      error_file_p = fopen(error_path_buffer, "w");
+      fprintf(error_file_p, "signal(SIGTERM %d %s\n", error, strerror(error));
+      fclose(error_file_p);
       exit(22);
    }
 
-   if (signal(SIGALRM, sigalrm_handler) == SIG_ERR) {
+   if (signal(SIGHUP, sighup_handler) == SIG_ERR) {
       error = errno;
-      syslog(LOG_ERR, "signal(SIGALRM %d %s", error, strerror(error));
-      error_file = fopen(error_path, "w");
-      fprintf(error_file, "signal(SIGLRM %d %s\n", error, strerror(error));
-      fclose(error_file);
-      exit(25);
+      syslog(LOG_ERR, "signal(SIGHUP %d %s", error, strerror(error));
+      error_file_p = fopen(error_path_buffer, "w");
+      fprintf(error_file_p, "signal(SIGHUP %d %s\n", error, strerror(error));
+      fclose(error_file_p);
+      exit(28);
    }
 
-   hc = new_hash_cache(HASH_TABLE_SIZE,HASH_TABLE_MEMORY_SIZE);
-   if(hc == NULL) {
-      syslog(LOG_ERR, "hash_cache init error");
-      error_file = fopen(error_path, "w");
-      fprintf(error_file, "hash_cache init error");
-      fclose(error_file);
-      exit(26);
+   if (signal(SIGUSR1, sigusr1_handler) == SIG_ERR) {
+      error = errno;
+      syslog(LOG_ERR, "signal(SIGUSR1 %d %s", error, strerror(error));
+      error_file_p = fopen(error_path_buffer, "w");
+      fprintf(error_file_p, "signal(SIGUSR1 %d %s\n", error, strerror(error));
+      fclose(error_file_p);
+      exit(31);
    }
 
-   timer.it_interval.tv_usec = 0;
-   timer.it_interval.tv_sec = 3;
-   timer.it_value.tv_usec = 0;
-   timer.it_value.tv_sec = 3;
-   flush_now = 0;
-   setitimer(ITIMER_REAL,&timer,NULL);
-
-   wd_directory_initialize();
-
-   initialize_temp_path(notification_path);
-
-   inotify_fd = inotify_init();
-   if (-1 == inotify_fd) {
+   if (signal(SIGUSR2, sigusr2_handler) == SIG_ERR) {
       error = errno;
-      syslog(LOG_ERR, "inotify_init %d %s", error, strerror(error));
-      error_file = fopen(error_path, "w");
-      fprintf(error_file, "inotify_init %d %s\n", error, strerror(error));
-      fclose(error_file);
+      syslog(LOG_ERR, "signal(SIGUSR2 %d %s", error, strerror(error));
+      error_file_p = fopen(error_path_buffer, "w");
+      fprintf(error_file_p, "signal(SIGUSR2 %d %s\n", error, strerror(error));
+      fclose(error_file_p);
+      exit(31);
+   }
+
+   if (
+      dirwatcher_create_from_files(
+         notification_path, 
+         config_file_path, 
+         exclude_file_path
+      ) != 0
+   ) {
+      error = errno;
+      syslog(LOG_ERR, "dirwatcher_create %d %s", error, strerror(error));
+      error_file_p = fopen(error_path_buffer, "w");
+      fprintf(error_file_p, "dirwatcher_create %d %s\n", error, strerror(error));
+      fclose(error_file_p);
       exit(23);
    }
 
-   load_excludes(exclude_file_path);
-   load_top_level_paths(config_file_path);
-
-   poll_fds[0].fd = inotify_fd;
-   poll_fds[0].events = POLLIN;
-   poll_fd_count = 1;
+   poll_fd.fd = dirwatcher_poll_fd();
+   poll_fd.events = POLLIN;
 
    syslog(LOG_DEBUG, "start poll loop");
    while (alive) {
-      poll_result = poll(poll_fds, poll_fd_count, POLL_TIMEOUT * 1000);
+      poll_result = poll(&poll_fd, 1, POLL_TIMEOUT * 1000);
+      if (-1 == poll_result) {
+         error = errno;
+         if (EINTR != error) {
+            syslog(LOG_ERR, "poll %d %s", error, strerror(error));
+            error_file_p = fopen(error_path_buffer, "w");
+            fprintf(error_file_p, "poll %d %s\n", error, strerror(error));
+            fclose(error_file_p);
+            exit(24);
+         }
+      }
 
       if (parent_pid != getppid()) {
           syslog(LOG_NOTICE, "Parent process gone: stopping");
           alive = 0;
       }
-      if(flush_now) {
-          flush_now = 0;
-          flush_hash_cache(notification_path, NULL);
+      if (stats_now) {
+          stats_now = 0;
+          dirwatcher_write_stats();
+      }
+      if (trace_now) {
+          trace_now = 0;
+          dirwatcher_dump_trace();
+      }
+
+      // the events waiting, and a notification every 3 seconds
+      if (alive && (dirwatcher_dispatch() != 0)) {
+         error = errno;
+         syslog(LOG_ERR, "dirwatcher_dispatch %d %s", error, strerror(error));
+         error_file_p = fopen(error_path_buffer, "w");
+         fprintf(
+            error_file_p, 
+            "dirwatcher_dispatch %d %s\n", 
+            error, 
+            strerror(error)
+         );
+         fclose(error_file_p);
+         exit(24);
       }
 
-      switch (poll_result) {
-         case -1: // error
-            error = errno;
-            if (EINTR != error) {
-               syslog(LOG_ERR, "poll %d %s", error, strerror(error));
-               error_file = fopen(error_path, "w");
-               fprintf(error_file, "poll %d %s\n", error, strerror(error));
-               fclose(error_file);
-               exit(24);
-            }
-            break;
-         case 0: // timeout
-            break;
-         default:
-            if (alive && (poll_fds[0].revents & POLLIN)) {
-               process_inotify_events(notification_path);
-            }
-      } // switch
+      if (alive && reload_now) {
+         reload_now = 0;
+         dirwatcher_reload();
+      }
 
    } // while (alive)
    syslog(LOG_DEBUG, "end poll loop");
 
-   close(inotify_fd);
-   wd_directory_close();
+   dirwatcher_destroy();
    syslog(LOG_NOTICE, "Program terminates normally");
    closelog();
    return 0;
@@ -0,0 +1,317 @@
+//-----------------------------------------------------------------------------
+// metrics.c
+//
+// low overhead runtime counters and histograms, published as a text file
+//-----------------------------------------------------------------------------
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <syslog.h>
+#include <time.h>
+
+#include "metrics.h"
+
+// Log-linear buckets: values below 4 have a bucket each, above that every
+// power of 2 is split into 4 buckets, so a percentile read from the buckets
+// is within 25% of the real value.
+#define SUB_BUCKET_BITS 2
+#define SUB_BUCKETS (1 << SUB_BUCKET_BITS)
+#define HISTOGRAM_BUCKETS (SUB_BUCKETS * 63)
+
+struct HISTOGRAM {
+   uint64_t count;
+   uint64_t sum;
+   uint64_t max;
+   uint64_t buckets[HISTOGRAM_BUCKETS];
+};
+
+uint64_t metric_counters[METRIC_COUNTER_COUNT];
+
+static struct HISTOGRAM histograms[METRIC_HISTOGRAM_COUNT];
+static uint64_t event_type_counts[32];
+static uint64_t start_ns = 0;
+
+static const char * counter_names[METRIC_COUNTER_COUNT] = {
+   "watches_added",
+   "event_batches",
+   "events",
+   "events_temp_file",
+   "events_unchanged",
+   "events_rate_limited",
+   "events_no_parent",
+   "events_deleted",
+   "events_already_marked",
+   "directories_excluded",
+   "directories_marked",
+   "directories_moved",
+   "directories_unmarked",
+   "flushes",
+   "notifications_written",
+   "notifications_coalesced",
+   "directories_notified",
+   "crawl_directories",
+   "crawl_nanoseconds",
+   "reloads",
+   "barriers"
+};
+
+static const char * histogram_names[METRIC_HISTOGRAM_COUNT] = {
+   "events_per_batch",
+   "queue_bytes",
+   "hash_cache_fill",
+   "wd_lookup_ns",
+   "flush_ns",
+   "writer_wait_ns",
+   "queue_wait_ns",
+   "read_ns",
+   "batch_lookup_ns",
+   "batch_ns",
+   "debounce_ns",
+   "read_to_publish_ns"
+};
+
+// indexed by bit number in the inotify event mask
+static const char * event_type_names[32] = {
+   "IN_ACCESS",
+   "IN_MODIFY",
+   "IN_ATTRIB",
+   "IN_CLOSE_WRITE",
+   "IN_CLOSE_NOWRITE",
+   "IN_OPEN",
+   "IN_MOVED_FROM",
+   "IN_MOVED_TO",
+   "IN_CREATE",
+   "IN_DELETE",
+   "IN_DELETE_SELF",
+   "IN_MOVE_SELF",
+   NULL,
+   "IN_UNMOUNT",
+   "IN_Q_OVERFLOW",
+   "IN_IGNORED",
+   NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+   NULL, NULL, NULL, NULL, NULL, NULL,
+   "IN_ISDIR",
+   NULL
+};
+
+//-----------------------------------------------------------------------------
+static unsigned int bucket_index(uint64_t value) {
+//-----------------------------------------------------------------------------
+   unsigned int exponent;
+
+   if (value < SUB_BUCKETS) {
+      return (unsigned int) value;
+   }
+
+   exponent = 63 - __builtin_clzll(value);
+   return
+      SUB_BUCKETS * (exponent - SUB_BUCKET_BITS + 1) +
+      (unsigned int) ((value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+
+} // bucket_index
+
+//-----------------------------------------------------------------------------
+static uint64_t bucket_lower_bound(unsigned int index) {
+//-----------------------------------------------------------------------------
+   unsigned int exponent;
+
+   if (index < SUB_BUCKETS) {
+      return index;
+   }
+
+   exponent = index / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+   return
+      (uint64_t) (SUB_BUCKETS + index % SUB_BUCKETS) <<
+      (exponent - SUB_BUCKET_BITS);
+
+} // bucket_lower_bound
+
+//-----------------------------------------------------------------------------
+// the value below which fraction of the recorded values fall, to the
+// resolution of the buckets
+static uint64_t histogram_percentile(
+   const struct HISTOGRAM * histogram_p,
+   double fraction
+) {
+//-----------------------------------------------------------------------------
+   uint64_t target;
+   uint64_t seen;
+   uint64_t upper;
+   unsigned int i;
+
+   if (0 == histogram_p->count) {
+      return 0;
+   }
+
+   // the rank of the value, rounded up
+   target = (uint64_t) (fraction * histogram_p->count);
+   if ((target < fraction * histogram_p->count) || (0 == target)) {
+      target++;
+   }
+
+   seen = 0;
+   for (i=0; i < HISTOGRAM_BUCKETS; i++) {
+      seen += histogram_p->buckets[i];
+      if (seen >= target) {
+         upper =
+            (i+1 < HISTOGRAM_BUCKETS) ? bucket_lower_bound(i+1) - 1 : UINT64_MAX;
+         return upper < histogram_p->max ? upper : histogram_p->max;
+      }
+   }
+
+   return histogram_p->max;
+
+} // histogram_percentile
+
+//-----------------------------------------------------------------------------
+void metrics_initialize(void) {
+//-----------------------------------------------------------------------------
+   start_ns = metric_now_ns();
+} // metrics_initialize
+
+//-----------------------------------------------------------------------------
+void metric_count_event(uint32_t mask) {
+//-----------------------------------------------------------------------------
+   METRIC_INCREMENT(METRIC_EVENTS);
+   while (mask != 0) {
+      event_type_counts[__builtin_ctz(mask)]++;
+      mask &= mask - 1;
+   }
+} // metric_count_event
+
+//-----------------------------------------------------------------------------
+void metric_record(enum METRIC_HISTOGRAM histogram, uint64_t value) {
+//-----------------------------------------------------------------------------
+   struct HISTOGRAM * histogram_p = &histograms[histogram];
+
+   histogram_p->count++;
+   histogram_p->sum += value;
+   if (value > histogram_p->max) {
+      histogram_p->max = value;
+   }
+   histogram_p->buckets[bucket_index(value)]++;
+
+} // metric_record
+
+//-----------------------------------------------------------------------------
+uint64_t metric_now_ns(void) {
+//-----------------------------------------------------------------------------
+   struct timespec now;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+
+} // metric_now_ns
+
+//-----------------------------------------------------------------------------
+static void write_histogram(
+   FILE * file_p,
+   const char * name_p,
+   const struct HISTOGRAM * histogram_p
+) {
+//-----------------------------------------------------------------------------
+   unsigned int i;
+
+   fprintf(file_p, "%s.count %llu\n", name_p, (unsigned long long) histogram_p->count);
+   fprintf(file_p, "%s.sum %llu\n", name_p, (unsigned long long) histogram_p->sum);
+   fprintf(file_p, "%s.max %llu\n", name_p, (unsigned long long) histogram_p->max);
+   fprintf(
+      file_p,
+      "%s.p50 %llu\n",
+      name_p,
+      (unsigned long long) histogram_percentile(histogram_p, 0.50)
+   );
+   fprintf(
+      file_p,
+      "%s.p99 %llu\n",
+      name_p,
+      (unsigned long long) histogram_percentile(histogram_p, 0.99)
+   );
+
+   // the non empty buckets, by lower bound, for anyone who wants more
+   for (i=0; i < HISTOGRAM_BUCKETS; i++) {
+      if (histogram_p->buckets[i] != 0) {
+         fprintf(
+            file_p,
+            "%s.bucket.%llu %llu\n",
+            name_p,
+            (unsigned long long) bucket_lower_bound(i),
+            (unsigned long long) histogram_p->buckets[i]
+         );
+      }
+   }
+
+} // write_histogram
+
+//-----------------------------------------------------------------------------
+int write_metrics_file(
+   const char * path,
+   const char * temp_path,
+   METRIC_GAUGE_WRITER gauge_writer_p
+) {
+//-----------------------------------------------------------------------------
+   FILE * file_p;
+   int error;
+   int i;
+
+   file_p = fopen(temp_path, "w");
+   if (NULL == file_p) {
+      error = errno;
+      syslog(LOG_WARNING, "fopen %s %d %s", temp_path, error, strerror(error));
+      return -1;
+   }
+
+   fprintf(file_p, "version 1\n");
+   fprintf(file_p, "time %ld\n", (long) time(NULL));
+   fprintf(
+      file_p,
+      "uptime_seconds %llu\n",
+      (unsigned long long) ((metric_now_ns() - start_ns) / 1000000000ULL)
+   );
+
+   for (i=0; i < METRIC_COUNTER_COUNT; i++) {
+      fprintf(
+         file_p,
+         "%s %llu\n",
+         counter_names[i],
+         (unsigned long long) metric_counters[i]
+      );
+   }
+
+   for (i=0; i < 32; i++) {
+      if ((event_type_names[i] != NULL) && (event_type_counts[i] != 0)) {
+         fprintf(
+            file_p,
+            "events.%s %llu\n",
+            event_type_names[i],
+            (unsigned long long) event_type_counts[i]
+         );
+      }
+   }
+
+   for (i=0; i < METRIC_HISTOGRAM_COUNT; i++) {
+      write_histogram(file_p, histogram_names[i], &histograms[i]);
+   }
+
+   if (gauge_writer_p != NULL) {
+      gauge_writer_p(file_p);
+   }
+
+   if (ferror(file_p)) {
+      error = errno;
+      syslog(LOG_WARNING, "fprintf %s %d %s", temp_path, error, strerror(error));
+      fclose(file_p);
+      return -1;
+   }
+   fclose(file_p);
+
+   if (rename(temp_path, path) != 0) {
+      error = errno;
+      syslog(LOG_WARNING, "rename %s %d %s", path, error, strerror(error));
+      return -1;
+   }
+
+   return 0;
+
+} // write_metrics_file
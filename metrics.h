@@ -0,0 +1,90 @@
+//-----------------------------------------------------------------------------
+// metrics.h
+//
+// low overhead runtime counters and histograms, published as a text file
+//
+// Counters are plain increments and histograms are a bucket increment, so
+// keeping them costs next to nothing. The text is only formatted when
+// write_metrics_file is called.
+//-----------------------------------------------------------------------------
+#if !defined(__METRICS_H)
+#define __METRICS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+enum METRIC_COUNTER {
+   METRIC_WATCHES_ADDED,
+   METRIC_EVENT_BATCHES,
+   METRIC_EVENTS,
+   METRIC_EVENTS_TEMP_FILE,        // dropped by the temp file patterns
+   METRIC_EVENTS_UNCHANGED,        // dropped by the fingerprint cache
+   METRIC_EVENTS_RATE_LIMITED,     // IN_MODIFY held back
+   METRIC_EVENTS_NO_PARENT,        // wd no longer known
+   METRIC_EVENTS_DELETED,          // in a directory deleted in the same batch
+   METRIC_EVENTS_ALREADY_MARKED,   // in a directory already marked this batch
+   METRIC_DIRECTORIES_EXCLUDED,
+   METRIC_DIRECTORIES_MARKED,      // hash_cache_add calls
+   METRIC_DIRECTORIES_MOVED,       // renames kept without a crawl
+   METRIC_DIRECTORIES_UNMARKED,    // deleted before they were reported
+   METRIC_FLUSHES,
+   METRIC_NOTIFICATIONS_WRITTEN,
+   METRIC_NOTIFICATIONS_COALESCED, // flushes held back for a lagging consumer
+   METRIC_DIRECTORIES_NOTIFIED,
+   METRIC_CRAWL_DIRECTORIES,
+   METRIC_CRAWL_NANOSECONDS,
+   METRIC_RELOADS,
+   METRIC_BARRIERS,
+   METRIC_COUNTER_COUNT
+};
+
+enum METRIC_HISTOGRAM {
+   METRIC_EVENTS_PER_BATCH,
+   METRIC_QUEUE_BYTES,             // FIONREAD before each read
+   METRIC_HASH_CACHE_FILL,         // distinct directories at flush
+   METRIC_WD_LOOKUP_NS,
+   METRIC_FLUSH_NS,                // writing and renaming a notification
+   METRIC_WRITER_WAIT_NS,          // a flush waiting for the writer thread
+
+   // the stages between the kernel queueing an event and the notification
+   // file being renamed into place, for each read batch
+   METRIC_QUEUE_WAIT_NS,           // poll wakeup to read
+   METRIC_READ_NS,                 // the read itself
+   METRIC_BATCH_LOOKUP_NS,         // wd to path lookups in the batch
+   METRIC_BATCH_NS,                // read to the end of processing the batch
+   METRIC_DEBOUNCE_NS,             // first directory marked to flush
+   METRIC_READ_TO_PUBLISH_NS,      // oldest read to the notification rename
+   METRIC_HISTOGRAM_COUNT
+};
+
+extern uint64_t metric_counters[METRIC_COUNTER_COUNT];
+
+#define METRIC_INCREMENT(counter) (metric_counters[counter]++)
+#define METRIC_ADD(counter, value) (metric_counters[counter] += (value))
+
+// note the start time, for uptime
+void metrics_initialize(void);
+
+// count an inotify event under each event type bit in its mask
+void metric_count_event(uint32_t mask);
+
+// add a value to a histogram
+void metric_record(enum METRIC_HISTOGRAM histogram, uint64_t value);
+
+// monotonic clock in nanoseconds, for timing things
+uint64_t metric_now_ns(void);
+
+// a value which is not a counter or histogram, such as the number of
+// directories being watched, is supplied by the caller when publishing
+typedef void (* METRIC_GAUGE_WRITER)(FILE * file_p);
+
+// write all metrics as 'name value' lines to temp_path, then rename it
+// to path, so a reader never sees a partial file
+// returns 0 for success
+int write_metrics_file(
+   const char * path,
+   const char * temp_path,
+   METRIC_GAUGE_WRITER gauge_writer_p
+);
+
+#endif // !defined(__METRICS_H)
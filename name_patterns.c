@@ -0,0 +1,229 @@
+//-----------------------------------------------------------------------------
+// name_patterns.c
+//
+// a compiled set of file or directory name patterns
+//-----------------------------------------------------------------------------
+#include <fnmatch.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "name_patterns.h"
+
+#define INITIAL_LITERAL_SLOTS 64
+
+struct NAME_PATTERNS {
+   // open addressing hash set of plain names, size is a power of 2
+   char        ** literals;
+   unsigned int   literal_slots;
+   unsigned int   literal_count;
+
+   // patterns containing glob characters, matched in order
+   char        ** globs;
+   unsigned int   glob_slots;
+   unsigned int   glob_count;
+};
+
+//-----------------------------------------------------------------------------
+static uint32_t name_hash(const char * name_p) {
+//-----------------------------------------------------------------------------
+   // FNV-1a
+   uint32_t hash = 2166136261u;
+
+   for (; *name_p != '\0'; name_p++) {
+      hash ^= (unsigned char) *name_p;
+      hash *= 16777619u;
+   }
+
+   return hash;
+
+} // name_hash
+
+//-----------------------------------------------------------------------------
+static int is_glob(const char * pattern_p) {
+//-----------------------------------------------------------------------------
+   return strpbrk(pattern_p, "*?[") != NULL;
+} // is_glob
+
+//-----------------------------------------------------------------------------
+static char ** find_literal_slot(
+   char ** literals,
+   unsigned int slots,
+   const char * name_p
+) {
+//-----------------------------------------------------------------------------
+   unsigned int i;
+
+   for (
+      i = name_hash(name_p) & (slots - 1);
+      literals[i] != NULL;
+      i = (i + 1) & (slots - 1)
+   ) {
+      if (0 == strcmp(literals[i], name_p)) {
+         break;
+      }
+   }
+
+   return &literals[i];
+
+} // find_literal_slot
+
+//-----------------------------------------------------------------------------
+static int grow_literals(NAME_PATTERNS_P patterns_p) {
+//-----------------------------------------------------------------------------
+   char ** new_literals;
+   unsigned int new_slots;
+   unsigned int i;
+
+   new_slots = patterns_p->literal_slots * 2;
+   new_literals = calloc(new_slots, sizeof(char *));
+   if (NULL == new_literals) {
+      return -1;
+   }
+
+   for (i=0; i < patterns_p->literal_slots; i++) {
+      if (patterns_p->literals[i] != NULL) {
+         *find_literal_slot(new_literals, new_slots, patterns_p->literals[i]) =
+            patterns_p->literals[i];
+      }
+   }
+
+   free(patterns_p->literals);
+   patterns_p->literals = new_literals;
+   patterns_p->literal_slots = new_slots;
+
+   return 0;
+
+} // grow_literals
+
+//-----------------------------------------------------------------------------
+NAME_PATTERNS_P new_name_patterns(void) {
+//-----------------------------------------------------------------------------
+   NAME_PATTERNS_P patterns_p;
+
+   patterns_p = calloc(1, sizeof(struct NAME_PATTERNS));
+   if (NULL == patterns_p) {
+      return NULL;
+   }
+
+   patterns_p->literal_slots = INITIAL_LITERAL_SLOTS;
+   patterns_p->literals = calloc(patterns_p->literal_slots, sizeof(char *));
+   if (NULL == patterns_p->literals) {
+      free(patterns_p);
+      return NULL;
+   }
+
+   return patterns_p;
+
+} // new_name_patterns
+
+//-----------------------------------------------------------------------------
+int add_name_pattern(NAME_PATTERNS_P patterns_p, const char * pattern_p) {
+//-----------------------------------------------------------------------------
+   char ** slot_p;
+   char ** new_globs;
+   char * copy_p;
+
+   if (is_glob(pattern_p)) {
+      if (patterns_p->glob_count == patterns_p->glob_slots) {
+         new_globs = realloc(
+            patterns_p->globs,
+            (patterns_p->glob_slots + 8) * sizeof(char *)
+         );
+         if (NULL == new_globs) {
+            return -1;
+         }
+         patterns_p->globs = new_globs;
+         patterns_p->glob_slots += 8;
+      }
+      copy_p = strdup(pattern_p);
+      if (NULL == copy_p) {
+         return -1;
+      }
+      patterns_p->globs[patterns_p->glob_count++] = copy_p;
+      return 0;
+   }
+
+   // keep the table at most half full
+   if ((patterns_p->literal_count + 1) * 2 > patterns_p->literal_slots) {
+      if (grow_literals(patterns_p) != 0) {
+         return -1;
+      }
+   }
+
+   slot_p = find_literal_slot(
+      patterns_p->literals,
+      patterns_p->literal_slots,
+      pattern_p
+   );
+   if (*slot_p != NULL) {
+      // duplicate
+      return 0;
+   }
+
+   copy_p = strdup(pattern_p);
+   if (NULL == copy_p) {
+      return -1;
+   }
+   *slot_p = copy_p;
+   patterns_p->literal_count++;
+
+   return 0;
+
+} // add_name_pattern
+
+//-----------------------------------------------------------------------------
+int name_pattern_count(NAME_PATTERNS_P patterns_p) {
+//-----------------------------------------------------------------------------
+   return patterns_p->literal_count + patterns_p->glob_count;
+} // name_pattern_count
+
+//-----------------------------------------------------------------------------
+const char * match_name_patterns(NAME_PATTERNS_P patterns_p, const char * name_p) {
+//-----------------------------------------------------------------------------
+   char ** slot_p;
+   unsigned int i;
+
+   if (patterns_p->literal_count > 0) {
+      slot_p = find_literal_slot(
+         patterns_p->literals,
+         patterns_p->literal_slots,
+         name_p
+      );
+      if (*slot_p != NULL) {
+         return *slot_p;
+      }
+   }
+
+   for (i=0; i < patterns_p->glob_count; i++) {
+      if (0 == fnmatch(patterns_p->globs[i], name_p, 0)) {
+         return patterns_p->globs[i];
+      }
+   }
+
+   return NULL;
+
+} // match_name_patterns
+
+//-----------------------------------------------------------------------------
+void release_name_patterns(NAME_PATTERNS_P patterns_p) {
+//-----------------------------------------------------------------------------
+   unsigned int i;
+
+   if (NULL == patterns_p) {
+      return;
+   }
+
+   for (i=0; i < patterns_p->literal_slots; i++) {
+      free(patterns_p->literals[i]);
+   }
+   free(patterns_p->literals);
+
+   for (i=0; i < patterns_p->glob_count; i++) {
+      free(patterns_p->globs[i]);
+   }
+   free(patterns_p->globs);
+
+   free(patterns_p);
+
+} // release_name_patterns
@@ -0,0 +1,33 @@
+//-----------------------------------------------------------------------------
+// name_patterns.h
+//
+// a compiled set of file or directory name patterns
+//
+// Plain names (no '*', '?' or '[') are kept in a hash set, so matching
+// against them costs the same however many there are. Names with glob
+// characters are matched with fnmatch(3).
+//-----------------------------------------------------------------------------
+#if !defined(__NAME_PATTERNS_H)
+#define __NAME_PATTERNS_H
+
+typedef struct NAME_PATTERNS * NAME_PATTERNS_P;
+
+// create an empty pattern set
+// returns NULL on failure
+NAME_PATTERNS_P new_name_patterns(void);
+
+// add a pattern to the set
+// return 0 for success, nonzero for failure
+int add_name_pattern(NAME_PATTERNS_P patterns_p, const char * pattern_p);
+
+// the number of patterns in the set
+int name_pattern_count(NAME_PATTERNS_P patterns_p);
+
+// match a single name (no '/') against the set
+// returns the matching pattern, or NULL if no pattern matches
+const char * match_name_patterns(NAME_PATTERNS_P patterns_p, const char * name_p);
+
+// release a pattern set, does nothing if patterns_p is NULL
+void release_name_patterns(NAME_PATTERNS_P patterns_p);
+
+#endif // !defined(__NAME_PATTERNS_H)
@@ -0,0 +1,676 @@
+//-----------------------------------------------------------------------------
+// notification_writer.c
+//
+// write notification files on a thread of their own
+//-----------------------------------------------------------------------------
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "notification_writer.h"
+#include "metrics.h"
+
+#define MAX_PATH_LEN 4096
+
+// how often we look for the last notification to be taken while there is
+// a backlog
+#define BACKLOG_CHECK_SECONDS 1
+
+// the metrics recorded here (notifications_written, flush_ns,
+// read_to_publish_ns and notifications_coalesced) are recorded by nothing
+// else, so the two threads never update the same one. The stats file may
+// catch one of them half updated, which costs it no more than the latest
+// value.
+
+static pthread_t writer_thread;
+static pthread_mutex_t writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_cond;
+
+static const char * temp_path = NULL;
+
+// guarded by writer_mutex: the loop hands over a cache by setting
+// pending_hc, and the writer sets it back to NULL once it is written
+static hash_cache * pending_hc = NULL;
+static hash_cache * writer_hc = NULL;
+static char first_path[MAX_PATH_LEN+1];
+static uint64_t pending_read_ns = 0;
+static int running = 0;
+static int backlog_wanted = 0;     // by notification_writer_wait
+static int backlog_entries = 0;
+
+// When the writer can't write a notification, it stops, and leaves the
+// exit status and the reason for the loop to fail with. writer_status is
+// guarded by writer_mutex, and error_text is only written before it is set.
+static int writer_status = 0;
+static int failed_status = 0;     // the writer's own, until it is published
+static char error_text[2 * MAX_PATH_LEN];
+
+// Each stream is a sequence of notification files of its own, in its own
+// directory. What we are handed is sorted into the streams' backlogs, and
+// each backlog with something in it is written as the stream's next file.
+//
+// The consumer removes each notification file once it has read it. We
+// watch the oldest file of a stream we haven't seen taken, and if it is
+// still there lag_ns after it was written, the stream's consumer has fallen
+// behind: its backlog is held until it has taken the files before it,
+// instead of making more files for it to go through. The backlog grows
+// with the number of dirty directories, not with time.
+// The streams are the writer's own: the loop only reads last_number, once
+// notification_writer_wait has returned.
+struct STREAM {
+   char         dir_path[MAX_PATH_LEN];
+   int          last_number;
+   int          watch_number;       // 0 for none
+   hash_cache * backlog_hc;
+   unsigned int backlog_hash_size;
+   unsigned int backlog_mem_size;
+   uint64_t     backlog_read_ns;    // the oldest read in the backlog
+};
+static struct STREAM streams[NOTIFICATION_MAX_STREAMS];
+static int stream_count = 1;
+static uint64_t lag_ns = 0;
+
+//-----------------------------------------------------------------------------
+// record why the writer has to stop, and the exit status for the loop
+// returns -1
+static int writer_failed(int status, const char * format_p, ...) {
+//-----------------------------------------------------------------------------
+   va_list args;
+
+   va_start(args, format_p);
+   vsnprintf(error_text, sizeof error_text, format_p, args);
+   va_end(args);
+   failed_status = status;
+
+   return -1;
+
+} // writer_failed
+
+//-----------------------------------------------------------------------------
+// returns NULL on failure
+static FILE * open_temp_file(void) {
+//-----------------------------------------------------------------------------
+   FILE * temp_file_p;
+   int error;
+
+   temp_file_p = fopen(temp_path, "w");
+   if (NULL == temp_file_p) {
+      error = errno;
+      writer_failed(
+         11, "open(temp_file %s %d %s", temp_path, error, strerror(error)
+      );
+   }
+
+   return temp_file_p;
+
+} // open_temp_file
+
+//-----------------------------------------------------------------------------
+// fill path_buffer (MAX_PATH_LEN) with the path of the stream's file number
+// returns 0 on success, -1 if the path doesn't fit
+static int notification_path(
+   const struct STREAM * stream_p,
+   int number,
+   char * path_buffer
+) {
+//-----------------------------------------------------------------------------
+   int bytes_written;
+
+   bytes_written = snprintf(
+      path_buffer, MAX_PATH_LEN, "%s/%08d.txt", stream_p->dir_path, number
+   );
+   if (bytes_written >= MAX_PATH_LEN) {
+      return -1;
+   }
+
+   return 0;
+
+} // notification_path
+
+//-----------------------------------------------------------------------------
+// returns 0 on success
+static int rename_temp_file(struct STREAM * stream_p) {
+//-----------------------------------------------------------------------------
+   char notification_path_buffer[MAX_PATH_LEN];
+   int error;
+
+   if (
+      notification_path(
+         stream_p, stream_p->last_number + 1, notification_path_buffer
+      ) != 0
+   ) {
+      return writer_failed(
+         12, "notification path overflow %s", notification_path_buffer
+      );
+   }
+
+   if (-1 == rename(temp_path, notification_path_buffer)) {
+      error = errno;
+      return writer_failed(
+         13,
+         "rename(temp_file %s %s %d %s",
+         temp_path,
+         notification_path_buffer,
+         error,
+         strerror(error)
+      );
+   }
+   METRIC_INCREMENT(METRIC_NOTIFICATIONS_WRITTEN);
+
+   stream_p->last_number++;
+   if (0 == stream_p->watch_number) {
+      stream_p->watch_number = stream_p->last_number;
+   }
+
+   return 0;
+
+} // rename_temp_file
+
+//-----------------------------------------------------------------------------
+// returns 0 on success
+static int write_path(FILE * temp_file_p, const char * path_p) {
+//-----------------------------------------------------------------------------
+   int error;
+
+   fprintf(temp_file_p, "%s\n", path_p);
+   if (ferror(temp_file_p)) {
+      error = errno;
+      return writer_failed(
+         20, "fprintf(temp_file %s %d %s", temp_path, error, strerror(error)
+      );
+   }
+
+   return 0;
+
+} // write_path
+
+//-----------------------------------------------------------------------------
+// returns 0 on success
+static int write_backlog(struct STREAM * stream_p) {
+//-----------------------------------------------------------------------------
+   FILE * temp_file_p;
+   unsigned int pos;
+   unsigned int count;
+   unsigned int datalen;
+   char * str;
+   uint64_t start_ns;
+
+   start_ns = metric_now_ns();
+
+   temp_file_p = open_temp_file();
+   if (NULL == temp_file_p) {
+      return -1;
+   }
+   for(pos = 0; (pos = hash_cache_iter(stream_p->backlog_hc, pos, &count, (void**)&str, &datalen))!=0;) {
+      if (write_path(temp_file_p, str) != 0) {
+         fclose(temp_file_p);
+         return -1;
+      }
+   }
+   fclose(temp_file_p);
+   if (rename_temp_file(stream_p) != 0) {
+      return -1;
+   }
+   hash_cache_clear(stream_p->backlog_hc);
+
+   metric_record(METRIC_FLUSH_NS, metric_now_ns() - start_ns);
+   if (stream_p->backlog_read_ns != 0) {
+      metric_record(
+         METRIC_READ_TO_PUBLISH_NS, 
+         metric_now_ns() - stream_p->backlog_read_ns
+      );
+      stream_p->backlog_read_ns = 0;
+   }
+
+   return 0;
+
+} // write_backlog
+
+//-----------------------------------------------------------------------------
+static int consumer_lagging(struct STREAM * stream_p) {
+//-----------------------------------------------------------------------------
+   char watch_path_buffer[MAX_PATH_LEN];
+   struct stat stat_buffer;
+   struct timespec now;
+   uint64_t written_ns;
+   uint64_t now_ns;
+
+   if ((0 == lag_ns) || (0 == stream_p->watch_number)) {
+      return 0;
+   }
+
+   // once the watched file is taken, move on to the next one still there:
+   // the consumer takes them in order, so that is the oldest it hasn't read
+   for (;;) {
+      if (
+         notification_path(
+            stream_p, stream_p->watch_number, watch_path_buffer
+         ) != 0
+      ) {
+         stream_p->watch_number = 0;
+         return 0;
+      }
+      if (0 == stat(watch_path_buffer, &stat_buffer)) {
+         break;
+      }
+      if (stream_p->watch_number >= stream_p->last_number) {
+         stream_p->watch_number = 0;
+         return 0;
+      }
+      stream_p->watch_number++;
+   }
+
+   // the file is written just before it is renamed into place, so its
+   // modification time is when we wrote it
+   clock_gettime(CLOCK_REALTIME, &now);
+   now_ns = (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+   written_ns = (uint64_t) stat_buffer.st_mtim.tv_sec * 1000000000ULL
+      + stat_buffer.st_mtim.tv_nsec;
+   if (now_ns < written_ns) {
+      return 0;
+   }
+
+   return now_ns - written_ns >= lag_ns;
+
+} // consumer_lagging
+
+//-----------------------------------------------------------------------------
+// key is a directory as the loop keeps it: with more than one stream, it
+// starts with the stream number
+// returns 0 on success
+static int add_to_backlog(const char * key_p, uint64_t read_ns) {
+//-----------------------------------------------------------------------------
+   struct STREAM * stream_p;
+   const char * path_p;
+   hash_cache * new_hc;
+   unsigned int pos;
+   unsigned int count;
+   unsigned int datalen;
+   char * str;
+
+   stream_p = &streams[0];
+   path_p = key_p;
+   if (stream_count > 1) {
+      stream_p = &streams[NOTIFICATION_KEY_STREAM(key_p)];
+      path_p = key_p + 1;
+   }
+
+   while (0 == hash_cache_add(stream_p->backlog_hc, (void*)path_p, strlen(path_p)+1)) {
+      // full: move it all to one twice the size
+      new_hc = new_hash_cache(
+         stream_p->backlog_hash_size * 2, stream_p->backlog_mem_size * 2
+      );
+      if (NULL == new_hc) {
+         return writer_failed(
+            41,
+            "unable to grow the notification backlog to %u bytes", 
+            stream_p->backlog_mem_size * 2
+         );
+      }
+      for(pos = 0; (pos = hash_cache_iter(stream_p->backlog_hc, pos, &count, (void**)&str, &datalen))!=0;) {
+         hash_cache_add(new_hc, str, datalen);
+      }
+      free_hash_cache(stream_p->backlog_hc);
+      stream_p->backlog_hc = new_hc;
+      stream_p->backlog_hash_size *= 2;
+      stream_p->backlog_mem_size *= 2;
+   }
+
+   if (
+      (0 == stream_p->backlog_read_ns) || 
+      ((read_ns != 0) && (read_ns < stream_p->backlog_read_ns))
+   ) {
+      stream_p->backlog_read_ns = read_ns;
+   }
+
+   return 0;
+
+} // add_to_backlog
+
+//-----------------------------------------------------------------------------
+// returns 0 on success
+static int sort_into_backlogs(
+   hash_cache * hc,
+   const char * first_key_p,
+   uint64_t read_ns
+) {
+//-----------------------------------------------------------------------------
+   unsigned int pos;
+   unsigned int count;
+   unsigned int datalen;
+   char * str;
+
+   if ((first_key_p[0] != '\0') && (add_to_backlog(first_key_p, read_ns) != 0)) {
+      return -1;
+   }
+   for(pos = 0; (pos = hash_cache_iter(hc, pos, &count, (void**)&str, &datalen))!=0;) {
+      if (add_to_backlog(str, read_ns) != 0) {
+         return -1;
+      }
+   }
+   hash_cache_clear(hc);
+
+   return 0;
+
+} // sort_into_backlogs
+
+//-----------------------------------------------------------------------------
+// write the backlogs whose consumers are keeping up, or all of them
+// returns the number of directories left in the backlogs, -1 on failure
+static int write_backlogs(int all, int handed_over) {
+//-----------------------------------------------------------------------------
+   struct STREAM * stream_p;
+   int entries;
+   int left;
+
+   left = 0;
+   for (stream_p=streams; stream_p < streams + stream_count; stream_p++) {
+      entries = hash_cache_entries(stream_p->backlog_hc);
+      if (0 == entries) {
+         continue;
+      }
+      if (all || (! consumer_lagging(stream_p))) {
+         if (write_backlog(stream_p) != 0) {
+            return -1;
+         }
+         continue;
+      }
+      if (handed_over) {
+         METRIC_INCREMENT(METRIC_NOTIFICATIONS_COALESCED);
+      }
+      left += entries;
+   }
+
+   return left;
+
+} // write_backlogs
+
+//-----------------------------------------------------------------------------
+static void wait_for_work(void) {
+//-----------------------------------------------------------------------------
+   struct timespec until;
+
+   if (0 == backlog_entries) {
+      pthread_cond_wait(&writer_cond, &writer_mutex);
+      return;
+   }
+
+   // come back to see whether the consumer has caught up
+   clock_gettime(CLOCK_MONOTONIC, &until);
+   until.tv_sec += BACKLOG_CHECK_SECONDS;
+   pthread_cond_timedwait(&writer_cond, &writer_mutex, &until);
+
+} // wait_for_work
+
+//-----------------------------------------------------------------------------
+static void * writer_main(void * arg_p) {
+//-----------------------------------------------------------------------------
+   hash_cache * hc;
+   int flush_backlog;
+   int entries;
+
+   pthread_mutex_lock(&writer_mutex);
+   for (;;) {
+      if (writer_status != 0) {
+         // failed: nothing more is written, the loop is on its way out
+         if (! running) {
+            break;
+         }
+         pthread_cond_wait(&writer_cond, &writer_mutex);
+         continue;
+      }
+      if (running && (NULL == pending_hc) && (! backlog_wanted)) {
+         wait_for_work();
+      }
+      if ((! running) && (NULL == pending_hc) && (0 == backlog_entries)) {
+         break;
+      }
+      hc = pending_hc;
+      flush_backlog = backlog_wanted || (! running);
+
+      // the loop leaves these alone until pending_hc is NULL again
+      pthread_mutex_unlock(&writer_mutex);
+
+      entries = -1;
+      if ((NULL == hc) || (0 == sort_into_backlogs(hc, first_path, pending_read_ns))) {
+         entries = write_backlogs(flush_backlog, hc != NULL);
+      }
+
+      pthread_mutex_lock(&writer_mutex);
+      if (hc != NULL) {
+         hash_cache_clear(hc);
+         writer_hc = hc;
+         pending_hc = NULL;
+      }
+      if (flush_backlog) {
+         backlog_wanted = 0;
+      }
+      if (entries < 0) {
+         writer_status = failed_status;
+      } else {
+         backlog_entries = entries;
+      }
+      pthread_cond_broadcast(&writer_cond);
+   }
+   pthread_mutex_unlock(&writer_mutex);
+
+   return NULL;
+
+} // writer_main
+
+//-----------------------------------------------------------------------------
+int notification_writer_start(
+   const char * notify_dir_p,
+   const char * temp_path_p,
+   unsigned int hash_size,
+   unsigned int mem_size,
+   int lag_seconds,
+   int streams_wanted
+) {
+//-----------------------------------------------------------------------------
+   struct STREAM * stream_p;
+   pthread_condattr_t cond_attr;
+   sigset_t all_signals;
+   sigset_t old_signals;
+   int result;
+   int i;
+
+   temp_path = temp_path_p;
+   lag_ns = (uint64_t) lag_seconds * 1000000000ULL;
+   stream_count = streams_wanted;
+   pending_hc = NULL;
+   writer_status = 0;
+   failed_status = 0;
+
+   writer_hc = new_hash_cache(hash_size, mem_size);
+   if (NULL == writer_hc) {
+      return -1;
+   }
+
+   // with one stream, the files go in the notification directory itself
+   for (i=0; i < stream_count; i++) {
+      stream_p = &streams[i];
+      memset(stream_p, 0, sizeof(struct STREAM));
+      if (1 == stream_count) {
+         snprintf(stream_p->dir_path, MAX_PATH_LEN, "%s", notify_dir_p);
+      } else {
+         snprintf(stream_p->dir_path, MAX_PATH_LEN, "%s/%02d", notify_dir_p, i);
+         if ((mkdir(stream_p->dir_path, 0777) != 0) && (errno != EEXIST)) {
+            syslog(
+               LOG_ERR, 
+               "mkdir %s %d %s", 
+               stream_p->dir_path, 
+               errno, 
+               strerror(errno)
+            );
+            return -1;
+         }
+      }
+      stream_p->backlog_hc = new_hash_cache(hash_size, mem_size);
+      if (NULL == stream_p->backlog_hc) {
+         return -1;
+      }
+      stream_p->backlog_hash_size = hash_size;
+      stream_p->backlog_mem_size = mem_size;
+   }
+
+   // the backlog check must not be upset by the clock being set
+   pthread_condattr_init(&cond_attr);
+   pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+   pthread_cond_init(&writer_cond, &cond_attr);
+   pthread_condattr_destroy(&cond_attr);
+
+   // the signals are for the event loop's poll
+   running = 1;
+   sigfillset(&all_signals);
+   pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+   result = pthread_create(&writer_thread, NULL, writer_main, NULL);
+   pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+   if (result != 0) {
+      running = 0;
+      return -1;
+   }
+
+   return 0;
+
+} // notification_writer_start
+
+//-----------------------------------------------------------------------------
+int notification_writer_swap(
+   hash_cache ** hc_pp,
+   const char * first_path_p,
+   uint64_t read_ns
+) {
+//-----------------------------------------------------------------------------
+   uint64_t wait_start_ns;
+   int status;
+
+   pthread_mutex_lock(&writer_mutex);
+   if ((pending_hc != NULL) && (0 == writer_status)) {
+      wait_start_ns = metric_now_ns();
+      while ((pending_hc != NULL) && (0 == writer_status)) {
+         pthread_cond_wait(&writer_cond, &writer_mutex);
+      }
+      metric_record(METRIC_WRITER_WAIT_NS, metric_now_ns() - wait_start_ns);
+   }
+   status = writer_status;
+   if (status != 0) {
+      pthread_mutex_unlock(&writer_mutex);
+      return status;
+   }
+
+   pending_hc = *hc_pp;
+   *hc_pp = writer_hc;
+   writer_hc = NULL;
+   if (NULL == first_path_p) {
+      first_path[0] = '\0';
+   } else {
+      strncpy(first_path, first_path_p, MAX_PATH_LEN);
+   }
+   pending_read_ns = read_ns;
+   pthread_cond_broadcast(&writer_cond);
+   pthread_mutex_unlock(&writer_mutex);
+
+   return 0;
+
+} // notification_writer_swap
+
+//-----------------------------------------------------------------------------
+int notification_writer_wait(void) {
+//-----------------------------------------------------------------------------
+   int status;
+
+   pthread_mutex_lock(&writer_mutex);
+   if ((backlog_entries > 0) && (0 == writer_status)) {
+      backlog_wanted = 1;
+      pthread_cond_broadcast(&writer_cond);
+   }
+   while (((pending_hc != NULL) || backlog_wanted) && (0 == writer_status)) {
+      pthread_cond_wait(&writer_cond, &writer_mutex);
+   }
+   status = writer_status;
+   pthread_mutex_unlock(&writer_mutex);
+
+   return status;
+
+} // notification_writer_wait
+
+//-----------------------------------------------------------------------------
+int notification_writer_status(void) {
+//-----------------------------------------------------------------------------
+   int status;
+
+   pthread_mutex_lock(&writer_mutex);
+   status = writer_status;
+   pthread_mutex_unlock(&writer_mutex);
+
+   return status;
+
+} // notification_writer_status
+
+//-----------------------------------------------------------------------------
+const char * notification_writer_error(void) {
+//-----------------------------------------------------------------------------
+   return error_text;
+} // notification_writer_error
+
+//-----------------------------------------------------------------------------
+int notification_writer_last_number(int stream) {
+//-----------------------------------------------------------------------------
+   int last_number;
+
+   pthread_mutex_lock(&writer_mutex);
+   last_number = streams[stream].last_number;
+   pthread_mutex_unlock(&writer_mutex);
+
+   return last_number;
+
+} // notification_writer_last_number
+
+//-----------------------------------------------------------------------------
+int notification_writer_backlog(void) {
+//-----------------------------------------------------------------------------
+   int entries;
+
+   pthread_mutex_lock(&writer_mutex);
+   entries = backlog_entries;
+   pthread_mutex_unlock(&writer_mutex);
+
+   return entries;
+
+} // notification_writer_backlog
+
+//-----------------------------------------------------------------------------
+int notification_writer_stop(void) {
+//-----------------------------------------------------------------------------
+   int i;
+
+   if (! running) {
+      return 0;
+   }
+
+   pthread_mutex_lock(&writer_mutex);
+   running = 0;
+   pthread_cond_broadcast(&writer_cond);
+   pthread_mutex_unlock(&writer_mutex);
+   pthread_join(writer_thread, NULL);
+   pthread_cond_destroy(&writer_cond);
+
+   free_hash_cache(writer_hc);
+   writer_hc = NULL;
+   for (i=0; i < stream_count; i++) {
+      free_hash_cache(streams[i].backlog_hc);
+      streams[i].backlog_hc = NULL;
+   }
+
+   return writer_status;
+
+} // notification_writer_stop
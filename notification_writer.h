@@ -0,0 +1,81 @@
+//-----------------------------------------------------------------------------
+// notification_writer.h
+//
+// write notification files on a thread of their own
+//
+// The event loop marks dirty directories in a hash cache. To flush, it
+// hands the cache to the writer and goes on with the writer's empty one,
+// so a slow notification directory doesn't hold up reading events. The
+// loop only waits if the writer is still busy with the cache before.
+// While the consumer is behind, the writer holds on to what it is given
+// rather than piling up notification files.
+//
+// If a notification can't be written, the writer stops, and the next call
+// which would wait for it returns the exit status the watcher should fail
+// with: notification_writer_error says why.
+//
+// The notifications may be split into streams, each a numbered sequence
+// of its own, so that several consumers can work through them at once.
+//-----------------------------------------------------------------------------
+#if !defined(__NOTIFICATION_WRITER_H__)
+#define __NOTIFICATION_WRITER_H__
+
+#include <stdint.h>
+
+#include "hash_cache.h"
+
+#define NOTIFICATION_MAX_STREAMS 32
+
+// with more than one stream, the directories handed over are keyed by a
+// byte holding the stream number plus one, followed by the path
+#define NOTIFICATION_KEY_STREAM(key_p) ((unsigned char) (key_p)[0] - 1)
+
+// start the writer thread, with hash caches the size of the event
+// loop's. Each notification is written to temp_path_p and renamed to
+// <notify_dir_p>/<number>.txt, or with more than one stream to
+// <notify_dir_p>/<stream>/<number>.txt. The paths must stay valid until
+// notification_writer_stop. Once a stream's notification has been left
+// unread for lag_seconds, what follows for it is merged into a backlog
+// until its consumer catches up (0 for never).
+// returns 0 on success
+int notification_writer_start(
+   const char * notify_dir_p,
+   const char * temp_path_p,
+   unsigned int hash_size,
+   unsigned int mem_size,
+   int lag_seconds,
+   int stream_count
+);
+
+// hand over *hc_pp to be written, with first_path_p (if not NULL) above
+// its directories. read_ns is when the oldest event in it was read.
+// *hc_pp is given the writer's cache, empty, once it has finished with it.
+// returns 0, or the exit status if the writer has failed
+int notification_writer_swap(
+   hash_cache ** hc_pp,
+   const char * first_path_p,
+   uint64_t read_ns
+);
+
+// wait until everything handed over is written, backlog included
+// returns 0, or the exit status if the writer has failed
+int notification_writer_wait(void);
+
+// 0, or the exit status if the writer has failed
+int notification_writer_status(void);
+
+// why the writer failed
+const char * notification_writer_error(void);
+
+// the number of the stream's last notification file, 0 for none
+// only to be called once notification_writer_wait has returned
+int notification_writer_last_number(int stream);
+
+// the number of directories in the backlogs
+int notification_writer_backlog(void);
+
+// write anything handed over, stop the thread and free its caches
+// returns 0, or the exit status if the writer has failed
+int notification_writer_stop(void);
+
+#endif // !defined(__NOTIFICATION_WRITER_H__)
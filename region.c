@@ -0,0 +1,187 @@
+//-----------------------------------------------------------------------------
+// region.c
+//
+// a stack of memory for short lived lists
+//-----------------------------------------------------------------------------
+#include <stdlib.h>
+#include <string.h>
+
+#include "region.h"
+
+#define REGION_ALIGN 16
+
+struct CHUNK {
+   struct CHUNK * prev_p;
+   struct CHUNK * next_p;    // a spare once this one is used up or released
+   size_t         size;
+   size_t         used;
+   size_t         base;      // bytes in use in the chunks before this one
+};
+
+#define ALIGNED(size) (((size) + REGION_ALIGN - 1) & ~((size_t) REGION_ALIGN - 1))
+#define CHUNK_DATA(chunk_p) ((char *) (chunk_p) + ALIGNED(sizeof(struct CHUNK)))
+
+struct REGION {
+   struct CHUNK      * first_p;
+   struct CHUNK      * current_p;
+   size_t              chunk_size;
+   struct REGION_STATS stats;
+};
+
+//-----------------------------------------------------------------------------
+static struct CHUNK * new_chunk(REGION_P region_p, size_t size) {
+//-----------------------------------------------------------------------------
+   struct CHUNK * chunk_p;
+
+   if (size < region_p->chunk_size) {
+      size = region_p->chunk_size;
+   }
+
+   chunk_p = malloc(ALIGNED(sizeof(struct CHUNK)) + size);
+   if (NULL == chunk_p) {
+      return NULL;
+   }
+   chunk_p->prev_p = NULL;
+   chunk_p->next_p = NULL;
+   chunk_p->size = size;
+   chunk_p->used = 0;
+   chunk_p->base = 0;
+
+   region_p->stats.chunk_allocations++;
+   region_p->stats.chunk_bytes += size;
+
+   return chunk_p;
+
+} // new_chunk
+
+//-----------------------------------------------------------------------------
+REGION_P new_region(size_t chunk_size) {
+//-----------------------------------------------------------------------------
+   REGION_P region_p;
+
+   region_p = calloc(1, sizeof(struct REGION));
+   if (NULL == region_p) {
+      return NULL;
+   }
+   region_p->chunk_size = ALIGNED(chunk_size);
+
+   region_p->first_p = new_chunk(region_p, region_p->chunk_size);
+   if (NULL == region_p->first_p) {
+      free(region_p);
+      return NULL;
+   }
+   region_p->current_p = region_p->first_p;
+
+   return region_p;
+
+} // new_region
+
+//-----------------------------------------------------------------------------
+void * region_alloc(REGION_P region_p, size_t size) {
+//-----------------------------------------------------------------------------
+   struct CHUNK * current_p = region_p->current_p;
+   struct CHUNK * chunk_p;
+   void * memory_p;
+
+   size = ALIGNED(size);
+
+   if (current_p->used + size > current_p->size) {
+      chunk_p = current_p->next_p;
+      if ((NULL == chunk_p) || (chunk_p->size < size)) {
+         // too big for the spare, if there is one: put a new chunk in
+         // front of it
+         chunk_p = new_chunk(region_p, size);
+         if (NULL == chunk_p) {
+            return NULL;
+         }
+         chunk_p->prev_p = current_p;
+         chunk_p->next_p = current_p->next_p;
+         if (chunk_p->next_p != NULL) {
+            chunk_p->next_p->prev_p = chunk_p;
+         }
+         current_p->next_p = chunk_p;
+      }
+      chunk_p->base = current_p->base + current_p->used;
+      chunk_p->used = 0;
+      region_p->current_p = current_p = chunk_p;
+   }
+
+   memory_p = CHUNK_DATA(current_p) + current_p->used;
+   current_p->used += size;
+
+   region_p->stats.allocations++;
+   region_p->stats.bytes_in_use = current_p->base + current_p->used;
+   if (region_p->stats.bytes_in_use > region_p->stats.bytes_peak) {
+      region_p->stats.bytes_peak = region_p->stats.bytes_in_use;
+   }
+
+   return memory_p;
+
+} // region_alloc
+
+//-----------------------------------------------------------------------------
+void region_release(REGION_P region_p, const void * first_p) {
+//-----------------------------------------------------------------------------
+   struct CHUNK * chunk_p;
+   struct CHUNK * next_p;
+   const char * data_p;
+
+   if (NULL == first_p) {
+      return;
+   }
+
+   // nearly always the current chunk
+   for (chunk_p=region_p->current_p; chunk_p != NULL; chunk_p=chunk_p->prev_p) {
+      data_p = CHUNK_DATA(chunk_p);
+      if (((const char *) first_p >= data_p) &&
+         ((const char *) first_p < data_p + chunk_p->used)) {
+         break;
+      }
+   }
+   if (NULL == chunk_p) {
+      // not ours, or already released
+      return;
+   }
+
+   chunk_p->used = (const char *) first_p - CHUNK_DATA(chunk_p);
+   region_p->current_p = chunk_p;
+   region_p->stats.releases++;
+   region_p->stats.bytes_in_use = chunk_p->base + chunk_p->used;
+
+   if (region_p->stats.bytes_in_use > 0) {
+      return;
+   }
+
+   // empty: give back everything but the first chunk
+   for (chunk_p=region_p->first_p->next_p; chunk_p != NULL; chunk_p=next_p) {
+      next_p = chunk_p->next_p;
+      region_p->stats.chunk_bytes -= chunk_p->size;
+      free(chunk_p);
+   }
+   region_p->first_p->next_p = NULL;
+
+} // region_release
+
+//-----------------------------------------------------------------------------
+const struct REGION_STATS * region_stats(REGION_P region_p) {
+//-----------------------------------------------------------------------------
+   return &region_p->stats;
+} // region_stats
+
+//-----------------------------------------------------------------------------
+void release_region(REGION_P region_p) {
+//-----------------------------------------------------------------------------
+   struct CHUNK * chunk_p;
+   struct CHUNK * next_p;
+
+   if (NULL == region_p) {
+      return;
+   }
+
+   for (chunk_p=region_p->first_p; chunk_p != NULL; chunk_p=next_p) {
+      next_p = chunk_p->next_p;
+      free(chunk_p);
+   }
+   free(region_p);
+
+} // release_region
@@ -0,0 +1,49 @@
+//-----------------------------------------------------------------------------
+// region.h
+//
+// a stack of memory for short lived lists
+//
+// Allocating is bumping a pointer in a large chunk, and releasing a list
+// is moving the pointer back to its first node, however long the list is.
+// The crawl's lists nest (a directory's listing is kept while its
+// subdirectories are listed), so they are released in the reverse order
+// of their creation, which is what a stack needs. Chunks are kept while
+// the region is in use, and all but the first are freed when it is empty
+// again, so a big crawl doesn't hold on to its memory.
+//-----------------------------------------------------------------------------
+#if !defined(__REGION_H)
+#define __REGION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct REGION * REGION_P;
+
+struct REGION_STATS {
+   uint64_t allocations;        // region_alloc calls
+   uint64_t releases;           // region_release calls
+   uint64_t chunk_allocations;  // mallocs behind them
+   size_t   bytes_in_use;
+   size_t   bytes_peak;
+   size_t   chunk_bytes;        // currently held, in use or not
+};
+
+// create an empty region which gets memory chunk_size bytes at a time
+// returns NULL on failure
+REGION_P new_region(size_t chunk_size);
+
+// allocate size bytes, not zeroed
+// returns NULL on failure
+void * region_alloc(REGION_P region_p, size_t size);
+
+// release first_p, which region_alloc returned, and everything allocated
+// after it
+void region_release(REGION_P region_p, const void * first_p);
+
+// what the region has done so far
+const struct REGION_STATS * region_stats(REGION_P region_p);
+
+// release a region, does nothing if region_p is NULL
+void release_region(REGION_P region_p);
+
+#endif // !defined(__REGION_H)
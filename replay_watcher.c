@@ -0,0 +1,213 @@
+//-----------------------------------------------------------------------------
+// replay_watcher.c
+//
+// feed a recording made with SPIDEROAK_DIR_WATCHER_CAPTURE through the
+// watcher's processing and flushing, and report how fast it went
+//
+// arguments:
+// argv[1] - the recording
+// argv[2] - notification directory
+// argv[3] - optional: 'realtime' to keep the recorded timing, otherwise
+//           the events are replayed as fast as possible
+//
+// The config and exclude files from the recording are written to
+// replay.config and replay.exclude in the notification directory.
+// The results are printed as 'name value' lines, and the full metrics
+// are in stats.txt as usual.
+//-----------------------------------------------------------------------------
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <syslog.h>
+#include <time.h>
+
+#include "dir_watcher.h"
+#include "error_text.h"
+#include "event_source.h"
+#include "metrics.h"
+
+#define MAX_PATH_LEN 4096
+
+static char config_path[MAX_PATH_LEN];
+static char exclude_path[MAX_PATH_LEN];
+
+//-----------------------------------------------------------------------------
+static void write_file(const char * path_p, const char * data_p, size_t len) {
+//-----------------------------------------------------------------------------
+   FILE * file_p;
+
+   file_p = fopen(path_p, "w");
+   if (
+      (NULL == file_p) ||
+      ((len > 0) && (fwrite(data_p, len, 1, file_p) != 1))
+   ) {
+      fprintf(stderr, "unable to write %s: %s\n", path_p, strerror(errno));
+      exit(1);
+   }
+   fclose(file_p);
+
+} // write_file
+
+//-----------------------------------------------------------------------------
+// write the config and exclude files from a start or reload record
+static void write_config_files(void) {
+//-----------------------------------------------------------------------------
+   const char * data_p;
+   uint32_t len;
+   size_t config_len;
+
+   source_replay_take(&data_p, &len);
+
+   config_len = strnlen(data_p, len);
+   write_file(config_path, data_p, config_len);
+   if (config_len < len) {
+      write_file(exclude_path, data_p + config_len + 1, len - config_len - 1);
+   } else {
+      write_file(exclude_path, "", 0);
+   }
+
+} // write_config_files
+
+//-----------------------------------------------------------------------------
+// in realtime mode, sleep until the next record is due
+static void wait_for_record(uint64_t start_ns, uint64_t first_record_ns) {
+//-----------------------------------------------------------------------------
+   uint64_t due_ns;
+   uint64_t now_ns;
+   struct timespec delay;
+
+   due_ns = start_ns + (source_replay_time() - first_record_ns);
+   now_ns = metric_now_ns();
+   if (due_ns <= now_ns) {
+      return;
+   }
+
+   delay.tv_sec = (due_ns - now_ns) / 1000000000ULL;
+   delay.tv_nsec = (due_ns - now_ns) % 1000000000ULL;
+   nanosleep(&delay, NULL);
+
+} // wait_for_record
+
+//-----------------------------------------------------------------------------
+int main(int argc, char **argv) {
+//-----------------------------------------------------------------------------
+   const char * notification_path;
+   int realtime;
+   int done;
+   uint64_t crawl_start_ns;
+   uint64_t start_ns;
+   uint64_t elapsed_ns;
+   uint64_t first_record_ns;
+   uint64_t batches;
+   uint64_t ticks;
+   uint64_t events;
+
+   if ((argc < 3) || (argc > 4)) {
+      fprintf(
+         stderr,
+         "usage: %s <recording> <notification directory> [realtime]\n",
+         argv[0]
+      );
+      return 1;
+   }
+   notification_path = argv[2];
+   realtime = (4 == argc) && (0 == strcmp(argv[3], "realtime"));
+
+   umask(0077);
+   openlog("spideroak_replay", LOG_CONS | LOG_PID | LOG_PERROR, LOG_USER);
+   setlogmask(LOG_UPTO(LOG_WARNING));
+
+   snprintf(config_path, sizeof config_path, "%s/replay.config", notification_path);
+   snprintf(exclude_path, sizeof exclude_path, "%s/replay.exclude", notification_path);
+
+   dir_watcher_initialize(notification_path);
+
+   if (source_replay_open(argv[1]) != 0) {
+      fprintf(stderr, "unable to replay %s\n", argv[1]);
+      return 1;
+   }
+
+   if (source_replay_peek() != SOURCE_START) {
+      fprintf(stderr, "%s does not start with the config files\n", argv[1]);
+      return 1;
+   }
+   write_config_files();
+
+   // the crawl is replayed from the recorded listings
+   crawl_start_ns = metric_now_ns();
+   if (dir_watcher_start(config_path, exclude_path) != 0) {
+      fprintf(stderr, "inotify_init %s\n", strerror(errno));
+      return 1;
+   }
+   elapsed_ns = metric_now_ns() - crawl_start_ns;
+   printf("crawl_seconds %.6f\n", elapsed_ns / 1e9);
+   printf("watches %llu\n", (unsigned long long) metric_counters[METRIC_WATCHES_ADDED]);
+
+   events = metric_counters[METRIC_EVENTS];
+   batches = 0;
+   ticks = 0;
+   first_record_ns = source_replay_time();
+   start_ns = metric_now_ns();
+   done = 0;
+   while (! done) {
+      if (realtime) {
+         wait_for_record(start_ns, first_record_ns);
+      }
+
+      switch (source_replay_peek()) {
+         case SOURCE_END:
+            done = 1;
+            break;
+         case SOURCE_QUEUE_BYTES:
+         case SOURCE_READ:
+            dir_watcher_process_events(0, metric_now_ns());
+            batches++;
+            break;
+         case SOURCE_TICK:
+            source_replay_take(NULL, NULL);
+            dir_watcher_tick();
+            ticks++;
+            break;
+         case SOURCE_BARRIER:
+            source_replay_take(NULL, NULL);
+            dir_watcher_flush();
+            break;
+         case SOURCE_RELOAD:
+            write_config_files();
+            dir_watcher_reload();
+            break;
+         default:
+            fprintf(stderr, "replay diverged: unexpected record\n");
+            return 32;
+      } // switch
+   } // while
+
+   // flush whatever is left, as the watcher would on its next tick, and
+   // wait for the notification writer to finish
+   dir_watcher_tick();
+   dir_watcher_flush();
+   elapsed_ns = metric_now_ns() - start_ns;
+   events = metric_counters[METRIC_EVENTS] - events;
+
+   printf("replay_seconds %.6f\n", elapsed_ns / 1e9);
+   printf("batches %llu\n", (unsigned long long) batches);
+   printf("ticks %llu\n", (unsigned long long) ticks);
+   printf("events %llu\n", (unsigned long long) events);
+   printf(
+      "events_per_second %.0f\n",
+      0 == elapsed_ns ? 0.0 : events * 1e9 / elapsed_ns
+   );
+   printf(
+      "notifications %llu\n",
+      (unsigned long long) metric_counters[METRIC_NOTIFICATIONS_WRITTEN]
+   );
+
+   dir_watcher_write_stats();
+   dir_watcher_close();
+   closelog();
+
+   return 0;
+
+} // main
@@ -0,0 +1,522 @@
+"""
+stress_watcher.py
+
+Find the highest event rate the watcher can keep up with before the kernel
+queue overflows (the watcher exits with status 16), and how that changes
+with the number of watched directories.
+
+For each tree size, a tree of that many directories is built and watched.
+Worker processes then create, rewrite, rename and delete files in random
+directories of the tree at a target rate, which goes up by --ramp-factor
+every --stage-seconds until the watcher overflows, or the workers cannot
+reach the target. The harness consumes the notification files as the
+spider would, and drops a probe file every --probe-interval seconds to
+measure how long a change takes to reach a notification.
+
+    python stress_watcher.py --directories 1000,10000,100000 ./spideroak_inotify_dir_watcher
+
+For each stage the JSON results have the target and achieved operation
+rates, the inotify events per second the watcher read (from its stats),
+its CPU time per event, and the probe latencies. The ceiling for a tree
+size is the events per second of the last stage before the overflow.
+
+Settings for the watcher are taken from the environment, as
+launch_watcher.py does.
+"""
+from __future__ import print_function
+
+import json
+import multiprocessing
+import os
+import os.path
+import random
+import shutil
+import signal
+import subprocess
+import sys
+import tempfile
+import time
+
+from benchmark_crawl import read_max_user_watches
+from benchmark_crawl import read_rss
+from benchmark_crawl import read_stats
+from benchmark_crawl import watcher_environment
+from watcher_barrier import barrier
+from watcher_barrier import BarrierTimeout
+
+_overflow_exit_code = 16
+_directories_per_group = 1000
+_consumer_interval = 0.01
+_stats_timeout = 10.0
+_barrier_timeout = 30.0
+_operations = ("create", "write", "rename", "delete", )
+_notification_suffix = ".txt"
+_not_notifications = ("stats.txt", "trace.txt", "error.txt", )
+
+class StressError(Exception):
+    pass
+
+def _parse_command_line():
+    from optparse import OptionParser
+
+    parser = OptionParser(
+        usage="%prog [options] <executable path>"
+    )
+    parser.add_option(
+        "--directories", dest="directories", type="string",
+        help="comma separated tree sizes to run"
+    )
+    parser.set_defaults(directories="1000,10000")
+    parser.add_option(
+        "--workers", dest="workers", type="int",
+        help="load generating processes"
+    )
+    parser.set_defaults(workers=multiprocessing.cpu_count())
+    parser.add_option(
+        "--mix", dest="mix", type="string",
+        help="relative weights of the operations, "
+             "default create=4,write=3,rename=2,delete=1"
+    )
+    parser.set_defaults(mix="create=4,write=3,rename=2,delete=1")
+    parser.add_option(
+        "--start-rate", dest="start_rate", type="float",
+        help="operations per second in the first stage"
+    )
+    parser.set_defaults(start_rate=1000.0)
+    parser.add_option(
+        "--ramp-factor", dest="ramp_factor", type="float",
+        help="rate multiplier for each stage"
+    )
+    parser.set_defaults(ramp_factor=1.5)
+    parser.add_option(
+        "--max-rate", dest="max_rate", type="float",
+        help="stop ramping at this many operations per second"
+    )
+    parser.set_defaults(max_rate=10000000.0)
+    parser.add_option(
+        "--stage-seconds", dest="stage_seconds", type="float",
+        help="length of each stage"
+    )
+    parser.set_defaults(stage_seconds=5.0)
+    parser.add_option(
+        "--probe-interval", dest="probe_interval", type="float",
+        help="seconds between latency probes"
+    )
+    parser.set_defaults(probe_interval=0.5)
+    parser.add_option(
+        "--root-dir", dest="root_dir", type="string",
+        help="where to build the trees, default a new temporary directory"
+    )
+    parser.add_option(
+        "--output", dest="output", type="string",
+        help="write the JSON here instead of stdout"
+    )
+
+    options, args = parser.parse_args()
+    if len(args) != 1:
+        parser.error("you must specify the watcher executable")
+    options.executable_path = os.path.abspath(args[0])
+
+    try:
+        options.directory_counts = [
+            int(count) for count in options.directories.split(",")
+        ]
+        options.weights = _parse_mix(options.mix)
+    except ValueError:
+        parser.error("invalid --directories or --mix")
+
+    return options
+
+def _parse_mix(mix):
+    """'create=4,write=3' as a list of weights in the order of _operations"""
+    weights = dict([(operation, 0, ) for operation in _operations])
+    for item in mix.split(","):
+        name, weight = item.split("=")
+        if name not in weights:
+            raise ValueError(name)
+        weights[name] = int(weight)
+    if sum(weights.values()) == 0:
+        raise ValueError(mix)
+    return [weights[operation] for operation in _operations]
+
+def _directory_path(data_path, index):
+    """directories are in groups, so no directory gets too big"""
+    return os.path.join(
+        data_path,
+        "g%04d" % (index // _directories_per_group, ),
+        "d%06d" % (index, )
+    )
+
+def _create_tree(data_path, directory_count):
+    for index in range(directory_count):
+        if index % _directories_per_group == 0:
+            os.mkdir(os.path.dirname(_directory_path(data_path, index)))
+        os.mkdir(_directory_path(data_path, index))
+
+def _choose_operation(generator, weights, total_weight):
+    pick = generator.randrange(total_weight)
+    for operation, weight in zip(_operations, weights):
+        if pick < weight:
+            return operation
+        pick -= weight
+
+def _worker(
+    worker_id, data_path, directory_count, weights, rate, seconds, result_queue
+):
+    """
+    a load generating process: run operations at rate for seconds, and
+    put the number done on result_queue
+    """
+    generator = random.Random(worker_id)
+    total_weight = sum(weights)
+    files = list()
+    serial = 0
+    done = 0
+    start_time = time.time()
+    end_time = start_time + seconds
+    data = b"x" * 64
+
+    while True:
+        now = time.time()
+        if now >= end_time:
+            break
+        # keep to the rate, catching up in a burst if we fall behind
+        if done >= rate * (now - start_time):
+            time.sleep(0.001)
+            continue
+
+        operation = _choose_operation(generator, weights, total_weight)
+        if operation != "create" and not files:
+            operation = "create"
+
+        if operation == "create":
+            path = os.path.join(
+                _directory_path(
+                    data_path, generator.randrange(directory_count)
+                ),
+                "w%02d_%08d" % (worker_id, serial, )
+            )
+            serial += 1
+            with open(path, "wb") as output_file:
+                output_file.write(data)
+            files.append(path)
+        else:
+            index = generator.randrange(len(files))
+            path = files[index]
+            if operation == "write":
+                with open(path, "ab") as output_file:
+                    output_file.write(data)
+            elif operation == "rename":
+                new_path = "%s_%08d" % (path.rsplit("_", 1)[0], serial, )
+                serial += 1
+                os.rename(path, new_path)
+                files[index] = new_path
+            else:
+                os.unlink(path)
+                files[index] = files[-1]
+                files.pop()
+
+        done += 1
+
+    result_queue.put(done)
+
+def _read_cpu_seconds(pid):
+    """user + system time of a process"""
+    with open("/proc/%d/stat" % (pid, )) as stat_file:
+        # the command name is in parentheses, and may contain spaces
+        fields = stat_file.read().rsplit(")", 1)[1].split()
+    return (int(fields[11]) + int(fields[12])) / float(os.sysconf("SC_CLK_TCK"))
+
+def _percentile(values, fraction):
+    if not values:
+        return None
+    values = sorted(values)
+    index = min(len(values) - 1, int(fraction * len(values)))
+    return values[index]
+
+class _Watcher(object):
+    """a running watcher, and the consumer of its notifications"""
+
+    def __init__(self, executable_path, work_path, data_path):
+        self.work_path = work_path
+        self.notify_path = os.path.join(work_path, "notify")
+        self.stats_path = os.path.join(self.notify_path, "stats.txt")
+        self.probe_path = os.path.join(data_path, "probe")
+        self._probes = list()
+        self.latencies = list()
+        self.notifications = 0
+
+        if os.path.exists(self.notify_path):
+            shutil.rmtree(self.notify_path)
+        os.mkdir(self.notify_path)
+        os.mkdir(self.probe_path)
+
+        config_path = os.path.join(work_path, "config.txt")
+        exclude_path = os.path.join(work_path, "exclude.txt")
+        with open(config_path, "w") as config_file:
+            config_file.write("%s\n" % (data_path, ))
+        open(exclude_path, "w").close()
+
+        environment = watcher_environment()
+        environment["SPIDEROAK_DIR_WATCHER_STATS_INTERVAL"] = "0"
+
+        self.process = subprocess.Popen(
+            [
+                executable_path,
+                str(os.getpid()),
+                config_path,
+                exclude_path,
+                self.notify_path,
+            ],
+            env=environment
+        )
+
+        # the first stats file is written when the crawl is done
+        while not os.path.exists(self.stats_path):
+            if self.process.poll() is not None:
+                raise StressError(
+                    "watcher exited %s during the crawl" % (
+                        self.process.returncode,
+                    )
+                )
+            time.sleep(_consumer_interval)
+
+    def alive(self):
+        return self.process.poll() is None
+
+    def consume(self):
+        """read and remove notification files, as the spider does"""
+        for name in sorted(os.listdir(self.notify_path)):
+            if not name.endswith(_notification_suffix):
+                continue
+            if name in _not_notifications:
+                continue
+            path = os.path.join(self.notify_path, name)
+            with open(path) as notification_file:
+                directories = notification_file.read().split("\n")
+            os.unlink(path)
+            self.notifications += 1
+            if self.probe_path in directories:
+                now = time.time()
+                for probe_time in self._probes:
+                    self.latencies.append(now - probe_time)
+                self._probes = list()
+
+    def probe(self):
+        """change the probe directory, and time its notification"""
+        # a notification already waiting must not be taken for this probe
+        self.consume()
+        self._probes.append(time.time())
+        with open(os.path.join(self.probe_path, "probe"), "w") as probe_file:
+            probe_file.write("x")
+
+    def stats(self):
+        """ask for a fresh stats file, and read it"""
+        inode = os.stat(self.stats_path).st_ino
+        os.kill(self.process.pid, signal.SIGUSR1)
+        start_time = time.time()
+        while os.stat(self.stats_path).st_ino == inode:
+            if not self.alive():
+                return None
+            if time.time() - start_time > _stats_timeout:
+                raise StressError("watcher did not write stats")
+            time.sleep(_consumer_interval)
+        return read_stats(self.stats_path)
+
+    def error_text(self):
+        error_path = os.path.join(self.notify_path, "error.txt")
+        if not os.path.exists(error_path):
+            return None
+        with open(error_path) as error_file:
+            return error_file.read().strip()
+
+    def stop(self):
+        if self.alive():
+            os.kill(self.process.pid, signal.SIGTERM)
+        self.process.wait()
+        return self.process.returncode
+
+def _run_stage(options, watcher, data_path, directory_count, rate):
+    """one stage of the ramp, returning its results"""
+    stats_before = watcher.stats()
+    cpu_before = _read_cpu_seconds(watcher.process.pid)
+    watcher.latencies = list()
+
+    result_queue = multiprocessing.Queue()
+    workers = list()
+    for worker_id in range(options.workers):
+        worker = multiprocessing.Process(
+            target=_worker,
+            args=(
+                worker_id,
+                data_path,
+                directory_count,
+                options.weights,
+                rate / options.workers,
+                options.stage_seconds,
+                result_queue,
+            )
+        )
+        worker.start()
+        workers.append(worker)
+
+    start_time = time.time()
+    next_probe_time = start_time
+    while any([worker.is_alive() for worker in workers]):
+        if not watcher.alive():
+            break
+        if time.time() >= next_probe_time:
+            watcher.probe()
+            next_probe_time += options.probe_interval
+        watcher.consume()
+        time.sleep(_consumer_interval)
+
+    operations = sum([result_queue.get() for _ in workers])
+    for worker in workers:
+        worker.join()
+    elapsed = time.time() - start_time
+
+    result = {
+        "target_operations_per_second": round(rate, 1),
+        "operations_per_second": round(operations / elapsed, 1),
+        "overflow": False,
+    }
+
+    # let the watcher catch up, so the probes and stats cover the stage
+    if watcher.alive():
+        try:
+            barrier(watcher.work_path, watcher.notify_path, _barrier_timeout)
+        except BarrierTimeout:
+            pass
+    watcher.consume()
+
+    if not watcher.alive():
+        result["overflow"] = (
+            watcher.process.returncode == _overflow_exit_code
+        )
+        result["exit_code"] = watcher.process.returncode
+        result["error"] = watcher.error_text()
+        return result
+
+    cpu_seconds = _read_cpu_seconds(watcher.process.pid) - cpu_before
+    stats_after = watcher.stats()
+    events = stats_after["events"] - stats_before["events"]
+
+    result.update({
+        "events_per_second": round(events / elapsed, 1),
+        "cpu_percent": round(100.0 * cpu_seconds / elapsed, 1),
+        "cpu_us_per_event": (
+            round(1e6 * cpu_seconds / events, 3) if events else None
+        ),
+        "probe_latency_p50_seconds": _percentile(watcher.latencies, 0.5),
+        "probe_latency_max_seconds": _percentile(watcher.latencies, 1.0),
+        "read_to_publish_p99_ns": stats_after.get("read_to_publish_ns.p99"),
+        "queue_bytes_max": stats_after.get("queue_bytes.max"),
+    })
+    return result
+
+def _run_tree(options, root_path, directory_count):
+    """ramp up the load on a tree of directory_count until it overflows"""
+    tree_path = os.path.join(root_path, "tree%d" % (directory_count, ))
+    data_path = os.path.join(tree_path, "data")
+    work_path = os.path.join(tree_path, "work")
+    if os.path.exists(tree_path):
+        shutil.rmtree(tree_path)
+    os.mkdir(tree_path)
+    os.mkdir(data_path)
+    os.mkdir(work_path)
+    _create_tree(data_path, directory_count)
+
+    watcher = _Watcher(options.executable_path, work_path, data_path)
+    stages = list()
+    ceiling = None
+    limited_by = "max_rate"
+    rate = options.start_rate
+    try:
+        while rate <= options.max_rate:
+            stage = _run_stage(
+                options, watcher, data_path, directory_count, rate
+            )
+            stages.append(stage)
+            if stage["overflow"]:
+                limited_by = "overflow"
+                break
+            if "exit_code" in stage:
+                limited_by = "watcher exited"
+                break
+            ceiling = stage["events_per_second"]
+            if stage["operations_per_second"] < 0.9 * rate:
+                limited_by = "generator"
+                break
+            rate *= options.ramp_factor
+
+        peak_rss = None
+        if watcher.alive():
+            peak_rss, _ = read_rss(watcher.process.pid)
+    finally:
+        watcher.stop()
+        shutil.rmtree(tree_path)
+
+    return {
+        "directories": directory_count,
+        "ceiling_events_per_second": ceiling,
+        "limited_by": limited_by,
+        "peak_rss_bytes": peak_rss,
+        "notifications": watcher.notifications,
+        "stages": stages,
+    }
+
+def _read_max_queued_events():
+    try:
+        with open("/proc/sys/fs/inotify/max_queued_events") as limit_file:
+            return int(limit_file.read())
+    except (IOError, OSError, ValueError):
+        return None
+
+def main():
+    options = _parse_command_line()
+
+    if options.root_dir is None:
+        root_path = tempfile.mkdtemp(prefix="stress_watcher.")
+    else:
+        root_path = os.path.abspath(options.root_dir)
+        if not os.path.isdir(root_path):
+            os.makedirs(root_path)
+
+    trees = list()
+    try:
+        for directory_count in options.directory_counts:
+            trees.append(_run_tree(options, root_path, directory_count))
+    finally:
+        if options.root_dir is None:
+            shutil.rmtree(root_path)
+
+    report = {
+        "executable": options.executable_path,
+        "time": int(time.time()),
+        "workers": options.workers,
+        "mix": dict(zip(_operations, options.weights)),
+        "stage_seconds": options.stage_seconds,
+        "max_queued_events": _read_max_queued_events(),
+        "max_user_watches": read_max_user_watches(),
+        "trees": trees,
+    }
+
+    text = json.dumps(
+        report, indent=4, sort_keys=True, separators=(",", ": ")
+    )
+    if options.output is None:
+        print(text)
+    else:
+        with open(options.output, "w") as output_file:
+            output_file.write(text)
+            output_file.write("\n")
+
+    return 0
+
+if __name__ == "__main__":
+    try:
+        sys.exit(main())
+    except StressError as instance:
+        print("stress failed: %s" % (instance, ), file=sys.stderr)
+        sys.exit(1)
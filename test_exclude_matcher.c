@@ -0,0 +1,183 @@
+//-----------------------------------------------------------------------------
+// Test exclude_matcher.c
+//-----------------------------------------------------------------------------
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "exclude_matcher.h"
+
+struct TEST_ENTRY {
+   const char * path_p;
+   const char * rule_p; // the rule we expect to match, NULL for none
+};
+
+static const char * rules[] = {
+   "/home/user/Downloads",
+   "/home/user/Projects/big/",
+   "/home/user/Projects/big/build",
+   "node_modules",
+   ".cache",
+   "*.tmpdir",
+   ""
+}; // rules
+
+static struct TEST_ENTRY paths[] = {
+   {"/home/user/Downloads", "/home/user/Downloads"},
+   {"/home/user/Downloads/iso", "/home/user/Downloads"},
+   {"/home/user/Downloads2", NULL},
+   {"/home/user/Download", NULL},
+   {"/home/user", NULL},
+   {"/home/user/Projects/big", "/home/user/Projects/big/"},
+   {"/home/user/Projects/big/src", "/home/user/Projects/big/"},
+   {"/home/user/Projects/bigger", NULL},
+   {"/home/user/Projects/web/node_modules", "node_modules"},
+   {"/home/user/Projects/web/node_modules/x", NULL},
+   {"/home/user/.cache", ".cache"},
+   {"/home/user/cache", NULL},
+   {"/home/user/work/a.tmpdir", "*.tmpdir"},
+   {"/home/user/work/a.tmpdir/", "*.tmpdir"},
+   {"/home//user//Downloads", "/home/user/Downloads"}
+}; // paths
+
+//-----------------------------------------------------------------------------
+void test_empty_matcher(void) {
+//-----------------------------------------------------------------------------
+   EXCLUDE_MATCHER_P matcher_p;
+
+   fprintf(stdout, "test empty matcher\n");
+
+   matcher_p = new_exclude_matcher();
+   assert(matcher_p != NULL);
+   assert(0 == exclude_rule_count(matcher_p));
+   assert(NULL == match_exclude(matcher_p, "/"));
+   assert(NULL == match_exclude(matcher_p, "/home/user"));
+
+   release_exclude_matcher(matcher_p);
+
+} // test_empty_matcher
+
+//-----------------------------------------------------------------------------
+void test_rules(void) {
+//-----------------------------------------------------------------------------
+   EXCLUDE_MATCHER_P matcher_p;
+   int rule_count;
+   int path_count;
+   int i;
+   const char * result_p;
+
+   fprintf(stdout, "test rules\n");
+
+   matcher_p = new_exclude_matcher();
+   assert(matcher_p != NULL);
+
+   rule_count = sizeof rules / sizeof(const char *);
+   for (i=0; i < rule_count; i++) {
+      assert(0 == add_exclude_rule(matcher_p, rules[i]));
+   }
+
+   // the empty rule is ignored
+   assert(rule_count-1 == exclude_rule_count(matcher_p));
+
+   path_count = sizeof paths / sizeof(struct TEST_ENTRY);
+   for (i=0; i < path_count; i++) {
+      result_p = match_exclude(matcher_p, paths[i].path_p);
+      if (NULL == paths[i].rule_p) {
+         assert(NULL == result_p);
+      } else {
+         assert(result_p != NULL);
+         assert(strcmp(result_p, paths[i].rule_p) == 0);
+      }
+   }
+
+   assert(exclude_rules_below(matcher_p, "/"));
+   assert(exclude_rules_below(matcher_p, "/home/user/Projects"));
+   assert(exclude_rules_below(matcher_p, "/home/user/Downloads"));
+   assert(! exclude_rules_below(matcher_p, "/home/user/Projects/web"));
+   assert(! exclude_rules_below(matcher_p, "/home/user/Downloads/iso"));
+   assert(! exclude_rules_below(matcher_p, "/var"));
+
+   release_exclude_matcher(matcher_p);
+
+} // test_rules
+
+//-----------------------------------------------------------------------------
+void test_many_rules(void) {
+//-----------------------------------------------------------------------------
+   EXCLUDE_MATCHER_P matcher_p;
+   char rule_buffer[256];
+   int i;
+
+   fprintf(stdout, "test many rules\n");
+
+   matcher_p = new_exclude_matcher();
+   assert(matcher_p != NULL);
+
+   for (i=0; i < 10000; i++) {
+      snprintf(rule_buffer, sizeof rule_buffer, "/data/%d/excluded", i);
+      assert(0 == add_exclude_rule(matcher_p, rule_buffer));
+      snprintf(rule_buffer, sizeof rule_buffer, "name%d", i);
+      assert(0 == add_exclude_rule(matcher_p, rule_buffer));
+   }
+   assert(20000 == exclude_rule_count(matcher_p));
+
+   for (i=0; i < 10000; i++) {
+      snprintf(rule_buffer, sizeof rule_buffer, "/data/%d/excluded/sub", i);
+      assert(match_exclude(matcher_p, rule_buffer) != NULL);
+      snprintf(rule_buffer, sizeof rule_buffer, "/data/%d", i);
+      assert(NULL == match_exclude(matcher_p, rule_buffer));
+      snprintf(rule_buffer, sizeof rule_buffer, "/data/%d/name%d", i, i);
+      assert(match_exclude(matcher_p, rule_buffer) != NULL);
+   }
+
+   release_exclude_matcher(matcher_p);
+
+} // test_many_rules
+
+//-----------------------------------------------------------------------------
+void test_root_rule(void) {
+//-----------------------------------------------------------------------------
+   EXCLUDE_MATCHER_P matcher_p;
+   char path_buffer[NAME_MAX + 64];
+
+   fprintf(stdout, "test root rule\n");
+
+   matcher_p = new_exclude_matcher();
+   assert(matcher_p != NULL);
+   assert(0 == add_exclude_rule(matcher_p, "/"));
+   assert(0 == add_exclude_rule(matcher_p, "*"));
+
+   // "/" excludes the root, not everything below it
+   assert(match_exclude(matcher_p, "/") != NULL);
+   assert(0 == strcmp("/", match_exclude(matcher_p, "/")));
+   assert(0 == strcmp("*", match_exclude(matcher_p, "/home")));
+
+   // a name too long for a directory matches no pattern, even "*"
+   memset(path_buffer, 'x', sizeof path_buffer);
+   path_buffer[0] = '/';
+   path_buffer[NAME_MAX + 2] = '/';
+   path_buffer[NAME_MAX + 3] = '\0';
+   assert(NULL == match_exclude(matcher_p, path_buffer));
+   path_buffer[NAME_MAX + 2] = '\0';
+   assert(NULL == match_exclude(matcher_p, path_buffer));
+   path_buffer[NAME_MAX + 1] = '\0';
+   assert(0 == strcmp("*", match_exclude(matcher_p, path_buffer)));
+
+   release_exclude_matcher(matcher_p);
+
+} // test_root_rule
+
+//-----------------------------------------------------------------------------
+int main(int argc, char **argv) {
+//-----------------------------------------------------------------------------
+   fprintf(stdout, "test starts\n");
+
+   test_empty_matcher();
+   test_rules();
+   test_many_rules();
+   test_root_rule();
+
+   fprintf(stdout, "test completes normally\n");
+   return 0;
+} // main
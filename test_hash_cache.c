@@ -0,0 +1,113 @@
+//-----------------------------------------------------------------------------
+// Test hash_cache.c
+//-----------------------------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "hash_cache.h"
+
+#define HASH_SIZE 100
+#define MEMORY_SIZE 15000
+
+//-----------------------------------------------------------------------------
+static int contains(hash_cache * hc, const char * path_p) {
+//-----------------------------------------------------------------------------
+   unsigned int pos;
+   unsigned int count;
+   unsigned int datalen;
+   char * str;
+
+   for (pos=0; (pos=hash_cache_iter(hc, pos, &count, (void**)&str, &datalen))!=0;) {
+      if (0 == strcmp(str, path_p)) {
+         return count;
+      }
+   }
+
+   return 0;
+
+} // contains
+
+//-----------------------------------------------------------------------------
+void test_remove(void) {
+//-----------------------------------------------------------------------------
+   hash_cache * hc;
+   char path_buffer[64];
+   int i;
+
+   fprintf(stdout, "test remove\n");
+
+   hc = new_hash_cache(HASH_SIZE, MEMORY_SIZE);
+   assert(hc != NULL);
+
+   // enough to collide
+   for (i=0; i < 40; i++) {
+      snprintf(path_buffer, sizeof path_buffer, "/data/%d", i);
+      assert(1 == hash_cache_add(hc, path_buffer, strlen(path_buffer)+1));
+   }
+   assert(2 == hash_cache_add(hc, "/data/7", strlen("/data/7")+1));
+   assert(40 == hash_cache_entries(hc));
+
+   assert(0 == hash_cache_remove(hc, "/data/x", strlen("/data/x")+1));
+   assert(2 == hash_cache_remove(hc, "/data/7", strlen("/data/7")+1));
+   assert(0 == hash_cache_remove(hc, "/data/7", strlen("/data/7")+1));
+
+   // every other element removed, the rest still found
+   for (i=0; i < 40; i += 2) {
+      snprintf(path_buffer, sizeof path_buffer, "/data/%d", i);
+      assert(1 == hash_cache_remove(hc, path_buffer, strlen(path_buffer)+1));
+   }
+   for (i=0; i < 40; i++) {
+      snprintf(path_buffer, sizeof path_buffer, "/data/%d", i);
+      if ((i % 2 != 0) && (i != 7)) {
+         assert(1 == contains(hc, path_buffer));
+         assert(2 == hash_cache_add(hc, path_buffer, strlen(path_buffer)+1));
+      } else {
+         assert(0 == contains(hc, path_buffer));
+      }
+   }
+
+   assert(19 == hash_cache_entries(hc));
+
+   hash_cache_clear(hc);
+   assert(0 == hash_cache_entries(hc));
+   free_hash_cache(hc);
+
+} // test_remove
+
+//-----------------------------------------------------------------------------
+void test_remove_gives_back_memory(void) {
+//-----------------------------------------------------------------------------
+   hash_cache * hc;
+   char path_buffer[64];
+   int i;
+
+   fprintf(stdout, "test remove gives back memory\n");
+
+   hc = new_hash_cache(HASH_SIZE, 100);
+   assert(hc != NULL);
+
+   // marked and deleted, over and over: the memory never fills
+   for (i=0; i < 1000; i++) {
+      snprintf(path_buffer, sizeof path_buffer, "/build/%d", i);
+      assert(hash_cache_add(hc, "/build", strlen("/build")+1) != 0);
+      assert(1 == hash_cache_add(hc, path_buffer, strlen(path_buffer)+1));
+      assert(1 == hash_cache_remove(hc, path_buffer, strlen(path_buffer)+1));
+   }
+   assert(1000 == contains(hc, "/build"));
+
+   free_hash_cache(hc);
+
+} // test_remove_gives_back_memory
+
+//-----------------------------------------------------------------------------
+int main(int argc, char **argv) {
+//-----------------------------------------------------------------------------
+   fprintf(stdout, "test starts\n");
+
+   test_remove();
+   test_remove_gives_back_memory();
+
+   fprintf(stdout, "test completes normally\n");
+   return 0;
+} // main
@@ -0,0 +1,101 @@
+//-----------------------------------------------------------------------------
+// Test region.c
+//-----------------------------------------------------------------------------
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "region.h"
+
+#define CHUNK_SIZE 1024
+
+//-----------------------------------------------------------------------------
+void test_nested_lists(void) {
+//-----------------------------------------------------------------------------
+   REGION_P region_p;
+   const struct REGION_STATS * stats_p;
+   char * outer_p;
+   char * inner_p;
+   char * p;
+   int i;
+
+   fprintf(stdout, "test nested lists\n");
+
+   region_p = new_region(CHUNK_SIZE);
+   assert(region_p != NULL);
+   stats_p = region_stats(region_p);
+   assert(1 == stats_p->chunk_allocations);
+
+   outer_p = region_alloc(region_p, 100);
+   assert(outer_p != NULL);
+   memset(outer_p, 'o', 100);
+
+   // enough to need more chunks
+   inner_p = region_alloc(region_p, 10);
+   assert(inner_p != NULL);
+   for (i=0; i < 100; i++) {
+      p = region_alloc(region_p, 100);
+      assert(p != NULL);
+      memset(p, 'i', 100);
+   }
+   assert(stats_p->chunk_allocations > 1);
+
+   // releasing the inner list leaves the outer one alone
+   region_release(region_p, inner_p);
+   for (i=0; i < 100; i++) {
+      assert('o' == outer_p[i]);
+   }
+   assert(stats_p->bytes_in_use < CHUNK_SIZE);
+   assert(stats_p->bytes_peak > 100 * 100);
+
+   // the next allocation reuses the memory
+   p = region_alloc(region_p, 10);
+   assert(p == inner_p);
+
+   // once empty, only the first chunk is kept
+   region_release(region_p, outer_p);
+   assert(0 == stats_p->bytes_in_use);
+   assert(CHUNK_SIZE == stats_p->chunk_bytes);
+
+   release_region(region_p);
+
+} // test_nested_lists
+
+//-----------------------------------------------------------------------------
+void test_large_allocation(void) {
+//-----------------------------------------------------------------------------
+   REGION_P region_p;
+   char * small_p;
+   char * large_p;
+
+   fprintf(stdout, "test large allocation\n");
+
+   region_p = new_region(CHUNK_SIZE);
+   assert(region_p != NULL);
+
+   small_p = region_alloc(region_p, 10);
+   large_p = region_alloc(region_p, 10 * CHUNK_SIZE);
+   assert(large_p != NULL);
+   memset(large_p, 'x', 10 * CHUNK_SIZE);
+
+   region_release(region_p, large_p);
+   assert(region_alloc(region_p, 10) == large_p);
+
+   region_release(region_p, small_p);
+   assert(0 == region_stats(region_p)->bytes_in_use);
+
+   release_region(region_p);
+
+} // test_large_allocation
+
+//-----------------------------------------------------------------------------
+int main(int argc, char **argv) {
+//-----------------------------------------------------------------------------
+   fprintf(stdout, "test starts\n");
+
+   test_nested_lists();
+   test_large_allocation();
+
+   fprintf(stdout, "test completes normally\n");
+   return 0;
+} // main
@@ -6,6 +6,12 @@
 #include <assert.h>
 
 #include "wd_directory.h"
+#include "error_text.h"
+
+// wd_directory.c reports fatal errors here, main.c defines these for the
+// real program
+char error_path[] = "/tmp/test_wd_directory_error.txt";
+FILE * error_file = NULL;
 
 struct TEST_ENTRY {
    int wd;
@@ -48,8 +54,9 @@ void test_single_directory(void) {
    wd_directory_initialize();
 
    fprintf(stdout, "test single directory\n");
-   result = add_wd_directory(single.wd, single.parent_wd, single.path_p);
+   result = add_wd_directory(single.wd, single.parent_wd, single.path_p, 0);
    assert(0 == result);
+   assert(1 == wd_directory_count());
 
    result_path = find_wd_directory(single.wd, path_buffer, PATH_BUFFER_LEN);
    assert(result_path != NULL);
@@ -63,6 +70,7 @@ void test_single_directory(void) {
 
    result = remove_wd_directory(single.wd);
    assert(0 == result);
+   assert(0 == wd_directory_count());
 
    result = find_directory_wd(single.path_p);
    assert(result == NULL_WD);
@@ -73,7 +81,7 @@ void test_single_directory(void) {
    result = find_wd_parent(single.wd);
    assert(result == NULL_WD);
    
-   result = add_wd_directory(single.wd, single.parent_wd, single.path_p);
+   result = add_wd_directory(single.wd, single.parent_wd, single.path_p, 0);
    assert(0 == result);
 
    node_p = prune_wd_directory(single.wd);
@@ -106,7 +114,8 @@ void test_small_tree(void) {
       result = add_wd_directory(
          small_tree[i].wd, 
          small_tree[i].parent_wd, 
-         small_tree[i].path_p
+         small_tree[i].path_p,
+         0
       );
       assert(0 == result);
    } 
@@ -148,7 +157,8 @@ void test_small_tree(void) {
       result = add_wd_directory(
          small_tree[i].wd, 
          small_tree[i].parent_wd, 
-         small_tree[i].path_p
+         small_tree[i].path_p,
+         0
       );
       assert(0 == result);
    } 
@@ -172,6 +182,95 @@ void test_small_tree(void) {
 
 } // test_small_tree
 
+//-----------------------------------------------------------------------------
+void test_move(void) {
+//-----------------------------------------------------------------------------
+   int tree_size;
+   int i;
+   int result;
+   const char * result_path;
+
+   wd_directory_initialize();
+
+   fprintf(stdout, "test move\n");
+   tree_size = sizeof small_tree / sizeof(struct TEST_ENTRY);
+
+   for (i=0; i < tree_size; i++ ) {
+      result = add_wd_directory(
+         small_tree[i].wd, 
+         small_tree[i].parent_wd, 
+         small_tree[i].path_p,
+         0
+      );
+      assert(0 == result);
+   } 
+
+   // mv aaa/ccc aaa/bbb/hhh
+   result = move_wd_directory(12, 11, "hhh");
+   assert(0 == result);
+   assert(tree_size == wd_directory_count());
+   assert(NULL_WD == find_directory_wd("aaa/ccc"));
+   assert(NULL_WD == find_directory_wd("aaa/ccc/fff"));
+   assert(12 == find_directory_wd("aaa/bbb/hhh"));
+   assert(16 == find_directory_wd("aaa/bbb/hhh/ggg"));
+   assert(11 == find_wd_parent(12));
+
+   result_path = find_wd_directory(15, path_buffer, PATH_BUFFER_LEN);
+   assert(result_path != NULL);
+   assert(strcmp(result_path, "aaa/bbb/hhh/fff") == 0);
+
+   // not into itself, and not onto a directory we have
+   assert(move_wd_directory(11, 12, "bbb") != 0);
+   assert(move_wd_directory(13, 11, "eee") != 0);
+
+   release_wd_list(prune_wd_directory(11));
+   assert(1 == wd_directory_count());
+   assert(NULL_WD == find_directory_wd("aaa/bbb/hhh/ggg"));
+
+   wd_directory_close();
+
+} // test_move
+
+//-----------------------------------------------------------------------------
+void test_shared_prefix(void) {
+//-----------------------------------------------------------------------------
+   int result;
+   const char * result_path;
+
+   wd_directory_initialize();
+
+   fprintf(stdout, "test shared prefix\n");
+
+   // top level directories: the components above them are not watched
+   assert(0 == add_wd_directory(1, NULL_WD, "/home/user/Projects", 0));
+   assert(0 == add_wd_directory(2, NULL_WD, "/home/user/Documents", 0));
+   assert(0 == add_wd_directory(3, 1, "/home/user/Projects/src", 1));
+   assert(0 == add_wd_directory(4, 2, "/home/user/Documents/src", 0));
+   assert(add_wd_directory(5, 1, "/home/user/Projects/src", 0) != 0);
+   assert(add_wd_directory(4, 1, "/home/user/Projects/lib", 0) != 0);
+   assert(4 == wd_directory_count());
+   assert(NULL_WD == find_directory_wd("/home/user"));
+   assert(1 == find_wd_profile(3));
+
+   // a directory removed before its subdirectories keeps their paths
+   result = remove_wd_directory(1);
+   assert(0 == result);
+   assert(NULL_WD == find_directory_wd("/home/user/Projects"));
+   result_path = find_wd_directory(3, path_buffer, PATH_BUFFER_LEN);
+   assert(result_path != NULL);
+   assert(strcmp(result_path, "/home/user/Projects/src") == 0);
+
+   assert(0 == add_wd_directory(6, NULL_WD, "/home/user/Projects", 0));
+   assert(6 == find_directory_wd("/home/user/Projects"));
+
+   result_path = find_wd_directory(4, path_buffer, 10);
+   assert(result_path != NULL);
+   assert(strncmp(result_path, "/home/user", 10) == 0);
+
+   wd_directory_close();
+
+} // test_shared_prefix
+
 //-----------------------------------------------------------------------------
 int main(int argc, char **argv) {
 //-----------------------------------------------------------------------------
@@ -179,6 +278,8 @@ int main(int argc, char **argv) {
 
    test_single_directory();
    test_small_tree();
+   test_move();
+   test_shared_prefix();
 
    fprintf(stdout, "test completes normally\n");
    return 0;
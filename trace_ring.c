@@ -0,0 +1,122 @@
+//-----------------------------------------------------------------------------
+// trace_ring.c
+//
+// a fixed size in memory record of recent events and what we did with them
+//-----------------------------------------------------------------------------
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+
+#include "trace_ring.h"
+
+struct TRACE_RECORD {
+   uint64_t time_ns;       // CLOCK_MONOTONIC
+   int32_t  wd;
+   uint32_t mask;
+   uint32_t cookie;
+   uint32_t action;
+};
+
+static struct TRACE_RECORD ring[TRACE_RING_SIZE];
+static uint64_t next_record = 0; // total records ever written
+
+static const char * action_names[TRACE_ACTION_COUNT] = {
+   "event",
+   "watch_added",
+   "watch_excluded",
+   "watch_removed",
+   "pruned",
+   "moved",
+   "cookie_absent",
+   "drop_temp_file",
+   "drop_no_parent",
+   "drop_unchanged",
+   "drop_rate_limited",
+   "drop_deleted",
+   "marked",
+   "flushed",
+   "reload",
+   "barrier",
+   "resync"
+};
+
+//-----------------------------------------------------------------------------
+void trace(enum TRACE_ACTION action, int wd, uint32_t mask, uint32_t cookie) {
+//-----------------------------------------------------------------------------
+   struct TRACE_RECORD * record_p;
+   struct timespec now;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+
+   record_p = &ring[next_record & (TRACE_RING_SIZE - 1)];
+   record_p->time_ns = (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+   record_p->wd = wd;
+   record_p->mask = mask;
+   record_p->cookie = cookie;
+   record_p->action = action;
+   next_record++;
+
+} // trace
+
+//-----------------------------------------------------------------------------
+int dump_trace_ring(const char * path, const char * temp_path) {
+//-----------------------------------------------------------------------------
+   FILE * file_p;
+   const struct TRACE_RECORD * record_p;
+   uint64_t first;
+   uint64_t i;
+   int error;
+
+   file_p = fopen(temp_path, "w");
+   if (NULL == file_p) {
+      error = errno;
+      syslog(LOG_WARNING, "fopen %s %d %s", temp_path, error, strerror(error));
+      return -1;
+   }
+
+   first = 0;
+   if (next_record > TRACE_RING_SIZE) {
+      first = next_record - TRACE_RING_SIZE;
+   }
+
+   fprintf(
+      file_p,
+      "# %llu records, %llu overwritten\n",
+      (unsigned long long) next_record,
+      (unsigned long long) first
+   );
+   fprintf(file_p, "# time_ns wd mask cookie action\n");
+
+   for (i=first; i < next_record; i++) {
+      record_p = &ring[i & (TRACE_RING_SIZE - 1)];
+      fprintf(
+         file_p,
+         "%llu %d 0x%08X %u %s\n",
+         (unsigned long long) record_p->time_ns,
+         record_p->wd,
+         record_p->mask,
+         record_p->cookie,
+         record_p->action < TRACE_ACTION_COUNT ?
+            action_names[record_p->action] : "*unknown*"
+      );
+   }
+
+   if (ferror(file_p)) {
+      error = errno;
+      syslog(LOG_WARNING, "fprintf %s %d %s", temp_path, error, strerror(error));
+      fclose(file_p);
+      return -1;
+   }
+   fclose(file_p);
+
+   if (rename(temp_path, path) != 0) {
+      error = errno;
+      syslog(LOG_WARNING, "rename %s %d %s", path, error, strerror(error));
+      return -1;
+   }
+
+   return 0;
+
+} // dump_trace_ring
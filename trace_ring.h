@@ -0,0 +1,49 @@
+//-----------------------------------------------------------------------------
+// trace_ring.h
+//
+// a fixed size in memory record of recent events and what we did with them
+//
+// Recording is a few stores into a binary ring, with no formatting and no
+// system calls, so it is always on. The ring is only turned into text when
+// it is dumped: on SIGUSR2, and when the watcher exits with an error.
+//-----------------------------------------------------------------------------
+#if !defined(__TRACE_RING_H)
+#define __TRACE_RING_H
+
+#include <stdint.h>
+
+#define TRACE_RING_SIZE 8192 // records, must be a power of 2
+
+enum TRACE_ACTION {
+   TRACE_EVENT,            // read from inotify
+   TRACE_WATCH_ADDED,
+   TRACE_WATCH_EXCLUDED,   // wd is the parent, the directory is not watched
+   TRACE_WATCH_REMOVED,    // IN_IGNORED, the kernel removed the watch
+   TRACE_PRUNED,           // we removed the watch and everything below it
+   TRACE_MOVED,            // a watched directory was renamed, cookie is
+                           // the new parent's wd
+   TRACE_COOKIE_ABSENT,    // IN_MOVED_TO without a matching IN_MOVED_FROM
+   TRACE_DROP_TEMP_FILE,
+   TRACE_DROP_NO_PARENT,
+   TRACE_DROP_UNCHANGED,
+   TRACE_DROP_RATE_LIMITED,
+   TRACE_DROP_DELETED,     // the directory is deleted later in the batch
+   TRACE_MARKED,           // the directory is dirty
+   TRACE_FLUSHED,          // cookie is the directories handed to the writer
+   TRACE_RELOAD,
+   TRACE_BARRIER,          // cookie is stream 0's last notification number
+   TRACE_RESYNC,           // a shard's queue overflowed, cookie is the shard
+   TRACE_ACTION_COUNT
+};
+
+// record an action
+// wd, mask and cookie are from the inotify event, where there is one
+void trace(enum TRACE_ACTION action, int wd, uint32_t mask, uint32_t cookie);
+
+// write the ring, oldest record first, as text lines to temp_path, then
+// rename it to path
+// This is called from an on_exit handler, so it must not exit
+// returns 0 for success
+int dump_trace_ring(const char * path, const char * temp_path);
+
+#endif // !defined(__TRACE_RING_H)
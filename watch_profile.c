@@ -0,0 +1,257 @@
+//-----------------------------------------------------------------------------
+// watch_profile.c
+//
+// per top level directory inotify masks
+//-----------------------------------------------------------------------------
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <syslog.h>
+#include <time.h>
+
+#include "watch_profile.h"
+
+#define MAX_WATCH_PROFILES 32
+#define MODIFY_TABLE_SIZE 4096 // must be a power of 2
+
+#define STRUCTURE_MASK ( \
+      IN_CREATE \
+    | IN_DELETE \
+    | IN_MOVED_FROM \
+    | IN_MOVED_TO \
+    | IN_DELETE_SELF \
+    | IN_MOVE_SELF \
+)
+
+#define DEFAULT_MASK (STRUCTURE_MASK | IN_CLOSE_WRITE)
+
+struct WATCH_PROFILE {
+   uint32_t mask;
+   int      modify_interval;
+};
+
+static struct WATCH_PROFILE profiles[MAX_WATCH_PROFILES] = {
+   {DEFAULT_MASK, 0}
+};
+static int profile_count = 1;
+
+// one file whose IN_MODIFY events we are rate limiting
+struct MODIFY_ENTRY {
+   int      wd;           // NULL_WD (0) for an empty slot
+   uint32_t name_hash;
+   time_t   last_report;
+   int      interval;
+   int      pending;      // an event was suppressed since last_report
+};
+
+static struct MODIFY_ENTRY * modify_table = NULL;
+static int modify_entry_count = 0; // slots in use
+
+//-----------------------------------------------------------------------------
+static time_t monotonic_seconds(void) {
+//-----------------------------------------------------------------------------
+   struct timespec now;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+   return now.tv_sec;
+
+} // monotonic_seconds
+
+//-----------------------------------------------------------------------------
+static int find_profile(uint32_t mask, int modify_interval) {
+//-----------------------------------------------------------------------------
+   int i;
+
+   for (i=0; i < profile_count; i++) {
+      if (
+         (profiles[i].mask == mask) &&
+         (profiles[i].modify_interval == modify_interval)
+      ) {
+         return i;
+      }
+   }
+
+   if (profile_count == MAX_WATCH_PROFILES) {
+      syslog(LOG_ERR, "too many watch profiles");
+      return -1;
+   }
+
+   profiles[profile_count].mask = mask;
+   profiles[profile_count].modify_interval = modify_interval;
+   return profile_count++;
+
+} // find_profile
+
+//-----------------------------------------------------------------------------
+const char * parse_watch_profile(const char * line_p, int * profile_p) {
+//-----------------------------------------------------------------------------
+   const char * path_p;
+   char * end_p;
+   size_t name_len;
+   long interval;
+   int profile;
+
+   if ('/' == *line_p) {
+      *profile_p = DEFAULT_WATCH_PROFILE;
+      return line_p;
+   }
+
+   path_p = strchr(line_p, ' ');
+   if (NULL == path_p) {
+      return NULL;
+   }
+   name_len = path_p - line_p;
+   while (' ' == *path_p) {
+      path_p++;
+   }
+
+   if ((7 == name_len) && (0 == strncmp(line_p, "default", name_len))) {
+      profile = DEFAULT_WATCH_PROFILE;
+   } else if ((9 == name_len) && (0 == strncmp(line_p, "structure", name_len))) {
+      profile = find_profile(STRUCTURE_MASK, 0);
+   } else if ((name_len > 7) && (0 == strncmp(line_p, "modify:", 7))) {
+      interval = strtol(line_p + 7, &end_p, 10);
+      if ((end_p != line_p + name_len) || (interval < 1)) {
+         return NULL;
+      }
+      profile = find_profile(DEFAULT_MASK | IN_MODIFY, (int) interval);
+   } else {
+      return NULL;
+   }
+
+   if (profile < 0) {
+      return NULL;
+   }
+
+   *profile_p = profile;
+   return path_p;
+
+} // parse_watch_profile
+
+//-----------------------------------------------------------------------------
+uint32_t watch_profile_mask(int profile) {
+//-----------------------------------------------------------------------------
+   if ((profile < 0) || (profile >= profile_count)) {
+      return DEFAULT_MASK;
+   }
+   return profiles[profile].mask;
+} // watch_profile_mask
+
+//-----------------------------------------------------------------------------
+int watch_profile_modify_interval(int profile) {
+//-----------------------------------------------------------------------------
+   if ((profile < 0) || (profile >= profile_count)) {
+      return 0;
+   }
+   return profiles[profile].modify_interval;
+} // watch_profile_modify_interval
+
+//-----------------------------------------------------------------------------
+int allow_modify_event(int wd, const char * name_p, int interval) {
+//-----------------------------------------------------------------------------
+   struct MODIFY_ENTRY * entry_p;
+   uint32_t hash;
+   time_t now;
+
+   if (NULL == modify_table) {
+      modify_table = calloc(MODIFY_TABLE_SIZE, sizeof(struct MODIFY_ENTRY));
+      if (NULL == modify_table) {
+         // no rate limiting is better than no reports
+         return 1;
+      }
+   }
+
+   // FNV-1a over the wd and the name
+   hash = (2166136261u ^ (uint32_t) wd) * 16777619u;
+   for (; *name_p != '\0'; name_p++) {
+      hash ^= (unsigned char) *name_p;
+      hash *= 16777619u;
+   }
+
+   now = monotonic_seconds();
+   entry_p = &modify_table[hash & (MODIFY_TABLE_SIZE - 1)];
+
+   if (
+      (entry_p->wd == wd) &&
+      (entry_p->name_hash == hash) &&
+      (now - entry_p->last_report < entry_p->interval)
+   ) {
+      entry_p->pending = 1;
+      return 0;
+   }
+
+   // don't lose a suppressed event for another file, report this one
+   // without tracking it instead
+   if (
+      entry_p->pending && 
+      ((entry_p->wd != wd) || (entry_p->name_hash != hash))
+   ) {
+      return 1;
+   }
+
+   if (0 == entry_p->wd) {
+      modify_entry_count++;
+   }
+   entry_p->wd = wd;
+   entry_p->name_hash = hash;
+   entry_p->last_report = now;
+   entry_p->interval = interval;
+   entry_p->pending = 0;
+
+   return 1;
+
+} // allow_modify_event
+
+//-----------------------------------------------------------------------------
+void expire_modify_events(MODIFY_REPORTER report_p) {
+//-----------------------------------------------------------------------------
+   struct MODIFY_ENTRY * entry_p;
+   time_t now;
+
+   if (NULL == modify_table) {
+      return;
+   }
+
+   now = monotonic_seconds();
+   for (
+      entry_p = modify_table;
+      entry_p < modify_table + MODIFY_TABLE_SIZE;
+      entry_p++
+   ) {
+      if ((0 == entry_p->wd) || (now - entry_p->last_report < entry_p->interval)) {
+         continue;
+      }
+      if (entry_p->pending) {
+         entry_p->pending = 0;
+         entry_p->last_report = now;
+         report_p(entry_p->wd);
+      } else {
+         // quiet for a whole interval: the next event is reported anyway
+         memset(entry_p, 0, sizeof(struct MODIFY_ENTRY));
+         modify_entry_count--;
+      }
+   }
+
+} // expire_modify_events
+
+//-----------------------------------------------------------------------------
+void forget_modify_events(MODIFY_WD_TEST watched_p) {
+//-----------------------------------------------------------------------------
+   struct MODIFY_ENTRY * entry_p;
+
+   if (0 == modify_entry_count) {
+      return;
+   }
+
+   for (
+      entry_p = modify_table;
+      entry_p < modify_table + MODIFY_TABLE_SIZE;
+      entry_p++
+   ) {
+      if ((entry_p->wd != 0) && (! watched_p(entry_p->wd))) {
+         memset(entry_p, 0, sizeof(struct MODIFY_ENTRY));
+         modify_entry_count--;
+      }
+   }
+
+} // forget_modify_events
@@ -0,0 +1,53 @@
+//-----------------------------------------------------------------------------
+// watch_profile.h
+//
+// per top level directory inotify masks
+//
+// A line in the config file may start with a profile name:
+//
+//    /home/user                  the default profile
+//    structure /archive          only directory structure changes
+//    modify:60 /var/lib/vms      also IN_MODIFY, at most once every 60
+//                                seconds for each file
+//
+// Every directory below a top level directory uses its profile.
+//-----------------------------------------------------------------------------
+#if !defined(__WATCH_PROFILE_H)
+#define __WATCH_PROFILE_H
+
+#include <stdint.h>
+
+#define DEFAULT_WATCH_PROFILE 0
+
+// split a config line into profile and path
+// returns a pointer to the path within line_p and stores the profile in
+// *profile_p, or returns NULL if the profile is not valid
+const char * parse_watch_profile(const char * line_p, int * profile_p);
+
+// the inotify mask for a profile
+uint32_t watch_profile_mask(int profile);
+
+// the minimum number of seconds between IN_MODIFY reports for a file,
+// 0 if the profile does not watch IN_MODIFY
+int watch_profile_modify_interval(int profile);
+
+// rate limit IN_MODIFY for a file in the directory watched by wd
+// returns nonzero if the event should be reported. A suppressed event is
+// remembered, and reported by expire_modify_events when its interval ends.
+// Memory is bounded: when the table is full we forget older files, which
+// only means an extra report.
+int allow_modify_event(int wd, const char * name_p, int interval);
+
+// call report_p with the wd of every suppressed IN_MODIFY whose interval
+// has ended, and forget the files which have had none
+typedef void (* MODIFY_REPORTER)(int wd);
+void expire_modify_events(MODIFY_REPORTER report_p);
+
+// forget the IN_MODIFY events for the wds watched_p says are gone. Call
+// after wds are removed, before the kernel can give them to other
+// directories, so they aren't reported as changed. It goes through the
+// whole table, so call it once for a batch of removals, not for each.
+typedef int (* MODIFY_WD_TEST)(int wd);
+void forget_modify_events(MODIFY_WD_TEST watched_p);
+
+#endif // !defined(__WATCH_PROFILE_H)
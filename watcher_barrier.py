@@ -0,0 +1,97 @@
+"""
+watcher_barrier.py
+
+Wait until the watcher has processed every change made so far.
+
+The consumer writes barrier.<token> in the directory holding the config
+file. The watcher reads everything that was already queued, writes the
+notification file for it, and answers with barrier.<token>.ack in the
+notification directory. The ack holds the number of the last notification
+file written, so every change made before the barrier is in that file or
+an earlier one. When the watcher splits its notifications into streams
+(SPIDEROAK_DIR_WATCHER_STREAMS), the ack holds a line for each stream with
+the stream and its last number.
+
+    from watcher_barrier import barrier
+    last_notification = barrier(config_dir, notify_dir)
+
+or from the shell, printing the number:
+
+    python watcher_barrier.py <config dir> <notification dir> [timeout]
+"""
+from __future__ import print_function
+
+import os
+import os.path
+import sys
+import time
+import uuid
+
+_barrier_prefix = "barrier."
+_ack_suffix = ".ack"
+_poll_interval = 0.005
+
+class BarrierTimeout(Exception):
+    pass
+
+def barrier(config_dir, notify_dir, timeout=30.0):
+    """
+    return the number of the last notification file covering every change
+    made before the call (0 if there are none yet), or with more than one
+    stream, a dict of stream number to last notification number
+    """
+    token = uuid.uuid4().hex
+    barrier_path = os.path.join(config_dir, _barrier_prefix + token)
+    ack_path = os.path.join(
+        notify_dir, "".join([_barrier_prefix, token, _ack_suffix, ])
+    )
+
+    open(barrier_path, "w").close()
+
+    start_time = time.time()
+    while not os.path.exists(ack_path):
+        if time.time() - start_time > timeout:
+            # don't leave it for the watcher to find later
+            if os.path.exists(barrier_path):
+                os.unlink(barrier_path)
+            raise BarrierTimeout(
+                "no ack for %s after %s seconds" % (barrier_path, timeout, )
+            )
+        time.sleep(_poll_interval)
+
+    with open(ack_path) as ack_file:
+        lines = ack_file.read().split()
+    os.unlink(ack_path)
+
+    if len(lines) == 1:
+        return int(lines[0])
+    return dict(
+        (int(stream), int(number), ) 
+        for stream, number in zip(lines[0::2], lines[1::2])
+    )
+
+def main():
+    args = sys.argv[1:]
+    if len(args) not in (2, 3, ):
+        print(
+            "Usage: ... <config dir> <notification dir> [timeout seconds]",
+            file=sys.stderr
+        )
+        return -1
+
+    timeout = float(args[2]) if len(args) == 3 else 30.0
+    try:
+        last_notification = barrier(args[0], args[1], timeout)
+        if isinstance(last_notification, dict):
+            for stream in sorted(last_notification):
+                print("%02d %08d" % (stream, last_notification[stream], ))
+        else:
+            print("%08d" % (last_notification, ))
+    except BarrierTimeout as instance:
+        print(str(instance), file=sys.stderr)
+        return 1
+
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -2,185 +2,771 @@
 // wd_directory.c
 //
 // connect inotify watch descriptor (wd) to the directory it is watching
+//
+// The watched tree is kept as a prefix tree: one node per path component,
+// holding its parent's node index and an interned name. Paths are rebuilt
+// from the nodes on demand, so a shared prefix like /home/user/Projects is
+// stored once, and a renamed directory is moved by relinking one node.
+// Directories on the way to watched ones (/home, /home/user) have nodes
+// with NULL_WD, and so does a removed directory whose subdirectories are
+// still watched.
 //-----------------------------------------------------------------------------
-#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
-#include <unistd.h>
-
-#include <sqlite3.h>
 
 #include "wd_directory.h"
 #include "error_text.h"
 
-static int error; // holder for errno
+#define ABSOLUTE_ROOT 0      // parent of the first component of /a/b
+#define RELATIVE_ROOT 1      // parent of the first component of a/b
+#define NO_NODE (-1)
+#define FREE_NODE (-2)       // parent of a node on the free list
+#define NO_NAME (-1)
+#define FREE_SLOT (-1)
+#define INITIAL_NODES 1024
+#define INITIAL_NAMES 1024
+#define INITIAL_POOL_SIZE 16384
+#define INITIAL_TABLE_SLOTS 2048
+#define VISIT_PATH_LEN 4096
+#define WD_LIST_REGION_CHUNK_SIZE (64 * 1024)
+
+// one directory, or one component on the way to a watched directory
+struct WD_NODE {
+   int      wd;              // NULL_WD if not watched
+   int      parent_wd;       // as given to add_wd_directory
+   int      profile;
+   int      parent;          // node index, NO_NODE for the roots
+   int      name;            // index in names
+   uint32_t hash;            // hash of (parent, name)
+   int      first_child;
+   // siblings are a circular list, so the first child's prev_sibling
+   // is the last child
+   int      next_sibling;
+   int      prev_sibling;
+};
+
+// a component name, shared by every directory with that name
+struct NAME_ENTRY {
+   int      offset;          // in the pool, or the next free entry
+   int      len;
+   int      refs;            // 0 for a free entry
+   uint32_t hash;
+};
+
+// open addressing hash of indexes, size is a power of 2,
+// FREE_SLOT marks a free slot, kept at most half full
+struct SLOT_TABLE {
+   int        * slots;
+   unsigned int size;
+   int          count;
+};
+
+typedef uint32_t (* ENTRY_HASH)(int entry);
+
+static struct WD_NODE * nodes = NULL;
+static int node_count = 0;           // the high water mark
+static int node_slots = 0;
+static int free_nodes = NO_NODE;
+
+static struct NAME_ENTRY * names = NULL;
+static int name_count = 0;
+static int name_slots = 0;
+static int free_names = NO_NAME;
+
+static char * pool = NULL;
+static int pool_used = 0;
+static int pool_size = 0;
+static int pool_dead = 0;            // bytes of names no longer used
+
+static struct SLOT_TABLE wd_table;     // nodes keyed by wd
+static struct SLOT_TABLE child_table;  // nodes keyed by (parent, name)
+static struct SLOT_TABLE name_table;   // names keyed by text
+
+static char visit_path[VISIT_PATH_LEN+1];
+
+static REGION_P wd_list_region = NULL;
 
-static const char * memory_database = ":memory:";
-static const char * use_memory_database = 
-   "SPIDEROAK_DIR_WATCHER_MEMORY_DATABASE";
+//-----------------------------------------------------------------------------
+static void out_of_memory(const char * what_p) {
+//-----------------------------------------------------------------------------
+   syslog(LOG_ERR, "unable to allocate %s", what_p);
+   error_file = fopen(error_path, "w");
+   fprintf(error_file, "unable to allocate %s\n", what_p);
+   fclose(error_file);
+   exit(-1);
+} // out_of_memory
 
-static const char * schema =
-"CREATE TABLE wd_directory ("
-"   wd          INTEGER PRIMARY KEY,"
-"   parent_wd   INTEGER,"
-"   path        TEXT"
-");"
-"CREATE UNIQUE INDEX wd_directory_path ON wd_directory(path);"
-"CREATE INDEX wd_directory_parent ON wd_directory(parent_wd);"
-;
+//-----------------------------------------------------------------------------
+static uint32_t text_hash(const char * text_p, int text_len) {
+//-----------------------------------------------------------------------------
+   // FNV-1a
+   uint32_t hash = 2166136261u;
+   int i;
 
-static const char * journal_off =
-"PRAGMA journal_mode = OFF;";
+   for (i=0; i < text_len; i++) {
+      hash ^= (unsigned char) text_p[i];
+      hash *= 16777619u;
+   }
 
-static const char * sync_off =
-"PRAGMA synchronous = 0;";
+   return hash;
 
-static const char * add_entry =
-"INSERT INTO wd_directory VALUES(%i, %i, %Q);";
+} // text_hash
 
-static const char * remove_entry =
-"DELETE FROM wd_directory where wd = %i;";
+//-----------------------------------------------------------------------------
+static uint32_t component_hash(int parent, int name) {
+//-----------------------------------------------------------------------------
+   // FNV-1a over the parent index and the name index
+   uint32_t hash = 2166136261u;
+
+   hash = (hash ^ (uint32_t) parent) * 16777619u;
+   hash = (hash ^ (uint32_t) name) * 16777619u;
+
+   return hash;
+
+} // component_hash
+
+//-----------------------------------------------------------------------------
+static uint32_t wd_hash(int wd) {
+//-----------------------------------------------------------------------------
+   // wds are small consecutive integers, spread them over the table
+   return (uint32_t) wd * 2654435761u;
+} // wd_hash
+
+//-----------------------------------------------------------------------------
+static uint32_t wd_entry_hash(int node) {
+//-----------------------------------------------------------------------------
+   return wd_hash(nodes[node].wd);
+} // wd_entry_hash
 
-static const char * fetch_wd = 
-"SELECT wd from wd_directory where path = %Q;";
+//-----------------------------------------------------------------------------
+static uint32_t child_entry_hash(int node) {
+//-----------------------------------------------------------------------------
+   return nodes[node].hash;
+} // child_entry_hash
 
-static const char * fetch_parent = 
-"SELECT parent_wd from wd_directory where wd = %i;";
+//-----------------------------------------------------------------------------
+static uint32_t name_entry_hash(int name) {
+//-----------------------------------------------------------------------------
+   return names[name].hash;
+} // name_entry_hash
 
-static const char * fetch_path = 
-"SELECT path from wd_directory where wd = %i;";
+//-----------------------------------------------------------------------------
+static void table_initialize(struct SLOT_TABLE * table_p, unsigned int size) {
+//-----------------------------------------------------------------------------
+   unsigned int i;
 
-static const char * fetch_children = 
-"SELECT wd from wd_directory where parent_wd = %i;";
+   table_p->slots = malloc(size * sizeof(int));
+   if (NULL == table_p->slots) {
+      out_of_memory("wd_directory table");
+   }
+   for (i=0; i < size; i++) {
+      table_p->slots[i] = FREE_SLOT;
+   }
+   table_p->size = size;
+   table_p->count = 0;
 
-static sqlite3 * sqlite3_p = NULL;
+} // table_initialize
 
-//----------------------------------------------------------------------------
-static void execute_sql(const char * format_p, ...) {
-//----------------------------------------------------------------------------
-   va_list ap;
-   char * sql_p;
-   char * error_message_p;
-   int result;
+//-----------------------------------------------------------------------------
+// put an entry in the slot found for it, growing the table if need be
+static void table_insert(
+   struct SLOT_TABLE * table_p,
+   unsigned int slot,
+   int entry,
+   ENTRY_HASH entry_hash_p
+) {
+//-----------------------------------------------------------------------------
+   struct SLOT_TABLE old_table;
+   unsigned int mask;
+   unsigned int i;
+   unsigned int j;
+
+   table_p->slots[slot] = entry;
+   table_p->count++;
+   if (table_p->count * 2 <= table_p->size) {
+      return;
+   }
 
-   va_start(ap, format_p);
-   sql_p = sqlite3_vmprintf(format_p, ap);
-   va_end(ap);
+   old_table = *table_p;
+   table_initialize(table_p, old_table.size * 2);
+   table_p->count = old_table.count;
 
-   error_message_p = NULL;
-   result = sqlite3_exec(sqlite3_p, sql_p, NULL, NULL, &error_message_p); 
-   if (result != SQLITE_OK) {
-      error_file = fopen(error_path, "w");
-      syslog(LOG_ERR, "%s %s", sqlite3_errmsg(sqlite3_p), sql_p);
-      fprintf(error_file, "%s %s\n", sqlite3_errmsg(sqlite3_p), sql_p);
-      if (error_message_p != NULL) {
-         syslog(LOG_ERR, "SQL error %s", error_message_p);
-         fprintf(error_file, "SQL error %s\n", error_message_p);
-         sqlite3_free(error_message_p);
-         error_message_p = NULL;
+   mask = table_p->size - 1;
+   for (j=0; j < old_table.size; j++) {
+      if (FREE_SLOT == old_table.slots[j]) {
+         continue;
       }
-      fclose(error_file);
-      exit(-1);
+      for (
+         i = entry_hash_p(old_table.slots[j]) & mask;
+         table_p->slots[i] != FREE_SLOT;
+         i = (i+1) & mask
+      ) {
+      }
+      table_p->slots[i] = old_table.slots[j];
+   }
+
+   free(old_table.slots);
+
+} // table_insert
+
+//-----------------------------------------------------------------------------
+// empty a slot, moving back the entries after it which would otherwise
+// no longer be found
+static void table_delete(
+   struct SLOT_TABLE * table_p,
+   unsigned int slot,
+   ENTRY_HASH entry_hash_p
+) {
+//-----------------------------------------------------------------------------
+   unsigned int mask = table_p->size - 1;
+   unsigned int i;
+   unsigned int j;
+   unsigned int home;
+
+   i = slot;
+   j = slot;
+   while (1) {
+      table_p->slots[i] = FREE_SLOT;
+      while (1) {
+         j = (j+1) & mask;
+         if (FREE_SLOT == table_p->slots[j]) {
+            table_p->count--;
+            return;
+         }
+         home = entry_hash_p(table_p->slots[j]) & mask;
+         // the entry at j can stay unless i lies between home and j
+         if ((i <= j) ? ((i < home) && (home <= j)) : ((i < home) || (home <= j))) {
+            continue;
+         }
+         break;
+      }
+      table_p->slots[i] = table_p->slots[j];
+      i = j;
    }
 
-   sqlite3_free(sql_p);
+} // table_delete
 
-} // execute_sql
+//-----------------------------------------------------------------------------
+// the slot in a table holding this entry
+static unsigned int table_entry_slot(
+   struct SLOT_TABLE * table_p,
+   int entry,
+   uint32_t hash
+) {
+//-----------------------------------------------------------------------------
+   unsigned int mask = table_p->size - 1;
+   unsigned int i;
 
-//----------------------------------------------------------------------------
-static sqlite3_stmt * prepare_sql_statement(const char * format_p, ...) {
-//----------------------------------------------------------------------------
-   va_list ap;
-   char * sql_p;
-   sqlite3_stmt * statement_p;
-   const char * tail_p; 
-   int result;
+   for (i = hash & mask; table_p->slots[i] != entry; i = (i+1) & mask) {
+   }
 
-   va_start(ap, format_p);
-   sql_p = sqlite3_vmprintf(format_p, ap);
-   va_end(ap);
+   return i;
 
-   result = sqlite3_prepare(
-      sqlite3_p, 
-      sql_p, 
-      strlen(sql_p), 
-      &statement_p,
-      &tail_p
-   );    
-   sqlite3_free(sql_p);
+} // table_entry_slot
 
-   if (result != SQLITE_OK) {
-      error_file = fopen(error_path, "w");
-      fprintf(
-         error_file, 
-         "sqlite3_prepare %s %s\n", 
-         sqlite3_errmsg(sqlite3_p), 
-         sql_p
-      );
-      fclose(error_file);
-      syslog(
-         LOG_ERR, 
-         "sqlite3_prepare %s %s", 
-         sqlite3_errmsg(sqlite3_p), 
-         sql_p
-      );
+//-----------------------------------------------------------------------------
+// the slot in the wd table holding the wd, or the free slot where it
+// would go
+static unsigned int find_wd_slot(int wd) {
+//-----------------------------------------------------------------------------
+   unsigned int mask = wd_table.size - 1;
+   unsigned int i;
+
+   for (
+      i = wd_hash(wd) & mask;
+      wd_table.slots[i] != FREE_SLOT;
+      i = (i+1) & mask
+   ) {
+      if (nodes[wd_table.slots[i]].wd == wd) {
+         break;
+      }
+   }
 
-      sqlite3_close(sqlite3_p);
-      exit(-1);
+   return i;
+
+} // find_wd_slot
+
+//-----------------------------------------------------------------------------
+static int find_wd_node(int wd) {
+//-----------------------------------------------------------------------------
+   if (NULL_WD == wd) {
+      return NO_NODE;
    }
+   return wd_table.slots[find_wd_slot(wd)];
+} // find_wd_node
 
-   return statement_p;
+//-----------------------------------------------------------------------------
+// the slot in the children table holding the child, or the free slot
+// where it would go
+static unsigned int find_child_slot(int parent, int name, uint32_t hash) {
+//-----------------------------------------------------------------------------
+   unsigned int mask = child_table.size - 1;
+   unsigned int i;
+   struct WD_NODE * node_p;
+
+   for (
+      i = hash & mask;
+      child_table.slots[i] != FREE_SLOT;
+      i = (i+1) & mask
+   ) {
+      node_p = &nodes[child_table.slots[i]];
+      if ((node_p->parent == parent) && (node_p->name == name)) {
+         break;
+      }
+   }
+
+   return i;
 
-} // prepare_sql_statement
+} // find_child_slot
 
 //-----------------------------------------------------------------------------
-int wd_directory_initialize(void) {
+// the slot in the name table holding the name, or the free slot where it
+// would go
+static unsigned int find_name_slot(
+   const char * name_p,
+   int name_len,
+   uint32_t hash
+) {
+//-----------------------------------------------------------------------------
+   unsigned int mask = name_table.size - 1;
+   unsigned int i;
+   struct NAME_ENTRY * entry_p;
+
+   for (
+      i = hash & mask;
+      name_table.slots[i] != FREE_SLOT;
+      i = (i+1) & mask
+   ) {
+      entry_p = &names[name_table.slots[i]];
+      if (
+         (entry_p->hash == hash) &&
+         (entry_p->len == name_len) &&
+         (0 == memcmp(&pool[entry_p->offset], name_p, name_len))
+      ) {
+         break;
+      }
+   }
+
+   return i;
+
+} // find_name_slot
+
+//-----------------------------------------------------------------------------
+static int pool_store(const char * text_p, int text_len) {
+//-----------------------------------------------------------------------------
+   char * new_pool;
+   int new_size;
+   int offset;
+
+   if (pool_used + text_len + 1 > pool_size) {
+      new_size = pool_size * 2;
+      while (pool_used + text_len + 1 > new_size) {
+         new_size *= 2;
+      }
+      new_pool = realloc(pool, new_size);
+      if (NULL == new_pool) {
+         out_of_memory("wd_directory name pool");
+      }
+      pool = new_pool;
+      pool_size = new_size;
+   }
+
+   offset = pool_used;
+   memcpy(&pool[offset], text_p, text_len);
+   pool[offset+text_len] = '\0';
+   pool_used += text_len + 1;
+
+   return offset;
+
+} // pool_store
+
+//-----------------------------------------------------------------------------
+// copy the names still in use to a new pool, once most of it is dead
+static void compact_pool(void) {
+//-----------------------------------------------------------------------------
+   char * new_pool;
+   int new_size;
+   int live;
+   int offset;
+   int name;
+
+   live = pool_used - pool_dead;
+   new_size = pool_size;
+   while ((new_size > INITIAL_POOL_SIZE) && (live * 4 <= new_size)) {
+      new_size /= 2;
+   }
+
+   new_pool = malloc(new_size);
+   if (NULL == new_pool) {
+      out_of_memory("wd_directory name pool");
+   }
+
+   offset = 0;
+   for (name=0; name < name_count; name++) {
+      if (0 == names[name].refs) {
+         continue;
+      }
+      memcpy(&new_pool[offset], &pool[names[name].offset], names[name].len+1);
+      names[name].offset = offset;
+      offset += names[name].len + 1;
+   }
+
+   free(pool);
+   pool = new_pool;
+   pool_size = new_size;
+   pool_used = offset;
+   pool_dead = 0;
+
+} // compact_pool
+
 //-----------------------------------------------------------------------------
-   int result;
-   const char * env_p;   
-   int use_memory = 0;
-   char database_path [] = "/tmp/spideroak_inotify_db.XXXXXX";
-   int fd;
+// find a name without adding it, NO_NAME if we don't have it
+static int lookup_name(const char * name_p, int name_len) {
+//-----------------------------------------------------------------------------
+   unsigned int slot;
+
+   slot = find_name_slot(name_p, name_len, text_hash(name_p, name_len));
+   return name_table.slots[slot];
 
-   env_p = getenv(use_memory_database);
-   if (NULL != env_p) {
-      use_memory = atoi(env_p);
+} // lookup_name
+
+//-----------------------------------------------------------------------------
+// find or add a name, taking a reference to it
+static int intern_name(const char * name_p, int name_len) {
+//-----------------------------------------------------------------------------
+   struct NAME_ENTRY * new_names;
+   uint32_t hash;
+   unsigned int slot;
+   int name;
+
+   hash = text_hash(name_p, name_len);
+   slot = find_name_slot(name_p, name_len, hash);
+   name = name_table.slots[slot];
+   if (name != FREE_SLOT) {
+      names[name].refs++;
+      return name;
    }
 
-   if (use_memory) {
-      syslog(LOG_DEBUG, "Using sqlite3 memory database");
-      result = sqlite3_open(memory_database, &sqlite3_p);
+   if (free_names != NO_NAME) {
+      name = free_names;
+      free_names = names[name].offset;
    } else {
-      fd = mkstemp(database_path);
-      if (-1 == fd) {
-         error = errno;
-         error_file = fopen(error_path, "w");
-         fprintf(
-            error_file, "mkstemp failed (%d) %s\n", error, strerror(error)
-         );
-         fclose(error_file);
-         syslog(
-            LOG_ERR, "mkstemp failed (%d) %s", error, strerror(error)
+      if (name_count == name_slots) {
+         new_names = realloc(
+            names, name_slots * 2 * sizeof(struct NAME_ENTRY)
          );
-         exit(-1);
+         if (NULL == new_names) {
+            out_of_memory("wd_directory names");
+         }
+         names = new_names;
+         name_slots *= 2;
       }
-      close(fd);
-      result = sqlite3_open(database_path, &sqlite3_p);
+      name = name_count++;
    }
 
-   if (result != 0) {
-      error_file = fopen(error_path, "w");
-      fprintf(error_file, "sqlite3_open %s\n", sqlite3_errmsg(sqlite3_p));
-      fclose(error_file);
-      syslog(LOG_ERR, "sqlite3_open %s", sqlite3_errmsg(sqlite3_p));
-      sqlite3_close(sqlite3_p);
-      exit(-1);
+   names[name].offset = pool_store(name_p, name_len);
+   names[name].len = name_len;
+   names[name].refs = 1;
+   names[name].hash = hash;
+   table_insert(&name_table, slot, name, name_entry_hash);
+
+   return name;
+
+} // intern_name
+
+//-----------------------------------------------------------------------------
+static void release_name(int name) {
+//-----------------------------------------------------------------------------
+   names[name].refs--;
+   if (names[name].refs > 0) {
+      return;
+   }
+
+   table_delete(
+      &name_table,
+      table_entry_slot(&name_table, name, names[name].hash),
+      name_entry_hash
+   );
+   pool_dead += names[name].len + 1;
+   names[name].offset = free_names;
+   free_names = name;
+
+   if ((pool_size > INITIAL_POOL_SIZE) && (pool_dead * 2 > pool_used)) {
+      compact_pool();
+   }
+
+} // release_name
+
+//-----------------------------------------------------------------------------
+static int new_node(void) {
+//-----------------------------------------------------------------------------
+   struct WD_NODE * new_nodes;
+   int node;
+
+   if (free_nodes != NO_NODE) {
+      node = free_nodes;
+      free_nodes = nodes[node].next_sibling;
+   } else {
+      if (node_count == node_slots) {
+         new_nodes = realloc(nodes, node_slots * 2 * sizeof(struct WD_NODE));
+         if (NULL == new_nodes) {
+            out_of_memory("wd_directory nodes");
+         }
+         nodes = new_nodes;
+         node_slots *= 2;
+      }
+      node = node_count++;
+   }
+
+   nodes[node].wd = NULL_WD;
+   nodes[node].parent_wd = NULL_WD;
+   nodes[node].profile = 0;
+   nodes[node].parent = NO_NODE;
+   nodes[node].name = NO_NAME;
+   nodes[node].hash = 0;
+   nodes[node].first_child = NO_NODE;
+   nodes[node].next_sibling = NO_NODE;
+   nodes[node].prev_sibling = NO_NODE;
+
+   return node;
+
+} // new_node
+
+//-----------------------------------------------------------------------------
+// add a node to the end of its parent's children
+static void link_child(int parent, int node) {
+//-----------------------------------------------------------------------------
+   int first;
+   int last;
+
+   first = nodes[parent].first_child;
+   if (NO_NODE == first) {
+      nodes[parent].first_child = node;
+      nodes[node].next_sibling = node;
+      nodes[node].prev_sibling = node;
+      return;
    }
 
-   execute_sql(journal_off); 
-   execute_sql(sync_off); 
-   execute_sql(schema); 
+   last = nodes[first].prev_sibling;
+   nodes[node].next_sibling = first;
+   nodes[node].prev_sibling = last;
+   nodes[last].next_sibling = node;
+   nodes[first].prev_sibling = node;
+
+} // link_child
+
+//-----------------------------------------------------------------------------
+static void unlink_child(int node) {
+//-----------------------------------------------------------------------------
+   int parent = nodes[node].parent;
+   int next = nodes[node].next_sibling;
+   int prev = nodes[node].prev_sibling;
+
+   if (next == node) {
+      nodes[parent].first_child = NO_NODE;
+      return;
+   }
+
+   nodes[prev].next_sibling = next;
+   nodes[next].prev_sibling = prev;
+   if (nodes[parent].first_child == node) {
+      nodes[parent].first_child = next;
+   }
+
+} // unlink_child
+
+//-----------------------------------------------------------------------------
+// give back a node which has no children and is not linked to its parent
+static void free_node(int node) {
+//-----------------------------------------------------------------------------
+   if (nodes[node].wd != NULL_WD) {
+      table_delete(
+         &wd_table, find_wd_slot(nodes[node].wd), wd_entry_hash
+      );
+   }
+   table_delete(
+      &child_table,
+      table_entry_slot(&child_table, node, nodes[node].hash),
+      child_entry_hash
+   );
+   release_name(nodes[node].name);
+
+   nodes[node].wd = NULL_WD;
+   nodes[node].parent = FREE_NODE;
+   nodes[node].next_sibling = free_nodes;
+   free_nodes = node;
+
+} // free_node
+
+//-----------------------------------------------------------------------------
+// remove unwatched nodes which no longer lead to a watched directory,
+// starting at node and working up
+static void collapse(int node) {
+//-----------------------------------------------------------------------------
+   int parent;
+
+   while (
+      (node != ABSOLUTE_ROOT) &&
+      (node != RELATIVE_ROOT) &&
+      (NULL_WD == nodes[node].wd) &&
+      (NO_NODE == nodes[node].first_child)
+   ) {
+      parent = nodes[node].parent;
+      unlink_child(node);
+      free_node(node);
+      node = parent;
+   }
+
+} // collapse
+
+//-----------------------------------------------------------------------------
+// the node for a path, adding the missing components if add is nonzero,
+// NO_NODE if there is none
+static int path_node(const char * path_p, int add) {
+//-----------------------------------------------------------------------------
+   const char * start_p;
+   const char * end_p;
+   uint32_t hash;
+   unsigned int slot;
+   int node;
+   int child;
+   int name;
+
+   node = ('/' == path_p[0]) ? ABSOLUTE_ROOT : RELATIVE_ROOT;
+
+   for (start_p=path_p; *start_p != '\0'; start_p=end_p) {
+      while ('/' == *start_p) {
+         start_p++;
+      }
+      if ('\0' == *start_p) {
+         break;
+      }
+      for (end_p=start_p; (*end_p != '\0') && (*end_p != '/'); end_p++) {
+      }
+
+      if (! add) {
+         name = lookup_name(start_p, end_p - start_p);
+         if (NO_NAME == name) {
+            return NO_NODE;
+         }
+         node = child_table.slots[
+            find_child_slot(node, name, component_hash(node, name))
+         ];
+         if (NO_NODE == node) {
+            return NO_NODE;
+         }
+         continue;
+      }
+
+      name = intern_name(start_p, end_p - start_p);
+      hash = component_hash(node, name);
+      slot = find_child_slot(node, name, hash);
+      if (child_table.slots[slot] != FREE_SLOT) {
+         release_name(name);
+         node = child_table.slots[slot];
+         continue;
+      }
+
+      child = new_node();
+      nodes[child].parent = node;
+      nodes[child].name = name;
+      nodes[child].hash = hash;
+      table_insert(&child_table, slot, child, child_entry_hash);
+      link_child(node, child);
+      node = child;
+   }
+
+   return node;
+
+} // path_node
+
+//-----------------------------------------------------------------------------
+// rebuild the path of a node, copying at most max_len characters
+static void build_path(int node, char * dest_p, size_t max_len) {
+//-----------------------------------------------------------------------------
+   size_t path_len;
+   size_t start;
+   size_t copy_len;
+   int absolute;
+   int n;
+
+   // measure it first, so it can be written back to front
+   path_len = 0;
+   for (n=node; nodes[n].parent != NO_NODE; n=nodes[n].parent) {
+      path_len += names[nodes[n].name].len + 1;
+   }
+   absolute = (ABSOLUTE_ROOT == n);
+   if (! absolute) {
+      path_len--;
+   } else if (0 == path_len) {
+      path_len = 1;
+   }
+
+   if (path_len < max_len) {
+      dest_p[path_len] = '\0';
+   }
+   if (node == n) {
+      if ((absolute) && (max_len > 0)) {
+         dest_p[0] = '/';
+      }
+      return;
+   }
+
+   start = path_len;
+   for (n=node; nodes[n].parent != NO_NODE; n=nodes[n].parent) {
+      start -= names[nodes[n].name].len;
+      if (start < max_len) {
+         copy_len = names[nodes[n].name].len;
+         if (start + copy_len > max_len) {
+            copy_len = max_len - start;
+         }
+         memcpy(&dest_p[start], &pool[names[nodes[n].name].offset], copy_len);
+      }
+      if ((start > 0) && (start - 1 < max_len)) {
+         dest_p[start-1] = '/';
+      }
+      start--;
+   }
+
+} // build_path
+
+//-----------------------------------------------------------------------------
+int wd_directory_initialize(void) {
+//-----------------------------------------------------------------------------
+   int root;
+
+   node_slots = INITIAL_NODES;
+   nodes = malloc(node_slots * sizeof(struct WD_NODE));
+   name_slots = INITIAL_NAMES;
+   names = malloc(name_slots * sizeof(struct NAME_ENTRY));
+   pool_size = INITIAL_POOL_SIZE;
+   pool = malloc(pool_size);
+   if ((NULL == nodes) || (NULL == names) || (NULL == pool)) {
+      out_of_memory("wd_directory");
+   }
+   node_count = 0;
+   free_nodes = NO_NODE;
+   name_count = 0;
+   free_names = NO_NAME;
+   pool_used = 0;
+   pool_dead = 0;
+
+   table_initialize(&wd_table, INITIAL_TABLE_SLOTS);
+   table_initialize(&child_table, INITIAL_TABLE_SLOTS);
+   table_initialize(&name_table, INITIAL_TABLE_SLOTS);
+
+   wd_list_region = new_region(WD_LIST_REGION_CHUNK_SIZE);
+   if (NULL == wd_list_region) {
+      out_of_memory("wd_directory list region");
+   }
+
+   // ABSOLUTE_ROOT and RELATIVE_ROOT
+   for (root=ABSOLUTE_ROOT; root <= RELATIVE_ROOT; root++) {
+      new_node();
+   }
 
    return 0;
 } // wd_directory_initialize
@@ -188,13 +774,46 @@ int wd_directory_initialize(void) {
 //-----------------------------------------------------------------------------
 void wd_directory_close(void) {
 //-----------------------------------------------------------------------------
-   sqlite3_close(sqlite3_p);
+   free(nodes);
+   nodes = NULL;
+   free(names);
+   names = NULL;
+   free(pool);
+   pool = NULL;
+   free(wd_table.slots);
+   wd_table.slots = NULL;
+   free(child_table.slots);
+   child_table.slots = NULL;
+   free(name_table.slots);
+   name_table.slots = NULL;
+   release_region(wd_list_region);
+   wd_list_region = NULL;
 } // wd_directory_close
 
 //-----------------------------------------------------------------------------
-int add_wd_directory(int wd, int parent_wd, const char * path_p) {
+int add_wd_directory(int wd, int parent_wd, const char * path_p, int profile) {
 //-----------------------------------------------------------------------------
-   execute_sql(add_entry, wd, parent_wd, path_p);
+   unsigned int slot;
+   int node;
+
+   if ((NULL_WD == wd) || ('\0' == path_p[0])) {
+      return -1;
+   }
+
+   slot = find_wd_slot(wd);
+   if (wd_table.slots[slot] != FREE_SLOT) {
+      return -1;
+   }
+
+   node = path_node(path_p, 1);
+   if ((nodes[node].wd != NULL_WD) || (RELATIVE_ROOT == node)) {
+      return -1;
+   }
+
+   nodes[node].wd = wd;
+   nodes[node].parent_wd = parent_wd;
+   nodes[node].profile = profile;
+   table_insert(&wd_table, slot, node, wd_entry_hash);
 
    return 0;
 } // add_wd_directory
@@ -202,240 +821,279 @@ int add_wd_directory(int wd, int parent_wd, const char * path_p) {
 //-----------------------------------------------------------------------------
 int wd_directory_exists(int wd) {
 //-----------------------------------------------------------------------------
-   int result;
-   sqlite3_stmt * statement_p;
-   int ret_val = 0;
-
-   statement_p = prepare_sql_statement(fetch_path, wd);
-
-   result = sqlite3_step(statement_p);
-   switch (result) {
-      case SQLITE_DONE:
-         ret_val = 0;
-         break;
-      case SQLITE_ROW:
-         ret_val = 1;
-         break;
-      default:
-         error_file = fopen(error_path, "w");
-         fprintf(error_file, "sqlite3_step %s\n", sqlite3_errmsg(sqlite3_p));
-         fclose(error_file);
-         syslog( LOG_ERR, "sqlite3_step %s", sqlite3_errmsg(sqlite3_p));
-         sqlite3_close(sqlite3_p);
-         exit(-1);
-   } // switch
-
-   sqlite3_finalize(statement_p);
-
-   return ret_val;
-
+   return find_wd_node(wd) != NO_NODE;
 } // wd_directory_exists
 
 //-----------------------------------------------------------------------------
 const char * find_wd_directory(int wd, char * dest_p, size_t max_len) {
 //-----------------------------------------------------------------------------
-   int result;
-   sqlite3_stmt * statement_p;
-   const unsigned char * path_column_p;
-   const char * path_p;
-
-   statement_p = prepare_sql_statement(fetch_path, wd);
+   int node;
 
-   result = sqlite3_step(statement_p);
-   switch (result) {
-      case SQLITE_DONE:
-         path_p = NULL;
-         break;
-      case SQLITE_ROW:
-         path_column_p = sqlite3_column_text(statement_p, 0);
-         strncpy(dest_p, (const char *) path_column_p, max_len);
-         path_p = dest_p; 
-         break;
-      default:
-         error_file = fopen(error_path, "w");
-         fprintf(error_file, "sqlite3_step %s\n", sqlite3_errmsg(sqlite3_p));
-         fclose(error_file);
-         syslog( LOG_ERR, "sqlite3_step %s", sqlite3_errmsg(sqlite3_p));
-         sqlite3_close(sqlite3_p);
-         exit(-1);
-   } // switch
+   node = find_wd_node(wd);
+   if (NO_NODE == node) {
+      return NULL;
+   }
 
-   sqlite3_finalize(statement_p);
+   build_path(node, dest_p, max_len);
 
-   return path_p;
+   return dest_p;
 
 } // find_wd_directory
 
 //-----------------------------------------------------------------------------
 int find_directory_wd(const char * path_p) {
 //-----------------------------------------------------------------------------
-   int result;
-   sqlite3_stmt * statement_p;
-   int result_wd;
-
-   statement_p = prepare_sql_statement(fetch_wd, path_p);
+   int node;
 
-   result = sqlite3_step(statement_p);
-   switch (result) {
-      case SQLITE_DONE:
-         result_wd = NULL_WD;
-         break;
-      case SQLITE_ROW:
-         result_wd = sqlite3_column_int(statement_p, 0);
-         break;
-      default:
-         error_file = fopen(error_path, "w");
-         fprintf(error_file, "sqlite3_step %s\n", sqlite3_errmsg(sqlite3_p));
-         fclose(error_file);
-         syslog(LOG_ERR, "sqlite3_step %s", sqlite3_errmsg(sqlite3_p));
-         sqlite3_close(sqlite3_p);
-         exit(-1);
-   } // switch
-
-   sqlite3_finalize(statement_p);
+   node = path_node(path_p, 0);
+   if (NO_NODE == node) {
+      return NULL_WD;
+   }
 
-   return result_wd;
+   return nodes[node].wd;
 
 } // find_directory_wd
 
 //-----------------------------------------------------------------------------
 int find_wd_parent(int wd) {
 //-----------------------------------------------------------------------------
-   int result;
-   sqlite3_stmt * statement_p;
-   int result_wd;
+   int node;
 
-   statement_p = prepare_sql_statement(fetch_parent, wd);
+   node = find_wd_node(wd);
+   if (NO_NODE == node) {
+      return NULL_WD;
+   }
 
-   result = sqlite3_step(statement_p);
-   switch (result) {
-      case SQLITE_DONE:
-         result_wd = NULL_WD;
-         break;
-      case SQLITE_ROW:
-         result_wd = sqlite3_column_int(statement_p, 0);
-         break;
-      default:
-         error_file = fopen(error_path, "w");
-         fprintf(error_file, "sqlite3_step %s\n", sqlite3_errmsg(sqlite3_p));
-         fclose(error_file);
-         syslog(LOG_ERR, "sqlite3_step %s", sqlite3_errmsg(sqlite3_p));
-         sqlite3_close(sqlite3_p);
-         exit(-1);
-   } // switch
+   return nodes[node].parent_wd;
 
-   sqlite3_finalize(statement_p);
+} // find_wd_parent
 
-   return result_wd;
+//-----------------------------------------------------------------------------
+int find_wd_profile(int wd) {
+//-----------------------------------------------------------------------------
+   int node;
 
-} // find_wd_parent
+   node = find_wd_node(wd);
+   if (NO_NODE == node) {
+      return 0;
+   }
+
+   return nodes[node].profile;
+
+} // find_wd_profile
+
+//-----------------------------------------------------------------------------
+int wd_directory_count(void) {
+//-----------------------------------------------------------------------------
+   return wd_table.count;
+} // wd_directory_count
+
+//-----------------------------------------------------------------------------
+size_t wd_directory_memory(void) {
+//-----------------------------------------------------------------------------
+   return
+      node_slots * sizeof(struct WD_NODE) +
+      name_slots * sizeof(struct NAME_ENTRY) +
+      pool_size +
+      (wd_table.size + child_table.size + name_table.size) * sizeof(int);
+} // wd_directory_memory
 
 //-----------------------------------------------------------------------------
 int remove_wd_directory(int wd) {
 //-----------------------------------------------------------------------------
-   execute_sql(remove_entry, wd);
+   unsigned int slot;
+   int node;
+
+   slot = find_wd_slot(wd);
+   node = wd_table.slots[slot];
+   if (NO_NODE == node) {
+      return 0;
+   }
+
+   table_delete(&wd_table, slot, wd_entry_hash);
+   nodes[node].wd = NULL_WD;
+   nodes[node].parent_wd = NULL_WD;
+
+   // keep it while its subdirectories are still watched
+   collapse(node);
 
    return 0;
 
 } // remove_wd_directory
 
 //-----------------------------------------------------------------------------
-// recursively find the wds that have the parent wd as a parent
-static WD_LIST_NODE_P find_children(int wd) {
+WD_LIST_NODE_P new_wd_list_node(int wd) {
 //-----------------------------------------------------------------------------
-   WD_LIST_NODE_P head_p;
    WD_LIST_NODE_P node_p;
-   int result;
-   sqlite3_stmt * statement_p;
-
-   statement_p = prepare_sql_statement(fetch_children, wd);
-
-   node_p = head_p = NULL;
-   while((result = sqlite3_step(statement_p)) != SQLITE_DONE) {
-      switch (result) {
-         case SQLITE_ROW:
-            if (NULL == head_p) { 
-               node_p = head_p = calloc(1, sizeof(struct WD_LIST_NODE));
-            } else {
-               node_p->next_p = calloc(1, sizeof(struct WD_LIST_NODE));
-               node_p = node_p->next_p;
-            }
-
-            if (NULL == node_p) {
-               syslog(LOG_ERR, "unable to calloc WD_LIST_NODE");
-               error_file = fopen(error_path, "w");
-               fprintf(error_file, "unable to calloc WD_LIST_NODE\n");
-               fclose(error_file);
-               exit(-1);
-            }
-
-            node_p->wd = sqlite3_column_int(statement_p, 0);
-            break;
-         default:
-            error_file = fopen(error_path, "w");
-            fprintf(error_file, "sqlite3_step %s\n", sqlite3_errmsg(sqlite3_p));
-            fclose(error_file);
-            syslog(LOG_ERR, "sqlite3_step %s", sqlite3_errmsg(sqlite3_p));
-            sqlite3_close(sqlite3_p);
-            exit(-1);
-      } // switch
-   } // while
-
-   sqlite3_finalize(statement_p);
 
-   return head_p;
-  
-} // find_children
+   node_p = region_alloc(wd_list_region, sizeof(struct WD_LIST_NODE));
+   if (NULL == node_p) {
+      syslog(LOG_ERR, "unable to allocate WD_LIST_NODE");
+      error_file = fopen(error_path, "w");
+      fprintf(error_file, "unable to allocate WD_LIST_NODE\n");
+      fclose(error_file);
+      exit(-1);
+   }
+   node_p->next_p = NULL;
+   node_p->wd = wd;
+
+   return node_p;
+
+} // new_wd_list_node
 
 //-----------------------------------------------------------------------------
 WD_LIST_NODE_P prune_wd_directory(int wd) {
 //-----------------------------------------------------------------------------
    WD_LIST_NODE_P head_p;
-   WD_LIST_NODE_P current_p;
    WD_LIST_NODE_P tail_p;
+   int top;
+   int node;
+   int parent;
 
-   head_p = calloc(1, sizeof(struct WD_LIST_NODE));
-   if (NULL == head_p) {
-      syslog(LOG_ERR, "unable to calloc WD_LIST_NODE");
-      error_file = fopen(error_path, "w");
-      fprintf(error_file, "unable to calloc WD_LIST_NODE\n");
-      fclose(error_file);
-      exit(-1);
-   } 
-   head_p->wd = wd;  
+   head_p = tail_p = new_wd_list_node(wd);
 
-   tail_p = head_p;
-   for (current_p=head_p; current_p != NULL; current_p=current_p->next_p) {
+   top = find_wd_node(wd);
+   if (NO_NODE == top) {
+      return head_p;
+   }
 
-      // point tail_p to the end of the list
-      while (tail_p->next_p != NULL) {
+   // list the watched directories under top, parents before children
+   node = top;
+   while (1) {
+      if ((node != top) && (nodes[node].wd != NULL_WD)) {
+         tail_p->next_p = new_wd_list_node(nodes[node].wd);
          tail_p = tail_p->next_p;
       }
+      if (nodes[node].first_child != NO_NODE) {
+         node = nodes[node].first_child;
+         continue;
+      }
+      while (
+         (node != top) &&
+         (nodes[node].next_sibling ==
+            nodes[nodes[node].parent].first_child)
+      ) {
+         node = nodes[node].parent;
+      }
+      if (node == top) {
+         break;
+      }
+      node = nodes[node].next_sibling;
+   }
 
-      // append the children of the current node to the tail
-      tail_p->next_p = find_children(current_p->wd);
-
-   } // for
-
-   // now remove all wd_directory rows for the tree 
-   for (current_p=head_p; current_p != NULL; current_p=current_p->next_p) {
-      remove_wd_directory(current_p->wd);
+   // now free the subtree, leaves first
+   node = top;
+   while (1) {
+      while (nodes[node].first_child != NO_NODE) {
+         node = nodes[node].first_child;
+      }
+      if (node == top) {
+         break;
+      }
+      parent = nodes[node].parent;
+      unlink_child(node);
+      free_node(node);
+      node = parent;
    }
 
+   table_delete(&wd_table, find_wd_slot(wd), wd_entry_hash);
+   nodes[top].wd = NULL_WD;
+   nodes[top].parent_wd = NULL_WD;
+   collapse(top);
+
    return head_p;
 
 } // prune_wd_directory
 
 //-----------------------------------------------------------------------------
-void release_wd_list(WD_LIST_NODE_P head_p) {
+int move_wd_directory(int wd, int new_parent_wd, const char * name_p) {
 //-----------------------------------------------------------------------------
-   WD_LIST_NODE_P node_p;
-   WD_LIST_NODE_P next_p;
+   uint32_t hash;
+   unsigned int slot;
+   int node;
+   int new_parent;
+   int old_parent;
+   int name;
+   int n;
+
+   node = find_wd_node(wd);
+   new_parent = find_wd_node(new_parent_wd);
+   if (
+      (NO_NODE == node) ||
+      (NO_NODE == new_parent) ||
+      ('\0' == name_p[0]) ||
+      (strchr(name_p, '/') != NULL)
+   ) {
+      return -1;
+   }
+
+   // a directory can't be moved inside itself
+   for (n=new_parent; n != NO_NODE; n=nodes[n].parent) {
+      if (n == node) {
+         return -1;
+      }
+   }
+
+   name = intern_name(name_p, strlen(name_p));
+   hash = component_hash(new_parent, name);
+   slot = find_child_slot(new_parent, name, hash);
+   if (child_table.slots[slot] != FREE_SLOT) {
+      // only a node kept for its watched subdirectories can be there,
+      // and those would have to be merged
+      release_name(name);
+      return (child_table.slots[slot] == node) ? 0 : -1;
+   }
 
-   for (node_p=head_p; node_p != NULL; node_p=next_p) {
-      next_p = node_p->next_p;
-      free(node_p);
-   } // for
+   old_parent = nodes[node].parent;
+   table_delete(
+      &child_table,
+      table_entry_slot(&child_table, node, nodes[node].hash),
+      child_entry_hash
+   );
+   unlink_child(node);
+   release_name(nodes[node].name);
+
+   nodes[node].parent = new_parent;
+   nodes[node].parent_wd = new_parent_wd;
+   nodes[node].name = name;
+   nodes[node].hash = hash;
+   // the delete may have moved entries, find the free slot again
+   slot = find_child_slot(new_parent, name, hash);
+   table_insert(&child_table, slot, node, child_entry_hash);
+   link_child(new_parent, node);
+
+   collapse(old_parent);
 
+   return 0;
+
+} // move_wd_directory
+
+//-----------------------------------------------------------------------------
+void for_each_wd_directory(WD_DIRECTORY_VISITOR visit_p, void * arg_p) {
+//-----------------------------------------------------------------------------
+   int node;
+
+   for (node=0; node < node_count; node++) {
+      if ((FREE_NODE == nodes[node].parent) || (NULL_WD == nodes[node].wd)) {
+         continue;
+      }
+      build_path(node, visit_path, VISIT_PATH_LEN);
+      visit_path[VISIT_PATH_LEN] = '\0';
+      visit_p(nodes[node].wd, visit_path, arg_p);
+   }
+
+} // for_each_wd_directory
+
+//-----------------------------------------------------------------------------
+void release_wd_list(WD_LIST_NODE_P head_p) {
+//-----------------------------------------------------------------------------
+   if (head_p != NULL) {
+      region_release(wd_list_region, head_p);
+   }
 } // release_wd_list
 
+//-----------------------------------------------------------------------------
+const struct REGION_STATS * wd_list_stats(void) {
+//-----------------------------------------------------------------------------
+   return region_stats(wd_list_region);
+} // wd_list_stats
@@ -6,6 +6,8 @@
 #if !defined(__WD_DIRECTORY_H)
 #define __WD_DIRECTORY_H
 
+#include "region.h"
+
 #define NULL_WD 0
 
 // a list of wds 
@@ -26,8 +28,9 @@ void wd_directory_close(void);
 // add a watch decriptor <-> directory connection
 // parent_wd is the wd watching the parent direcory 
 // top level directories have NULL_WD
+// profile is the watch profile (watch_profile.h) used for the directory
 // return 0 for success, nonzero for failure
-int add_wd_directory(int wd, int parent_wd, const char * path_p);
+int add_wd_directory(int wd, int parent_wd, const char * path_p, int profile);
 
 // find the directory associated with a watch descriptor
 // returns 0 for no directory, nonzero if we already have
@@ -50,6 +53,16 @@ int find_directory_wd(const char * path_p);
 // directory is top level: i.e. we are not watching its parent
 int find_wd_parent(int wd);
 
+// find the watch profile of the directory
+// returns 0 (the default profile) if the wd does not exist
+int find_wd_profile(int wd);
+
+// the number of watch descriptor <-> directory connections
+int wd_directory_count(void);
+
+// the bytes allocated for the connections
+size_t wd_directory_memory(void);
+
 // remove a watch descriptor <-> directory connection
 // return 0 for succes, nonzero for failure 
 int remove_wd_directory(int wd);
@@ -63,7 +76,29 @@ int remove_wd_directory(int wd);
 // done wiht it.
 WD_LIST_NODE_P prune_wd_directory(int wd);
 
+// a watched directory was renamed: new_parent_wd is the wd watching the
+// directory it is now in, name_p its new name. The wds under it keep
+// their connections, and their paths follow the move.
+// return 0 for success, nonzero if either wd is unknown or there is
+// already a directory by that name
+int move_wd_directory(int wd, int new_parent_wd, const char * name_p);
+
+// call visit_p once for every watch descriptor <-> directory connection
+// visit_p must not add or remove connections
+typedef void (* WD_DIRECTORY_VISITOR)(int wd, const char * path_p, void * arg_p);
+void for_each_wd_directory(WD_DIRECTORY_VISITOR visit_p, void * arg_p);
+
+// a node for a wd list built elsewhere, such as by a visitor
+// Wd lists come from a region (region.h): the first node allocated must be
+// the head of the list, and lists must be released in the reverse order
+// of their creation.
+WD_LIST_NODE_P new_wd_list_node(int wd);
+
 // clear a wd list, given a pointer to the head of the list
+// any list created after it is cleared too
 void release_wd_list(WD_LIST_NODE_P head_p);
 
+// allocation counts for the wd lists, for the stats file
+const struct REGION_STATS * wd_list_stats(void);
+
 #endif // !defined(__WD_DIRECTORY_H)